@@ -22,9 +22,14 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <thread>
 #include <utility>
+#include <fstream>
 #include <cstdlib> // For abort().
+#include <memory>
+
+#include <sys/stat.h>
 
 #include "sync_queue_impl_selector.h"
 #include "Logger.h"
@@ -36,20 +41,259 @@
 #include "MatchList.h"
 #include "FileScanner.h"
 #include "OutputTask.h"
+#include "PipelineStats.h"
+#include "Trace.h"
+#include "ThreadPlacement.h"
+#include "AdaptiveJobController.h"
+#include "TaskPool.h"
+#include "FileScheduler.h"
+#include "Prefetcher.h"
+#include "TrigramIndex.h"
+#include "TrigramQuery.h"
+#include "SearchPipeline.h"
+#include "SearchServer.h"
+#include "DirectoryCache.h"
 
 
-int main(int argc, char **argv)
+/**
+ * Write the --trace timeline, if tracing is enabled.  Only call this once all the pipeline threads have been joined.
+ */
+static void WriteTrace(const std::string &trace_filename)
+{
+	if(Tracer::IsEnabled())
+	{
+		std::ofstream trace_file(trace_filename);
+		Tracer::WriteChromeTraceJSON(trace_file);
+		trace_file.close();
+		if(!trace_file)
+		{
+			WARN() << "Couldn't write trace file \'" << trace_filename << "\'.";
+		}
+	}
+}
+
+/**
+ * Handle --index: traverse the tree with the same Globber, TypeManager, and DirInclusionManager filtering as a
+ * search, but hand the files to TrigramIndexBuilder threads instead of FileScanners, then write out the index.
+ * If there's already a usable index, only the files which have changed since it was built are read.
+ */
+static void BuildIndex(const ArgParse &arg_parser, TypeManager &type_manager, DirInclusionManager &dir_inclusion_manager,
+		const DirectoryCache *dir_cache, PipelineStats &pipeline_stats)
+{
+	std::string index_file = arg_parser.m_index_file.empty() ? TRIGRAM_INDEX_DEFAULT_FILENAME : arg_parser.m_index_file;
+
+	// Update the existing index if there is one we can use.
+	std::unique_ptr<TrigramIndex> previous_index;
+	struct stat stat_buf;
+	if(stat(index_file.c_str(), &stat_buf) == 0)
+	{
+		try
+		{
+			previous_index.reset(new TrigramIndex(index_file));
+		}
+		catch(const TrigramIndexException &e)
+		{
+			// E.g. an index from an older version of ucg.
+			LOG(INFO) << e.what() << ", rebuilding it from scratch.";
+		}
+	}
+
+	sync_queue<FileID> files_to_index_queue;
+
+	// No index for the Globber to check against, we want every file.
+	Globber globber(arg_parser.m_paths, type_manager, dir_inclusion_manager, arg_parser.m_recurse, arg_parser.m_dirjobs, nullptr,
+			dir_cache, files_to_index_queue, pipeline_stats);
+
+	TrigramIndexBuilder index_builder(files_to_index_queue, previous_index.get(), pipeline_stats);
+
+	std::vector<std::thread> indexer_threads;
+	for(int t=0; t<arg_parser.m_jobs; ++t)
+	{
+		indexer_threads.emplace_back(&TrigramIndexBuilder::Run, &index_builder, t);
+	}
+
+	globber.Run();
+	files_to_index_queue.close();
+	for(auto& indexer_thread : indexer_threads)
+	{
+		indexer_thread.join();
+	}
+
+	index_builder.Write(index_file);
+
+	if(pipeline_stats.IsEnabled())
+	{
+		pipeline_stats.Print(std::cerr);
+		std::cerr << "\nDirectory traversal totals:\n" << globber.GetTraversalStats()
+				<< "\nNumber of files indexed: " << index_builder.GetNumFilesIndexed()
+				<< "\nNumber of files read: " << index_builder.GetNumFilesIndexed() - index_builder.GetNumFilesReused()
+				<< "\nNumber of unchanged files reused from the previous index: " << index_builder.GetNumFilesReused()
+				<< "\nNumber of stale entries dropped from the previous index: " << index_builder.GetNumFilesDropped() << std::endl;
+	}
+}
+
+/**
+ * Open the index to use for this search, and work out which of its files could match PATTERN.
+ *
+ * @return  The index, or nullptr if we're not using one.
+ */
+static std::unique_ptr<TrigramIndex> OpenIndex(const ArgParse &arg_parser)
 {
+	std::unique_ptr<TrigramIndex> index;
+
+	if(!arg_parser.m_use_index)
+	{
+		return index;
+	}
+
+	if(arg_parser.m_search_compressed)
+	{
+		// The index is of the files' raw bytes, so it can't tell us anything about what's in compressed files.
+		LOG(INFO) << "Not using an index with -z.";
+		return index;
+	}
+
+	bool index_file_given = !arg_parser.m_index_file.empty();
+	std::string index_file = index_file_given ? arg_parser.m_index_file : TRIGRAM_INDEX_DEFAULT_FILENAME;
+	struct stat stat_buf;
+	if(!index_file_given && stat(index_file.c_str(), &stat_buf) != 0)
+	{
+		// No default index here, which is the normal case.
+		return index;
+	}
+
 	try
 	{
-		// First thing, set up logging.
-		Logger::Init(argv[0]);
+		index.reset(new TrigramIndex(index_file));
+		index->SetQuery(TrigramQuery::FromPattern(arg_parser.m_pattern, arg_parser.m_pattern_is_literal));
+	}
+	catch(const TrigramIndexException &e)
+	{
+		// The index only ever lets us skip work, so we can always carry on without it.
+		WARN() << e.what() << ", searching without it.";
+		index.reset();
+	}
 
-		// We'll keep the scanner threads in this vector so we can join() them later.
-		std::vector<std::thread> scanner_threads;
+	return index;
+}
 
-		// Instantiate classes for file and directory inclusion/exclusion management.
-		TypeManager type_manager;
+
+/**
+ * Pull any "--connect=SOCKET" or "--connect SOCKET" out of the command line, before argp ever sees it.
+ *
+ * @return  The SOCKET, or an empty string if there was no --connect.
+ */
+static std::string ExtractConnectOption(std::vector<std::string> *args)
+{
+	std::string socket_path;
+
+	for(auto it = args->begin(); it != args->end(); )
+	{
+		if(*it == "--")
+		{
+			// Everything after this is PATTERN or FILES.
+			break;
+		}
+		else if(it->compare(0, 10, "--connect=") == 0)
+		{
+			socket_path = it->substr(10);
+			it = args->erase(it);
+		}
+		else if(*it == "--connect" && it+1 != args->end())
+		{
+			socket_path = *(it+1);
+			it = args->erase(it, it+2);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	return socket_path;
+}
+
+/**
+ * The --task-pool search.  Instead of the Globber, FileScanner, and OutputTask each getting their own threads, the
+ * directory traversal, the scanning of each file, and the printing of the results are all tasks on one pool of
+ * @a num_workers threads.  Downstream work has the higher priority, so the results get printed and the files found
+ * get scanned before more directories are traversed.
+ */
+static void RunTaskPoolSearch(int num_workers, bool search_stdin, bool have_paths, Globber &globber, FileScanner &file_scanner,
+		OutputTask &output_task, sync_queue<MatchList> &match_queue)
+{
+	file_scanner.PrepareForTaskPool(num_workers);
+
+	TaskPool pool(num_workers, [](int worker_index){
+		set_thread_name("POOL_" + std::to_string(worker_index));
+		ThreadPlacement::PlaceThisThread(ThreadRole::SCANNER);
+	});
+
+	// Only one output task is queued or running at a time, since the output has to be printed in order.
+	std::atomic<bool> output_task_scheduled { false };
+	std::function<void(int)> output_task_fn = [&](int){
+		do
+		{
+			output_task.DrainQueue();
+			output_task_scheduled = false;
+			// A scan which finished after our last pull but before we cleared the flag won't have queued another of us,
+			// so look again.
+		} while(match_queue.size() != 0 && !output_task_scheduled.exchange(true));
+	};
+
+	// A stream's matches are sent on as they're found, well before its scanning task finishes.
+	file_scanner.SetPartialResultsHook([&](){
+		if(!output_task_scheduled.exchange(true))
+		{
+			pool.Submit(TaskPool::Priority::HIGH, output_task_fn);
+		}
+	});
+
+	auto scan_task = [&](FileID &&file_id){
+		// The FileID is moved into the task, so it can be scanned on whichever worker gets to it.
+		auto file = std::make_shared<FileID>(std::move(file_id));
+		pool.Submit(TaskPool::Priority::NORMAL, [&, file](int worker_index){
+			if(file_scanner.ScanOnWorker(worker_index, *file) && !output_task_scheduled.exchange(true))
+			{
+				pool.Submit(TaskPool::Priority::HIGH, output_task_fn);
+			}
+		});
+	};
+
+	output_task.Begin();
+
+	if(search_stdin)
+	{
+		scan_task(FileID::Stdin());
+	}
+	if(have_paths)
+	{
+		// Blocks until the pool has finished everything.
+		globber.RunOnTaskPool(pool, scan_task);
+	}
+	pool.WaitUntilIdle();
+
+	// Anything that finished after the last output task looked.
+	output_task.DrainQueue();
+	output_task.End();
+
+	file_scanner.FinishTaskPool();
+}
+
+/**
+ * Run one ucg command line, from option parsing through the end of the search.
+ *
+ * @param type_manager      The TypeManager to use.  Taken as a parameter so the --server can set it up once, and
+ *                          have each request's child process start with a copy of it.
+ * @param server_dir_cache  If we're handling a request in a --server's child process, the server's directory cache.
+ *                          nullptr otherwise.
+ * @return  The process exit status.
+ */
+static int RunCommandLine(int argc, char **argv, TypeManager &type_manager, const DirectoryCache *server_dir_cache)
+{
+	try
+	{
+		// Instantiate classes for directory inclusion/exclusion management.
 		DirInclusionManager dir_inclusion_manager;
 
 		// Instantiate the argument parser.
@@ -63,57 +307,179 @@ int main(int argc, char **argv)
 		type_manager.CompileTypeTables();
 		dir_inclusion_manager.CompileExclusionTables();
 
+		if(!arg_parser.m_server_socket.empty())
+		{
+			if(server_dir_cache != nullptr)
+			{
+				ERROR() << "--server can't be sent to a server.";
+				return 255;
+			}
+
+			// Cache the directory tree we were started in, minus anything our own --ignore-dir etc. exclude.
+			DirectoryCache dir_cache(".", dir_inclusion_manager);
+
+			// Serve requests until we're killed.  Each request's child starts with a pristine copy of the TypeManager,
+			// so that one request's --type-set etc. don't leak into the next.  Its tables are compiled here, once, so
+			// that requests which don't change the types reuse them instead of compiling their own.
+			TypeManager pristine_type_manager;
+			pristine_type_manager.CompileTypeTables();
+			SearchServer server(arg_parser.m_server_socket, &dir_cache,
+					[&pristine_type_manager, &dir_cache](int request_argc, char **request_argv){
+				return RunCommandLine(request_argc, request_argv, pristine_type_manager, &dir_cache);
+			});
+			server.Run();
+			return 0;
+		}
+
 		LOG(INFO) << "Num scanner jobs: " << arg_parser.m_jobs;
 
 		// Create the Globber->FileScanner queue.
 		sync_queue<FileID> files_to_scan_queue;
 
+		// With --prefetch, the Globber also sends each file it finds to the Prefetcher, through this queue.
+		sync_queue<FileID> files_to_prefetch_queue;
+
 		// Create the FileScanner->OutputTask queue.
 		sync_queue<MatchList> match_queue;
 
+		// Set up the --stats collector.
+		PipelineStats pipeline_stats(arg_parser.m_stats);
+
+		// Turn on --trace recording before any of the pipeline threads start.
+		if(!arg_parser.m_trace_file.empty() && !Tracer::Enable())
+		{
+			WARN() << "--trace is not supported on this platform, ignoring.";
+		}
+
+		// Likewise --thread-placement.
+		if(!ThreadPlacement::Enable(arg_parser.m_thread_placement))
+		{
+			WARN() << "--thread-placement is not supported on this platform, ignoring.";
+		}
+
+		if(arg_parser.m_build_index)
+		{
+			// We're building an index, not searching.
+			BuildIndex(arg_parser, type_manager, dir_inclusion_manager, server_dir_cache, pipeline_stats);
+			WriteTrace(arg_parser.m_trace_file);
+			return 0;
+		}
+
+		// Use an index to narrow down the files to search, if we have one.
+		std::unique_ptr<TrigramIndex> index = OpenIndex(arg_parser);
+
+		// "-" is the standard input.  It doesn't go through the Globber, we hand it to the scanners ourselves.
+		auto num_paths = arg_parser.m_paths.size();
+		arg_parser.m_paths.erase(std::remove(arg_parser.m_paths.begin(), arg_parser.m_paths.end(), "-"), arg_parser.m_paths.end());
+		const bool search_stdin = (arg_parser.m_paths.size() != num_paths);
+
+		// Set up the --prefetch stage, if we can.
+		std::unique_ptr<Prefetcher> prefetcher;
+		if(arg_parser.m_prefetch)
+		{
+			if(Prefetcher::IsSupported())
+			{
+				prefetcher.reset(new Prefetcher(files_to_prefetch_queue));
+			}
+			else
+			{
+				WARN() << "--prefetch is not supported on this platform, ignoring.";
+			}
+		}
+
 		// Set up the globber.
-		Globber globber(arg_parser.m_paths, type_manager, dir_inclusion_manager, arg_parser.m_recurse, arg_parser.m_dirjobs, files_to_scan_queue);
+		Globber globber(arg_parser.m_paths, type_manager, dir_inclusion_manager, arg_parser.m_recurse, arg_parser.m_dirjobs, index.get(), server_dir_cache,
+				files_to_scan_queue, pipeline_stats);
+		globber.SetPrefetcher(prefetcher.get());
 
 		// Set up the output task object.
-		OutputTask output_task(arg_parser.m_color, arg_parser.m_nocolor, arg_parser.m_column, match_queue);
+		OutputTask output_task(arg_parser.m_color, arg_parser.m_nocolor, arg_parser.m_column,
+				(arg_parser.m_lines_before > 0) || (arg_parser.m_lines_after > 0), arg_parser.m_output_format, match_queue, pipeline_stats);
 
 		// Create the FileScanner object.
-		std::unique_ptr<FileScanner> file_scanner(FileScanner::Create(files_to_scan_queue, match_queue, arg_parser.m_pattern, arg_parser.m_ignore_case, arg_parser.m_word_regexp, arg_parser.m_pattern_is_literal));
+		std::unique_ptr<FileScanner> file_scanner(FileScanner::Create(files_to_scan_queue, match_queue, arg_parser.m_pattern, arg_parser.m_ignore_case, arg_parser.m_word_regexp, arg_parser.m_pattern_is_literal,
+				arg_parser.m_lines_before, arg_parser.m_lines_after, arg_parser.m_search_compressed, pipeline_stats));
 
-		// Start the output task thread.
-		std::thread output_task_thread {&OutputTask::Run, &output_task};
+		// --no-cache-pollution.
+		file_scanner->SetCachePolicy(arg_parser.m_cache_policy);
 
-		// Start the scanner threads.
-		for(int t=0; t<arg_parser.m_jobs; ++t)
+		if(arg_parser.m_task_pool)
 		{
-			std::thread fst {&FileScanner::Run, file_scanner.get(), t};
-			scanner_threads.push_back(std::move(fst));
+			RunTaskPoolSearch(arg_parser.m_jobs, search_stdin, !arg_parser.m_paths.empty(), globber, *file_scanner, output_task, match_queue);
 		}
+		else
+		{
+			// With --adaptive-jobs, start extra scanner threads which the controller can unpark if the search turns out to be
+			// I/O bound.  Without it, the number of scanners is fixed at --jobs.
+			std::unique_ptr<AdaptiveJobController> job_controller;
+			int num_scanner_threads = arg_parser.m_jobs;
+			if(arg_parser.m_adaptive_jobs)
+			{
+				job_controller.reset(new AdaptiveJobController(files_to_scan_queue, arg_parser.m_jobs, 2*arg_parser.m_jobs,
+						CpuTopology::NumUsableCpus()));
+				num_scanner_threads = job_controller->GetMaxJobs();
+				file_scanner->SetJobController(job_controller.get());
+				job_controller->Start();
+			}
 
-		// Start the globber threads last.
-		// We do this last because the globber is the ultimate source for the work queue; all other threads will be
-		// waiting for it to start sending data to the Globber->FileScanner queue.  If we started it
-		// first, the globbing would start immediately, and it would take longer to get the scanner and output
-		// threads created and started, and ultimately slow down startup.
-		// Note that we just call globber.Run() here.  It blocks, spawning and managing its own threads until the directory
-		// tree traversal is complete.
-		globber.Run();
+			// With --schedule, the scanners pull the files through the scheduler to get them in the requested order.
+			FileScheduler file_scheduler(files_to_scan_queue, arg_parser.m_schedule);
+			if(arg_parser.m_schedule != FileScheduleMode::TRAVERSAL)
+			{
+				file_scanner->SetFileScheduler(&file_scheduler);
+			}
 
-		// Close the Globber->FileScanner queue.
-		files_to_scan_queue.close();
+			if(prefetcher)
+			{
+				file_scanner->SetPrefetcher(prefetcher.get());
+				prefetcher->Start();
+			}
 
-		// Wait for all scanner threads to complete.
-		for (auto& scanner_thread_ref : scanner_threads)
-		{
-			scanner_thread_ref.join();
+			if(search_stdin)
+			{
+				files_to_scan_queue.wait_push(FileID::Stdin());
+			}
+
+			// Run the Globber->FileScanner->OutputTask pipeline, with each traversal and scanner thread started by the
+			// pipeline and the output printed on this thread.
+			SearchPipeline pipeline(globber, *file_scanner, match_queue);
+			pipeline.Run(num_scanner_threads, [&](){
+					// Close the Globber->FileScanner queue, and the Prefetcher's.
+					files_to_scan_queue.close();
+					files_to_prefetch_queue.close();
+				},
+				[&output_task](){
+					// Put this thread's name back afterwards, for the log messages which follow.
+					std::string thread_name = get_thread_name();
+					output_task.Run();
+					set_thread_name(thread_name);
+				});
+
+			if(job_controller)
+			{
+				// The scanners have drained the queue, so there's nothing left to adjust.
+				job_controller->Stop();
+				LOG(INFO) << "Adaptive jobs: peak number of active scanners: " << job_controller->GetPeakActive();
+			}
+
+			if(prefetcher)
+			{
+				// The scanners have taken every file, so it's got nothing left to wait for.
+				prefetcher->Join();
+				LOG(INFO) << "Prefetch: " << prefetcher->GetNumPrefetched() << " files prefetched, " << prefetcher->GetNumSkipped()
+						<< " skipped, final lead " << prefetcher->GetLead() << " files, hit rate " << prefetcher->GetHitRate();
+			}
 		}
-		// All scanner threads completed.
 
-		// Close the FileScanner->OutputTask queue.
-		match_queue.close();
+		if(pipeline_stats.IsEnabled())
+		{
+			// All the threads are done, print the --stats report.
+			pipeline_stats.Print(std::cerr);
+			std::cerr << "\nDirectory traversal totals:\n" << globber.GetTraversalStats() << std::endl;
+		}
 
-		// Wait for the output thread to complete.
-		output_task_thread.join();
+		// All the threads are done, write out the --trace timeline.
+		WriteTrace(arg_parser.m_trace_file);
 
 		auto total_matched_lines = output_task.GetTotalMatchedLines();
 
@@ -138,6 +504,16 @@ int main(int argc, char **argv)
 		ERROR() << "Error during arg parsing: " << e.what();
 		return 255;
 	}
+	catch(const TrigramIndexException &e)
+	{
+		ERROR() << "Error building index: " << e.what();
+		return 255;
+	}
+	catch(const SearchServerException &e)
+	{
+		ERROR() << "Error running server: " << e.what();
+		return 255;
+	}
 	catch(const std::runtime_error &e)
 	{
 		ERROR() << "std::runtime_error exception: " << e.what();
@@ -150,6 +526,30 @@ int main(int argc, char **argv)
 		// without an error code.  I ran into this when trying to instantiate std::locale with locale=="" in ArgParse,
 		// and before I had the std::runtime_error catch clause above.
 		ERROR() << "Unknown exception occurred.";
+		Logger::Flush();
 		std::abort();
 	}
 }
+
+int main(int argc, char **argv)
+{
+	// First thing, set up logging.
+	Logger::Init(argv[0]);
+
+	// If we're a --connect client and there's a server listening, hand the whole search off to it.
+	std::vector<std::string> args(argv, argv+argc);
+	std::string connect_socket = ExtractConnectOption(&args);
+	if(!connect_socket.empty())
+	{
+		int exit_status;
+		if(SearchClient::Run(connect_socket, args, &exit_status))
+		{
+			return exit_status;
+		}
+		// Else there's no server, do the search ourselves.
+	}
+
+	TypeManager type_manager;
+
+	return RunCommandLine(argc, argv, type_manager, nullptr);
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "AdaptiveJobController.h"
+
+#include <algorithm>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "Logger.h"
+#include "Trace.h"
+
+/// How often the monitor thread takes a look and adjusts the number of running scanners.
+static constexpr std::chrono::milliseconds f_sample_interval { 50 };
+
+/// @name Thresholds for adjusting the number of running scanners.
+///@{
+/// Scanners are considered I/O bound if they spend more than this fraction of their time reading files.
+static constexpr double f_io_bound_read_fraction = 0.5;
+/// Only add scanners if we're using less than this fraction of the CPUs we have.
+static constexpr double f_cpu_headroom_fraction = 0.75;
+/// Remove oversubscribed scanners if we're using more than this fraction of the CPUs we have.
+static constexpr double f_cpu_saturated_fraction = 0.9;
+///@}
+
+/**
+ * @return The user + system CPU time used by all the threads of this process so far, in ns.
+ */
+static long long GetProcessCpuTimeNs() noexcept
+{
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	return (static_cast<long long>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000000LL
+			+ (static_cast<long long>(usage.ru_utime.tv_usec) + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+AdaptiveJobController::AdaptiveJobController(sync_queue<FileID> &in_queue, int initial_active, int max_jobs, int num_cpus)
+	: m_in_queue(in_queue), m_max_jobs(std::max(1, max_jobs)), m_num_cpus(std::max(1, num_cpus)),
+	  m_num_active(std::min(std::max(1, initial_active), m_max_jobs)), m_peak_active(m_num_active.load())
+{
+}
+
+AdaptiveJobController::~AdaptiveJobController()
+{
+	Stop();
+}
+
+void AdaptiveJobController::Start()
+{
+	LOG(INFO) << "Adaptive jobs: " << m_num_active.load() << " of " << m_max_jobs << " scanners active to start, "
+			<< m_num_cpus << " CPUs.";
+	m_monitor_thread = std::thread(&AdaptiveJobController::MonitorLoop, this);
+}
+
+void AdaptiveJobController::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_stop)
+		{
+			LOG(INFO) << "Adaptive jobs: stopping.";
+		}
+		m_stop = true;
+		// Nobody should still be parked by now, but don't leave anyone stuck if they are.
+		m_input_drained = true;
+	}
+	m_stop_cv.notify_all();
+	m_unpark_cv.notify_all();
+
+	if(m_monitor_thread.joinable())
+	{
+		m_monitor_thread.join();
+	}
+}
+
+void AdaptiveJobController::InputDrained()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_input_drained)
+		{
+			return;
+		}
+		LOG(INFO) << "Adaptive jobs: input drained, releasing the parked scanners.";
+		m_input_drained = true;
+	}
+	m_unpark_cv.notify_all();
+}
+
+void AdaptiveJobController::Park(int thread_index)
+{
+	ScopedTrace trace("parked");
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_unpark_cv.wait(lock, [this, thread_index](){ return thread_index < m_num_active.load() || m_input_drained; });
+}
+
+void AdaptiveJobController::MonitorLoop()
+{
+	set_thread_name("ADAPTIVE_JOBS");
+
+	auto last_wall_time = std::chrono::steady_clock::now();
+	long long last_cpu_ns = GetProcessCpuTimeNs();
+	long long last_read_ns = 0;
+	long long last_scan_ns = 0;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_stop_cv.wait_for(lock, f_sample_interval, [this](){ return m_stop; }))
+	{
+		lock.unlock();
+
+		auto wall_time = std::chrono::steady_clock::now();
+		long long cpu_ns = GetProcessCpuTimeNs();
+		long long read_ns = m_read_time_ns.load(std::memory_order_relaxed);
+		long long scan_ns = m_scan_time_ns.load(std::memory_order_relaxed);
+
+		long long wall_delta_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wall_time - last_wall_time).count();
+		long long read_delta_ns = read_ns - last_read_ns;
+		long long busy_delta_ns = read_delta_ns + (scan_ns - last_scan_ns);
+		double cpus_used = wall_delta_ns > 0 ? static_cast<double>(cpu_ns - last_cpu_ns) / wall_delta_ns : 0;
+
+		last_wall_time = wall_time;
+		last_cpu_ns = cpu_ns;
+		last_read_ns = read_ns;
+		last_scan_ns = scan_ns;
+
+		int num_active = m_num_active.load();
+		int new_num_active = num_active;
+
+		// If no scanner finished a file this time around, we have nothing to go on.
+		if(busy_delta_ns > 0)
+		{
+			double read_fraction = static_cast<double>(read_delta_ns) / busy_delta_ns;
+			size_t backlog = m_in_queue.size();
+
+			if(read_fraction > f_io_bound_read_fraction && backlog > static_cast<size_t>(num_active)
+					&& cpus_used < f_cpu_headroom_fraction * m_num_cpus && num_active < m_max_jobs)
+			{
+				// Waiting on I/O with work piling up and CPU to spare.  More reads in flight should help.
+				new_num_active = num_active + 1;
+			}
+			else if(read_fraction <= f_io_bound_read_fraction && cpus_used > f_cpu_saturated_fraction * m_num_cpus
+					&& num_active > m_num_cpus)
+			{
+				// CPU bound, and more scanners than CPUs.  The extra ones are just contending with the others.
+				new_num_active = num_active - 1;
+			}
+
+			LOG(DEBUG) << "Adaptive jobs: read fraction " << read_fraction << ", CPUs used " << cpus_used
+					<< ", backlog " << backlog << ", active " << num_active;
+		}
+
+		lock.lock();
+
+		if(new_num_active != num_active && !m_stop)
+		{
+			LOG(INFO) << "Adaptive jobs: " << (new_num_active > num_active ? "unparking" : "parking") << " a scanner, "
+					<< new_num_active << " now active.";
+			// Change this under the lock, so a scanner can't miss the wakeup between checking it and waiting.
+			m_num_active.store(new_num_active);
+			m_peak_active = std::max(m_peak_active, new_num_active);
+			if(new_num_active > num_active)
+			{
+				m_unpark_cv.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_ADAPTIVEJOBCONTROLLER_H_
+#define SRC_ADAPTIVEJOBCONTROLLER_H_
+
+#include <config.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "sync_queue_impl_selector.h"
+#include "FileID.h"
+
+/**
+ * Adjusts the number of running FileScanner threads during the search, for --adaptive-jobs.
+ *
+ * All of the scanner threads which might be needed are started up front, and the ones numbered at or above the current
+ * "active" count park themselves between files in WaitUntilActive().  A monitor thread periodically looks at:
+ * - how deep the Globber->FileScanner queue is,
+ * - how the scanners have been splitting their time between reading files and scanning them, and
+ * - how much CPU time the process has been using,
+ *
+ * and unparks another scanner when the scanners are mostly waiting on I/O with work backed up and CPU to spare (cold
+ * cache, network filesystem), or parks one when the scanners are CPU bound with more of them running than we have
+ * CPUs for (hot cache, expensive regex).
+ */
+class AdaptiveJobController
+{
+public:
+	/**
+	 * @param in_queue        The FileScanners' input queue.
+	 * @param initial_active  The number of scanners to start out with running.
+	 * @param max_jobs        The number of scanner threads which will be started, i.e. the most that can be running.
+	 * @param num_cpus        The number of CPUs we can use.
+	 */
+	AdaptiveJobController(sync_queue<FileID> &in_queue, int initial_active, int max_jobs, int num_cpus);
+	~AdaptiveJobController();
+
+	AdaptiveJobController(const AdaptiveJobController&) = delete;
+	AdaptiveJobController& operator=(const AdaptiveJobController&) = delete;
+
+	/// Start the monitor thread.
+	void Start();
+
+	/**
+	 * Stop the monitor thread.  Call this once the scanners are done.
+	 */
+	void Stop();
+
+	/**
+	 * Called by a scanner when it finds the input queue closed and empty.  Releases the parked scanners so they can
+	 * see that too and exit.  Until then, the number of running scanners stays under the monitor's control, even after
+	 * the traversal has finished and closed the queue.
+	 */
+	void InputDrained();
+
+	/**
+	 * Called by scanner thread @a thread_index before each file it pulls.  Blocks while the thread is parked.
+	 */
+	void WaitUntilActive(int thread_index)
+	{
+		if(thread_index < m_num_active.load(std::memory_order_relaxed))
+		{
+			// Fast path, we're running.
+			return;
+		}
+		Park(thread_index);
+	};
+
+	/**
+	 * Called by the scanners after each file to report how long they spent reading and scanning it.
+	 */
+	void ReportTimes(std::chrono::steady_clock::duration read_time, std::chrono::steady_clock::duration scan_time) noexcept
+	{
+		m_read_time_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(read_time).count(), std::memory_order_relaxed);
+		m_scan_time_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(scan_time).count(), std::memory_order_relaxed);
+	};
+
+	int GetMaxJobs() const noexcept { return m_max_jobs; };
+
+	/// The most scanners that were running at once.
+	int GetPeakActive() const noexcept { return m_peak_active; };
+
+private:
+
+	void Park(int thread_index);
+
+	void MonitorLoop();
+
+	sync_queue<FileID> &m_in_queue;
+
+	const int m_max_jobs;
+
+	const int m_num_cpus;
+
+	/// The number of scanners which are allowed to run.  Scanners [0, m_num_active) run, the rest are parked.
+	std::atomic<int> m_num_active;
+
+	int m_peak_active;
+
+	/// Totals over all the scanners of the time reported to ReportTimes().
+	std::atomic<long long> m_read_time_ns { 0 };
+	std::atomic<long long> m_scan_time_ns { 0 };
+
+	/// Protects m_stop and m_input_drained, and is what parked scanners wait on.
+	std::mutex m_mutex;
+	std::condition_variable m_unpark_cv;
+	std::condition_variable m_stop_cv;
+	bool m_stop { false };
+
+	/// Set once there's nothing left for any scanner to do, so parked ones shouldn't stay parked.
+	bool m_input_drained { false };
+
+	std::thread m_monitor_thread;
+};
+
+#endif /* SRC_ADAPTIVEJOBCONTROLLER_H_ */
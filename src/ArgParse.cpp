@@ -37,6 +37,7 @@
 #include <iostream>
 #include <sstream>
 #include <system_error>
+#include <limits>
 
 #include <argp.h>
 #ifdef HAVE_LIBPCRE
@@ -65,11 +66,6 @@
 #include "File.h"
 #include "Logger.h"
 
-// The sweet spot for the number of directory tree traversal threads seems to be 2 on Linux, independent of the
-// number of scanner threads.  Cygwin does better with 3 or 4 here (and more dirjobs with more scanner threads) since it
-// spends so much more time in the Windows<->POSIX path resolution logic.
-static constexpr size_t f_default_dirjobs = 2;
-
 // Our --version output isn't just a static string, so we'll register with argp for a version callback.
 static void PrintVersionTextRedirector(FILE *stream, struct argp_state *state)
 {
@@ -102,7 +98,8 @@ const char *argp_program_bug_address = PACKAGE_BUGREPORT;
  * The pre- and post-opion help text.
  */
 static const char doc[] = "\nucg: the UniversalCodeGrep code search tool."
-		"\vExit status is 0 if any matches were found, 1 if no matches, 2 or greater on error.";
+		"\vA FILE of \"-\" is the standard input, which is searched by default if it's a pipe and no FILES OR DIRECTORIES are given.\n\n"
+		"Exit status is 0 if any matches were found, 1 if no matches, 2 or greater on error.";
 
 /**
  * The "Usage:" text.
@@ -128,9 +125,24 @@ enum OPT
 	OPT_TYPE_ADD,
 	OPT_TYPE_DEL,
 	OPT_PERF_DIRJOBS,
+	OPT_PERF_THREAD_PLACEMENT,
+	OPT_PERF_ADAPTIVE_JOBS,
+	OPT_PERF_TASK_POOL,
+	OPT_PERF_SCHEDULE,
+	OPT_PERF_PREFETCH,
+	OPT_PERF_NO_CACHE_POLLUTION,
+	OPT_PERF_STATS,
+	OPT_PERF_TRACE,
+	OPT_INDEX,
+	OPT_INDEX_FILE,
+	OPT_NOINDEX,
+	OPT_SERVER,
+	OPT_CONNECT,
 	OPT_HELP_TYPES,
 	OPT_COLUMN,
 	OPT_NOCOLUMN,
+	OPT_JSON,
+	OPT_BINARY_OUTPUT,
 	OPT_TEST_LOG_ALL,
 	OPT_TEST_NOENV_USER,
 	OPT_TEST_USE_MMAP,
@@ -158,9 +170,15 @@ static struct argp_option options[] = {
 		{"no-smart-case", OPT_NO_SMART_CASE, 0, OPTION_HIDDEN | OPTION_ALIAS },
 		{"word-regexp", 'w', 0, 0, "PATTERN must match a complete word."},
 		{"literal", 'Q', 0, 0, "Treat all characters in PATTERN as literal."},
+		{"search-zip", 'z', 0, 0, "Also search the contents of gzip, zstd, and xz-compressed files."},
 		{0,0,0,0, "Search Output:"},
 		{"column", OPT_COLUMN, 0, 0, "Print column of first match after line number."},
 		{"nocolumn", OPT_NOCOLUMN, 0, 0, "Don't print column of first match (default)."},
+		{"after-context", 'A', "NUM", 0, "Print NUM lines of trailing context after each matched line."},
+		{"before-context", 'B', "NUM", 0, "Print NUM lines of leading context before each matched line."},
+		{"context", 'C', "NUM", 0, "Print NUM lines of leading and trailing context around each matched line."},
+		{"json-output", OPT_JSON, 0, 0, "Print results as JSON Lines, one object per matched or context line, with byte offsets."},
+		{"binary-output", OPT_BINARY_OUTPUT, 0, 0, "Print results as compact length-prefixed binary records, for consumption by other programs."},
 		{0,0,0,0, "File presentation:" },
 		{"color", OPT_COLOR, 0, 0, "Render the output with ANSI color codes."},
 		{"colour", OPT_COLOR, 0, OPTION_ALIAS },
@@ -193,6 +211,21 @@ static struct argp_option options[] = {
 		{0,0,0,0, "Performance tuning:"},
 		{"jobs",  'j', "NUM_JOBS",      0,  "Number of scanner jobs (std::thread<>s) to use." },
 		{"dirjobs",  OPT_PERF_DIRJOBS, "NUM_JOBS",      0,  "Number of directory traversal jobs (std::thread<>s) to use." },
+		{"adaptive-jobs", OPT_PERF_ADAPTIVE_JOBS, 0, 0, "Vary the number of running scanner jobs during the search, from 1 up to twice the --jobs number, depending on whether the search is I/O or CPU bound."},
+		{"task-pool", OPT_PERF_TASK_POOL, 0, 0, "Run the directory traversal, scanning, and output as tasks on one pool of --jobs work-stealing threads, instead of on separate groups of threads.  --dirjobs is ignored."},
+		{"schedule", OPT_PERF_SCHEDULE, "ORDER", 0, "The order to scan the files found in.  ORDER is \"traversal\" to scan them in the order they're found (default), \"size\" to scan the largest first, so that a few big files found late don't leave one job running long after the rest are done, or \"inode\" to read them in inode order, which is close to on-disk order, for spinning disks and network filesystems."},
+		{"prefetch", OPT_PERF_PREFETCH, 0, 0, "Start reading files into the page cache ahead of the scanner jobs, as far ahead as it takes for the data to be there when they get to it.  Helps when the files aren't already cached."},
+		{"no-cache-pollution", OPT_PERF_NO_CACHE_POLLUTION, "METHOD", OPTION_ARG_OPTIONAL, "Don't leave the files searched in the page cache, so a big search doesn't push out other programs' cached files.  METHOD is \"drop\" (default) to drop each file from the cache after reading it, unless it was already cached, or \"direct\" to read around the cache with O_DIRECT where possible."},
+		{"thread-placement", OPT_PERF_THREAD_PLACEMENT, "MODE", 0, "Where to run the scanner and directory traversal threads.  MODE is \"os\" to leave it to the OS (default), \"numa\" to spread them over the NUMA nodes we're allowed to run on and keep each on its node, or \"numa-nosmt\" to also keep them off the second hardware thread of each core."},
+		{"stats", OPT_PERF_STATS, 0, 0, "Print per-stage and per-thread statistics to stderr after the search completes."},
+		{"trace", OPT_PERF_TRACE, "FILE", 0, "Record a timeline of pipeline activity and write it to FILE in Chrome trace JSON format."},
+		{0,0,0,0, "Indexing:" },
+		{"index", OPT_INDEX, 0, 0, "Build a trigram index of the FILES OR DIRECTORIES instead of searching, for faster repeated searches.  No PATTERN is given with this option."},
+		{"index-file", OPT_INDEX_FILE, "FILE", 0, "Build or search with the index in FILE (default: .ucgindex in the current directory, if it exists)."},
+		{"noindex", OPT_NOINDEX, 0, 0, "Don't use an index when searching, even if one exists."},
+		{0,0,0,0, "Search server:" },
+		{"server", OPT_SERVER, "SOCKET", 0, "Run as a long-lived search server listening on the Unix-domain socket SOCKET instead of searching.  No PATTERN is given with this option."},
+		{"connect", OPT_CONNECT, "SOCKET", 0, "Send this search to the server listening on SOCKET.  If there's no server there, search as usual."},
 		{0,0,0,0, "Miscellaneous:" },
 		{"noenv", OPT_NOENV, 0, 0, "Ignore .ucgrc files."},
 		{0,0,0,0, "Informational options:", -1}, // -1 is the same group the default --help and --version are in.
@@ -212,6 +245,29 @@ struct argp ArgParse::argp = { options, ArgParse::parse_opt, args_doc, doc };
 #pragma GCC diagnostic pop // Re-enable -Wmissing-field-initializers
 
 
+/**
+ * Helper for parse_opt() which converts the NUM argument of the -A/-B/-C context options to an int.
+ * Terminates the program via argp_failure() if @a arg isn't a non-negative integer.
+ *
+ * @param state  The argp state passed to parse_opt().
+ * @param arg    The option's argument string.
+ * @return The number of context lines requested.
+ */
+static int ParseContextArg(struct argp_state *state, const char *arg)
+{
+	char *end;
+	long num_lines = std::strtol(arg, &end, 10);
+
+	if((end == arg) || (*end != '\0') || (num_lines < 0) || (num_lines > std::numeric_limits<int>::max()))
+	{
+		argp_failure(state, STATUS_EX_USAGE, 0, "context line count must be an integer >= 0, got \'%s\'", arg);
+		// argp_failure() won't return unless ARGP_NO_EXIT was specified.
+		return 0;
+	}
+
+	return num_lines;
+}
+
 error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 {
 	class ArgParse *arguments = static_cast<ArgParse*>(state->input);
@@ -238,12 +294,32 @@ error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 	case 'Q':
 		arguments->m_pattern_is_literal = true;
 		break;
+	case 'z':
+		arguments->m_search_compressed = true;
+		arguments->m_type_manager.SetSearchCompressed(true);
+		break;
 	case OPT_COLUMN:
 		arguments->m_column = true;
 		break;
 	case OPT_NOCOLUMN:
 		arguments->m_column = false;
 		break;
+	case OPT_JSON:
+		arguments->m_output_format = OutputFormat::JSON;
+		break;
+	case OPT_BINARY_OUTPUT:
+		arguments->m_output_format = OutputFormat::BINARY;
+		break;
+	case 'A':
+		arguments->m_lines_after = ParseContextArg(state, arg);
+		break;
+	case 'B':
+		arguments->m_lines_before = ParseContextArg(state, arg);
+		break;
+	case 'C':
+		arguments->m_lines_before = ParseContextArg(state, arg);
+		arguments->m_lines_after = arguments->m_lines_before;
+		break;
 	case OPT_IGNORE_DIR:
 		arguments->m_excludes.insert(arg);
 		break;
@@ -326,6 +402,88 @@ error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 			arguments->m_dirjobs = atoi(arg);
 		}
 		break;
+	case OPT_PERF_ADAPTIVE_JOBS:
+		arguments->m_adaptive_jobs = true;
+		break;
+	case OPT_PERF_TASK_POOL:
+		arguments->m_task_pool = true;
+		break;
+	case OPT_PERF_SCHEDULE:
+		if(std::strcmp(arg, "traversal") == 0)
+		{
+			arguments->m_schedule = FileScheduleMode::TRAVERSAL;
+		}
+		else if(std::strcmp(arg, "size") == 0)
+		{
+			arguments->m_schedule = FileScheduleMode::SIZE;
+		}
+		else if(std::strcmp(arg, "inode") == 0)
+		{
+			arguments->m_schedule = FileScheduleMode::INODE;
+		}
+		else
+		{
+			argp_failure(state, STATUS_EX_USAGE, 0, "invalid --schedule ORDER \'%s\', must be one of \"traversal\", \"size\", or \"inode\"", arg);
+		}
+		break;
+	case OPT_PERF_PREFETCH:
+		arguments->m_prefetch = true;
+		break;
+	case OPT_PERF_NO_CACHE_POLLUTION:
+		if(arg == nullptr || std::strcmp(arg, "drop") == 0)
+		{
+			arguments->m_cache_policy = FileCachePolicy::DROP;
+		}
+		else if(std::strcmp(arg, "direct") == 0)
+		{
+			arguments->m_cache_policy = FileCachePolicy::DIRECT;
+		}
+		else
+		{
+			argp_failure(state, STATUS_EX_USAGE, 0, "invalid --no-cache-pollution METHOD \'%s\', must be one of \"drop\" or \"direct\"", arg);
+		}
+		break;
+	case OPT_PERF_THREAD_PLACEMENT:
+		if(std::strcmp(arg, "os") == 0)
+		{
+			arguments->m_thread_placement = ThreadPlacementMode::OS;
+		}
+		else if(std::strcmp(arg, "numa") == 0)
+		{
+			arguments->m_thread_placement = ThreadPlacementMode::NUMA;
+		}
+		else if(std::strcmp(arg, "numa-nosmt") == 0)
+		{
+			arguments->m_thread_placement = ThreadPlacementMode::NUMA_NO_SMT;
+		}
+		else
+		{
+			argp_failure(state, STATUS_EX_USAGE, 0, "invalid --thread-placement MODE \'%s\', must be one of \"os\", \"numa\", or \"numa-nosmt\"", arg);
+		}
+		break;
+	case OPT_PERF_STATS:
+		arguments->m_stats = true;
+		break;
+	case OPT_PERF_TRACE:
+		arguments->m_trace_file = arg;
+		break;
+	case OPT_INDEX:
+		arguments->m_build_index = true;
+		break;
+	case OPT_INDEX_FILE:
+		arguments->m_index_file = arg;
+		arguments->m_use_index = true;
+		break;
+	case OPT_NOINDEX:
+		arguments->m_use_index = false;
+		break;
+	case OPT_SERVER:
+		arguments->m_server_socket = arg;
+		break;
+	case OPT_CONNECT:
+		// --connect is handled in main() before we ever get here.  If we do see it, we're the fallback
+		// when there's no server, or a server child handling a request, and either way we just do the search.
+		break;
 	case OPT_COLOR:
 		arguments->m_color = true;
 		arguments->m_nocolor = false;
@@ -335,6 +493,10 @@ error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 		arguments->m_nocolor = true;
 		break;
 	case OPT_TEST_LOG_ALL:
+		if(!INFO::IsCompiledIn())
+		{
+			WARN() << "--test-log-all: this ucg was built with diagnostic logging compiled out (configure --with-min-log-level)";
+		}
 		INFO::Enable(true);
 		break;
 	case OPT_TEST_NOENV_USER:
@@ -344,9 +506,9 @@ error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 		arguments->m_use_mmap = true;
 		break;
 	case ARGP_KEY_ARG:
-		if(state->arg_num == 0)
+		if(state->arg_num == 0 && !arguments->m_build_index && arguments->m_server_socket.empty())
 		{
-			// First arg is the pattern.
+			// First arg is the pattern.  There isn't one if we're building an index or running a server.
 			arguments->m_pattern = arg;
 		}
 		else
@@ -356,7 +518,37 @@ error_t ArgParse::parse_opt (int key, char *arg, struct argp_state *state)
 		}
 		break;
 	case ARGP_KEY_END:
-		if(state->arg_num < 1)
+		if(arguments->m_task_pool && arguments->m_adaptive_jobs)
+		{
+			argp_error(state, "--adaptive-jobs can't be used with --task-pool");
+		}
+		if(arguments->m_task_pool && arguments->m_schedule != FileScheduleMode::TRAVERSAL)
+		{
+			argp_error(state, "--schedule can't be used with --task-pool");
+		}
+		if(arguments->m_task_pool && arguments->m_prefetch)
+		{
+			argp_error(state, "--prefetch can't be used with --task-pool");
+		}
+		if(arguments->m_prefetch && arguments->m_schedule != FileScheduleMode::TRAVERSAL)
+		{
+			// The scheduler takes files off the queue thousands at a time to reorder them, so the Prefetcher couldn't
+			// tell how far ahead of the scanners it was.
+			argp_error(state, "--prefetch can't be used with --schedule");
+		}
+		if(arguments->m_prefetch && arguments->m_cache_policy != FileCachePolicy::NORMAL)
+		{
+			// The prefetching would make every file look like it was already cached, and so not ours to drop.
+			argp_error(state, "--prefetch can't be used with --no-cache-pollution");
+		}
+		if(!arguments->m_server_socket.empty())
+		{
+			if(state->arg_num > 0)
+			{
+				argp_error(state, "no PATTERN or FILES are given with --server");
+			}
+		}
+		else if(state->arg_num < 1 && !arguments->m_build_index)
 		{
 			// Not enough args.
 			argp_usage(state);
@@ -445,31 +637,30 @@ void ArgParse::Parse(int argc, char **argv)
 
 	//// Now set up some defaults which we can only determine after all arg parsing is complete.
 
-	// Number of jobs.
-	if(m_jobs == 0)
-	{
-		// Number of jobs wasn't specified on command line.  Default to the number of cores the std lib says we have.
-		m_jobs = std::thread::hardware_concurrency();
+	// Number of scanner and directory scanning jobs, if they weren't specified.  These are sized to the CPUs we can
+	// actually use (our cpuset and cgroup quota, and the --thread-placement), not the number of cores on the host.
+	SetDefaultJobCounts(m_jobs, m_dirjobs, m_thread_placement);
 
-		if(m_jobs == 0)
+	// Search files/directories.
+	if(m_paths.empty())
+	{
+		struct stat stdin_stat;
+		if(!m_build_index && m_server_socket.empty() && fstat(STDIN_FILENO, &stdin_stat) == 0 && S_ISFIFO(stdin_stat.st_mode))
 		{
-			// std::thread::hardware_concurrency() is broken.  Default to one thread.
-			m_jobs = 1;
+			// Something's being piped into us, e.g. "cmd | ucg PATTERN".  Search that.
+			// Note that we don't do this for sockets, which is what a lot of IDEs, CI runners etc. give their children as
+			// stdin and then never close.
+			m_paths.push_back("-");
+		}
+		else
+		{
+			// Default to current directory.
+			m_paths.push_back(".");
 		}
 	}
-
-	// Number of directory scanning jobs.
-	if(m_dirjobs == 0)
-	{
-		// Wasn't specified on command line.  Use the default.
-		m_dirjobs = f_default_dirjobs;
-	}
-
-	// Search files/directories.
-	if(m_paths.empty())
+	else if(m_build_index && std::find(m_paths.begin(), m_paths.end(), "-") != m_paths.end())
 	{
-		// Default to current directory.
-		m_paths.push_back(".");
+		throw ArgParseException("the standard input can't be indexed");
 	}
 
 	// Is smart-case enabled, and will we otherwise not be ignoring case?
@@ -29,6 +29,11 @@
 #include <cstdio>
 #include <argp.h>
 
+#include "OutputContext.h"
+#include "ThreadPlacement.h"
+#include "FileScheduler.h"
+#include "File.h"
+
 class TypeManager;
 class File;
 
@@ -124,9 +129,21 @@ public:
 	/// true if PATTERN should be treated as literal chars (i.e. not a regex).
 	bool m_pattern_is_literal { false };
 
+	/// true if compressed files should be decompressed and searched (-z).
+	bool m_search_compressed { false };
+
 	/// true if we should print the column of the first match after the line number.
 	bool m_column { false };
 
+	/// Text, --json-output, or --binary-output.
+	OutputFormat m_output_format { OutputFormat::TEXT };
+
+	/// Number of lines of leading context to print before each matched line.
+	int m_lines_before { 0 };
+
+	/// Number of lines of trailing context to print after each matched line.
+	int m_lines_after { 0 };
+
 	/// The file and directory paths given on the command line.
 	std::vector<std::string> m_paths;
 
@@ -139,6 +156,42 @@ public:
 	/// Number of Globber threads to use.
 	int m_dirjobs { 0 };
 
+	/// Whether to adjust the number of running FileScanner threads during the search (--adaptive-jobs).
+	bool m_adaptive_jobs { false };
+
+	/// Whether to run the whole search on one work-stealing TaskPool instead of per-stage threads (--task-pool).
+	bool m_task_pool { false };
+
+	/// How to place the FileScanner and Globber threads on CPUs (--thread-placement).
+	ThreadPlacementMode m_thread_placement { ThreadPlacementMode::OS };
+
+	/// The order to scan the files in (--schedule).
+	FileScheduleMode m_schedule { FileScheduleMode::TRAVERSAL };
+
+	/// Whether to start reading the files ahead of the scanners (--prefetch).
+	bool m_prefetch { false };
+
+	/// What to do about the page cache (--no-cache-pollution).
+	FileCachePolicy m_cache_policy { FileCachePolicy::NORMAL };
+
+	/// Whether to print pipeline statistics at the end of the run.
+	bool m_stats { false };
+
+	/// If not empty, the file to write a Chrome trace JSON timeline of the run to.
+	std::string m_trace_file;
+
+	/// true if we're building an index (--index) instead of searching.
+	bool m_build_index { false };
+
+	/// The --index-file given, or empty if none was given.
+	std::string m_index_file;
+
+	/// false if --noindex was given.
+	bool m_use_index { true };
+
+	/// The --server socket, or empty if we're not running as a server.
+	std::string m_server_socket;
+
 	/// Whether to use color output or not.
 	/// both false == not specified on command line.
 	bool m_color { false };
@@ -0,0 +1,343 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "Decompressor.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <future/string.hpp>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+CompressionFormat DetectCompressionFormat(const unsigned char *magic, size_t len) noexcept
+{
+	if(len >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+	{
+		return CompressionFormat::GZIP;
+	}
+	if(len >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+	{
+		return CompressionFormat::ZSTD;
+	}
+	if(len >= 6 && std::memcmp(magic, "\xFD" "7zXZ\0", 6) == 0)
+	{
+		return CompressionFormat::XZ;
+	}
+	return CompressionFormat::NONE;
+}
+
+size_t CompressedFileSuffixLength(const std::string &name) noexcept
+{
+	static const char * const suffixes[] = { ".gz", ".zst", ".xz" };
+
+	for(const char *suffix : suffixes)
+	{
+		size_t suffix_len = std::strlen(suffix);
+		// Require at least one char of name in front of the suffix, so e.g. a file named ".gz" isn't stripped to nothing.
+		if(name.length() > suffix_len && name.compare(name.length() - suffix_len, suffix_len, suffix) == 0)
+		{
+			return suffix_len;
+		}
+	}
+	return 0;
+}
+
+Decompressor::Decompressor(int file_descriptor)
+	: m_file_descriptor(file_descriptor), m_in_buffer(new unsigned char[m_in_buffer_size])
+{
+}
+
+Decompressor::~Decompressor()
+{
+}
+
+bool Decompressor::FillInputBuffer()
+{
+	if(m_in_pos < m_in_end)
+	{
+		// Still have some.
+		return true;
+	}
+
+	ssize_t num_read;
+	do
+	{
+		num_read = read(m_file_descriptor, m_in_buffer.get(), m_in_buffer_size);
+	} while(num_read < 0 && errno == EINTR);
+
+	if(num_read < 0)
+	{
+		throw DecompressorException(std::string("read error: ") + std::strerror(errno));
+	}
+
+	m_in_pos = 0;
+	m_in_end = num_read;
+	return num_read > 0;
+}
+
+
+#ifdef HAVE_LIBZ
+/**
+ * gzip decompressor.  Handles multi-member files, e.g. the result of "cat a.gz b.gz".
+ */
+class GzipDecompressor : public Decompressor
+{
+public:
+	explicit GzipDecompressor(int file_descriptor) : Decompressor(file_descriptor)
+	{
+		std::memset(&m_stream, 0, sizeof(m_stream));
+		// 15 == max window size, +16 == expect a gzip header and trailer.
+		if(inflateInit2(&m_stream, 15 + 16) != Z_OK)
+		{
+			throw DecompressorException("couldn't initialize zlib");
+		}
+	}
+
+	~GzipDecompressor() override
+	{
+		inflateEnd(&m_stream);
+	}
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		m_stream.next_out = reinterpret_cast<Bytef*>(buffer);
+		m_stream.avail_out = len;
+
+		while(m_stream.avail_out > 0)
+		{
+			// Note that we keep calling inflate() after the input runs out, since it may still have output to flush.
+			bool have_input = FillInputBuffer();
+
+			if(m_at_member_end)
+			{
+				if(!have_input)
+				{
+					// Clean end of the last member.
+					break;
+				}
+				// There's more data after the end of the last member, start on the next one.
+				inflateReset(&m_stream);
+				m_at_member_end = false;
+			}
+
+			m_stream.next_in = m_in_buffer.get() + m_in_pos;
+			m_stream.avail_in = m_in_end - m_in_pos;
+			int retval = inflate(&m_stream, Z_NO_FLUSH);
+			m_in_pos = m_in_end - m_stream.avail_in;
+
+			if(retval == Z_STREAM_END)
+			{
+				m_at_member_end = true;
+			}
+			else if(retval == Z_BUF_ERROR && !have_input)
+			{
+				// No progress possible and no more input.
+				throw DecompressorException("unexpected end of gzip data");
+			}
+			else if(retval != Z_OK)
+			{
+				throw DecompressorException(std::string("gzip data error: ") + (m_stream.msg != nullptr ? m_stream.msg : zError(retval)));
+			}
+		}
+
+		return len - m_stream.avail_out;
+	}
+
+private:
+	z_stream m_stream;
+
+	/// true if we've reached the end of a gzip member.
+	bool m_at_member_end { false };
+};
+#endif
+
+#ifdef HAVE_LIBZSTD
+/**
+ * Zstandard decompressor.  ZSTD_decompressStream() handles concatenated frames on its own.
+ */
+class ZstdDecompressor : public Decompressor
+{
+public:
+	explicit ZstdDecompressor(int file_descriptor) : Decompressor(file_descriptor), m_dctx(ZSTD_createDCtx())
+	{
+		if(m_dctx == nullptr)
+		{
+			throw DecompressorException("couldn't initialize libzstd");
+		}
+	}
+
+	~ZstdDecompressor() override
+	{
+		ZSTD_freeDCtx(m_dctx);
+	}
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		ZSTD_outBuffer out { buffer, len, 0 };
+
+		while(out.pos < out.size)
+		{
+			// Note that we keep calling ZSTD_decompressStream() after the input runs out, since it may still have output to flush.
+			bool have_input = FillInputBuffer();
+
+			ZSTD_inBuffer in { m_in_buffer.get(), m_in_end, m_in_pos };
+			size_t prev_in_pos = in.pos;
+			size_t prev_out_pos = out.pos;
+			size_t retval = ZSTD_decompressStream(m_dctx, &out, &in);
+			m_in_pos = in.pos;
+			if(ZSTD_isError(retval))
+			{
+				throw DecompressorException(std::string("zstd data error: ") + ZSTD_getErrorName(retval));
+			}
+			bool made_progress = (in.pos != prev_in_pos) || (out.pos != prev_out_pos);
+			if(made_progress)
+			{
+				// 0 means a frame was completely decoded and flushed.  A call which did nothing returns a nonzero
+				// input size hint, which doesn't tell us anything about where we are.
+				m_at_frame_end = (retval == 0);
+			}
+
+			if(!have_input && !made_progress)
+			{
+				// Nothing more to come.
+				if(!m_at_frame_end)
+				{
+					throw DecompressorException("unexpected end of zstd data");
+				}
+				break;
+			}
+		}
+
+		return out.pos;
+	}
+
+private:
+	ZSTD_DCtx *m_dctx;
+
+	bool m_at_frame_end { true };
+};
+#endif
+
+#ifdef HAVE_LIBLZMA
+/**
+ * xz decompressor.
+ */
+class XzDecompressor : public Decompressor
+{
+public:
+	explicit XzDecompressor(int file_descriptor) : Decompressor(file_descriptor), m_stream(LZMA_STREAM_INIT)
+	{
+		if(lzma_stream_decoder(&m_stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+		{
+			throw DecompressorException("couldn't initialize liblzma");
+		}
+	}
+
+	~XzDecompressor() override
+	{
+		lzma_end(&m_stream);
+	}
+
+	size_t Read(char *buffer, size_t len) override
+	{
+		m_stream.next_out = reinterpret_cast<uint8_t*>(buffer);
+		m_stream.avail_out = len;
+
+		while(m_stream.avail_out > 0 && !m_at_end)
+		{
+			// With LZMA_CONCATENATED, the decoder only knows it's seen the last stream once we tell it there's no more input.
+			lzma_action action = FillInputBuffer() ? LZMA_RUN : LZMA_FINISH;
+
+			m_stream.next_in = m_in_buffer.get() + m_in_pos;
+			m_stream.avail_in = m_in_end - m_in_pos;
+			lzma_ret retval = lzma_code(&m_stream, action);
+			m_in_pos = m_in_end - m_stream.avail_in;
+
+			if(retval == LZMA_STREAM_END)
+			{
+				m_at_end = true;
+			}
+			else if(retval == LZMA_BUF_ERROR)
+			{
+				// No progress possible and no more input.
+				throw DecompressorException("unexpected end of xz data");
+			}
+			else if(retval != LZMA_OK)
+			{
+				throw DecompressorException("xz data error: liblzma error code " + std::to_string(retval));
+			}
+		}
+
+		return len - m_stream.avail_out;
+	}
+
+private:
+	lzma_stream m_stream;
+
+	bool m_at_end { false };
+};
+#endif
+
+std::unique_ptr<Decompressor> Decompressor::Create(CompressionFormat format, int file_descriptor)
+{
+	std::unique_ptr<Decompressor> retval;
+
+	switch(format)
+	{
+	case CompressionFormat::GZIP:
+#ifdef HAVE_LIBZ
+		retval.reset(new GzipDecompressor(file_descriptor));
+#else
+		throw DecompressorException("gzip-compressed, but ucg was built without zlib support");
+#endif
+		break;
+	case CompressionFormat::ZSTD:
+#ifdef HAVE_LIBZSTD
+		retval.reset(new ZstdDecompressor(file_descriptor));
+#else
+		throw DecompressorException("zstd-compressed, but ucg was built without libzstd support");
+#endif
+		break;
+	case CompressionFormat::XZ:
+#ifdef HAVE_LIBLZMA
+		retval.reset(new XzDecompressor(file_descriptor));
+#else
+		throw DecompressorException("xz-compressed, but ucg was built without liblzma support");
+#endif
+		break;
+	default:
+		// Should never get here.  Throw.
+		throw DecompressorException("invalid CompressionFormat specified: " + std::to_string(static_cast<int>(format)));
+		break;
+	}
+
+	return retval;
+}
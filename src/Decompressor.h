@@ -0,0 +1,105 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_DECOMPRESSOR_H_
+#define SRC_DECOMPRESSOR_H_
+
+#include <config.h>
+
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+/**
+ * Decompressor will throw this if the compressed data is corrupt or can't otherwise be decompressed.
+ */
+struct DecompressorException : public std::runtime_error
+{
+	DecompressorException(const std::string &message) : std::runtime_error(message) {};
+};
+
+/// The compressed file formats we can search with -z.
+enum class CompressionFormat
+{
+	NONE,	//!< Not compressed, or not in a format we recognize.
+	GZIP,	//!< gzip (.gz), via zlib.
+	ZSTD,	//!< Zstandard (.zst), via libzstd.
+	XZ,		//!< xz (.xz), via liblzma.
+};
+
+/// The number of leading bytes of a file DetectCompressionFormat() needs to see.
+static constexpr size_t COMPRESSION_MAGIC_MAX_LEN = 6;
+
+/**
+ * Identify the compression format of a file from its first @a len bytes (up to COMPRESSION_MAGIC_MAX_LEN).
+ */
+CompressionFormat DetectCompressionFormat(const unsigned char *magic, size_t len) noexcept;
+
+/**
+ * If @a name ends in one of the usual compressed file suffixes (".gz", ".zst", ".xz", etc.), return that suffix's
+ * length, including the '.'.  Otherwise return 0.
+ */
+size_t CompressedFileSuffixLength(const std::string &name) noexcept;
+
+/**
+ * Base class for the streaming decompressors.  Each one reads compressed data from a file descriptor a block
+ * at a time and hands back decompressed data in whatever size pieces the caller asks for, so the whole of
+ * neither the compressed nor decompressed file ever has to be in memory.
+ */
+class Decompressor
+{
+public:
+
+	/**
+	 * Factory Method for creating a Decompressor for @a format, reading from @a file_descriptor.
+	 * Throws DecompressorException if ucg wasn't built with support for @a format.
+	 */
+	static std::unique_ptr<Decompressor> Create(CompressionFormat format, int file_descriptor);
+
+	virtual ~Decompressor();
+
+	/**
+	 * Decompress up to @a len bytes into @a buffer.
+	 *
+	 * @return  The number of bytes decompressed.  0 means the end of the compressed data has been reached.
+	 */
+	virtual size_t Read(char *buffer, size_t len) = 0;
+
+protected:
+
+	explicit Decompressor(int file_descriptor);
+
+	/**
+	 * Refill m_in_buffer from the file if it's been used up.
+	 * @return  false if there's no more compressed data.
+	 */
+	bool FillInputBuffer();
+
+	int m_file_descriptor;
+
+	/// Compressed data read from the file but not yet decompressed is [m_in_pos, m_in_end).
+	std::unique_ptr<unsigned char[]> m_in_buffer;
+	size_t m_in_pos { 0 };
+	size_t m_in_end { 0 };
+
+	/// Size of m_in_buffer.
+	static constexpr size_t m_in_buffer_size = 128*1024;
+};
+
+#endif /* SRC_DECOMPRESSOR_H_ */
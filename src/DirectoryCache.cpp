@@ -0,0 +1,338 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "DirectoryCache.h"
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(HAVE_INOTIFY_INIT1)
+#include <sys/inotify.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+
+#include "DirInclusionManager.h"
+#include "Logger.h"
+
+#if defined(HAVE_INOTIFY_INIT1)
+/// The changes we need to hear about in each cached directory.
+static constexpr uint32_t f_watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB
+		| IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+#endif
+
+/// Join a directory path and an entry name the same way fts does.
+static std::string JoinPath(const std::string &dir, const std::string &name)
+{
+	if(!dir.empty() && dir.back() == '/')
+	{
+		return dir + name;
+	}
+	return dir + "/" + name;
+}
+
+DirectoryCache::DirectoryCache(const std::string &root, const DirInclusionManager &dir_inc_manager)
+	: m_dir_inc_manager(dir_inc_manager)
+{
+	char *real_root = realpath(root.c_str(), nullptr);
+	if(real_root == nullptr)
+	{
+		WARN() << "Couldn't resolve directory \'" << root << "\', not caching it: " << Logger::strerror();
+		return;
+	}
+	m_root = real_root;
+	std::free(real_root);
+
+#if defined(HAVE_INOTIFY_INIT1)
+	m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(m_inotify_fd == -1)
+	{
+		WARN() << "Couldn't initialize inotify, not caching directories: " << Logger::strerror();
+	}
+#else
+	LOG(INFO) << "No inotify support, not caching directories.";
+#endif
+}
+
+DirectoryCache::~DirectoryCache()
+{
+	if(m_inotify_fd != -1)
+	{
+		close(m_inotify_fd);
+	}
+}
+
+void DirectoryCache::ProcessEvents()
+{
+#if defined(HAVE_INOTIFY_INIT1)
+	if(!IsEnabled())
+	{
+		return;
+	}
+
+	alignas(struct inotify_event) char buffer[64*1024];
+	ssize_t num_read;
+
+	while((num_read = read(m_inotify_fd, buffer, sizeof(buffer))) > 0)
+	{
+		for(char *p = buffer; p < buffer + num_read; )
+		{
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+			p += sizeof(struct inotify_event) + event->len;
+
+			if(event->mask & IN_Q_OVERFLOW)
+			{
+				// We lost events, so we can't trust anything we have.
+				LOG(INFO) << "inotify queue overflowed, invalidating the whole directory cache.";
+				InvalidateAll();
+				continue;
+			}
+
+			auto watch = m_watches.find(event->wd);
+			if(watch == m_watches.end())
+			{
+				// A watch we've already dropped.
+				continue;
+			}
+			std::string dir_path = watch->second;
+
+			if(event->mask & IN_IGNORED)
+			{
+				// The kernel removed the watch, e.g. the directory was deleted.
+				m_watches.erase(watch);
+				continue;
+			}
+
+			if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+			{
+				// The directory itself went away.  Its parent gets its own event for this.
+				InvalidateSubtree(dir_path);
+				continue;
+			}
+
+			// Something in this directory changed, so its listing is stale.  Only log the first change, since the
+			// log file itself may well be in a directory we're watching.
+			if(m_stale_directories.insert(dir_path).second)
+			{
+				LOG(INFO) << "Change in cached directory \'" << dir_path << "\', mask = " << std::hex << event->mask << std::dec;
+			}
+
+			if((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM)) && event->len > 0)
+			{
+				// A subdirectory was removed or renamed away, so is everything under it.
+				InvalidateSubtree(JoinPath(dir_path, event->name));
+			}
+		}
+	}
+#endif
+}
+
+void DirectoryCache::Refresh()
+{
+	if(!IsEnabled())
+	{
+		return;
+	}
+
+	ProcessEvents();
+
+	if(m_root_is_stale)
+	{
+		m_root_is_stale = false;
+		m_stale_directories.clear();
+		ReadTree(m_root);
+	}
+
+	// Re-read the listings which have changed.  This also reads in any new subdirectories.
+	std::set<std::string> stale_directories;
+	std::swap(stale_directories, m_stale_directories);
+	for(const auto &path : stale_directories)
+	{
+		if(m_directories.count(path) != 0)
+		{
+			ReadTree(path);
+		}
+	}
+
+	LOG(INFO) << "Directory cache refreshed: " << m_directories.size() << " directories cached, "
+			<< m_num_directories_read << " directory reads so far.";
+}
+
+const CachedDirectory* DirectoryCache::Find(const std::string &path) const
+{
+	auto it = m_directories.find(path);
+	if(it == m_directories.end())
+	{
+		return nullptr;
+	}
+	return &it->second;
+}
+
+void DirectoryCache::ReadTree(const std::string &path)
+{
+	std::vector<std::string> subdirs { path };
+
+	while(!subdirs.empty())
+	{
+		std::string dir = std::move(subdirs.back());
+		subdirs.pop_back();
+		ReadDirectory(dir, &subdirs);
+	}
+}
+
+void DirectoryCache::ReadDirectory(const std::string &path, std::vector<std::string> *subdirs)
+{
+#if defined(HAVE_INOTIFY_INIT1)
+	// Start watching before we read, so we can't miss a change made while we're reading.
+	auto existing = m_directories.find(path);
+	if(existing == m_directories.end())
+	{
+		int wd = inotify_add_watch(m_inotify_fd, path.c_str(), f_watch_mask);
+		if(wd == -1)
+		{
+			// E.g. we've hit fs.inotify.max_user_watches.  Searches will just read this directory themselves.
+			LOG(INFO) << "Couldn't watch \'" << path << "\', not caching it: " << Logger::strerror();
+			return;
+		}
+		m_watches[wd] = path;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if(dir == nullptr)
+	{
+		// Searches will report this themselves.
+		InvalidateSubtree(path);
+		return;
+	}
+	++m_num_directories_read;
+
+	CachedDirectory &cached_dir = m_directories[path];
+	cached_dir.m_path = path;
+	cached_dir.m_entries.clear();
+	if(fstat(dirfd(dir), &cached_dir.m_stat) != 0)
+	{
+		closedir(dir);
+		InvalidateSubtree(path);
+		return;
+	}
+
+	while(struct dirent *dirent = readdir(dir))
+	{
+		if(std::strcmp(dirent->d_name, ".") == 0 || std::strcmp(dirent->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		CachedDirectoryEntry entry;
+		entry.m_name = dirent->d_name;
+		if(fstatat(dirfd(dir), dirent->d_name, &entry.m_stat, AT_SYMLINK_NOFOLLOW) != 0)
+		{
+			// Gone already.
+			continue;
+		}
+
+		if(S_ISREG(entry.m_stat.st_mode))
+		{
+			entry.m_type = CachedDirectoryEntry::Type::FILE;
+		}
+		else if(S_ISDIR(entry.m_stat.st_mode))
+		{
+			entry.m_type = CachedDirectoryEntry::Type::DIRECTORY;
+			std::string subdir_path = JoinPath(path, entry.m_name);
+			if(!m_dir_inc_manager.DirShouldBeExcluded(entry.m_name) && m_directories.count(subdir_path) == 0)
+			{
+				subdirs->push_back(std::move(subdir_path));
+			}
+		}
+		else if(S_ISLNK(entry.m_stat.st_mode))
+		{
+			// Searches follow symlinks, so classify it by what it points to.
+			struct stat target_stat;
+			if(fstatat(dirfd(dir), dirent->d_name, &target_stat, 0) != 0)
+			{
+				entry.m_type = CachedDirectoryEntry::Type::BROKEN_SYMLINK;
+			}
+			else if(S_ISREG(target_stat.st_mode))
+			{
+				entry.m_type = CachedDirectoryEntry::Type::FILE_SYMLINK;
+			}
+			else if(S_ISDIR(target_stat.st_mode))
+			{
+				entry.m_type = CachedDirectoryEntry::Type::DIRECTORY_SYMLINK;
+			}
+			else
+			{
+				continue;
+			}
+		}
+		else
+		{
+			// Devices, FIFOs, etc., which searches ignore.
+			continue;
+		}
+
+		cached_dir.m_entries.push_back(std::move(entry));
+	}
+
+	closedir(dir);
+#else
+	(void)path;
+	(void)subdirs;
+#endif
+}
+
+void DirectoryCache::InvalidateSubtree(const std::string &path)
+{
+	// The descendants of path are the keys starting with path + "/", which are contiguous in the map.
+	std::string prefix = JoinPath(path, "");
+	m_directories.erase(path);
+	auto first = m_directories.lower_bound(prefix);
+	auto last = first;
+	while(last != m_directories.end() && last->first.compare(0, prefix.size(), prefix) == 0)
+	{
+		++last;
+	}
+	m_directories.erase(first, last);
+
+	for(auto it = m_watches.begin(); it != m_watches.end(); )
+	{
+		if(it->second == path || it->second.compare(0, prefix.size(), prefix) == 0)
+		{
+#if defined(HAVE_INOTIFY_INIT1)
+			inotify_rm_watch(m_inotify_fd, it->first);
+#endif
+			it = m_watches.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void DirectoryCache::InvalidateAll()
+{
+	InvalidateSubtree(m_root);
+	m_stale_directories.clear();
+	m_root_is_stale = true;
+}
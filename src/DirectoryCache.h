@@ -0,0 +1,155 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file DirectoryCache.h
+ * The --server's in-memory copy of the directory tree it was started in, kept up to date with inotify.
+ *
+ * The server process owns the cache and is the only one which modifies it.  Each request's fork()ed child gets a
+ * copy-on-write snapshot, and its Globber walks the cached listings instead of reading the directories again.
+ * Any directory which isn't in the cache (excluded by the server's own --ignore-dir settings, reached through a
+ * symlink, unwatchable, etc.) is simply traversed the normal way.
+ */
+
+#ifndef SRC_DIRECTORYCACHE_H_
+#define SRC_DIRECTORYCACHE_H_
+
+#include <config.h>
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class DirInclusionManager;
+
+/**
+ * One entry in a cached directory listing.
+ */
+struct CachedDirectoryEntry
+{
+	enum class Type : uint8_t
+	{
+		FILE,				///< A regular file, m_stat is valid.
+		DIRECTORY,			///< A directory, m_stat is valid.
+		FILE_SYMLINK,		///< A symlink to a regular file.  m_stat isn't valid, since we can't watch the target.
+		DIRECTORY_SYMLINK,	///< A symlink to a directory.  Never cached, always traversed the normal way.
+		BROKEN_SYMLINK		///< A symlink to nothing.
+	};
+
+	std::string m_name;
+
+	Type m_type;
+
+	struct stat m_stat;
+};
+
+/**
+ * A cached directory listing.
+ */
+struct CachedDirectory
+{
+	/// The absolute, symlink-free path of this directory.
+	std::string m_path;
+
+	struct stat m_stat;
+
+	std::vector<CachedDirectoryEntry> m_entries;
+};
+
+/**
+ * The cache itself.
+ */
+class DirectoryCache
+{
+public:
+	/**
+	 * @param root             The directory to cache the tree under.
+	 * @param dir_inc_manager  Directories this excludes aren't cached.
+	 */
+	DirectoryCache(const std::string &root, const DirInclusionManager &dir_inc_manager);
+	~DirectoryCache();
+
+	/// Returns false if the cache isn't supported on this platform, or couldn't be set up.
+	bool IsEnabled() const noexcept { return m_inotify_fd != -1; };
+
+	/// The file descriptor to poll() for changes.  When it's readable, call ProcessEvents().
+	int GetNotificationFD() const noexcept { return m_inotify_fd; };
+
+	/**
+	 * Read all pending change notifications, and invalidate the affected directories.  Doesn't block.
+	 */
+	void ProcessEvents();
+
+	/**
+	 * Process any pending change notifications, then re-read every invalidated directory, so that the cache is
+	 * an up-to-date snapshot.  The first call reads in the whole tree.
+	 */
+	void Refresh();
+
+	/**
+	 * Look up a directory by its absolute, symlink-free path.
+	 *
+	 * @return  The cached listing, or nullptr if @a path isn't cached.
+	 */
+	const CachedDirectory* Find(const std::string &path) const;
+
+	/// @name Cache statistics, for logging.
+	///@{
+	size_t GetNumDirectories() const noexcept { return m_directories.size(); };
+	size_t GetNumDirectoriesRead() const noexcept { return m_num_directories_read; };
+	///@}
+
+private:
+
+	/// Read @a path and every uncached directory under it into the cache.
+	void ReadTree(const std::string &path);
+
+	/// Read a single directory into the cache, appending any subdirectories which also need to be read to @a subdirs.
+	void ReadDirectory(const std::string &path, std::vector<std::string> *subdirs);
+
+	/// Drop @a path and everything under it from the cache.
+	void InvalidateSubtree(const std::string &path);
+
+	/// Drop everything from the cache.
+	void InvalidateAll();
+
+	std::string m_root;
+
+	const DirInclusionManager &m_dir_inc_manager;
+
+	int m_inotify_fd { -1 };
+
+	/// The cached directories, keyed by path.  Being ordered lets us find all of a directory's descendants as a
+	/// contiguous range.
+	std::map<std::string, CachedDirectory> m_directories;
+
+	/// inotify watch descriptor to watched path.
+	std::map<int, std::string> m_watches;
+
+	/// Directories whose listings need to be re-read by the next Refresh().
+	std::set<std::string> m_stale_directories;
+
+	/// true if the whole tree needs to be re-read, e.g. after the first call or an inotify queue overflow.
+	bool m_root_is_stale { true };
+
+	size_t m_num_directories_read { 0 };
+};
+
+#endif /* SRC_DIRECTORYCACHE_H_ */
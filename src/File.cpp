@@ -23,17 +23,58 @@
 
 #include <iostream>
 #include <system_error>
+#include <algorithm>
+#include <cerrno>
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "Logger.h"
 
-File::File(FileID file_id, std::shared_ptr<ResizableArray<char>> storage) : m_storage(storage)
+/// Size of each of the standard input StreamReader's buffers.
+static constexpr size_t f_stdin_buffer_size = 1024*1024;
+
+/// O_DIRECT transfers have to be a multiple of the device's logical block size.  This is the largest we'll see in practice.
+static constexpr size_t f_direct_io_block_size = 4096;
+
+/// With --no-cache-pollution, how much of a plain stream we read before dropping it from the page cache.
+static constexpr off_t f_stream_drop_interval = 8*1024*1024;
+
+/**
+ * @return true if the start of the file is already in the page cache.  false if it isn't, or if we can't tell.
+ */
+static bool IsInPageCache(int file_descriptor) noexcept
+{
+#if defined(HAVE_PREADV2) && defined(RWF_NOWAIT)
+	// A read which isn't allowed to wait for I/O only succeeds if the data is already cached.
+	char c;
+	struct iovec iov { &c, 1 };
+	return preadv2(file_descriptor, &iov, 1, 0, RWF_NOWAIT) > 0;
+#else
+	(void)file_descriptor;
+	return false;
+#endif
+}
+
+File::File(FileID file_id, std::shared_ptr<ResizableArray<char>> storage, bool decompress, size_t stream_min_size,
+		FileCachePolicy cache_policy) : m_storage(storage)
 {
 	m_filename = file_id.GetPath();
+
+	if(file_id.IsStdin())
+	{
+		// We don't know how big it is and can't seek in it, so it's always a stream, read through a StreamReader so
+		// that whatever's writing to it doesn't have to wait on us.  We don't own the descriptor, so don't keep it to close.
+		/// @todo Support -z on the standard input.  We'd need to sniff the magic bytes without losing them.
+		(void)decompress;
+		m_stream_reader.reset(new StreamReader(STDIN_FILENO, f_stdin_buffer_size));
+		m_is_stream = true;
+		return;
+	}
+
 	m_file_descriptor = open(m_filename.c_str(), O_RDONLY);
 	if(m_file_descriptor == -1)
 	{
@@ -58,6 +99,68 @@ File::File(FileID file_id, std::shared_ptr<ResizableArray<char>> storage) : m_st
 		return;
 	}
 
+#if defined(HAVE_POSIX_FADVISE)
+	if(cache_policy == FileCachePolicy::DIRECT)
+	{
+		// Decided below, once we know whether it's a stream.
+		m_direct = true;
+	}
+	else if(cache_policy == FileCachePolicy::DROP)
+	{
+		// If someone else already has this file in the cache, it's part of their working set, and not ours to drop.
+		m_drop_cache = !IsInPageCache(m_file_descriptor);
+		if(!m_drop_cache)
+		{
+			LOG(INFO) << "Leaving '" << m_filename << "' in the page cache, it was there already.";
+		}
+	}
+#else
+	(void)cache_policy;
+#endif
+
+	if(decompress)
+	{
+		// Check the magic bytes to see if it's a compressed file.
+		unsigned char magic[COMPRESSION_MAGIC_MAX_LEN];
+		ssize_t magic_len = pread(m_file_descriptor, magic, sizeof(magic), 0);
+		CompressionFormat format = DetectCompressionFormat(magic, magic_len > 0 ? magic_len : 0);
+		if(format != CompressionFormat::NONE)
+		{
+			// It is.  Leave the file open, and we'll decompress it a chunk at a time as it's Read().
+			try
+			{
+				m_decompressor = Decompressor::Create(format, m_file_descriptor);
+			}
+			catch(const DecompressorException &e)
+			{
+				close(m_file_descriptor);
+				m_file_descriptor = -1;
+				throw FileException("\"" + m_filename + "\": " + e.what());
+			}
+			m_is_stream = true;
+		}
+	}
+
+	if(!m_is_stream && stream_min_size != 0 && m_file_size >= stream_min_size)
+	{
+		// Too big to read in all at once, we'll read it a chunk at a time as it's Read().
+		m_is_stream = true;
+	}
+
+	if(m_is_stream)
+	{
+		if(m_direct)
+		{
+			// Stream reads aren't block-aligned, so no O_DIRECT.  Drop the pages instead.
+			m_direct = false;
+			m_drop_cache = true;
+		}
+#ifdef HAVE_POSIX_FADVISE
+		(void)posix_fadvise(m_file_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		return;
+	}
+
 	// Read or mmap the file into memory.
 	// Note that this closes the file descriptor.
 	// Note: per info here:
@@ -140,6 +243,68 @@ File::~File()
 {
 	// Clean up.
 	FreeFileData(m_file_data, m_file_size);
+	if(m_file_descriptor != -1)
+	{
+		// All of it, since e.g. a Decompressor reads the file itself.
+		DropFromCache(m_file_descriptor, 0);
+		close(m_file_descriptor);
+	}
+}
+
+size_t File::Read(char *buffer, size_t len)
+{
+	if(m_stream_reader)
+	{
+		try
+		{
+			return m_stream_reader->Read(buffer, len);
+		}
+		catch(const StreamReaderException &e)
+		{
+			throw FileException("\"" + m_filename + "\": " + e.what());
+		}
+	}
+	else if(m_decompressor)
+	{
+		try
+		{
+			return m_decompressor->Read(buffer, len);
+		}
+		catch(const DecompressorException &e)
+		{
+			throw FileException("\"" + m_filename + "\": " + e.what());
+		}
+	}
+
+	// A plain file, read it directly.
+	size_t total_read = 0;
+	while(total_read < len)
+	{
+		ssize_t num_read = read(m_file_descriptor, buffer + total_read, len - total_read);
+		if(num_read == 0)
+		{
+			// EOF.
+			break;
+		}
+		else if(num_read < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			throw FileException("\"" + m_filename + "\": " + std::generic_category().message(errno));
+		}
+		total_read += num_read;
+	}
+
+	m_stream_pos += total_read;
+	if(m_drop_cache && m_stream_pos - m_dropped_up_to >= f_stream_drop_interval)
+	{
+		// Don't let a huge file fill up the cache before we get to the end of it.
+		DropFromCache(m_file_descriptor, m_stream_pos);
+	}
+
+	return total_read;
 }
 
 const char* File::GetFileData(int file_descriptor, size_t file_size, size_t preferred_block_size)
@@ -160,6 +325,26 @@ const char* File::GetFileData(int file_descriptor, size_t file_size, size_t pref
 		// Hint that we'll be sequentially reading the mmapped file soon.
 		posix_madvise(const_cast<char*>(file_data), file_size, POSIX_MADV_SEQUENTIAL | POSIX_MADV_WILLNEED);
 	}
+	else if(m_direct)
+	{
+		// Read around the page cache.  The buffer is aligned to at least preferred_block_size, and reserve_no_copy()
+		// rounds its size up to a multiple of that.
+		m_storage->reserve_no_copy(file_size, std::max(preferred_block_size, f_direct_io_block_size));
+		file_data = m_storage->data();
+
+		if(ReadDirect(file_descriptor, const_cast<char*>(file_data)))
+		{
+			LOG(INFO) << "Read " << file_size << " bytes of '" << m_filename << "' with O_DIRECT.";
+		}
+		else
+		{
+			// Couldn't, e.g. tmpfs doesn't do O_DIRECT.  Read it normally and drop it afterwards.
+			LOG(INFO) << "O_DIRECT read of '" << m_filename << "' failed, falling back to a buffered read.";
+			m_direct = false;
+			m_drop_cache = true;
+			ReadAll(file_descriptor, const_cast<char*>(file_data), file_size);
+		}
+	}
 	else
 	{
 		// Not using mmap().
@@ -177,16 +362,104 @@ const char* File::GetFileData(int file_descriptor, size_t file_size, size_t pref
 		file_data = m_storage->data();
 
 		// Read in the whole file.
-		/// @todo Handle read() errors better.
-		while(read(file_descriptor, const_cast<char*>(file_data), file_size) > 0);
+		ReadAll(file_descriptor, const_cast<char*>(file_data), file_size);
 	}
 
 	// We don't need the file descriptor anymore.
+	DropFromCache(file_descriptor, 0);
 	close(file_descriptor);
 
 	return file_data;
 }
 
+bool File::ReadDirect(int file_descriptor, char *buffer) noexcept
+{
+#if defined(O_DIRECT)
+	int flags = fcntl(file_descriptor, F_GETFL);
+	if(flags == -1 || fcntl(file_descriptor, F_SETFL, flags | O_DIRECT) == -1)
+	{
+		return false;
+	}
+
+	const size_t aligned_size = (m_file_size + f_direct_io_block_size - 1) & ~(f_direct_io_block_size - 1);
+	size_t total_read = 0;
+	while(total_read < m_file_size)
+	{
+		ssize_t num_read = pread(file_descriptor, buffer + total_read, aligned_size - total_read, total_read);
+		if(num_read < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(num_read < 0)
+		{
+			// Some filesystems accept the flag, then fail the read.  Whatever the reason, let the caller start over
+			// with a buffered read, which will report the error if it wasn't O_DIRECT's fault.
+			(void)fcntl(file_descriptor, F_SETFL, flags);
+			return false;
+		}
+		if(num_read == 0)
+		{
+			// The file got shorter since we stat()ed it.
+			break;
+		}
+		total_read += num_read;
+		if(total_read % f_direct_io_block_size != 0)
+		{
+			// A short read which isn't block-aligned is the end of the file.
+			break;
+		}
+	}
+
+	return true;
+#else
+	(void)file_descriptor;
+	(void)buffer;
+	return false;
+#endif
+}
+
+void File::ReadAll(int file_descriptor, char *buffer, size_t file_size)
+{
+	size_t total_read = 0;
+	while(total_read < file_size)
+	{
+		ssize_t num_read = pread(file_descriptor, buffer + total_read, file_size - total_read, total_read);
+		if(num_read < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			int read_errno = errno;
+			close(file_descriptor);
+			throw FileException("\"" + m_filename + "\": " + std::generic_category().message(read_errno));
+		}
+		if(num_read == 0)
+		{
+			// The file got shorter since we stat()ed it.
+			break;
+		}
+		total_read += num_read;
+	}
+}
+
+void File::DropFromCache(int file_descriptor, off_t end) noexcept
+{
+#if defined(HAVE_POSIX_FADVISE)
+	if(m_drop_cache)
+	{
+		LOG(INFO) << "Dropping '" << m_filename << "' from the page cache, from offset " << m_dropped_up_to
+				<< (end == 0 ? std::string(" to the end.") : " to " + std::to_string(end) + ".");
+		// An end of 0 means to the end of the file.
+		(void)posix_fadvise(file_descriptor, m_dropped_up_to, end == 0 ? 0 : end - m_dropped_up_to, POSIX_FADV_DONTNEED);
+		m_dropped_up_to = end;
+	}
+#else
+	(void)file_descriptor;
+	(void)end;
+#endif
+}
+
 void File::FreeFileData(const char* file_data, size_t file_size) noexcept
 {
 	if(m_use_mmap)
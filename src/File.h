@@ -28,6 +28,8 @@
 
 #include "ResizableArray.h"
 #include "FileID.h"
+#include "Decompressor.h"
+#include "StreamReader.h"
 
 /**
  * File() may throw this if it runs into trouble opening the given filename.
@@ -38,14 +40,39 @@ struct FileException : public std::runtime_error
 };
 
 
+/// What File does about the page cache, for --no-cache-pollution.
+enum class FileCachePolicy
+{
+	/// Leave it to the OS.
+	NORMAL,
+	/// Once we've read a file, drop it from the page cache, unless it was already cached before we read it.
+	DROP,
+	/// Read whole files with O_DIRECT, bypassing the page cache.  Streams, and files on filesystems which don't
+	/// support O_DIRECT, get DROP.
+	DIRECT
+};
+
 /**
  * A class to represent the contents and some metadata of a read-only file.
  * Abstracts away the method of access to the data, i.e. mmap() vs. read().
+ *
+ * A File is either read into memory in its entirety, in which case data() and size() give the contents, or is a stream
+ * which has to be read a chunk at a time with Read().  Compressed files being decompressed, files too large to
+ * reasonably read in at once, and the standard input are streams.
  */
 class File
 {
 public:
-	File(FileID file_id, std::shared_ptr<ResizableArray<char>> storage = std::make_shared<ResizableArray<char>>());
+	/**
+	 * @param file_id     The file to open.
+	 * @param storage     Where to put the file's contents if it's read in.
+	 * @param decompress  If true and the file is compressed in a format we know (see DetectCompressionFormat()),
+	 *                    open it as a stream which Read() will return the decompressed contents of.
+	 * @param stream_min_size  Open files of at least this size as streams instead of reading them in.  0 means never.
+	 * @param cache_policy     What to do about the page cache.
+	 */
+	File(FileID file_id, std::shared_ptr<ResizableArray<char>> storage = std::make_shared<ResizableArray<char>>(), bool decompress = false,
+			size_t stream_min_size = 0, FileCachePolicy cache_policy = FileCachePolicy::NORMAL);
 	File(const std::string &filename, std::shared_ptr<ResizableArray<char>> storage = std::make_shared<ResizableArray<char>>());
 	~File();
 
@@ -53,6 +80,16 @@ public:
 
 	const char * data() const noexcept { return m_file_data; };
 
+	/// true if this File has to be read with Read() instead of through data() and size().
+	bool is_stream() const noexcept { return m_is_stream; };
+
+	/**
+	 * Read up to @a len bytes of the stream's contents into @a buffer.  Only valid if is_stream().
+	 *
+	 * @return  The number of bytes read, or 0 at the end of the file.
+	 */
+	size_t Read(char *buffer, size_t len);
+
 	/**
 	 * Returns the name of this File as passed to the constructor.
 	 * @return  The name of this File as passed to the constructor.
@@ -81,6 +118,26 @@ private:
 	 */
 	void FreeFileData(const char * file_data, size_t file_size) noexcept;
 
+	/**
+	 * Read the whole file into @a buffer with O_DIRECT.  @a buffer must be aligned for O_DIRECT, and have room for
+	 * m_file_size rounded up to a multiple of the block size.
+	 *
+	 * @return false if O_DIRECT isn't supported here or any read fails, in which case @a file_descriptor is back to
+	 *         normal reads and the caller should read the whole file again.
+	 */
+	bool ReadDirect(int file_descriptor, char *buffer) noexcept;
+
+	/**
+	 * Read @a file_size bytes of the file into @a buffer with ordinary reads, stopping early only if the file has shrunk.
+	 *
+	 * @note Closes @a file_descriptor before throwing.
+	 * @throws FileException if a read fails.
+	 */
+	void ReadAll(int file_descriptor, char *buffer, size_t file_size);
+
+	/// Drop what we've read of the file so far from the page cache, if we're supposed to.
+	void DropFromCache(int file_descriptor, off_t end) noexcept;
+
 	std::string m_filename;
 
 	int m_file_descriptor { -1 };
@@ -94,6 +151,25 @@ private:
 
 	bool m_use_mmap { false };
 
+	/// true if this File is read with Read().
+	bool m_is_stream { false };
+
+	/// true if we should drop the file's pages from the page cache once we've read them.
+	bool m_drop_cache { false };
+
+	/// true if we should try to read the file with O_DIRECT.
+	bool m_direct { false };
+
+	/// For plain streams, how far we've read, and how much of that we've dropped from the page cache.
+	off_t m_stream_pos { 0 };
+	off_t m_dropped_up_to { 0 };
+
+	/// If the file is compressed and we're decompressing it, the Decompressor reading from m_file_descriptor.
+	/// If it's a stream but this is null, Read() reads straight from m_file_descriptor.
+	std::unique_ptr<Decompressor> m_decompressor;
+
+	/// If this is the standard input, the StreamReader reading it.
+	std::unique_ptr<StreamReader> m_stream_reader;
 };
 
 #endif /* FILE_H_ */
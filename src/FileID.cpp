@@ -23,18 +23,45 @@
 
 #include <sys/stat.h>
 #include <fts.h>
+#include <unistd.h>
+
+#include <utility>
 
 FileID::FileID(const FTSENT *ftsent): m_path(ftsent->fts_path, ftsent->fts_pathlen)
 {
 	// Initialize the stat fields if possible.
 	if(ftsent->fts_statp != nullptr)
 	{
-		m_stat_info_valid = true;
-		m_unique_file_identifier = dev_ino_pair(ftsent->fts_statp->st_dev, ftsent->fts_statp->st_ino);
-		m_size = ftsent->fts_statp->st_size;
-		m_block_size = ftsent->fts_statp->st_blksize;
-		m_blocks = ftsent->fts_statp->st_blocks;
+		SetStatInfo(ftsent->fts_statp);
+	}
+}
+
+FileID::FileID(std::string path, const struct stat *stat_buf): m_path(std::move(path))
+{
+	if(stat_buf != nullptr)
+	{
+		SetStatInfo(stat_buf);
+	}
+}
+
+FileID FileID::Stdin()
+{
+	// Name it the same way grep does.
+	FileID retval("(standard input)", nullptr);
+	retval.m_is_stdin = true;
+
+	struct stat stat_buf;
+	if(fstat(STDIN_FILENO, &stat_buf) == 0)
+	{
+		retval.SetStatInfo(&stat_buf);
+	}
+	else
+	{
+		// Never try to stat() the display name.
+		retval.m_stat_info_valid = true;
 	}
+
+	return retval;
 }
 
 FileID::~FileID()
@@ -59,10 +86,23 @@ void FileID::LazyLoadStatInfo() const
 	}
 	else
 	{
-		m_stat_info_valid = true;
-		m_unique_file_identifier = dev_ino_pair(stat_buf.st_dev, stat_buf.st_ino);
-		m_size = stat_buf.st_size;
-		m_block_size = stat_buf.st_blksize;
-		m_blocks = stat_buf.st_blocks;
+		SetStatInfo(&stat_buf);
 	}
 }
+
+void FileID::SetStatInfo(const struct stat *stat_buf) const noexcept
+{
+	m_stat_info_valid = true;
+	m_unique_file_identifier = dev_ino_pair(stat_buf->st_dev, stat_buf->st_ino);
+	m_size = stat_buf->st_size;
+	m_block_size = stat_buf->st_blksize;
+	m_blocks = stat_buf->st_blocks;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+	m_mtime = stat_buf->st_mtim;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+	m_mtime = stat_buf->st_mtimespec;
+#else
+	m_mtime.tv_sec = stat_buf->st_mtime;
+	m_mtime.tv_nsec = 0;
+#endif
+}
@@ -39,6 +39,13 @@ class FileID
 public:
 	FileID() = default;
 	FileID(const FTSENT *ftsent);
+	/// For files we already have the stat info for, e.g. from the --server's directory cache.  @a stat_buf can be
+	/// nullptr, in which case it will be loaded lazily.
+	FileID(std::string path, const struct stat *stat_buf);
+
+	/// Factory for the FileID of the process's standard input, which is searched when "-" is given as a FILE.
+	static FileID Stdin();
+
 	FileID(const FileID&) = default;
 	FileID& operator=(const FileID&) = default;
 	FileID(FileID&&) = default;
@@ -46,6 +53,9 @@ public:
 
 	std::string GetPath() const { return m_path; };
 
+	/// true if this is the standard input rather than a file with a path.  GetPath() is only a display name then.
+	bool IsStdin() const noexcept { return m_is_stdin; };
+
 	bool IsStatInfoValid() const noexcept { return m_stat_info_valid; };
 
 	off_t GetFileSize() const noexcept { LazyLoadStatInfo(); return m_size; };
@@ -56,13 +66,22 @@ public:
 		return m_block_size;
 	};
 
+	dev_ino_pair GetUniqueFileIdentifier() const noexcept { LazyLoadStatInfo(); return m_unique_file_identifier; };
+
+	/// The last modification time of the file.  tv_nsec will be 0 on platforms whose struct stat doesn't have sub-second timestamps.
+	const struct timespec& GetModificationTime() const noexcept { LazyLoadStatInfo(); return m_mtime; };
+
 private:
 
 	void LazyLoadStatInfo() const;
 
+	void SetStatInfo(const struct stat *stat_buf) const noexcept;
+
 	/// The path to this file.
 	std::string m_path;
 
+	bool m_is_stdin { false };
+
 	/// @name Info normally gathered from a stat() call.
 	///@{
 
@@ -81,6 +100,9 @@ private:
 	/// Number of blocks allocated for this file.
 	/// @note POSIX doesn't define the units for this.  Linux is documented to use 512-byte units, as is GNU libc.
 	mutable blkcnt_t m_blocks { 0 };
+
+	/// Last modification time.
+	mutable struct timespec m_mtime { 0, 0 };
 	///@}
 
 };
@@ -30,6 +30,11 @@
 #include "File.h"
 #include "Match.h"
 #include "MatchList.h"
+#include "Trace.h"
+#include "ThreadPlacement.h"
+#include "AdaptiveJobController.h"
+#include "FileScheduler.h"
+#include "Prefetcher.h"
 
 #include <iostream>
 #include <string>
@@ -40,14 +45,19 @@
 #include <cstring> // For memchr().
 #include <cstddef> // For ptrdiff_t
 #include <cctype>
-#ifndef HAVE_SCHED_SETAFFINITY
-#else
-	#include <sched.h>
-#endif
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <vector>
 
 #include "ResizableArray.h"
 
-static std::mutex f_assign_affinity_mutex;
+/// The size of the chunks ScanStream() reads and scans streamed files in.
+static constexpr size_t f_stream_chunk_size = 1024*1024;
+
+/// Regular files at least this big are streamed through ScanStream() instead of being read into memory all at once,
+/// so that a scanner thread's memory use doesn't grow with the size of the largest file it scans.
+static constexpr size_t f_stream_min_file_size = 16*f_stream_chunk_size;
 
 /// Resolver function for determining the best version of CountLinesSinceLastMatch to call.
 /// Does its work at static init time, so incurs no call-time overhead.
@@ -65,6 +75,10 @@ std::unique_ptr<FileScanner> FileScanner::Create(sync_queue<FileID> &in_queue,
 			bool ignore_case,
 			bool word_regexp,
 			bool pattern_is_literal,
+			int lines_before,
+			int lines_after,
+			bool search_compressed,
+			PipelineStats &pipeline_stats,
 			RegexEngine engine)
 {
 	std::unique_ptr<FileScanner> retval;
@@ -72,13 +86,13 @@ std::unique_ptr<FileScanner> FileScanner::Create(sync_queue<FileID> &in_queue,
 	switch(engine)
 	{
 	case RegexEngine::CXX11:
-		retval.reset(new FileScannerCpp11(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal));
+		retval.reset(new FileScannerCpp11(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats));
 		break;
 	case RegexEngine::PCRE:
-		retval.reset(new FileScannerPCRE(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal));
+		retval.reset(new FileScannerPCRE(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats));
 		break;
 	case RegexEngine::PCRE2:
-		retval.reset(new FileScannerPCRE2(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal));
+		retval.reset(new FileScannerPCRE2(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats));
 		break;
 	default:
 		// Should never get here.  Throw.
@@ -94,9 +108,14 @@ FileScanner::FileScanner(sync_queue<FileID> &in_queue,
 		std::string regex,
 		bool ignore_case,
 		bool word_regexp,
-		bool pattern_is_literal) : m_ignore_case(ignore_case), m_word_regexp(word_regexp), m_pattern_is_literal(pattern_is_literal),
+		bool pattern_is_literal,
+		int lines_before,
+		int lines_after,
+		bool search_compressed,
+		PipelineStats &pipeline_stats) : m_ignore_case(ignore_case), m_word_regexp(word_regexp), m_pattern_is_literal(pattern_is_literal),
+				m_lines_before(lines_before), m_lines_after(lines_after),
 				m_in_queue(in_queue), m_output_queue(output_queue), m_regex(regex),
-				m_next_core(0), m_use_mmap(false), m_manually_assign_cores(false)
+				m_use_mmap(false), m_search_compressed(search_compressed), m_pipeline_stats(pipeline_stats)
 {
 }
 
@@ -109,99 +128,162 @@ void FileScanner::Run(int thread_index)
 	// Set the name of the thread.
 	set_thread_name("FILESCAN_" + std::to_string(thread_index));
 
-	if(m_manually_assign_cores)
-	{
-		// Spread the scanner threads across cores.  Linux at least doesn't seem to want to do that by default.
-		AssignToNextCore();
-	}
+	// Pin ourself to a NUMA node if --thread-placement says to.  Do this before we allocate anything, so that
+	// our buffers end up on the same node.
+	ThreadPlacement::PlaceThisThread(ThreadRole::SCANNER);
 
-	// Create a reusable, resizable buffer for the File() reads.
-	auto file_data_storage = std::make_shared<ResizableArray<char>>();
+	// Create a reusable, resizable buffer for the File() reads, and our per-thread --stats counters.
+	ScannerThreadState state;
+	ThreadStats &thread_stats = state.m_thread_stats;
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
 
-	using namespace std::chrono;
-	steady_clock::duration accum_elapsed_time {0};
-	long long total_bytes_read {0};
+	// --adaptive-jobs and --prefetch need the read and scan times even without --stats.
+	const bool collect_times = collect_stats || (m_job_controller != nullptr) || (m_prefetcher != nullptr);
+	ThreadStats::duration reported_read_time { 0 };
+	ThreadStats::duration reported_scan_time { 0 };
 
 	// Pull new filenames off the input queue until it's closed.
 	FileID next_file;
-	while(m_in_queue.wait_pull(std::move(next_file)) != queue_op_status::closed)
+	while(true)
 	{
-		try
+		if(m_job_controller != nullptr)
 		{
-			// Try to open and read the file.  This could throw.
-			LOG(INFO) << "Attempting to scan file \'" << next_file.GetPath() << "\'";
-			//steady_clock::time_point start = steady_clock::now();
-			File f(next_file, file_data_storage);
-			//steady_clock::time_point end = steady_clock::now();
-			//accum_elapsed_time += (end - start);
-			total_bytes_read += f.size();
+			// Tell the controller how the last file went, then wait here if it's parked us.
+			m_job_controller->ReportTimes(thread_stats.m_read_time - reported_read_time, thread_stats.m_scan_time - reported_scan_time);
+			reported_read_time = thread_stats.m_read_time;
+			reported_scan_time = thread_stats.m_scan_time;
+			m_job_controller->WaitUntilActive(thread_index);
+		}
 
+		queue_op_status status = (m_scheduler != nullptr)
+				? timed_wait_pull(*m_scheduler, std::move(next_file), collect_stats, thread_stats.m_queue_pull_wait_time)
+				: timed_wait_pull(m_in_queue, std::move(next_file), collect_stats, thread_stats.m_queue_pull_wait_time);
+		if(status == queue_op_status::closed)
+		{
+			if(m_job_controller != nullptr)
+			{
+				// There's nothing left for the parked scanners either, let them go.
+				m_job_controller->InputDrained();
+			}
+			break;
+		}
 
-			MatchList ml(next_file.GetPath());
+		if(m_prefetcher != nullptr && !next_file.IsStdin())
+		{
+			// Let the prefetcher know it doesn't need to bother with this one if it hasn't got to it yet.
+			m_prefetcher->FileTaken();
+		}
 
+		ScanOneFile(next_file, state, collect_stats, collect_times);
+	}
 
-			if(f.size() == 0)
-			{
-				LOG(INFO) << "WARNING: Filesize of \'" << next_file.GetPath() << "\' is 0, skipping.";
-				continue;
-			}
+	thread_stats.m_thread_name = get_thread_name();
+	m_pipeline_stats.AddThreadStats(PipelineStage::SCANNER, thread_stats);
+}
 
-			const char *file_data = f.data();
-			size_t file_size = f.size();
+void FileScanner::PrepareForTaskPool(int num_workers)
+{
+	m_task_pool_states.clear();
+	for(int i = 0; i < num_workers; ++i)
+	{
+		m_task_pool_states.emplace_back(new ScannerThreadState);
+	}
+}
 
-			// Scan the file data for occurrences of the regex, sending matches to the MatchList ml.
-			ScanFile(file_data, file_size, ml);
+bool FileScanner::ScanOnWorker(int worker_index, FileID &file)
+{
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
+	return ScanOneFile(file, *m_task_pool_states[worker_index], collect_stats, collect_stats);
+}
 
-			if(!ml.empty())
-			{
-				// Force move semantics here.
-				m_output_queue.wait_push(std::move(ml));
-			}
-		}
-		catch(const FileException &error)
+void FileScanner::FinishTaskPool()
+{
+	for(size_t i = 0; i < m_task_pool_states.size(); ++i)
+	{
+		m_task_pool_states[i]->m_thread_stats.m_thread_name = "POOL_" + std::to_string(i);
+		m_pipeline_stats.AddThreadStats(PipelineStage::SCANNER, m_task_pool_states[i]->m_thread_stats);
+	}
+	m_task_pool_states.clear();
+}
+
+bool FileScanner::ScanOneFile(FileID &next_file, ScannerThreadState &state, bool collect_stats, bool collect_times)
+{
+	ThreadStats &thread_stats = state.m_thread_stats;
+
+	try
+	{
+		// Try to open and read the file.  This could throw.
+		LOG(INFO) << "Attempting to scan file \'" << next_file.GetPath() << "\'";
+		ScopedTrace read_trace("File::File");
+		const ThreadStats::duration prev_read_time = thread_stats.m_read_time;
+		ScopedStatsTimer read_timer(collect_times, thread_stats.m_read_time);
+		File f(next_file, state.m_file_data_storage, m_search_compressed, f_stream_min_file_size, m_cache_policy);
+		read_timer.Stop();
+		read_trace.End();
+		thread_stats.m_num_files++;
+
+		if(m_prefetcher != nullptr && !f.is_stream())
 		{
-			// The File constructor threw an exception.
-			ERROR() << error.what();
+			// Let the prefetcher know whether it got this one in ahead of us.  Streams are read as they're scanned, so
+			// there's no one read time to report for them.
+			m_prefetcher->ReportRead(thread_stats.m_read_time - prev_read_time, f.size());
 		}
-		catch(const std::system_error& error)
+
+		MatchList ml(next_file.GetPath());
+
+		if(f.is_stream())
 		{
-			// A system error.  Currently should only be errors from File.
-			ERROR() << error.code() << " - " << error.code().message();
+			// Compressed or huge, read and scan it a chunk at a time.  The reading is part of the scan here.
+			ScopedTrace scan_trace("ScanStream");
+			ScopedStatsTimer scan_timer(collect_times, thread_stats.m_scan_time);
+			thread_stats.m_num_bytes_read += ScanStream(f, ml, thread_stats, collect_stats);
 		}
-		catch(...)
+		else
 		{
-			// Rethrow whatever it was.
-			throw;
-		}
-	}
-
-#if 0
-	duration<double> elapsed = duration_cast<duration<double>>(accum_elapsed_time);
-	LOG(INFO) << "Total bytes read = " << total_bytes_read << ", elapsed time = " << elapsed.count() << ", Bytes/Sec=" << total_bytes_read/elapsed.count() << std::endl;
-#endif
-}
-
-void FileScanner::AssignToNextCore()
-{
-#ifdef HAVE_SCHED_SETAFFINITY
+			thread_stats.m_num_bytes_read += f.size();
 
-	// Prevent the multiple threads from stepping on each other and screwing up m_next_core.
-	std::lock_guard<std::mutex> lg {f_assign_affinity_mutex};
+			if(f.size() == 0)
+			{
+				LOG(INFO) << "WARNING: Filesize of \'" << next_file.GetPath() << "\' is 0, skipping.";
+				return false;
+			}
 
-	cpu_set_t cpuset;
+			const char *file_data = f.data();
+			size_t file_size = f.size();
 
-	// Clear the cpu_set_t.
-	CPU_ZERO(&cpuset);
+			// Scan the file data for occurrences of the regex, sending matches to the MatchList ml.
+			ScopedTrace scan_trace("ScanFile");
+			ScopedStatsTimer scan_timer(collect_times, thread_stats.m_scan_time);
+			ScanState scan_state;
+			ScanFile(file_data, file_size, scan_state, ml, thread_stats);
+		}
 
-	// Set the bit of the next CPU.
-	CPU_SET(m_next_core, &cpuset);
+		if(!ml.empty())
+		{
+			thread_stats.m_num_matched_lines += ml.GetNumberOfMatchedLines();
 
-	sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+			// Force move semantics here.
+			timed_wait_push(m_output_queue, std::move(ml), collect_stats, thread_stats.m_queue_push_wait_time);
+			return true;
+		}
+	}
+	catch(const FileException &error)
+	{
+		// The File constructor or File::Read() threw an exception.
+		ERROR() << error.what();
+	}
+	catch(const std::system_error& error)
+	{
+		// A system error.  Currently should only be errors from File.
+		ERROR() << error.code() << " - " << error.code().message();
+	}
+	catch(...)
+	{
+		// Rethrow whatever it was.
+		throw;
+	}
 
-	// Increment so we use the next core the next time.
-	m_next_core++;
-	m_next_core %= std::thread::hardware_concurrency();
-#endif
+	return false;
 }
 
 //__attribute__((target("default")))
@@ -228,6 +310,183 @@ size_t FileScanner::CountLinesSinceLastMatch_default(const char * __restrict__ p
 	return num_lines_since_last_match;
 }
 
+/**
+ * Returns a pointer to the start of the line containing @a pos, i.e. one past the last '\n' before @a pos, or
+ * @a file_data if there isn't one.  If @a pos is already at the start of a line, returns @a pos itself.
+ * To step back to the previous line, pass a pointer to the '\n' terminating it (i.e. line_start - 1).
+ */
+static inline const char * StartOfLineBefore(const char * __restrict__ file_data, const char * __restrict__ pos) noexcept
+{
+	std::reverse_iterator<const char*> rstart(pos);
+	std::reverse_iterator<const char*> rend(file_data);
+
+	auto line_start_rit = std::find(rstart, rend, '\n');
+
+	// If there's no preceding '\n', this is the first line.  Otherwise clip the '\n' off.
+	return (line_start_rit == rend) ? file_data : line_start_rit.base();
+}
+
+void FileScanner::AddMatchWithContext(const char * __restrict__ file_data, size_t file_size, size_t match_start_offset, size_t match_end_offset,
+		size_t line_number, ScanState &ss, MatchList &ml)
+{
+	ContextState &cs = ss.m_context;
+
+	if(m_lines_before == 0 && m_lines_after == 0)
+	{
+		// No context requested, just add the match.
+		Match match(file_data, file_size, match_start_offset, match_end_offset, line_number);
+		match.m_line_offset += ss.m_file_offset;
+		ml.AddMatch(std::move(match));
+		return;
+	}
+
+	const char * const file_end = file_data + file_size;
+
+	// First, add any trailing context lines the previous match is still owed, up to the line before this match.
+	AddTrailingContext(file_data, file_end, line_number, ss, ml);
+
+	// Determine the first line of leading context.  We don't go back past the first line of the file, or
+	// past the last line we've already added to the MatchList.
+	size_t first_lineno = (line_number > static_cast<size_t>(m_lines_before)) ? line_number - m_lines_before : 1;
+	first_lineno = std::max(first_lineno, cs.m_last_added_lineno + 1);
+
+	if(first_lineno < line_number)
+	{
+		// Walk back from the match to the start of line first_lineno.  The match's line number was already computed
+		// by the vectorized line counter, so we only need to look at the bytes of the context lines themselves.
+		// That counter only counts '\n's in a range, it can't locate them, so the walk is a plain byte search.
+		const char *line_start = StartOfLineBefore(file_data, file_data + match_start_offset);
+		for(size_t lineno = line_number; lineno > first_lineno; --lineno)
+		{
+			line_start = StartOfLineBefore(file_data, line_start - 1);
+		}
+
+		// Now walk forward, adding the leading context lines.
+		for(size_t lineno = first_lineno; lineno < line_number; ++lineno)
+		{
+			const char *line_end = static_cast<const char*>(std::memchr(line_start, '\n', file_end - line_start));
+			ml.AddMatch(Match(line_start, line_end, lineno, ss.m_file_offset + (line_start - file_data)));
+			line_start = line_end + 1;
+		}
+	}
+
+	// Add the match itself.
+	Match match(file_data, file_size, match_start_offset, match_end_offset, line_number);
+	match.m_line_offset += ss.m_file_offset;
+	ml.AddMatch(std::move(match));
+
+	// Remember where the line after the match starts, so we can pick up the trailing context from there.
+	const char *eol = static_cast<const char*>(std::memchr(file_data + match_start_offset, '\n', file_size - match_start_offset));
+	cs.m_next_line_start = (eol == nullptr) ? file_end : eol + 1;
+	cs.m_last_added_lineno = line_number;
+	cs.m_lines_after_remaining = m_lines_after;
+}
+
+void FileScanner::FinishContext(const char * __restrict__ file_data, size_t file_size, ScanState &ss, MatchList &ml)
+{
+	AddTrailingContext(file_data, file_data + file_size, std::numeric_limits<size_t>::max(), ss, ml);
+}
+
+void FileScanner::AddTrailingContext(const char * __restrict__ file_data, const char * __restrict__ file_end, size_t stop_lineno, ScanState &ss, MatchList &ml)
+{
+	ContextState &cs = ss.m_context;
+
+	while((cs.m_lines_after_remaining > 0) && (cs.m_last_added_lineno + 1 < stop_lineno) && (cs.m_next_line_start < file_end))
+	{
+		const char *line_end = static_cast<const char*>(std::memchr(cs.m_next_line_start, '\n', file_end - cs.m_next_line_start));
+		if(line_end == nullptr)
+		{
+			// Last line of the file, with no terminating '\n'.
+			line_end = file_end;
+		}
+
+		++cs.m_last_added_lineno;
+		ml.AddMatch(Match(cs.m_next_line_start, line_end, cs.m_last_added_lineno, ss.m_file_offset + (cs.m_next_line_start - file_data)));
+
+		cs.m_next_line_start = (line_end == file_end) ? file_end : line_end + 1;
+		--cs.m_lines_after_remaining;
+	}
+}
+
+size_t FileScanner::ScanStream(File &file, MatchList &ml, ThreadStats &thread_stats, bool collect_stats)
+{
+	// The window holds, in order:
+	// - [0, history_len): The last m_lines_before lines we've already scanned, kept for leading context.
+	// - [history_len, data_len): Data not yet scanned.  Everything after the last '\n' in here is carried over.
+	std::vector<char> window;
+	size_t history_len = 0;
+	size_t data_len = 0;
+	size_t total_bytes = 0;
+	bool at_eof = false;
+	ScanState ss;
+
+	while(!at_eof)
+	{
+		// Read the next chunk onto the end of the window.  The window only grows past this if a line is longer than a chunk.
+		if(window.size() < data_len + f_stream_chunk_size)
+		{
+			window.resize(data_len + f_stream_chunk_size);
+		}
+		size_t num_read = file.Read(window.data() + data_len, f_stream_chunk_size);
+		at_eof = (num_read == 0);
+		data_len += num_read;
+		total_bytes += num_read;
+
+		// Find the end of the last complete line.  At EOF, that's the end of whatever's left.
+		size_t scan_end = data_len;
+		if(!at_eof)
+		{
+			std::reverse_iterator<const char*> rstart(window.data() + data_len);
+			std::reverse_iterator<const char*> rend(window.data() + history_len);
+			auto last_eol = std::find(rstart, rend, '\n');
+			if(last_eol == rend)
+			{
+				// No complete line yet, read more.
+				continue;
+			}
+			scan_end = last_eol.base() - window.data();
+		}
+
+		if(scan_end > history_len)
+		{
+			ss.m_scan_start = history_len;
+			// Any trailing context still owed to the last chunk's last match starts at the beginning of this chunk.
+			ss.m_context.m_next_line_start = window.data() + history_len;
+			ScanFile(window.data(), scan_end, ss, ml, thread_stats);
+			ss.m_line_number += CountLinesSinceLastMatch(window.data() + history_len, window.data() + scan_end);
+		}
+
+		if(!at_eof && !ml.empty())
+		{
+			// Don't hold on to the matches until EOF, which for a pipe could be a long time coming, or never.  Send what
+			// we've got so far, and carry on in a continuation.  Any trailing context still owed goes in that.
+			const size_t last_line_number = ml.GetMatches().back().m_line_number;
+			ml.SetMoreToFollow();
+			thread_stats.m_num_matched_lines += ml.GetNumberOfMatchedLines();
+			timed_wait_push(m_output_queue, std::move(ml), collect_stats, thread_stats.m_queue_push_wait_time);
+			ml = MatchList(file.name(), last_line_number);
+			if(m_partial_results_hook)
+			{
+				m_partial_results_hook();
+			}
+		}
+
+		// Keep the last m_lines_before scanned lines, and move them and the carry-over to the front of the window.
+		const char *keep_start = window.data() + scan_end;
+		for(int i = 0; i < m_lines_before && keep_start > window.data(); ++i)
+		{
+			keep_start = StartOfLineBefore(window.data(), keep_start - 1);
+		}
+		size_t keep_offset = keep_start - window.data();
+		std::memmove(window.data(), keep_start, data_len - keep_offset);
+		ss.m_file_offset += keep_offset;
+		history_len = scan_end - keep_offset;
+		data_len -= keep_offset;
+	}
+
+	return total_bytes;
+}
+
 const char * FileScanner::LiteralPrescan(std::string regex, const char * __restrict__ start_of_array, const char * __restrict__ end_of_array) noexcept
 {
 	size_t prefix_literal_len { 0 };
@@ -22,13 +22,22 @@
 
 #include <config.h>
 
+#include <functional>
 #include <stdexcept>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "sync_queue_impl_selector.h"
 #include "FileID.h"
 #include "MatchList.h"
+#include "PipelineStats.h"
+#include "ResizableArray.h"
+#include "File.h"
+
+class AdaptiveJobController;
+class FileScheduler;
+class Prefetcher;
 
 
 extern "C" void* resolve_CountLinesSinceLastMatch(void);
@@ -78,6 +87,10 @@ public:
 	 * @param ignore_case
 	 * @param word_regexp
 	 * @param pattern_is_literal
+	 * @param lines_before  Number of lines of leading context to add to the MatchList before each matched line.
+	 * @param lines_after   Number of lines of trailing context to add to the MatchList after each matched line.
+	 * @param search_compressed  If true, decompress and search compressed files (-z).
+	 * @param pipeline_stats  Where the scanner threads will send their --stats info.
 	 * @param engine
 	 * @return
 	 */
@@ -87,6 +100,10 @@ public:
 			bool ignore_case,
 			bool word_regexp,
 			bool pattern_is_literal,
+			int lines_before,
+			int lines_after,
+			bool search_compressed,
+			PipelineStats &pipeline_stats,
 			RegexEngine engine = RegexEngine::DEFAULT);
 
 public:
@@ -95,13 +112,70 @@ public:
 			std::string regex,
 			bool ignore_case,
 			bool word_regexp,
-			bool pattern_is_literal);
+			bool pattern_is_literal,
+			int lines_before,
+			int lines_after,
+			bool search_compressed,
+			PipelineStats &pipeline_stats);
 	virtual ~FileScanner();
 
 	void Run(int thread_index);
 
+	/**
+	 * For --adaptive-jobs, have the scanner threads report to and be parked by @a job_controller.  Must be called before
+	 * any of the threads are started.
+	 */
+	void SetJobController(AdaptiveJobController *job_controller) noexcept { m_job_controller = job_controller; };
+
+	/**
+	 * For --schedule, have the scanner threads pull their files through @a scheduler instead of directly from the input
+	 * queue.  Must be called before any of the threads are started.
+	 */
+	void SetFileScheduler(FileScheduler *scheduler) noexcept { m_scheduler = scheduler; };
+
+	/**
+	 * For --prefetch, have the scanner threads report their read times to @a prefetcher.  Must be called before any of the
+	 * threads are started.
+	 */
+	void SetPrefetcher(Prefetcher *prefetcher) noexcept { m_prefetcher = prefetcher; };
+
+	/// For --no-cache-pollution, what the Files we read should do about the page cache.
+	void SetCachePolicy(FileCachePolicy cache_policy) noexcept { m_cache_policy = cache_policy; };
+
+	/// @name For running the scanning as tasks on a --task-pool, instead of on Run() threads.
+	///@{
+	/// Set up the per-worker state for a TaskPool with @a num_workers workers.
+	void PrepareForTaskPool(int num_workers);
+	/// Scan @a file on TaskPool worker @a worker_index.  @return true if a MatchList was sent to the output queue.
+	bool ScanOnWorker(int worker_index, FileID &file);
+	/// Hand the workers' --stats over to the PipelineStats.  Call once all the scanning tasks have finished.
+	void FinishTaskPool();
+	/// Call @a hook whenever part of a stream's matches is sent to the output queue before the stream has been scanned
+	/// to the end, so the output can be scheduled without waiting for the scanning task to finish.
+	void SetPartialResultsHook(std::function<void()> hook) { m_partial_results_hook = std::move(hook); };
+	///@}
+
 protected:
 
+	/// The state a scanner thread keeps from one file to the next.
+	struct ScannerThreadState
+	{
+		/// Reusable, resizable buffer for the File() reads.
+		std::shared_ptr<ResizableArray<char>> m_file_data_storage { std::make_shared<ResizableArray<char>>() };
+
+		/// Per-thread --stats counters.
+		ThreadStats m_thread_stats;
+	};
+
+	/**
+	 * Read and scan @a file, sending any matches to the output queue.  Errors reading the file are reported and
+	 * otherwise ignored.
+	 *
+	 * @return true if a MatchList was sent to the output queue after the file was scanned.  A stream's earlier
+	 *         MatchLists are announced through the SetPartialResultsHook() hook instead.
+	 */
+	bool ScanOneFile(FileID &file, ScannerThreadState &state, bool collect_stats, bool collect_times);
+
 	/// @name Member-Function Pseudo-Multiversioning
 	/// All this mechanism is to support something along the lines of gcc's function multiversioning,
 	/// which doesn't work prior to gcc 4.9, at all on Cygwin even when the compiler/binutils support it,
@@ -134,6 +208,66 @@ protected:
 
 	std::tuple<const char *, size_t> GetEOL(const char *search_start, const char * buff_one_past_end);
 
+	/**
+	 * Per-file bookkeeping for context line (-A/-B/-C) generation.  Carried from match to match by AddMatchWithContext(),
+	 * and from chunk to chunk when a file is scanned in pieces.
+	 */
+	struct ContextState
+	{
+		/// Line number of the last line added to the MatchList, or 0 if no lines have been added yet.
+		size_t m_last_added_lineno { 0 };
+
+		/// Pointer to the start of the line following the last line added to the MatchList.
+		const char * m_next_line_start { nullptr };
+
+		/// Number of trailing context lines still owed to the last matched line.
+		int m_lines_after_remaining { 0 };
+	};
+
+	/**
+	 * Where the data passed to a ScanFile() call sits in the file it came from.  A file read into memory in its entirety
+	 * is scanned with one default-constructed ScanState.  A file scanned a chunk at a time (see ScanStream()) is scanned
+	 * with one ScanState which is updated for each chunk.
+	 */
+	struct ScanState
+	{
+		/// Offset in the data at which to start looking for matches.  Always the start of a line.  Any lines before this
+		/// have already been scanned, and are only there for leading context.
+		size_t m_scan_start { 0 };
+
+		/// Line number of the line starting at m_scan_start.
+		size_t m_line_number { 1 };
+
+		/// Byte offset of the start of the data from the start of the file.
+		size_t m_file_offset { 0 };
+
+		ContextState m_context;
+	};
+
+	/**
+	 * Add the match [@a match_start_offset, @a match_end_offset) on line @a line_number to @a ml, along with any context lines.
+	 * Context lines are found by walking out from the match in the file data we already have in memory, so there's no
+	 * second pass over the file.  Context windows which overlap or abut each other are merged, so no line is added twice.
+	 *
+	 * @note Matches must be passed in increasing line number order, with at most one match per line.
+	 *
+	 * @param file_data
+	 * @param file_size
+	 * @param match_start_offset
+	 * @param match_end_offset
+	 * @param line_number  Line number of the match, as computed by the caller with CountLinesSinceLastMatch().
+	 * @param ss           The ScanState for this ScanFile() call.
+	 * @param ml
+	 */
+	void AddMatchWithContext(const char * __restrict__ file_data, size_t file_size, size_t match_start_offset, size_t match_end_offset,
+			size_t line_number, ScanState &ss, MatchList &ml);
+
+	/**
+	 * Add any trailing context lines still owed to the last match to @a ml.  ScanFile() implementations call this once,
+	 * after the last match has been added.
+	 */
+	void FinishContext(const char * __restrict__ file_data, size_t file_size, ScanState &ss, MatchList &ml);
+
 	static const char * LiteralPrescan(std::string regex, const char * __restrict__ start_of_array, const char * __restrict__ end_of_array) noexcept;
 
 	bool m_ignore_case;
@@ -142,25 +276,43 @@ protected:
 
 	bool m_pattern_is_literal;
 
+	/// Number of lines of leading context to add before each matched line.
+	int m_lines_before;
+
+	/// Number of lines of trailing context to add after each matched line.
+	int m_lines_after;
+
 private:
 
 	/**
-	 * Helper to assign each thread which starts Run() to a different core.
-	 * Note that this currently only works on Linux, and does not appear to make
-	 * a measurable difference in performance, likely because we're I/O bound regardless.
+	 * Add up to @a cs.m_lines_after_remaining trailing context lines to @a ml, stopping before line number @a stop_lineno
+	 * or at the end of the file data.
+	 */
+	void AddTrailingContext(const char * __restrict__ file_data, const char * __restrict__ file_end, size_t stop_lineno, ScanState &ss, MatchList &ml);
+
+	/**
+	 * Scan a File which is a stream (a compressed or very large file) a chunk at a time.  Each chunk is cut back to the last
+	 * complete line and passed to ScanFile(), with the partial line at the end carried over to the next chunk.  Since
+	 * a match can never span lines, this finds exactly the matches scanning the whole file at once would, while
+	 * only ever needing a chunk or so of memory.
 	 *
-	 * Maintaining this for experimental purposes.
+	 * The matches found in each chunk are sent on to the output queue right away, so that e.g. `tail -f log | ucg`
+	 * prints them as they turn up.  @a ml is left holding whatever's left to send at EOF.
+	 *
+	 * @return  The number of bytes of file data scanned.
 	 */
-	void AssignToNextCore();
+	size_t ScanStream(File &file, MatchList &ml, ThreadStats &thread_stats, bool collect_stats);
 
 	/**
-	 * Scan @a file_data for matches of the regex.  Add hits to @a ml.
+	 * Scan @a file_data, starting at @a ss.m_scan_start, for matches of the regex.  Add hits to @a ml.
 	 *
 	 * @param file_data
 	 * @param file_size
+	 * @param ss            Where @a file_data sits in the file, and the context state carried over from any previous chunk.
 	 * @param ml
+	 * @param thread_stats  The calling thread's --stats counters.
 	 */
-	virtual void ScanFile(const char * __restrict__ file_data, size_t file_size, MatchList &ml) = 0;
+	virtual void ScanFile(const char * __restrict__ file_data, size_t file_size, ScanState &ss, MatchList &ml, ThreadStats &thread_stats) = 0;
 
 	sync_queue<FileID>& m_in_queue;
 
@@ -168,18 +320,31 @@ private:
 
 	std::string m_regex;
 
-	int m_next_core;
-
 	bool m_use_mmap;
 
-	/**
-	 * Switch to make Run() assign its std::thread to different cores on the machine.
-	 * If false, the underlying std::thread logic is allowed to decide which threads run on
-	 * which cores.  See note above for AssignToNextCore(); turning this on makes no real difference.
-	 *
-	 * Maintaining this for experimental purposes.
-	 */
-	bool m_manually_assign_cores;
+	/// Whether to decompress and search compressed files.
+	bool m_search_compressed;
+
+	/// Where the per-thread --stats info goes.
+	PipelineStats &m_pipeline_stats;
+
+	/// The --adaptive-jobs controller, or nullptr if the number of running scanners is fixed.
+	AdaptiveJobController *m_job_controller { nullptr };
+
+	/// The --schedule reordering of the input queue, or nullptr to take the files as they come.
+	FileScheduler *m_scheduler { nullptr };
+
+	/// The --prefetch stage feeding our input queue, or nullptr if there isn't one.
+	Prefetcher *m_prefetcher { nullptr };
+
+	/// What the Files we read should do about the page cache.
+	FileCachePolicy m_cache_policy { FileCachePolicy::NORMAL };
+
+	/// The per-worker states when running on a --task-pool.
+	std::vector<std::unique_ptr<ScannerThreadState>> m_task_pool_states;
+
+	/// See SetPartialResultsHook().
+	std::function<void()> m_partial_results_hook;
 };
 
 #endif /* FILESCANNER_H_ */
@@ -26,7 +26,11 @@ FileScannerCpp11::FileScannerCpp11(sync_queue<FileID> &in_queue,
 		std::string regex,
 		bool ignore_case,
 		bool word_regexp,
-		bool pattern_is_literal) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal)
+		bool pattern_is_literal,
+		int lines_before,
+		int lines_after,
+		bool search_compressed,
+		PipelineStats &pipeline_stats) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats)
 {
 #ifdef USE_CXX11_REGEX
 	// Create the std::regex we're looking for, possibly ignoring case, possibly with match-whole-word.
@@ -47,7 +51,7 @@ FileScannerCpp11::~FileScannerCpp11()
 {
 }
 
-void FileScannerCpp11::ScanFile( const char * __restrict__ file_data [[gnu::unused]], size_t file_size [[gnu::unused]], MatchList &ml [[gnu::unused]])
+void FileScannerCpp11::ScanFile( const char * __restrict__ file_data [[gnu::unused]], size_t file_size [[gnu::unused]], ScanState &ss [[gnu::unused]], MatchList &ml [[gnu::unused]], ThreadStats &thread_stats [[gnu::unused]])
 {
 #ifdef USE_CXX11_REGEX
 	// Scan the mmapped file for the regex.
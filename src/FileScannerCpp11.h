@@ -37,7 +37,11 @@ public:
 			std::string regex,
 			bool ignore_case,
 			bool word_regexp,
-			bool pattern_is_literal);
+			bool pattern_is_literal,
+			int lines_before,
+			int lines_after,
+			bool search_compressed,
+			PipelineStats &pipeline_stats);
 	virtual ~FileScannerCpp11();
 
 private:
@@ -49,7 +53,7 @@ private:
 	 * @param file_size
 	 * @param ml
 	 */
-	void ScanFile(const char * __restrict__ file_data, size_t file_size, MatchList &ml) override final;
+	void ScanFile(const char * __restrict__ file_data, size_t file_size, ScanState &ss, MatchList &ml, ThreadStats &thread_stats) override final;
 };
 
 #endif /* FILESCANNERCPP11_H_ */
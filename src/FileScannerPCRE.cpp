@@ -73,7 +73,11 @@ FileScannerPCRE::FileScannerPCRE(sync_queue<FileID> &in_queue,
 		std::string regex,
 		bool ignore_case,
 		bool word_regexp,
-		bool pattern_is_literal) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal)
+		bool pattern_is_literal,
+		int lines_before,
+		int lines_after,
+		bool search_compressed,
+		PipelineStats &pipeline_stats) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats)
 {
 #ifdef HAVE_LIBPCRE
 	// Compile the regex.
@@ -135,14 +139,14 @@ FileScannerPCRE::~FileScannerPCRE()
 #endif
 }
 
-void FileScannerPCRE::ScanFile(const char* __restrict__ file_data, size_t file_size, MatchList& ml)
+void FileScannerPCRE::ScanFile(const char* __restrict__ file_data, size_t file_size, ScanState &ss, MatchList& ml, ThreadStats &thread_stats)
 {
 #ifdef HAVE_LIBPCRE
 	// Match output vector.  We won't support submatches, so we only need two entries, plus a third for pcre's own use.
-	int ovector[3] = {-1, 0, 0};
-	size_t line_no = 1;
+	int ovector[3] = {-1, static_cast<int>(ss.m_scan_start), 0};
+	size_t line_no = ss.m_line_number;
 	size_t prev_lineno = 0;
-	const char *prev_lineno_search_end = file_data;
+	const char *prev_lineno_search_end = file_data + ss.m_scan_start;
 	// Up-cast file_size, which is a size_t (unsigned) to a ptrdiff_t (signed) which should be able to handle the
 	// same positive range, and not cause issues when compared with the ints of ovector[].
 	std::ptrdiff_t signed_file_size = file_size;
@@ -168,6 +172,7 @@ void FileScannerPCRE::ScanFile(const char* __restrict__ file_data, size_t file_s
 		}
 
 		// Try to match the regex to whatever's left of the file.
+		++thread_stats.m_num_regex_invocations;
 		int rc = pcre_exec(
 				m_pcre_regex,
 				m_pcre_extra,
@@ -257,9 +262,11 @@ void FileScannerPCRE::ScanFile(const char* __restrict__ file_data, size_t file_s
 			continue;
 		}
 		prev_lineno = line_no;
-		Match m(file_data, file_size, ovector[0], ovector[1], line_no);
 
-		ml.AddMatch(std::move(m));
+		AddMatchWithContext(file_data, file_size, ovector[0], ovector[1], line_no, ss, ml);
 	}
+
+	// Pick up any trailing context lines of the last match.
+	FinishContext(file_data, file_size, ss, ml);
 #endif // HAVE_LIBPCRE
 }
@@ -94,7 +94,11 @@ FileScannerPCRE2::FileScannerPCRE2(sync_queue<FileID> &in_queue,
 		std::string regex,
 		bool ignore_case,
 		bool word_regexp,
-		bool pattern_is_literal) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal)
+		bool pattern_is_literal,
+		int lines_before,
+		int lines_after,
+		bool search_compressed,
+		PipelineStats &pipeline_stats) : FileScanner(in_queue, output_queue, regex, ignore_case, word_regexp, pattern_is_literal, lines_before, lines_after, search_compressed, pipeline_stats)
 {
 #ifdef HAVE_LIBPCRE2
 	// Compile the regex.
@@ -194,7 +198,7 @@ struct default_delete<pcre2_match_context>
 /// @}
 #endif
 
-void FileScannerPCRE2::ScanFile(const char* __restrict__ file_data, size_t file_size, MatchList& ml)
+void FileScannerPCRE2::ScanFile(const char* __restrict__ file_data, size_t file_size, ScanState &ss, MatchList& ml, ThreadStats &thread_stats)
 {
 #ifdef HAVE_LIBPCRE2
 	// Pointer to the offset vector returned by pcre2_match().
@@ -203,16 +207,16 @@ void FileScannerPCRE2::ScanFile(const char* __restrict__ file_data, size_t file_
 	// Create a std::unique_ptr<> with a custom deleter (see above) to manage the lifetime of the match data.
 	std::unique_ptr<pcre2_match_data> match_data;
 
-	size_t line_no {1};
+	size_t line_no { ss.m_line_number };
 	size_t prev_lineno {0};
-	const char *prev_lineno_search_end {file_data};
-	size_t start_offset { 0 };
+	const char *prev_lineno_search_end { file_data + ss.m_scan_start };
+	size_t start_offset { ss.m_scan_start };
 
 	match_data.reset(pcre2_match_data_create_from_pattern(m_pcre2_regex, NULL));
 	ovector = pcre2_get_ovector_pointer(match_data.get());
 	// Fool the "previous match was zero-length" logic for the first iteration.
 	ovector[0] = -1;
-	ovector[1] = 0;
+	ovector[1] = ss.m_scan_start;
 
 	std::unique_ptr<pcre2_match_context> mctx(pcre2_match_context_create(NULL));
 	// Hook in our callout function.
@@ -239,6 +243,7 @@ void FileScannerPCRE2::ScanFile(const char* __restrict__ file_data, size_t file_
 		}
 
 		// Try to match the regex to whatever's left of the file.
+		++thread_stats.m_num_regex_invocations;
 		int rc = pcre2_match(
 				m_pcre2_regex,
 				reinterpret_cast<PCRE2_SPTR>(file_data),
@@ -328,10 +333,12 @@ void FileScannerPCRE2::ScanFile(const char* __restrict__ file_data, size_t file_
 			continue;
 		}
 		prev_lineno = line_no;
-		Match m(file_data, file_size, ovector[0], ovector[1], line_no);
 
-		ml.AddMatch(std::move(m));
+		AddMatchWithContext(file_data, file_size, ovector[0], ovector[1], line_no, ss, ml);
 	}
+
+	// Pick up any trailing context lines of the last match.
+	FinishContext(file_data, file_size, ss, ml);
 #endif // HAVE_LIBPCRE2
 }
 
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "FileScheduler.h"
+
+#include <limits>
+
+#include "Logger.h"
+
+/// The most files we'll hold back from the scanners to reorder.  Big enough to see well past the current directory,
+/// small enough that nothing waits long, and that the FileIDs don't add up to much memory.
+static constexpr size_t f_window_size = 4096;
+
+FileScheduler::FileScheduler(sync_queue<FileID> &in_queue, FileScheduleMode mode)
+	: m_in_queue(in_queue), m_mode(mode)
+{
+}
+
+queue_op_status FileScheduler::wait_pull(FileID &&file)
+{
+	if(m_mode == FileScheduleMode::TRAVERSAL)
+	{
+		// Nothing to reorder.
+		return m_in_queue.wait_pull(std::move(file));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Top up the window with whatever the Globber has found so far.
+		FileID next;
+		while(m_pending.size() < f_window_size && m_in_queue.try_pull(std::move(next)) == queue_op_status::success)
+		{
+			ScheduleKey key = GetScheduleKey(next);
+			if(LOG_ENABLED(INFO))
+			{
+				LogPending(next);
+			}
+			m_pending.emplace(key, std::move(next));
+		}
+
+		if(!m_pending.empty())
+		{
+			auto it = m_pending.begin();
+			if(m_mode == FileScheduleMode::INODE)
+			{
+				// Continue the sweep from where we left off, or start the next one.
+				it = m_pending.lower_bound(m_sweep_position);
+				if(it == m_pending.end())
+				{
+					it = m_pending.begin();
+				}
+				m_sweep_position = it->first;
+			}
+			file = std::move(it->second);
+			m_pending.erase(it);
+			return queue_op_status::success;
+		}
+	}
+
+	// Nothing pending.  Whatever comes in next is the only choice, so wait for it without holding up the other scanners.
+	return m_in_queue.wait_pull(std::move(file));
+}
+
+void FileScheduler::LogPending(const FileID &file) const
+{
+	if(!file.IsStatInfoValid())
+	{
+		LOG(INFO) << "Holding \'" << file.GetPath() << "\' for scheduling, no stat info.";
+	}
+	else if(m_mode == FileScheduleMode::SIZE)
+	{
+		LOG(INFO) << "Holding \'" << file.GetPath() << "\' for scheduling, size " << file.GetFileSize() << ".";
+	}
+	else
+	{
+		dev_ino_pair di = file.GetUniqueFileIdentifier();
+		LOG(INFO) << "Holding \'" << file.GetPath() << "\' for scheduling, device " << di.dev() << " inode " << di.ino() << ".";
+	}
+}
+
+FileScheduler::ScheduleKey FileScheduler::GetScheduleKey(const FileID &file) const noexcept
+{
+	// Only use the stat info if we already have it, we don't want to be stat()ing under the lock.  Files without it
+	// are mostly symlinks from the --server's cache, and go to the back of the line.
+	if(!file.IsStatInfoValid())
+	{
+		return { std::numeric_limits<uintmax_t>::max(), std::numeric_limits<uintmax_t>::max() };
+	}
+
+	if(m_mode == FileScheduleMode::SIZE)
+	{
+		// Largest first.
+		return { std::numeric_limits<uintmax_t>::max() - 1 - static_cast<uintmax_t>(file.GetFileSize()), 0 };
+	}
+	else
+	{
+		dev_ino_pair di = file.GetUniqueFileIdentifier();
+		return { static_cast<uintmax_t>(di.dev()), static_cast<uintmax_t>(di.ino()) };
+	}
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_FILESCHEDULER_H_
+#define SRC_FILESCHEDULER_H_
+
+#include <config.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "sync_queue_impl_selector.h"
+#include "FileID.h"
+
+/// The order the FileScanners scan the files the Globber finds in (--schedule).
+enum class FileScheduleMode
+{
+	/// In the order they're found.
+	TRAVERSAL,
+	/// Largest first.
+	SIZE,
+	/// In (device, inode) order, sweeping up through the numbers and starting over at the bottom.
+	INODE
+};
+
+/**
+ * Reorders the Globber->FileScanner queue, for --schedule.
+ *
+ * The scanners pull from this instead of directly from the queue.  Each pull first moves whatever the Globber has
+ * queued so far into a pending window of at most a fixed number of files, then hands out the best one in the window
+ * according to the FileScheduleMode.  The window bounds how far out of traversal order we'll go, and so how long any one
+ * file can be passed over.  If there's nothing pending at all, the pull just waits on the queue.
+ *
+ * With FileScheduleMode::SIZE, big files are started as soon as they're seen instead of whenever they come up, so that
+ * the last few files to finish are small ones, and we don't end up with one scanner grinding through a huge file found
+ * late while the rest sit idle.
+ *
+ * With FileScheduleMode::INODE, the files are handed out like an elevator: the next one up from the last one handed out,
+ * in (device, inode) order, going back to the lowest once there's nothing higher.  Most filesystems allocate a file's
+ * blocks near its inode, so on a spinning disk or a network filesystem the parallel scanners' reads come out close to
+ * sequential instead of seeking all over.  Files which arrive behind the sweep wait at most one more pass.
+ */
+class FileScheduler
+{
+public:
+	FileScheduler(sync_queue<FileID> &in_queue, FileScheduleMode mode);
+	~FileScheduler() = default;
+
+	FileScheduler(const FileScheduler&) = delete;
+	FileScheduler& operator=(const FileScheduler&) = delete;
+
+	/// Same as sync_queue<FileID>::wait_pull(), but with the files in scheduled order.
+	queue_op_status wait_pull(FileID &&file);
+
+private:
+
+	/// Where a file goes in m_pending.  Lower keys are scanned first, or next up in the sweep for INODE.
+	using ScheduleKey = std::pair<uintmax_t, uintmax_t>;
+
+	ScheduleKey GetScheduleKey(const FileID &file) const noexcept;
+
+	/// Log @a file going into m_pending, with what it's being scheduled by.
+	void LogPending(const FileID &file) const;
+
+	sync_queue<FileID> &m_in_queue;
+
+	const FileScheduleMode m_mode;
+
+	/// Protects m_pending and m_sweep_position.
+	std::mutex m_mutex;
+
+	/// The files we've pulled off m_in_queue but not handed out yet.
+	std::multimap<ScheduleKey, FileID> m_pending;
+
+	/// For INODE, the key of the last file handed out.
+	ScheduleKey m_sweep_position { 0, 0 };
+};
+
+#endif /* SRC_FILESCHEDULER_H_ */
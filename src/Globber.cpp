@@ -29,12 +29,19 @@
 #include <iomanip>
 #include "TypeManager.h"
 #include "DirInclusionManager.h"
+#include "TrigramIndex.h"
+#include "DirectoryCache.h"
+#include "Trace.h"
+#include "ThreadPlacement.h"
+#include "TaskPool.h"
+#include "Prefetcher.h"
 
 #include <fts.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
 #include <utility>
 #include <system_error>
@@ -69,6 +76,13 @@ std::string ftsent_path(FTSENT*p)
 	}
 }
 
+/// fts_read(), wrapped in a "fts_read" event for --trace.
+static inline FTSENT* traced_fts_read(FTS *fts)
+{
+	ScopedTrace trace("fts_read");
+	return fts_read(fts);
+}
+
 /**
  * @todo OBSOLETE, REMOVE.
  */
@@ -129,21 +143,26 @@ Globber::Globber(std::vector<std::string> start_paths,
 		DirInclusionManager &dir_inc_manager,
 		bool recurse_subdirs,
 		int dirjobs,
-		sync_queue<FileID>& out_queue)
+		const TrigramIndex *index,
+		const DirectoryCache *dir_cache,
+		sync_queue<FileID>& out_queue,
+		PipelineStats &pipeline_stats)
 		: m_start_paths(start_paths),
 		  m_num_start_paths_remaining(start_paths.size()),
 		  m_type_manager(type_manager),
 		  m_dir_inc_manager(dir_inc_manager),
 		  m_recurse_subdirs(recurse_subdirs),
 		  m_dirjobs(dirjobs),
-		  m_out_queue(out_queue)
+		  m_index(index),
+		  m_dir_cache(dir_cache),
+		  m_out_queue(out_queue),
+		  m_pipeline_stats(pipeline_stats)
 {
 
 }
 
 void Globber::Run()
 {
-	sync_queue<std::string> dir_queue;
 	std::vector<std::thread> threads;
 
 #if USE_DIRTREE == 1 /// @todo TEMP
@@ -152,43 +171,107 @@ void Globber::Run()
 	return;
 #endif
 
+	Start([&threads](std::function<void()> worker){ threads.emplace_back(std::move(worker)); }, [](){});
+
+	// Wait for all the threads to finish.
+	for(auto &thr : threads)
+	{
+		thr.join();
+	}
+}
+
+void Globber::Start(const WorkerLauncher &launch_worker, std::function<void()> on_done)
+{
 	/// @todo It looks like OSX needs any trailing slashes to be removed from the m_start_paths here, or its fts lib will double them up.
 	/// Doesn't seem to affect the overall scanning results though.
 
-	// Start the directory traversal threads.  They will all initially block on dir_queue, since it's empty.
+	m_on_done = std::move(on_done);
+
+	// Push the initial paths to the queue before any worker can look at it, so the first one doesn't find it empty
+	// and conclude that we're done.
+	LOG(INFO) << "Number of start paths = " << m_start_paths.size();
+	for(auto path : m_start_paths)
+	{
+		m_dir_queue.wait_push(path);
+	}
+
+	// Start the directory traversal workers.
+	m_num_workers_running = m_dirjobs;
 	for(int i=0; i<m_dirjobs; i++)
 	{
-		threads.push_back(std::thread(&Globber::RunSubdirScan, this, std::ref(dir_queue), i));
+		launch_worker([this, i](){
+			try
+			{
+				RunSubdirScan(i);
+			}
+			catch(...)
+			{
+				// Let the other workers go, they'd otherwise wait forever for this one's subdirectories.
+				m_dir_queue.close();
+				WorkerFinished();
+				throw;
+			}
+			WorkerFinished();
+		});
 	}
 
-	LOG(INFO) << "Globber threads = " << threads.size();
+	LOG(INFO) << "Globber threads = " << m_dirjobs;
+}
 
-	// Push the initial paths to the queue to start the threads off.
-	LOG(INFO) << "Number of start paths = " << m_start_paths.size();
-	for(auto path : m_start_paths)
+void Globber::WorkerFinished()
+{
+	if(--m_num_workers_running == 0)
 	{
-		dir_queue.wait_push(path);
+		// Log the traversal stats.
+		LOG(INFO) << m_traversal_stats;
+
+		m_on_done();
 	}
+}
 
-	// Wait for the producer+consumer threads to finish.
-	dir_queue.wait_for_worker_completion(m_dirjobs);
 
-	dir_queue.close();
+void Globber::RunOnTaskPool(TaskPool &pool, const FileSink &file_sink)
+{
+	// Every worker can traverse, so split the subdirectories up and detect cycles the same as we would for that
+	// many --dirjobs.
+	m_dirjobs = pool.GetNumWorkers();
+
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
+	std::atomic<size_t> num_files_scanned { 0 };
+
+	// Each directory is one task, which queues up another one for each subdirectory it hands off.
+	std::function<void(std::string, bool)> submit_dir = [&](std::string dir, bool is_start_path) {
+		pool.Submit(TaskPool::Priority::LOW, [&, dir, is_start_path](int){
+			DirectoryTraversalStats stats;
+			TraverseDirectory(dir, is_start_path, file_sink, [&](std::string &&subdir){ submit_dir(std::move(subdir), false); }, stats);
+			num_files_scanned += stats.m_num_files_scanned;
+			m_traversal_stats += stats;
+		});
+	};
 
-	// Wait for all the threads to finish.
-	for(auto &thr : threads)
+	LOG(INFO) << "Number of start paths = " << m_start_paths.size();
+	for(const auto &path : m_start_paths)
 	{
-		thr.join();
+		submit_dir(path, true);
 	}
 
+	pool.WaitUntilIdle();
+
 	// Log the traversal stats.
 	LOG(INFO) << m_traversal_stats;
-}
 
+	if(collect_stats)
+	{
+		// There are no Globber threads as such, so report the traversal as a whole.
+		ThreadStats thread_stats;
+		thread_stats.m_thread_name = "POOL";
+		thread_stats.m_num_files = num_files_scanned;
+		m_pipeline_stats.AddThreadStats(PipelineStage::GLOBBER, thread_stats);
+	}
+}
 
-void Globber::RunSubdirScan(sync_queue<std::string> &dir_queue, int thread_index)
+void Globber::RunSubdirScan(int thread_index)
 {
-	char * dirs[2];
 	std::string dir;
 
 	// Local for optimizing the determination of whether the paths specified on the command line have been consumed.
@@ -197,15 +280,37 @@ void Globber::RunSubdirScan(sync_queue<std::string> &dir_queue, int thread_index
 	// Local copy of a stats struct that we'll use to collect up stats just for this thread.
 	DirectoryTraversalStats stats;
 
+	// Per-thread --stats counters.
+	ThreadStats thread_stats;
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
+
 	// Set the name of the thread.
 	set_thread_name("GLOBBER_" + std::to_string(thread_index));
 
-	while(dir_queue.wait_pull(std::move(dir)) != queue_op_status::closed)
+	ThreadPlacement::PlaceThisThread(ThreadRole::GLOBBER);
+
+	// Files go to the scanners, subdirectories we're not traversing ourselves go back on the dir_queue for the next
+	// available Globber thread.
+	auto file_sink = [&](FileID &&file_id){
+		if(m_prefetcher != nullptr)
+		{
+			m_prefetcher->FileFound(file_id);
+		}
+		timed_wait_push(m_out_queue, std::move(file_id), collect_stats, thread_stats.m_queue_push_wait_time);
+	};
+	auto dir_sink = [&](std::string &&subdir){ m_dir_queue.wait_push(std::move(subdir)); };
+
+	// The workers close the dir queue themselves, when the last busy one comes back and finds it empty.
+	bool is_busy = false;
+	auto pull_dir = [&](){
+		ScopedTrace trace("wait_pull");
+		ScopedStatsTimer timer(collect_stats, thread_stats.m_queue_pull_wait_time);
+		return m_dir_queue.wait_pull_until_idle(std::move(dir), is_busy);
+	};
+
+	while(pull_dir() != queue_op_status::closed)
 	{
-		dirs[0] = const_cast<char*>(dir.c_str());
-		dirs[1] = 0;
 		size_t old_val {0};
-		size_t num_dirs_found_this_loop {0};
 
 		// If we haven't seen m_num_start_paths_remaining == 0 yet...
 		if(!start_paths_have_been_consumed)
@@ -219,99 +324,156 @@ void Globber::RunSubdirScan(sync_queue<std::string> &dir_queue, int thread_index
 			}
 		}
 
-		/// @todo We can't use FS_NOSTAT here.  OSX at least isn't able to determine regular
-		/// files without the stat, so they get returned as FTS_NSOK / 11 /	no stat(2) requested.
-		/// Does not seem to affect performance on Linux, but might be having an effect on Cygwin.
-		/// Look into workarounds.
-		/// @note Per looking at the fts_open() source, FTS_LOGICAL turns on FTS_NOCHDIR, but since we're traversing
-		/// in multiple threads, and there's only a process-wide cwd, we'll specify it anyway.
-		/// @todo Current gnulib supports additional flags here: FTS_CWDFD | FTS_DEFER_STAT | FTS_NOATIME.  We should
-		/// check for these and use them if they exist.  Note the following though regarding O_NOATIME from the GNU libc
-		/// docs <https://www.gnu.org/software/libc/manual/html_node/Operating-Modes.html#Operating-Modes>:
-		/// "Only the owner of the file or the superuser may use this bit. This is a GNU extension."
-		int fts_options = FTS_LOGICAL /*| FTS_NOSTAT*/;
+		TraverseDirectory(dir, !start_paths_have_been_consumed, file_sink, dir_sink, stats);
+
+		if(old_val == 0)
+		{
+			// We've consumed all of the paths given on the command line, we no longer need to do the check.
+			LOG(INFO) << "All start paths consumed.";
+			start_paths_have_been_consumed = true;
+		}
+	}
+
+	// Add the local stats to the class's stats.
+	m_traversal_stats += stats;
+
+	thread_stats.m_thread_name = get_thread_name();
+	thread_stats.m_num_files = stats.m_num_files_scanned;
+	m_pipeline_stats.AddThreadStats(PipelineStage::GLOBBER, thread_stats);
+}
+
+void Globber::TraverseDirectory(const std::string &dir, bool is_start_path, const FileSink &file_sink, const DirSink &dir_sink,
+		DirectoryTraversalStats &stats)
+{
+	if(m_dir_cache != nullptr && TraverseCachedDirectory(dir, file_sink, dir_sink, stats))
+	{
+		// The --server already had this whole directory cached, no need to read it.
+		return;
+	}
+
+	char * dirs[2];
+	dirs[0] = const_cast<char*>(dir.c_str());
+	dirs[1] = 0;
+	size_t num_dirs_found_this_loop {0};
+
+	/// @todo We can't use FS_NOSTAT here.  OSX at least isn't able to determine regular
+	/// files without the stat, so they get returned as FTS_NSOK / 11 /	no stat(2) requested.
+	/// Does not seem to affect performance on Linux, but might be having an effect on Cygwin.
+	/// Look into workarounds.
+	/// @note Per looking at the fts_open() source, FTS_LOGICAL turns on FTS_NOCHDIR, but since we're traversing
+	/// in multiple threads, and there's only a process-wide cwd, we'll specify it anyway.
+	/// @todo Current gnulib supports additional flags here: FTS_CWDFD | FTS_DEFER_STAT | FTS_NOATIME.  We should
+	/// check for these and use them if they exist.  Note the following though regarding O_NOATIME from the GNU libc
+	/// docs <https://www.gnu.org/software/libc/manual/html_node/Operating-Modes.html#Operating-Modes>:
+	/// "Only the owner of the file or the superuser may use this bit. This is a GNU extension."
+	int fts_options = FTS_LOGICAL /*| FTS_NOSTAT*/;
 #if defined(FTS_CWDFD)
-		fts_options |= FTS_CWDFD | FTS_TIGHT_CYCLE_CHECK | FTS_DEFER_STAT | FTS_NOATIME;
+	fts_options |= FTS_CWDFD | FTS_TIGHT_CYCLE_CHECK | FTS_DEFER_STAT | FTS_NOATIME;
 #else
-		fts_options |= FTS_NOCHDIR;
+	fts_options |= FTS_NOCHDIR;
 #endif
-		FTS *fts = fts_open(dirs, fts_options, NULL);
-		if(fts == nullptr)
-		{
-			perror("fts error");
-		}
-		while(FTSENT *ftsent = fts_read(fts))
-		{
-			std::string name;
+	FTS *fts = fts_open(dirs, fts_options, NULL);
+	if(fts == nullptr)
+	{
+		perror("fts error");
+	}
+	while(FTSENT *ftsent = traced_fts_read(fts))
+	{
+		std::string name;
 
-			bool skip_inclusion_checks = false;
+		bool skip_inclusion_checks = false;
 
-			LOG(INFO) << "Considering file path/name \'" << ftsent_path(ftsent) << " /// " << ftsent_name(ftsent) << "\' at depth = " << ftsent->fts_level;
+		LOG(INFO) << "Considering file path/name \'" << ftsent_path(ftsent) << " /// " << ftsent_name(ftsent) << "\' at depth = " << ftsent->fts_level;
 
-			// Determine if we should skip the inclusion/exclusion checks for this file/dir.  We should only do this
-			// for files/dirs specified on the command line, which will have an fts_level of FTS_ROOTLEVEL (0), and the
-			// start_paths_have_been_consumed flag will still be false.
-			if((ftsent->fts_level == FTS_ROOTLEVEL) && !start_paths_have_been_consumed)
-			{
-				skip_inclusion_checks = true;
-			}
+		// Determine if we should skip the inclusion/exclusion checks for this file/dir.  We should only do this
+		// for files/dirs specified on the command line, which will have an fts_level of FTS_ROOTLEVEL (0), and the
+		// is_start_path flag will be true.
+		if((ftsent->fts_level == FTS_ROOTLEVEL) && is_start_path)
+		{
+			skip_inclusion_checks = true;
+		}
 
-			switch(ftsent->fts_info)
-			{
-			case FTS_F:
-			{
-				// It's a normal file.
-				LOG(INFO) << "... normal file.";
-				stats.m_num_files_found++;
+		switch(ftsent->fts_info)
+		{
+		case FTS_F:
+		{
+			// It's a normal file.
+			LOG(INFO) << "... normal file.";
+			stats.m_num_files_found++;
 
-				// Check for inclusion.
-				name.assign(ftsent->fts_name, ftsent->fts_namelen);
-				if(skip_inclusion_checks || m_type_manager.FileShouldBeScanned(name))
-				{
-					// Based on the file name, this file should be scanned.
+			// Check for inclusion.
+			name.assign(ftsent->fts_name, ftsent->fts_namelen);
+			if(skip_inclusion_checks || m_type_manager.FileShouldBeScanned(name))
+			{
+				// Based on the file name, this file should be scanned.
 
-					LOG(INFO) << "... should be scanned.";
+				LOG(INFO) << "... should be scanned.";
 
-					m_out_queue.wait_push(FileID(ftsent));
+				FileID file_id(ftsent);
 
-					// Count the number of files we found that were included in the search.
-					stats.m_num_files_scanned++;
-				}
-				else
+				if(m_index != nullptr && !m_index->FileMightMatch(file_id))
 				{
-					stats.m_num_files_rejected++;
+					// The index says this file can't contain a match, no need to read it.
+					LOG(INFO) << "... skipped by index.";
+					stats.m_num_files_skipped_by_index++;
+					break;
 				}
 
-				break;
+				file_sink(std::move(file_id));
+
+				// Count the number of files we found that were included in the search.
+				stats.m_num_files_scanned++;
 			}
-			case FTS_D:
+			else
 			{
-				LOG(INFO) << "... directory.";
-				stats.m_num_directories_found++;
+				stats.m_num_files_rejected++;
+			}
 
-				// It's a directory.  Check if we should descend into it.
-				if(!m_recurse_subdirs && ftsent->fts_level > FTS_ROOTLEVEL)
-				{
-					// We were told not to recurse into subdirectories.
-					LOG(INFO) << "... --no-recurse specified, skipping.";
-					fts_set(fts, ftsent, FTS_SKIP);
-				}
+			break;
+		}
+		case FTS_D:
+		{
+			LOG(INFO) << "... directory.";
+			stats.m_num_directories_found++;
+
+			// It's a directory.  Check if we should descend into it.
+			if(!m_recurse_subdirs && ftsent->fts_level > FTS_ROOTLEVEL)
+			{
+				// We were told not to recurse into subdirectories.
+				LOG(INFO) << "... --no-recurse specified, skipping.";
+				fts_set(fts, ftsent, FTS_SKIP);
+			}
+
+			// Now we need the name in a std::string.
+			name.assign(ftsent->fts_name, ftsent->fts_namelen);
 
-				// Now we need the name in a std::string.
-				name.assign(ftsent->fts_name, ftsent->fts_namelen);
+			if(!skip_inclusion_checks && m_dir_inc_manager.DirShouldBeExcluded(name))
+			{
+				// This name is in the dir exclude list.  Exclude the dir and all subdirs from the scan.
+				LOG(INFO) << "... should be ignored.";
+				stats.m_num_dirs_rejected++;
+				fts_set(fts, ftsent, FTS_SKIP);
+				// Don't fall through to the multithreaded handling below, or we'd queue it up to be scanned anyway.
+				break;
+			}
 
-				if(!skip_inclusion_checks && m_dir_inc_manager.DirShouldBeExcluded(name))
+			// We possibly have some more work to do if we're doing a multithreaded traversal.
+			if(m_dirjobs > 1)
+			{
+				if(ftsent->fts_level == FTS_ROOTLEVEL)
 				{
-					// This name is in the dir exclude list.  Exclude the dir and all subdirs from the scan.
-					LOG(INFO) << "... should be ignored.";
-					stats.m_num_dirs_rejected++;
-					fts_set(fts, ftsent, FTS_SKIP);
+					// We're doing the directory traversal multithreaded, so we have to detect cycles ourselves.
+					if(HasDirBeenVisited(dev_ino_pair(ftsent->fts_dev, ftsent->fts_ino)))
+					{
+						// Found cycle.
+						WARN() << "\'" << ftsent->fts_path << "\': recursive directory loop";
+						fts_set(fts, ftsent, FTS_SKIP);
+						continue;
+					}
 				}
-
-				// We possibly have some more work to do if we're doing a multithreaded traversal.
-				if(m_dirjobs > 1)
+				if(m_recurse_subdirs && (ftsent->fts_level > FTS_ROOTLEVEL))
 				{
-					if(ftsent->fts_level == FTS_ROOTLEVEL)
+					if(num_dirs_found_this_loop == 0)
 					{
 						// We're doing the directory traversal multithreaded, so we have to detect cycles ourselves.
 						if(HasDirBeenVisited(dev_ino_pair(ftsent->fts_dev, ftsent->fts_ino)))
@@ -321,104 +483,208 @@ void Globber::RunSubdirScan(sync_queue<std::string> &dir_queue, int thread_index
 							fts_set(fts, ftsent, FTS_SKIP);
 							continue;
 						}
+
+						// Handle this one ourselves.
+						LOG(INFO) << "... subdir, not queuing it up for multithreaded scanning, handling it from same FTS stream.";
+						num_dirs_found_this_loop++;
 					}
-					if(m_recurse_subdirs && (ftsent->fts_level > FTS_ROOTLEVEL))
+					else
 					{
-						if(num_dirs_found_this_loop == 0)
-						{
-							// We're doing the directory traversal multithreaded, so we have to detect cycles ourselves.
-							if(HasDirBeenVisited(dev_ino_pair(ftsent->fts_dev, ftsent->fts_ino)))
-							{
-								// Found cycle.
-								WARN() << "\'" << ftsent->fts_path << "\': recursive directory loop";
-								fts_set(fts, ftsent, FTS_SKIP);
-								continue;
-							}
-
-							// Handle this one ourselves.
-							LOG(INFO) << "... subdir, not queuing it up for multithreaded scanning, handling it from same FTS stream.";
-							num_dirs_found_this_loop++;
-						}
-						else
-						{
-							// We're doing the directory traversal multithreaded, so queue it up for scanning.
-							LOG(INFO) << "... subdir, queuing it up for multithreaded scanning.";
-							dir_queue.wait_push(std::string(ftsent->fts_path, ftsent->fts_pathlen));
-							fts_set(fts, ftsent, FTS_SKIP);
-							num_dirs_found_this_loop++;
-						}
+						// We're doing the directory traversal multithreaded, so queue it up for scanning.
+						LOG(INFO) << "... subdir, queuing it up for multithreaded scanning.";
+						dir_sink(std::string(ftsent->fts_path, ftsent->fts_pathlen));
+						fts_set(fts, ftsent, FTS_SKIP);
+						num_dirs_found_this_loop++;
 					}
 				}
+			}
 
-				LOG(INFO) << "Pre-order visit to dir \'" << ftsent->fts_path << "\', setting fts_pointer==" << std::hex << ftsent->fts_pointer;
+			LOG(INFO) << "Pre-order visit to dir \'" << ftsent->fts_path << "\', setting fts_pointer==" << std::hex << ftsent->fts_pointer;
 
-				break;
-			}
-			case FTS_DP:
-			{
-				LOG(INFO) << "Post-order visit to dir \'" << ftsent->fts_path << "\', fts_pointer==" << std::hex << ftsent->fts_pointer;
-				break;
-			}
-			case FTS_NSOK:
-			{
-				// No stat info was requested because fts_open() was called with FTS_NOSTAT, and we didn't get any.
-				// Otherwise, we shouldn't get here.
-				NOTICE() << "No stat info requested for \'" << ftsent->fts_path << "\'.  Skipping.";
-				break;
-			}
-			/// @note Only FTS_DNR, FTS_ERR, and FTS_NS have valid fts_errno information.
-			case FTS_DNR:
+			break;
+		}
+		case FTS_DP:
+		{
+			LOG(INFO) << "Post-order visit to dir \'" << ftsent->fts_path << "\', fts_pointer==" << std::hex << ftsent->fts_pointer;
+			break;
+		}
+		case FTS_NSOK:
+		{
+			// No stat info was requested because fts_open() was called with FTS_NOSTAT, and we didn't get any.
+			// Otherwise, we shouldn't get here.
+			NOTICE() << "No stat info requested for \'" << ftsent->fts_path << "\'.  Skipping.";
+			break;
+		}
+		/// @note Only FTS_DNR, FTS_ERR, and FTS_NS have valid fts_errno information.
+		case FTS_DNR:
+		{
+			// A directory that couldn't be read.
+			NOTICE() << "Unable to read directory \'" << ftsent->fts_path << "\': "
+					<< LOG_STRERROR(ftsent->fts_errno) << ". Skipping.";
+			break;
+		}
+		case FTS_ERR:
+		{
+			ERROR() << "Directory traversal error at path \'" << ftsent->fts_path << "\': "
+					<< LOG_STRERROR(ftsent->fts_errno) << ".";
+
+			/// @todo Break out of loop entirely?
+			break;
+		}
+		case FTS_NS:
+		{
+			// No stat info.
+			NOTICE() << "Could not get stat info at path \'" << ftsent->fts_path << "\': "
+								<< LOG_STRERROR(ftsent->fts_errno) << ". Skipping.";
+			break;
+		}
+		case FTS_DC:
+		{
+			// Directory that causes cycles.
+			WARN() << "\'" << ftsent->fts_path << "\': recursive directory loop";
+			break;
+		}
+		case FTS_SLNONE:
+		{
+			// Broken symlink.
+			WARN() << "Broken symlink: \'" << ftsent->fts_path << "\'";
+			break;
+		}
+		default:
+		{
+			LOG(INFO) << "... unknown file type:" << ftsent->fts_info;
+			break;
+		}
+		}
+	}
+
+	fts_close(fts);
+}
+
+bool Globber::TraverseCachedDirectory(const std::string &dir, const FileSink &file_sink, const DirSink &dir_sink,
+		DirectoryTraversalStats &stats)
+{
+	// The cache is keyed on real paths.
+	char *real_dir = realpath(dir.c_str(), nullptr);
+	if(real_dir == nullptr)
+	{
+		return false;
+	}
+	const CachedDirectory *cached_dir = m_dir_cache->Find(real_dir);
+	std::free(real_dir);
+	if(cached_dir == nullptr)
+	{
+		return false;
+	}
+
+	LOG(INFO) << "Traversing '" << dir << "' from the directory cache.";
+	stats.m_num_directories_found++;
+
+	// Unlike fts, we don't have the chain of parent directories to check for cycles, so we have to register every
+	// directory we walk, no matter how many dirjobs there are.  That also catches duplicate start paths, and
+	// directory symlinks which were queued up and have come back around to the cache.
+	if(HasDirBeenVisited(dev_ino_pair(cached_dir->m_stat.st_dev, cached_dir->m_stat.st_ino)))
+	{
+		WARN() << "'" << dir << "': recursive directory loop";
+		return true;
+	}
+
+	// Depth-first, with the paths built up the same way fts would have, so the output is the same.
+	std::vector<std::pair<std::string, const CachedDirectory*>> dirs_to_visit { {dir, cached_dir} };
+	while(!dirs_to_visit.empty())
+	{
+		std::string dir_path = std::move(dirs_to_visit.back().first);
+		cached_dir = dirs_to_visit.back().second;
+		dirs_to_visit.pop_back();
+		stats.m_num_dirs_from_cache++;
+
+		for(const auto &entry : cached_dir->m_entries)
+		{
+			std::string path = dir_path;
+			if(path.empty() || path.back() != '/')
 			{
-				// A directory that couldn't be read.
-				NOTICE() << "Unable to read directory \'" << ftsent->fts_path << "\': "
-						<< LOG_STRERROR(ftsent->fts_errno) << ". Skipping.";
-				break;
+				path += '/';
 			}
-			case FTS_ERR:
-			{
-				ERROR() << "Directory traversal error at path \'" << ftsent->fts_path << "\': "
-						<< LOG_STRERROR(ftsent->fts_errno) << ".";
+			path += entry.m_name;
 
-				/// @todo Break out of loop entirely?
-				break;
-			}
-			case FTS_NS:
+			switch(entry.m_type)
 			{
-				// No stat info.
-				NOTICE() << "Could not get stat info at path \'" << ftsent->fts_path << "\': "
-									<< LOG_STRERROR(ftsent->fts_errno) << ". Skipping.";
-				break;
-			}
-			case FTS_DC:
+			case CachedDirectoryEntry::Type::FILE:
+			case CachedDirectoryEntry::Type::FILE_SYMLINK:
 			{
-				// Directory that causes cycles.
-				WARN() << "\'" << ftsent->fts_path << "\': recursive directory loop";
+				stats.m_num_files_found++;
+
+				if(!m_type_manager.FileShouldBeScanned(entry.m_name))
+				{
+					stats.m_num_files_rejected++;
+					break;
+				}
+
+				// We can't know if a symlink's target has changed, so let FileID stat() it when it needs to.
+				FileID file_id(std::move(path), entry.m_type == CachedDirectoryEntry::Type::FILE ? &entry.m_stat : nullptr);
+
+				if(m_index != nullptr && !m_index->FileMightMatch(file_id))
+				{
+					stats.m_num_files_skipped_by_index++;
+					break;
+				}
+
+				file_sink(std::move(file_id));
+				stats.m_num_files_scanned++;
 				break;
 			}
-			case FTS_SLNONE:
+			case CachedDirectoryEntry::Type::DIRECTORY:
+			case CachedDirectoryEntry::Type::DIRECTORY_SYMLINK:
 			{
-				// Broken symlink.
-				WARN() << "Broken symlink: \'" << ftsent->fts_path << "\'";
+				stats.m_num_directories_found++;
+
+				if(!m_recurse_subdirs)
+				{
+					break;
+				}
+
+				if(m_dir_inc_manager.DirShouldBeExcluded(entry.m_name))
+				{
+					stats.m_num_dirs_rejected++;
+					break;
+				}
+
+				const CachedDirectory *cached_subdir = nullptr;
+				if(entry.m_type == CachedDirectoryEntry::Type::DIRECTORY)
+				{
+					cached_subdir = m_dir_cache->Find(cached_dir->m_path + "/" + entry.m_name);
+				}
+				else if(char *real_subdir = realpath(path.c_str(), nullptr))
+				{
+					// The cache is keyed on real paths, so this finds the symlink's target if it's in the cache.
+					cached_subdir = m_dir_cache->Find(real_subdir);
+					std::free(real_subdir);
+				}
+
+				if(cached_subdir == nullptr)
+				{
+					// Not cached, e.g. the server excludes it.  Traverse it the normal way.
+					dir_sink(std::move(path));
+				}
+				else if(HasDirBeenVisited(dev_ino_pair(cached_subdir->m_stat.st_dev, cached_subdir->m_stat.st_ino)))
+				{
+					// Found cycle, e.g. a symlink back up to one of this directory's parents.
+					WARN() << "'" << path << "': recursive directory loop";
+				}
+				else
+				{
+					dirs_to_visit.emplace_back(std::move(path), cached_subdir);
+				}
 				break;
 			}
-			default:
+			case CachedDirectoryEntry::Type::BROKEN_SYMLINK:
 			{
-				LOG(INFO) << "... unknown file type:" << ftsent->fts_info;
+				WARN() << "Broken symlink: '" << path << "'";
 				break;
 			}
 			}
 		}
-
-		fts_close(fts);
-
-		if(old_val == 0)
-		{
-			// We've consumed all of the paths given on the command line, we no longer need to do the check.
-			LOG(INFO) << "All start paths consumed.";
-			start_paths_have_been_consumed = true;
-		}
 	}
 
-	// Add the local stats to the class's stats.
-	m_traversal_stats += stats;
+	return true;
 }
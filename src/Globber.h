@@ -29,14 +29,20 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <functional>
 #include <libext/filesystem.hpp>
 #include "sync_queue_impl_selector.h"
 
 #include "FileID.h"
+#include "PipelineStats.h"
 
 // Forward decls.
 class TypeManager;
 class DirInclusionManager;
+class TrigramIndex;
+class DirectoryCache;
+class TaskPool;
+class Prefetcher;
 
 /**
  * Helper class to collect up and communicate directory tree traversal stats.
@@ -49,6 +55,8 @@ public:
 	size_t m_num_files_rejected { 0 };
 	size_t m_num_files_scanned { 0 };
 	size_t m_num_dirs_rejected { 0 };
+	size_t m_num_files_skipped_by_index { 0 };
+	size_t m_num_dirs_from_cache { 0 };
 
 	/**
 	 * Atomic compound assignment by sum.
@@ -64,6 +72,8 @@ public:
 		m_num_files_rejected += other.m_num_files_rejected;
 		m_num_files_scanned += other.m_num_files_scanned;
 		m_num_dirs_rejected += other.m_num_dirs_rejected;
+		m_num_files_skipped_by_index += other.m_num_files_skipped_by_index;
+		m_num_dirs_from_cache += other.m_num_dirs_from_cache;
 	}
 
 	/**
@@ -79,7 +89,9 @@ public:
 				<< "\nNumber of directories found: " << dts.m_num_directories_found
 				<< "\nNumber of files rejected: " << dts.m_num_files_rejected
 				<< "\nNumber of files sent for scanning: " << dts.m_num_files_scanned
-				<< "\nNumber of directories rejected: " << dts.m_num_dirs_rejected;
+				<< "\nNumber of directories rejected: " << dts.m_num_dirs_rejected
+				<< "\nNumber of files skipped by index: " << dts.m_num_files_skipped_by_index
+				<< "\nNumber of directories listed from cache: " << dts.m_num_dirs_from_cache;
 
 	};
 
@@ -101,14 +113,73 @@ public:
 			DirInclusionManager &dir_inc_manager,
 			bool recurse_subdirs,
 			int dirjobs,
-			sync_queue<FileID> &out_queue);
+			const TrigramIndex *index,
+			const DirectoryCache *dir_cache,
+			sync_queue<FileID> &out_queue,
+			PipelineStats &pipeline_stats);
 	~Globber() = default;
 
+	/// Traverse the start paths on m_dirjobs threads of our own, returning once the traversal is complete.
 	void Run();
 
+	/// Starts one traversal worker, e.g. on a new std::thread or a task pool.
+	using WorkerLauncher = std::function<void(std::function<void()> worker)>;
+
+	/**
+	 * Start traversing the start paths on m_dirjobs workers, each started by @a launch_worker, and return without
+	 * waiting for them.  The workers never wait on each other to start, so it's fine if they're run one at a time.
+	 *
+	 * @param on_done  Called on the last worker to finish, once the traversal is complete.  Also called if a worker
+	 *                 throws, so that whatever is downstream still gets to see the end of its input.
+	 */
+	void Start(const WorkerLauncher &launch_worker, std::function<void()> on_done);
+
+	/// Where the traversal sends each file it finds that should be scanned.
+	using FileSink = std::function<void(FileID &&file_id)>;
+
+	/**
+	 * The --task-pool alternative to Run().  The start paths and the subdirectories found under them are traversed
+	 * as low-priority tasks on @a pool, each file found is passed to @a file_sink on whichever worker found it.
+	 * Returns when @a pool is idle, i.e. once @a file_sink and anything it submitted to the pool are done too.
+	 */
+	void RunOnTaskPool(TaskPool &pool, const FileSink &file_sink);
+
+	/**
+	 * For --prefetch, tell @a prefetcher about each file as it's sent to the scanners.  Must be called before the
+	 * traversal is started.
+	 */
+	void SetPrefetcher(Prefetcher *prefetcher) noexcept { m_prefetcher = prefetcher; };
+
+	/// Returns the directory traversal stats.  Only valid after Run() has returned.
+	const DirectoryTraversalStats& GetTraversalStats() const noexcept { return m_traversal_stats; };
+
 private:
 
-	void RunSubdirScan(sync_queue<std::string> &dir_queue, int thread_index);
+	void RunSubdirScan(int thread_index);
+
+	/// Called as each Start()ed worker exits.
+	void WorkerFinished();
+
+	/// Where the traversal sends subdirectories it wants some other thread or task to traverse.
+	using DirSink = std::function<void(std::string &&dir)>;
+
+	/**
+	 * Traverse @a dir, from m_dir_cache if it's there, otherwise with fts.  When traversing multithreaded, all but
+	 * the first subdirectory found are handed off to @a dir_sink instead of being descended into.
+	 *
+	 * @param is_start_path  true if @a dir was given on the command line, and so skips the inclusion checks.
+	 */
+	void TraverseDirectory(const std::string &dir, bool is_start_path, const FileSink &file_sink, const DirSink &dir_sink,
+			DirectoryTraversalStats &stats);
+
+	/**
+	 * Traverse @a dir using the listings in m_dir_cache instead of reading the directories.  Subdirectories which
+	 * aren't cached are passed to @a dir_sink to be traversed the normal way.
+	 *
+	 * @return  false if @a dir isn't cached, in which case nothing has been done.
+	 */
+	bool TraverseCachedDirectory(const std::string &dir, const FileSink &file_sink, const DirSink &dir_sink,
+			DirectoryTraversalStats &stats);
 
 	/// Vector of the paths which the user gave on the command line.
 	std::vector<std::string> m_start_paths;
@@ -125,13 +196,34 @@ private:
 
 	int m_dirjobs;
 
+	/// The --index to check files against before sending them on for scanning, or nullptr if we're not using one.
+	const TrigramIndex *m_index;
+
+	/// The --server's directory cache, or nullptr if we're not a server child.
+	const DirectoryCache *m_dir_cache;
+
 	sync_queue<FileID>& m_out_queue;
 
+	/// The --prefetch side stage, or nullptr if there isn't one.
+	Prefetcher *m_prefetcher { nullptr };
+
+	/// The directories waiting to be traversed by the next free worker.
+	sync_queue<std::string> m_dir_queue;
+
+	/// The number of Start()ed workers which haven't exited yet.
+	std::atomic<int> m_num_workers_running { 0 };
+
+	/// The Start() on_done callback.
+	std::function<void()> m_on_done;
+
 	std::mutex m_dir_mutex;
 	std::set<dev_ino_pair> m_dir_has_been_visited;
 	bool HasDirBeenVisited(dev_ino_pair di) { std::unique_lock<std::mutex> lock(m_dir_mutex); return !m_dir_has_been_visited.insert(di).second; };
 
 	DirectoryTraversalStats m_traversal_stats;
+
+	/// Where the per-thread --stats info goes.
+	PipelineStats &m_pipeline_stats;
 };
 
 
@@ -27,6 +27,17 @@
 
 #include <string>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+#include <pthread.h>
 
 #if defined(CXX11_THREADS_ARE_PTHREADS)
 #	if defined(HAVE_PTHREAD)
@@ -43,6 +54,8 @@ std::string Logger::m_program_invocation_short_name;
 /// Mutex for serializing writes to cerr.
 std::mutex Logger::m_cerr_mutex;
 
+std::chrono::steady_clock::time_point Logger::m_start_time { std::chrono::steady_clock::now() };
+
 #if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
 // Apple specifically disables C++11 thread_local support in the clang they ship:
 // http://stackoverflow.com/questions/28094794/why-does-apple-clang-disallow-c11-thread-local-when-official-clang-supports?lq=1
@@ -77,3 +90,479 @@ std::string get_thread_name()
 	return std::string(buffer, 16);
 #endif
 }
+
+std::string Logger::SecondsSinceStart(std::chrono::steady_clock::time_point time)
+{
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%11.6f", std::chrono::duration<double>(time - m_start_time).count());
+	return buffer;
+}
+
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+
+namespace
+{
+
+/**
+ * Single-producer/single-consumer ring of log records, one per logging thread.  The thread which owns it is the only
+ * one which writes to it, and the background writer thread is the only one which reads from it, so neither needs a lock.
+ *
+ * Each record is a header followed by the message bytes, possibly wrapping around the end of the buffer.
+ */
+class LogRing
+{
+public:
+	struct RecordHeader
+	{
+		int64_t m_timestamp_ns;
+		uint32_t m_len;
+	};
+
+	/// Power of 2, so positions can just be masked.
+	static constexpr size_t m_capacity = 64*1024;
+
+	/// The largest message which goes through the ring.  Anything bigger is written synchronously.
+	static constexpr size_t m_max_message_len = m_capacity/4;
+
+	LogRing() : m_buffer(new char[m_capacity]) {};
+
+	/// Called by the producer.  Returns false if there isn't room right now.
+	bool TryPush(int64_t timestamp_ns, const std::string &message) noexcept
+	{
+		RecordHeader hdr { timestamp_ns, static_cast<uint32_t>(message.size()) };
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		const size_t tail = m_tail.load(std::memory_order_acquire);
+		if(m_capacity - (head - tail) < sizeof(hdr) + message.size())
+		{
+			return false;
+		}
+		Copy(head, reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+		Copy(head + sizeof(hdr), message.data(), message.size());
+		m_head.store(head + sizeof(hdr) + message.size(), std::memory_order_release);
+		return true;
+	}
+
+	/// Called by the consumer.  Appends all the records currently in the ring to @a out.
+	template <typename OutputContainer>
+	void PopAll(OutputContainer &out)
+	{
+		const size_t head = m_head.load(std::memory_order_acquire);
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		while(tail != head)
+		{
+			RecordHeader hdr;
+			CopyOut(tail, reinterpret_cast<char*>(&hdr), sizeof(hdr));
+			std::string message(hdr.m_len, '\0');
+			CopyOut(tail + sizeof(hdr), &message[0], hdr.m_len);
+			out.emplace_back(hdr.m_timestamp_ns, std::move(message));
+			tail += sizeof(hdr) + hdr.m_len;
+		}
+		m_tail.store(tail, std::memory_order_release);
+	}
+
+	bool empty() const noexcept
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+	/// Set when the owning thread exits, so the writer can drop the ring once it's drained it.
+	std::atomic<bool> m_owner_exited { false };
+
+	/// @name Values of m_in_flight_since_ns other than a timestamp.
+	///@{
+	static constexpr int64_t m_idle = INT64_MAX;
+	static constexpr int64_t m_busy = -1;
+	///@}
+
+	/**
+	 * The timestamp of the message the owning thread is in the middle of formatting, m_idle if it isn't, or m_busy
+	 * for the instant between those.  Anything the owner hasn't pushed yet is timestamped no earlier than this, which
+	 * is what lets the writer know which of the messages it has are safe to write out.
+	 */
+	std::atomic<int64_t> m_in_flight_since_ns { m_idle };
+
+private:
+	void Copy(size_t pos, const char *src, size_t len) noexcept
+	{
+		const size_t start = pos & (m_capacity-1);
+		const size_t first = std::min(len, m_capacity - start);
+		std::memcpy(m_buffer.get() + start, src, first);
+		std::memcpy(m_buffer.get(), src + first, len - first);
+	}
+
+	void CopyOut(size_t pos, char *dest, size_t len) const noexcept
+	{
+		const size_t start = pos & (m_capacity-1);
+		const size_t first = std::min(len, m_capacity - start);
+		std::memcpy(dest, m_buffer.get() + start, first);
+		std::memcpy(dest + first, m_buffer.get(), len - first);
+	}
+
+	std::unique_ptr<char[]> m_buffer;
+
+	/// Total bytes ever pushed and popped.  Only ever increase; the position in m_buffer is these mod m_capacity.
+	std::atomic<size_t> m_head { 0 };
+	std::atomic<size_t> m_tail { 0 };
+};
+
+/**
+ * The background writer, and the registry of all threads' LogRings.
+ */
+struct LogWriter
+{
+	/// Protects everything below.
+	std::mutex m_mutex;
+
+	/// Signaled to wake the writer thread up.
+	std::condition_variable m_wakeup_cv;
+
+	/// Signaled by the writer thread when it's finished a drain pass.
+	std::condition_variable m_drained_cv;
+
+	std::vector<std::shared_ptr<LogRing>> m_rings;
+
+	/// Heap-allocated and never deleted, so there's no std::thread destructor to run at exit.
+	std::thread *m_thread { nullptr };
+
+	/// Incremented when the rings are all thrown away after a fork(), so each thread knows to get a new one.
+	std::atomic<uint64_t> m_generation { 0 };
+
+	bool m_stop { false };
+
+	/// Set once the writer has been stopped at exit.  Anything logged after that is written synchronously.
+	std::atomic<bool> m_shut_down { false };
+
+	/// Flush() requests made, and the number of them the writer has completed a drain pass after.
+	uint64_t m_flush_requests { 0 };
+	uint64_t m_flushes_done { 0 };
+
+	/// Set by producers which have pushed something since the writer last looked.  Only the thread which sets it
+	/// takes m_mutex to wake the writer, so most messages don't touch a lock at all.
+	std::atomic<bool> m_wakeup_pending { false };
+};
+
+/// The one LogWriter.  Leaked on purpose so it outlives every thread which could log, including during static
+/// destruction, and created on first use so it exists even for something logged during static initialization.
+/// A fork()ed child replaces it with a new one, see LoggerBackend::ForkChild().
+LogWriter*& GetLogWriterPtr()
+{
+	static LogWriter *log_writer = new LogWriter;
+	return log_writer;
+}
+
+LogWriter& GetLogWriter()
+{
+	return *GetLogWriterPtr();
+}
+
+/// Each thread's LogRing.
+struct RingHolder
+{
+	~RingHolder()
+	{
+		if(m_ring)
+		{
+			m_ring->m_owner_exited.store(true, std::memory_order_release);
+		}
+	}
+
+	std::shared_ptr<LogRing> m_ring;
+	uint64_t m_generation { 0 };
+
+	/// How many Loggers this thread has constructed and not yet submitted.  More than one only if something logs
+	/// while another message is being formatted.
+	int m_record_depth { 0 };
+};
+
+thread_local RingHolder t_ring_holder;
+
+int64_t ToNs(std::chrono::steady_clock::time_point time)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+void WriteToCerr(std::mutex &cerr_mutex, const std::string &text)
+{
+	std::lock_guard<std::mutex> lock(cerr_mutex);
+	std::cerr << text;
+	std::cerr.flush();
+}
+
+} // namespace
+
+/// Out-of-class so it can get at Logger's private cerr mutex.
+struct LoggerBackend
+{
+	static void WriterLoop();
+	static void Shutdown();
+	static void ForkPrepare();
+	static void ForkParent();
+	static void ForkChild();
+	static LogRing* GetThreadRing();
+	static void WakeWriter();
+	static void EndRecord();
+};
+
+void LoggerBackend::WakeWriter()
+{
+	if(!GetLogWriter().m_wakeup_pending.exchange(true, std::memory_order_acq_rel))
+	{
+		std::lock_guard<std::mutex> lock(GetLogWriter().m_mutex);
+		GetLogWriter().m_wakeup_cv.notify_one();
+	}
+}
+
+void LoggerBackend::WriterLoop()
+{
+	set_thread_name("LOG_WRITER");
+
+	using Record = std::pair<int64_t, std::string>;
+	auto older = [](const Record &a, const Record &b){ return a.first < b.first; };
+
+	// Records we've pulled out of the rings but can't write yet, in time order.
+	std::vector<Record> pending;
+	std::string out;
+
+	while(true)
+	{
+		std::vector<std::shared_ptr<LogRing>> rings;
+		uint64_t flush_requests;
+		bool stop;
+		{
+			std::unique_lock<std::mutex> lock(GetLogWriter().m_mutex);
+			auto have_work = []{
+				return GetLogWriter().m_wakeup_pending.load() || GetLogWriter().m_stop
+						|| (GetLogWriter().m_flush_requests != GetLogWriter().m_flushes_done); };
+			if(pending.empty())
+			{
+				GetLogWriter().m_wakeup_cv.wait(lock, have_work);
+			}
+			else
+			{
+				// Come back for what we're holding even if nothing new gets logged.
+				GetLogWriter().m_wakeup_cv.wait_for(lock, std::chrono::milliseconds(1), have_work);
+			}
+			GetLogWriter().m_wakeup_pending.store(false);
+			rings = GetLogWriter().m_rings;
+			flush_requests = GetLogWriter().m_flush_requests;
+			stop = GetLogWriter().m_stop;
+		}
+
+		// Find the horizon: the time before which no message can still show up.  A thread which isn't in the middle
+		// of a message now will timestamp its next one after this; one which is has already timestamped it.
+		// The order matters: the clock has to be read before we look at any thread's state.
+		int64_t horizon = ToNs(std::chrono::steady_clock::now());
+		for(auto &ring : rings)
+		{
+			int64_t in_flight_since;
+			while((in_flight_since = ring->m_in_flight_since_ns.load()) == LogRing::m_busy)
+			{
+				// The owner is between marking itself busy and reading the clock.
+				std::this_thread::yield();
+			}
+			horizon = std::min(horizon, in_flight_since);
+		}
+
+		// Gather up everything, and merge it into what we're holding.  Each ring is already in order.
+		const auto num_held = pending.size();
+		for(auto &ring : rings)
+		{
+			ring->PopAll(pending);
+		}
+		std::stable_sort(pending.begin() + num_held, pending.end(), older);
+		std::inplace_merge(pending.begin(), pending.begin() + num_held, pending.end(), older);
+
+		// Write out everything older than the horizon.  The rest waits for a later pass, unless we've been asked to
+		// get everything out now.
+		auto first_held = pending.end();
+		if(!stop && flush_requests == GetLogWriter().m_flushes_done)
+		{
+			first_held = std::lower_bound(pending.begin(), pending.end(), Record(horizon, std::string()), older);
+		}
+		out.clear();
+		for(auto r = pending.begin(); r != first_held; ++r)
+		{
+			out += r->second;
+		}
+		pending.erase(pending.begin(), first_held);
+		if(!out.empty())
+		{
+			WriteToCerr(Logger::m_cerr_mutex, out);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(GetLogWriter().m_mutex);
+			// Drop the rings of threads which have exited, once we've got everything out of them.
+			GetLogWriter().m_rings.erase(std::remove_if(GetLogWriter().m_rings.begin(), GetLogWriter().m_rings.end(),
+					[](const std::shared_ptr<LogRing> &r){ return r->m_owner_exited.load() && r->empty(); }), GetLogWriter().m_rings.end());
+			GetLogWriter().m_flushes_done = flush_requests;
+		}
+		GetLogWriter().m_drained_cv.notify_all();
+
+		if(stop)
+		{
+			return;
+		}
+	}
+}
+
+void LoggerBackend::Shutdown()
+{
+	std::thread *writer_thread;
+	{
+		std::lock_guard<std::mutex> lock(GetLogWriter().m_mutex);
+		writer_thread = GetLogWriter().m_thread;
+		GetLogWriter().m_thread = nullptr;
+		GetLogWriter().m_stop = true;
+		GetLogWriter().m_shut_down.store(true);
+	}
+	if(writer_thread != nullptr)
+	{
+		// It'll do one last drain pass and exit.
+		GetLogWriter().m_wakeup_cv.notify_one();
+		writer_thread->join();
+	}
+}
+
+void LoggerBackend::ForkPrepare()
+{
+	// Get everything out before fork()ing, so the child doesn't print it again, then make sure nobody's in the middle
+	// of anything the child would find locked.
+	Logger::Flush();
+	GetLogWriter().m_mutex.lock();
+	Logger::m_cerr_mutex.lock();
+}
+
+void LoggerBackend::ForkParent()
+{
+	Logger::m_cerr_mutex.unlock();
+	GetLogWriter().m_mutex.unlock();
+}
+
+void LoggerBackend::ForkChild()
+{
+	// The writer thread didn't come with us, and none of the other threads whose rings we have did either.
+	// Start over with a whole new LogWriter, with a new writer thread started by the first thing we log.  We can't
+	// reuse the old one's condition variables, since they can still think the parent's writer thread is waiting on them.
+	LogWriter *old_writer = GetLogWriterPtr();
+	LogWriter *new_writer = new LogWriter;
+	new_writer->m_generation.store(old_writer->m_generation.load() + 1);
+	GetLogWriterPtr() = new_writer;
+	Logger::m_cerr_mutex.unlock();
+}
+
+LogRing* LoggerBackend::GetThreadRing()
+{
+	const uint64_t generation = GetLogWriter().m_generation.load();
+	if(t_ring_holder.m_ring && t_ring_holder.m_generation == generation)
+	{
+		return t_ring_holder.m_ring.get();
+	}
+
+	// First message from this thread (or the first since a fork()).  Give it a ring.
+	t_ring_holder.m_ring = std::make_shared<LogRing>();
+	t_ring_holder.m_generation = generation;
+
+	static bool atexit_registered = false;
+
+	std::lock_guard<std::mutex> lock(GetLogWriter().m_mutex);
+	GetLogWriter().m_rings.push_back(t_ring_holder.m_ring);
+	if(GetLogWriter().m_thread == nullptr)
+	{
+		if(!atexit_registered)
+		{
+			// Make sure everything gets written out at exit().
+			atexit_registered = true;
+			std::atexit(&LoggerBackend::Shutdown);
+			pthread_atfork(&LoggerBackend::ForkPrepare, &LoggerBackend::ForkParent, &LoggerBackend::ForkChild);
+		}
+		GetLogWriter().m_thread = new std::thread(&LoggerBackend::WriterLoop);
+	}
+
+	return t_ring_holder.m_ring.get();
+}
+
+void LoggerBackend::EndRecord()
+{
+	if(--t_ring_holder.m_record_depth == 0 && t_ring_holder.m_ring)
+	{
+		t_ring_holder.m_ring->m_in_flight_since_ns.store(LogRing::m_idle);
+	}
+}
+
+std::chrono::steady_clock::time_point Logger::BeginRecord()
+{
+	if(t_ring_holder.m_record_depth++ > 0 || GetLogWriter().m_shut_down.load(std::memory_order_acquire))
+	{
+		// Nested in another message, which is already holding the writer back, or there's no writer to hold back.
+		return std::chrono::steady_clock::now();
+	}
+
+	// Tell the writer we're busy before reading the clock, so it can't miss this message.  See WriterLoop().
+	LogRing *ring = LoggerBackend::GetThreadRing();
+	ring->m_in_flight_since_ns.store(LogRing::m_busy);
+	auto timestamp = std::chrono::steady_clock::now();
+	ring->m_in_flight_since_ns.store(ToNs(timestamp));
+	return timestamp;
+}
+
+void Logger::Submit(std::chrono::steady_clock::time_point timestamp, const std::string &message)
+{
+	if(GetLogWriter().m_shut_down.load(std::memory_order_acquire) || message.size() > LogRing::m_max_message_len)
+	{
+		// After the writer has been shut down at exit, or too big for the ring.  Write it ourselves, after anything
+		// this thread logged before it.
+		Flush();
+		WriteToCerr(m_cerr_mutex, message);
+		LoggerBackend::EndRecord();
+		return;
+	}
+
+	LogRing *ring = LoggerBackend::GetThreadRing();
+
+	while(!ring->TryPush(ToNs(timestamp), message))
+	{
+		// Ring's full.  Give the writer a chance to catch up.
+		LoggerBackend::WakeWriter();
+		std::this_thread::yield();
+	}
+
+	LoggerBackend::EndRecord();
+	LoggerBackend::WakeWriter();
+}
+
+void Logger::Flush()
+{
+	std::unique_lock<std::mutex> lock(GetLogWriter().m_mutex);
+	if(GetLogWriter().m_thread == nullptr)
+	{
+		// Nothing's been logged, or we're shut down.
+		return;
+	}
+	const uint64_t my_request = ++GetLogWriter().m_flush_requests;
+	GetLogWriter().m_wakeup_cv.notify_one();
+	GetLogWriter().m_drained_cv.wait(lock, [my_request]{ return GetLogWriter().m_flushes_done >= my_request || GetLogWriter().m_thread == nullptr; });
+}
+
+#else // HAVE_NO_THREAD_LOCAL_SUPPORT
+
+// No thread_local, so no per-thread rings.  Write synchronously.
+
+std::chrono::steady_clock::time_point Logger::BeginRecord()
+{
+	return std::chrono::steady_clock::now();
+}
+
+void Logger::Submit(std::chrono::steady_clock::time_point timestamp, const std::string &message)
+{
+	(void)timestamp;
+	std::lock_guard<std::mutex> lock(m_cerr_mutex);
+	std::cerr << message;
+	std::cerr.flush();
+}
+
+void Logger::Flush()
+{
+}
+
+#endif // HAVE_NO_THREAD_LOCAL_SUPPORT
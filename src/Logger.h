@@ -20,7 +20,18 @@
  *
  * A basic multithreaded logging facility.
  *
- * @todo Redirecting to streams/files, timestamp, maybe sorting by timestamp, more log severity levels: trace, debug, info, warning, error, fatal.
+ * Each log statement is formatted in the calling thread and then put in that thread's own ring buffer, without taking
+ * any locks.  A background thread drains all the rings, merges the messages by timestamp, and writes them to stderr.
+ * It holds back any message which a thread still in the middle of logging could yet need to come after, so the output
+ * is in timestamp order across drain passes too; only a Flush() writes out what it has regardless.
+ * This way logging doesn't serialize all the threads on stderr, and so doesn't change the timing of whatever
+ * we're trying to diagnose nearly as much.  Call Logger::Flush() to make sure everything logged so far has been written;
+ * this is done automatically at exit().
+ *
+ * The diagnostic LOG(INFO) and LOG(DEBUG) levels can be compiled out entirely with configure's --with-min-log-level,
+ * for builds where their runtime enable check in the innermost loops isn't wanted either.
+ *
+ * @todo Redirecting to streams/files, more log severity levels: trace, debug, info, warning, error, fatal.
  */
 
 #ifndef SRC_LOGGER_H_
@@ -35,7 +46,19 @@
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <chrono>
 
+/// @name The log levels which can be compiled out with configure's --with-min-log-level.
+/// Any EnableableLogger with a level below UCG_MIN_LOG_LEVEL is compiled out.
+///@{
+#define UCG_LOG_LEVEL_DEBUG  0
+#define UCG_LOG_LEVEL_INFO   1
+#define UCG_LOG_LEVEL_NOTICE 2
+///@}
+
+#if !defined(UCG_MIN_LOG_LEVEL)
+#define UCG_MIN_LOG_LEVEL UCG_LOG_LEVEL_DEBUG
+#endif
 
 /**
  * Call this from inside the thread's callable object to set its name.
@@ -50,17 +73,14 @@ std::string get_thread_name();
 class Logger
 {
 public:
-	Logger() = default;
+	Logger() : m_timestamp(BeginRecord()) {};
 	virtual ~Logger()
 	{
-		// Add a newline to the stringstream and flush it.
-		m_tempstream << std::endl;
+		// Add a newline to the stringstream.
+		m_tempstream << '\n';
 
-		// Send it to the actual output stream.
-		{
-		std::unique_lock<std::mutex> lock(m_cerr_mutex);
-		std::cerr << m_tempstream.str();
-		}
+		// Send it on its way to the actual output stream.
+		Submit(m_timestamp, m_tempstream.str());
 	}
 
 	static void Init(const char * argv0)
@@ -83,8 +103,15 @@ public:
 #endif
 		// Set the name of the main thread.
 		set_thread_name(m_program_invocation_short_name);
+
+		m_start_time = std::chrono::steady_clock::now();
 	}
 
+	/**
+	 * Block until everything logged by any thread before this call has been written to stderr.
+	 */
+	static void Flush();
+
 	/// Helper function for converting a C errno into
 	static std::string strerror(int c_errno = errno) noexcept
 	{
@@ -101,51 +128,74 @@ protected:
 	static std::string m_program_invocation_name;
 	static std::string m_program_invocation_short_name;
 
+	/// Seconds since Init() as of @a time, formatted for a log message prefix.
+	static std::string SecondsSinceStart(std::chrono::steady_clock::time_point time);
+
+	/// When this message was logged.
+	std::chrono::steady_clock::time_point m_timestamp;
+
 private:
+	friend struct LoggerBackend;
+
+	/// Timestamp a new message, and let the background writer know this thread has one on the way.
+	static std::chrono::steady_clock::time_point BeginRecord();
+
+	/// Hand a formatted message off to the background writer.
+	static void Submit(std::chrono::steady_clock::time_point timestamp, const std::string &message);
+
+	/// When Init() was called.
+	static std::chrono::steady_clock::time_point m_start_time;
+
 	/// Mutex for serializing writes to cerr.
-	/// @note Portability: This is only needed on OSX.  Without it, individual characters written to either std::cerr or std::clog
-	/// by different threads will get intermixed.  I believe this is contrary to the C++11 spec, and that each "<< whatever" (which is
-	/// what we're otherwise doing here) should be atomic wrt the characters that actually get output (i.e. one flush per "<<").
+	/// Needed on every platform: the writer thread and any thread writing synchronously (at exit, or a message too big for
+	/// its ring) both write to cerr, and the fork() handlers hold it across the fork() so the child doesn't inherit
+	/// a half-written message.  Without it, on OSX even individual characters from different threads get intermixed.
 	static std::mutex m_cerr_mutex;
 };
 
 
-template <typename T>
+template <typename T, int level>
 class EnableableLogger : public Logger
 {
 public:
-	EnableableLogger(const char *reporting_name) { m_tempstream << reporting_name << ": " << get_thread_name() << ": "; };
+	EnableableLogger(const char *reporting_name)
+	{
+		m_tempstream << reporting_name << ": [" << SecondsSinceStart(m_timestamp) << "] " << get_thread_name() << ": ";
+	};
 	~EnableableLogger() noexcept override  = default;
 
 	static void Enable(bool enable) noexcept { m_enabled = enable; };
 
-	static bool IsEnabled() noexcept { return m_enabled; };
+	/// false if this logger was compiled out by configure's --with-min-log-level.
+	static constexpr bool IsCompiledIn() noexcept { return level >= UCG_MIN_LOG_LEVEL; };
+
+	static bool IsEnabled() noexcept { return IsCompiledIn() && m_enabled; };
 
 private:
 	static bool m_enabled;
 };
 
-template <typename T>
-bool EnableableLogger<T>::m_enabled { false };
+template <typename T, int level>
+bool EnableableLogger<T, level>::m_enabled { false };
 
 
 /**
  * The LOG(INFO) logger.
  */
-class INFO : public EnableableLogger<INFO>
+class INFO : public EnableableLogger<INFO, UCG_LOG_LEVEL_INFO>
 {
 public:
-	INFO() : EnableableLogger<INFO>(__func__) { };
+	INFO() : EnableableLogger<INFO, UCG_LOG_LEVEL_INFO>(__func__) { };
 };
 
 
 /**
  * The LOG(DEBUG) logger.
  */
-class DEBUG : public EnableableLogger<DEBUG>
+class DEBUG : public EnableableLogger<DEBUG, UCG_LOG_LEVEL_DEBUG>
 {
 public:
-	DEBUG() : EnableableLogger<DEBUG>(__func__) {};
+	DEBUG() : EnableableLogger<DEBUG, UCG_LOG_LEVEL_DEBUG>(__func__) {};
 };
 
 
@@ -158,6 +208,7 @@ public:
 	STDERR() { m_tempstream << m_program_invocation_short_name << ": "; };
 	~STDERR() override = default;
 
+	static constexpr bool IsCompiledIn() noexcept { return true; };
 	static bool IsEnabled() noexcept { return true; };
 };
 
@@ -170,6 +221,7 @@ public:
 	STDLOG() { m_tempstream << m_program_invocation_short_name << ": "; };
 	~STDLOG() override = default;
 
+	static constexpr bool IsCompiledIn() noexcept { return true; };
 	static bool IsEnabled() noexcept { return true; };
 };
 
@@ -178,8 +230,21 @@ public:
 #define LOG_STRERROR(...) Logger::strerror(__VA_ARGS__)
 
 /// @name Macros for logging messages which are not intended for end-user consumption.
+///
+/// Since "<<" binds tighter than "&&", everything streamed into a LOG() is the right-hand operand of the "&&",
+/// and so is never evaluated when the logger isn't enabled.  When the logger is compiled out, the whole statement
+/// is constant-folded away.  Anything which has to be computed in separate statements before it can be logged
+/// should be guarded with LOG_ENABLED(), e.g.:
+/// @code
+///   if(LOG_ENABLED(INFO))
+///   {
+///       ...expensive setup...
+///       LOG(INFO) << ...;
+///   }
+/// @endcode
 ///@{
-#define LOG(logger) logger::IsEnabled() && logger().m_tempstream
+#define LOG_ENABLED(logger) (logger::IsCompiledIn() && logger::IsEnabled())
+#define LOG(logger) LOG_ENABLED(logger) && logger().m_tempstream
 ///@}
 
 /// @name Macros for output intended for the end user.
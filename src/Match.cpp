@@ -51,5 +51,10 @@ Match::Match(const char *start_of_array, size_t array_size, size_t match_start_o
 	m_match = std::string(start_of_array+match_start_offset, start_of_array+match_end_offset);
 	m_post_match = std::string(start_of_array+match_start_offset+(match_end_offset-match_start_offset), line_end);
 	m_line_number = line_number;
+	m_line_offset = line_start - start_of_array;
 }
 
+Match::Match(const char *line_start, const char *line_end, size_t line_number, size_t line_offset)
+	: m_line_number(line_number), m_is_context(true), m_line_offset(line_offset), m_pre_match(line_start, line_end)
+{
+}
@@ -35,6 +35,18 @@ class Match
 {
 public:
 	Match(const char *start_of_array, size_t array_size, size_t match_start_offset, size_t match_end_offset, size_t line_number);
+
+	/**
+	 * Constructor for a context line, i.e. a non-matching line printed before or after a matched line due to -A/-B/-C.
+	 * The entire line [@a line_start, @a line_end) is stored in m_pre_match, and m_match and m_post_match are left empty.
+	 *
+	 * @param line_start   Pointer to the first char of the line.
+	 * @param line_end     Pointer to the line's terminating '\n', or one-past-the-end of the file data if it has none.
+	 * @param line_number  The line number of the line.
+	 * @param line_offset  The byte offset of @a line_start from the start of the file.
+	 */
+	Match(const char *line_start, const char *line_end, size_t line_number, size_t line_offset);
+
 	Match() = default;
 
 	/// Delete the copy constructor and the move assignment operator.  With the std::strings in here, this is a relatively expensive
@@ -52,6 +64,11 @@ public:
 
 	/// @note Data members not private, this is more of a struct than a class.
 	size_t m_line_number { 0 };
+	/// true if this is a context line, not a matched line.
+	bool m_is_context { false };
+	/// Byte offset of the start of the line from the start of the file.  The match itself starts
+	/// m_pre_match.length() bytes after this.
+	size_t m_line_offset { 0 };
 	std::string m_pre_match;
 	std::string m_match;
 	std::string m_post_match;
@@ -21,37 +21,245 @@
 
 #include "MatchList.h"
 
-#include <iostream>
-#include <sstream>
+#include <cstdint>
 #include <future/string.hpp>
 
-MatchList::MatchList(const std::string &filename) : m_filename(filename)
+MatchList::MatchList(const std::string &filename, size_t continues_after_line)
+	: m_filename(filename), m_continues_after_line(continues_after_line)
 {
 
 }
 
 void MatchList::AddMatch(Match &&match)
 {
+	if(!match.m_is_context)
+	{
+		++m_num_matched_lines;
+	}
 	m_match_list.push_back(std::move(match));
 }
 
+/**
+ * Append the text of the line @a match, including the terminating '\n', to @a buffer.
+ * For matched lines, the matched text is wrapped in the given color strings if @a color is true.
+ */
+static inline void AppendLineText(std::string &buffer, const Match &match, bool color, const std::string &color_match, const std::string &color_default)
+{
+	buffer += match.m_pre_match;
+	if(!match.m_is_context)
+	{
+		if(color) buffer += color_match;
+		buffer += match.m_match;
+		if(color) buffer += color_default;
+		buffer += match.m_post_match;
+	}
+	buffer += '\n';
+}
+
 
-void MatchList::Print(std::ostream &sstrm, OutputContext &output_context) const
+/**
+ * Returns @a filename with any leading "./" chopped off.  This is to match the behavior of ack.
+ */
+static inline std::string NoDotSlash(const std::string &filename)
 {
-	std::string no_dotslash_fn;
-	const std::string empty_color_string {""};
-	bool color = output_context.is_color_enabled();
+	if(filename.compare(0, 2, "./") == 0)
+	{
+		return std::string(filename.begin()+2, filename.end());
+	}
+	return filename;
+}
+
+/**
+ * Returns the length of the well-formed UTF-8 sequence starting at @a p, or 0 if it isn't one.
+ * @a p must point to a byte >= 0x80, and there must be @a remaining bytes available from @a p.
+ */
+static inline size_t ValidUTF8SequenceLength(const unsigned char *p, size_t remaining) noexcept
+{
+	size_t len;
+	unsigned char second_min = 0x80, second_max = 0xBF;
 
-	// If the file path starts with a "./", chop it off.
-	// This is to match the behavior of ack.
-	if(m_filename.find("./") == 0)
+	if(p[0] >= 0xC2 && p[0] <= 0xDF) { len = 2; }
+	else if(p[0] == 0xE0) { len = 3; second_min = 0xA0; }        // No overlongs.
+	else if(p[0] == 0xED) { len = 3; second_max = 0x9F; }        // No surrogates.
+	else if(p[0] >= 0xE1 && p[0] <= 0xEF) { len = 3; }
+	else if(p[0] == 0xF0) { len = 4; second_min = 0x90; }        // No overlongs.
+	else if(p[0] >= 0xF1 && p[0] <= 0xF3) { len = 4; }
+	else if(p[0] == 0xF4) { len = 4; second_max = 0x8F; }        // Nothing past U+10FFFF.
+	else { return 0; }
+
+	if(remaining < len || p[1] < second_min || p[1] > second_max)
 	{
-		no_dotslash_fn = std::string(m_filename.begin()+2, m_filename.end());
+		return 0;
 	}
-	else
+	for(size_t i = 2; i < len; ++i)
+	{
+		if((p[i] & 0xC0) != 0x80)
+		{
+			return 0;
+		}
+	}
+	return len;
+}
+
+/**
+ * Append @a str to @a out as a quoted JSON string.  Since JSON text has to be valid Unicode and source files
+ * aren't always valid UTF-8, any byte which isn't part of a well-formed UTF-8 sequence is replaced with U+FFFD.
+ * The byte offsets we print alongside are always in terms of the original file bytes.
+ */
+static void AppendJSONString(std::string &out, const std::string &str)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(str.data());
+	const unsigned char *end = p + str.size();
+
+	out += '"';
+	while(p < end)
+	{
+		// Copy the longest run of chars which need no escaping in one go.
+		const unsigned char *run_start = p;
+		while(p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+		{
+			++p;
+		}
+		out.append(reinterpret_cast<const char*>(run_start), p - run_start);
+		if(p == end)
+		{
+			break;
+		}
+
+		switch(*p)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if(*p < 0x20)
+			{
+				out += "\\u00";
+				out += hex_digits[*p >> 4];
+				out += hex_digits[*p & 0x0F];
+			}
+			else
+			{
+				size_t len = ValidUTF8SequenceLength(p, end - p);
+				if(len == 0)
+				{
+					out += "\\ufffd";
+				}
+				else
+				{
+					out.append(reinterpret_cast<const char*>(p), len);
+					p += len;
+					continue;
+				}
+			}
+			break;
+		}
+		++p;
+	}
+	out += '"';
+}
+
+/// Append @a value to @a out as @a num_bytes little-endian bytes.
+static inline void AppendLittleEndian(std::string &out, uint64_t value, int num_bytes)
+{
+	for(int i = 0; i < num_bytes; ++i)
 	{
-		no_dotslash_fn = std::string(m_filename.begin(), m_filename.end());
+		out += static_cast<char>((value >> (8*i)) & 0xFF);
 	}
+}
+
+void MatchList::Print(std::string &out, const OutputContext &output_context, bool continues_last_printed) const
+{
+	switch(output_context.output_format())
+	{
+	case OutputFormat::JSON:
+		PrintJSON(out);
+		break;
+	case OutputFormat::BINARY:
+		PrintBinary(out);
+		break;
+	default:
+		PrintText(out, output_context, continues_last_printed);
+		break;
+	}
+}
+
+void MatchList::PrintJSON(std::string &out) const
+{
+	std::string json_filename;
+	AppendJSONString(json_filename, NoDotSlash(m_filename));
+
+	std::string line_text;
+	for(const Match& it : m_match_list)
+	{
+		line_text = it.m_pre_match;
+		if(it.m_is_context)
+		{
+			out += "{\"type\":\"context\",\"file\":";
+			out += json_filename;
+			out += ",\"line\":";
+			out += std::to_string(it.m_line_number);
+			out += ",\"line_offset\":";
+			out += std::to_string(it.m_line_offset);
+		}
+		else
+		{
+			const size_t match_start = it.m_line_offset + it.m_pre_match.length();
+			line_text += it.m_match;
+			line_text += it.m_post_match;
+			out += "{\"type\":\"match\",\"file\":";
+			out += json_filename;
+			out += ",\"line\":";
+			out += std::to_string(it.m_line_number);
+			out += ",\"column\":";
+			out += std::to_string(it.m_pre_match.length()+1);
+			out += ",\"line_offset\":";
+			out += std::to_string(it.m_line_offset);
+			out += ",\"match_start\":";
+			out += std::to_string(match_start);
+			out += ",\"match_end\":";
+			out += std::to_string(match_start + it.m_match.length());
+		}
+		out += ",\"text\":";
+		AppendJSONString(out, line_text);
+		out += "}\n";
+	}
+}
+
+void MatchList::PrintBinary(std::string &out) const
+{
+	const std::string filename = NoDotSlash(m_filename);
+
+	// File record.
+	out += 'F';
+	AppendLittleEndian(out, filename.length(), 4);
+	out += filename;
+	AppendLittleEndian(out, m_match_list.size(), 4);
+
+	// One line record per matched or context line.
+	for(const Match& it : m_match_list)
+	{
+		const size_t line_length = it.m_pre_match.length() + it.m_match.length() + it.m_post_match.length();
+		out += it.m_is_context ? 'C' : 'M';
+		AppendLittleEndian(out, it.m_line_number, 8);
+		AppendLittleEndian(out, it.m_line_offset, 8);
+		AppendLittleEndian(out, it.m_pre_match.length(), 4);
+		AppendLittleEndian(out, it.m_match.length(), 4);
+		AppendLittleEndian(out, line_length, 4);
+		out += it.m_pre_match;
+		out += it.m_match;
+		out += it.m_post_match;
+	}
+}
+
+void MatchList::PrintText(std::string &out, const OutputContext &output_context, bool continues_last_printed) const
+{
+	const std::string no_dotslash_fn = NoDotSlash(m_filename);
+	const std::string empty_color_string {""};
+	bool color = output_context.is_color_enabled();
 
 	const std::string *color_filename { &empty_color_string };
 	const std::string *color_match { &empty_color_string };
@@ -80,78 +288,92 @@ void MatchList::Print(std::ostream &sstrm, OutputContext &output_context) const
 	{
 		// Render to a TTY device.
 
-		// Print file header.
-		if(color) composition_buffer += *color_filename;
-		composition_buffer += no_dotslash_fn;
-		if(color) composition_buffer += *color_default;
-		composition_buffer += '\n';
-		sstrm << composition_buffer;
+		if(!continues_last_printed)
+		{
+			// Print file header.
+			if(color) composition_buffer += *color_filename;
+			composition_buffer += no_dotslash_fn;
+			if(color) composition_buffer += *color_default;
+			composition_buffer += '\n';
+			out += composition_buffer;
+		}
 
 		// Print the individual matches.
+		size_t prev_line_number = continues_last_printed ? m_continues_after_line : 0;
 		for(const Match& it : m_match_list)
 		{
 			composition_buffer.clear();
+			if(output_context.is_context_enabled() && (prev_line_number != 0) && (it.m_line_number != prev_line_number+1))
+			{
+				// Non-contiguous group of lines, print a grep-style separator.
+				composition_buffer += "--\n";
+			}
+			prev_line_number = it.m_line_number;
+			// Context lines get a '-' instead of a ':' after the line number.
+			const char separator = it.m_is_context ? '-' : ':';
 			if(color) composition_buffer += *color_lineno;
 			composition_buffer += std::to_string(it.m_line_number);
 			if(color) composition_buffer += *color_default;
-			composition_buffer += ':';
-			sstrm << composition_buffer;
-			if(output_context.is_column_print_enabled())
+			composition_buffer += separator;
+			out += composition_buffer;
+			if(output_context.is_column_print_enabled() && !it.m_is_context)
 			{
-				sstrm << it.m_pre_match.length()+1 << ':';
+				out += std::to_string(it.m_pre_match.length()+1);
+				out += ':';
 			}
 			composition_buffer.clear();
-			composition_buffer += it.m_pre_match;
-			if(color) composition_buffer += *color_match;
-			composition_buffer += it.m_match;
-			if(color) composition_buffer += *color_default;
-			composition_buffer += it.m_post_match;
-			composition_buffer += '\n';
-			sstrm << composition_buffer;
+			AppendLineText(composition_buffer, it, color, *color_match, *color_default);
+			out += composition_buffer;
 		}
 	}
 	else
 	{
 		// Render to a pipe or file.
 
+		size_t prev_line_number = continues_last_printed ? m_continues_after_line : 0;
 		for(const Match& it : m_match_list)
 		{
-			// Print file name at the beginning of each line.
 			composition_buffer.clear();
+			if(output_context.is_context_enabled() && (prev_line_number != 0) && (it.m_line_number != prev_line_number+1))
+			{
+				// Non-contiguous group of lines, print a grep-style separator.
+				composition_buffer += "--\n";
+			}
+			prev_line_number = it.m_line_number;
+			// Context lines get '-'s instead of ':'s after the file name and line number.
+			const char separator = it.m_is_context ? '-' : ':';
+
+			// Print file name at the beginning of each line.
 			if(color) composition_buffer += *color_filename;
 			composition_buffer += no_dotslash_fn;
 			if(color) composition_buffer += *color_default;
-			composition_buffer += ':';
+			composition_buffer += separator;
 
 			// Line number.
 			if(color) composition_buffer += *color_lineno;
 			composition_buffer += std::to_string(it.m_line_number);
 			if(color) composition_buffer += *color_default;
-			composition_buffer += ':';
+			composition_buffer += separator;
 
-			sstrm << composition_buffer;
+			out += composition_buffer;
 
 			// The column, if enabled.
-			if(output_context.is_column_print_enabled())
+			if(output_context.is_column_print_enabled() && !it.m_is_context)
 			{
-				sstrm << it.m_pre_match.length()+1 << ':';
+				out += std::to_string(it.m_pre_match.length()+1);
+				out += ':';
 			}
 
 			// The match text.
 			composition_buffer.clear();
-			composition_buffer += it.m_pre_match;
-			if(color) composition_buffer += *color_match;
-			composition_buffer += it.m_match;
-			if(color) composition_buffer += *color_default;
-			composition_buffer += it.m_post_match;
-			composition_buffer += '\n';
-			sstrm << composition_buffer;
+			AppendLineText(composition_buffer, it, color, *color_match, *color_default);
+			out += composition_buffer;
 		}
 	}
 }
 
 std::vector<Match>::size_type MatchList::GetNumberOfMatchedLines() const noexcept
 {
-	// One Match in the MatchList equals one matched line.
-	return m_match_list.size();
+	// One non-context Match in the MatchList equals one matched line.
+	return m_num_matched_lines;
 }
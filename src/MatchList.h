@@ -24,7 +24,6 @@
 
 #include <string>
 #include <vector>
-#include <iosfwd>
 
 #include "Match.h"
 #include "OutputContext.h"
@@ -38,7 +37,13 @@
 class MatchList
 {
 public:
-	MatchList(const std::string &filename);
+	/**
+	 * @param filename              The file the Matches are in.
+	 * @param continues_after_line  For the second and later parts of a stream's matches, which are sent on to the output
+	 *                              as they're found (see SetMoreToFollow()), the line number of the last line in the
+	 *                              previous part.  0 for a whole file's matches, or the first part of a stream's.
+	 */
+	MatchList(const std::string &filename, size_t continues_after_line = 0);
 	MatchList() = default;
 
 	/// Delete the copy constructor and the move assignment operator.  With the std::vector<Match> in here, this is an expensive
@@ -54,9 +59,24 @@ public:
 	~MatchList() noexcept = default;
 
 	/// Add a match to this MatchList.  Note that this is done by moving, not copying, the given %match.
+	/// Context lines are added through this function as well, and must be added in line number order along with the matches.
 	void AddMatch(Match &&match);
 
-	void Print(std::ostream &sstrm, OutputContext &output_context) const;
+	/**
+	 * Append the rendering of this MatchList in the format selected by @a output_context to @a out.
+	 *
+	 * @param continues_last_printed  true if this is a continuation of the MatchList printed just before it, in which
+	 *                                case the text format doesn't repeat the file header.
+	 */
+	void Print(std::string &out, const OutputContext &output_context, bool continues_last_printed = false) const;
+
+	/// Mark this as only the matches found so far in a stream, with a continuation of it to follow.
+	void SetMoreToFollow() noexcept { m_more_to_follow = true; };
+
+	bool IsMoreToFollow() const noexcept { return m_more_to_follow; };
+
+	/// Whether this continues an earlier MatchList of the same file which had IsMoreToFollow() set.
+	bool IsContinuation() const noexcept { return m_continues_after_line != 0; };
 
 	/// Returns a bool indicating whether the MatchList is empty.
 	/// @note You might expect that this needs to indicate 'empty' after a move-from has occurred.
@@ -66,13 +86,52 @@ public:
 
 	std::vector<Match>::size_type GetNumberOfMatchedLines() const noexcept;
 
+	/// The file these Matches were found in.
+	const std::string& GetFilename() const noexcept { return m_filename; };
+
+	/// The Matches and context lines, in line number order.
+	const std::vector<Match>& GetMatches() const noexcept { return m_match_list; };
+
 private:
 
+	/// Render as grep/ack-style text, possibly with color.
+	void PrintText(std::string &out, const OutputContext &output_context, bool continues_last_printed) const;
+
+	/// Render as JSON Lines, one object per line:
+	/// @code
+	/// {"type":"match","file":F,"line":N,"column":C,"line_offset":L,"match_start":S,"match_end":E,"text":T}
+	/// {"type":"context","file":F,"line":N,"line_offset":L,"text":T}
+	/// @endcode
+	/// All offsets are byte offsets from the start of the file, and column is the 1-based byte column of the match.
+	void PrintJSON(std::string &out) const;
+
+	/**
+	 * Render as length-prefixed binary records.  All integers are unsigned little-endian.  There is one file record:
+	 *   - u8 'F', u32 filename length, filename bytes, u32 number of line records which follow.
+	 *
+	 * Followed by that many line records:
+	 *   - u8 'M' (matched line) or 'C' (context line), u64 line number, u64 byte offset of the line in the file,
+	 *     u32 byte offset of the match within the line, u32 match length, u32 line length, line bytes (no '\n').
+	 *
+	 * The match offset and length are 0 for context lines.  A stream's matches are printed as they're found, so the
+	 * same file can have several file records.
+	 */
+	void PrintBinary(std::string &out) const;
+
 	/// The filename where the Matches in this MatchList were found.
 	std::string m_filename;
 
 	/// The Matches found in this file.
 	std::vector<Match> m_match_list;
+
+	/// The number of Matches in m_match_list which aren't context lines.
+	std::vector<Match>::size_type m_num_matched_lines { 0 };
+
+	/// See the constructor.
+	size_t m_continues_after_line { 0 };
+
+	/// See SetMoreToFollow().
+	bool m_more_to_follow { false };
 };
 
 // Require MatchList to be nothrow move constructible so that a container of them can use move on reallocation.
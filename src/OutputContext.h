@@ -24,18 +24,33 @@
 
 #include <string>
 
+/**
+ * The format the search results are rendered in.
+ */
+enum class OutputFormat
+{
+	/// The usual human-readable grep/ack-style text.
+	TEXT,
+	/// JSON Lines, one object per matched or context line.
+	JSON,
+	/// The compact length-prefixed binary records described in MatchList::PrintBinary().
+	BINARY
+};
+
 /**
  * A class for encapsulating the output "context", e.g. what colors to use, whether to print the column number, etc.
  */
 class OutputContext
 {
 public:
-	OutputContext(bool output_is_tty, bool enable_color, bool print_column);
+	OutputContext(bool output_is_tty, bool enable_color, bool print_column, bool print_context, OutputFormat output_format);
 	~OutputContext();
 
 	inline bool is_output_tty() const noexcept { return m_output_is_tty; };
 	inline bool is_color_enabled() const noexcept { return m_enable_color; };
 	inline bool is_column_print_enabled() const noexcept { return m_print_column; };
+	inline bool is_context_enabled() const noexcept { return m_print_context; };
+	inline OutputFormat output_format() const noexcept { return m_output_format; };
 
 	/// @name Active colors.
 	/// @{
@@ -55,6 +70,12 @@ private:
 	/// Whether to print the column number of the first match or not.
 	bool m_print_column;
 
+	/// Whether context lines (-A/-B/-C) were requested, and hence whether "--" group separators should be printed.
+	bool m_print_context;
+
+	/// Text, JSON, or binary output.
+	OutputFormat m_output_format;
+
 	/// @name Default output colors.
 	/// @{
 	// ANSI SGR parameter setting sequences for setting the color and boldness of the output text.
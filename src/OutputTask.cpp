@@ -23,12 +23,17 @@
 
 #include <unistd.h>
 #include <stdio.h>
-#include <iostream>
 
 #include "Logger.h"
+#include "OutputWriter.h"
+#include "Trace.h"
 
-OutputTask::OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, sync_queue<MatchList> &input_queue)
-	: m_input_queue(input_queue)
+/// When stdout isn't a TTY, the output is written out in blocks of at least this many bytes.
+static constexpr size_t f_output_block_size = 64*1024;
+
+OutputTask::OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, bool flag_context, OutputFormat output_format,
+		sync_queue<MatchList> &input_queue, PipelineStats &pipeline_stats)
+	: m_input_queue(input_queue), m_output_format(output_format), m_pipeline_stats(pipeline_stats)
 {
 	// Determine if the output is going to a terminal.  If so we'll use color by default, group the matches under
 	// the filename, etc.
@@ -37,7 +42,12 @@ OutputTask::OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, syn
 	// Determine whether to enable color or not.
 	// Color is enabled if explicitly specified with --color or
 	// if outputting to a TTY and --nocolor is not specified.
-	if(flag_color || (!flag_nocolor && m_output_is_tty))
+	// The JSON and binary formats are for other programs to consume, and are never colored.
+	if(m_output_format != OutputFormat::TEXT)
+	{
+		m_enable_color = false;
+	}
+	else if(flag_color || (!flag_nocolor && m_output_is_tty))
 	{
 		m_enable_color = true;
 	}
@@ -48,7 +58,9 @@ OutputTask::OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, syn
 
 	m_print_column = flag_column;
 
-	m_output_context.reset(new OutputContext(m_output_is_tty, m_enable_color, m_print_column));
+	m_print_context = flag_context;
+
+	m_output_context.reset(new OutputContext(m_output_is_tty, m_enable_color, m_print_column, m_print_context, m_output_format));
 }
 
 OutputTask::~OutputTask()
@@ -59,25 +71,98 @@ void OutputTask::Run()
 {
 	set_thread_name("OutputTask");
 
+	Begin();
+
 	MatchList ml;
-	bool first_matchlist_printed = false;
-	std::stringstream sstrm;
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
+	while(timed_wait_pull(m_input_queue, std::move(ml), collect_stats, m_thread_stats.m_queue_pull_wait_time) != queue_op_status::closed)
+	{
+		Print(ml);
+	}
 
-	while(m_input_queue.wait_pull(std::move(ml)) != queue_op_status::closed)
+	End();
+}
+
+void OutputTask::Begin()
+{
+	// If a person is watching, write out each file's matches as soon as we have them.  Otherwise, buffer them up
+	// and write them out in big blocks.
+	m_writer.reset(new OutputWriter(fileno(stdout), m_output_is_tty ? 1 : f_output_block_size));
+
+	if(m_output_format == OutputFormat::BINARY)
+	{
+		// Binary stream header: magic and format version.
+		m_writer->GetBuffer() += "UCGB";
+		m_writer->GetBuffer() += '\x01';
+	}
+}
+
+void OutputTask::Print(MatchList &ml)
+{
+	std::string &out = m_writer->GetBuffer();
+
+	// A stream's matches come in several parts.  Unless some other file's got printed in between, the later ones carry
+	// on from the earlier ones without a new header or separator.
+	const bool continues_last_printed = ml.IsContinuation() && m_first_matchlist_printed
+			&& m_last_more_to_follow && ml.GetFilename() == m_last_filename;
+
+	if(m_output_format == OutputFormat::TEXT && !continues_last_printed)
 	{
-		if(first_matchlist_printed && m_output_is_tty)
+		if(m_first_matchlist_printed && m_output_is_tty)
 		{
 			// Print a blank line between the match lists (i.e. the groups of matches in one file).
-			std::cout << '\n';
+			out += '\n';
+		}
+		else if(m_first_matchlist_printed && m_print_context)
+		{
+			// Not a TTY, but we're printing context lines.  Separate the files' groups the same way grep does.
+			out += "--\n";
 		}
-		ml.Print(sstrm, *m_output_context);
-		std::cout << sstrm.str();
-		std::cout.flush();
-		sstrm.str(std::string());
-		sstrm.clear();
-		first_matchlist_printed = true;
-
-		// Count up the total number of matches.
-		m_total_matched_lines += ml.GetNumberOfMatchedLines();
 	}
+	ScopedTrace print_trace("Print");
+	ml.Print(out, *m_output_context, continues_last_printed);
+	if(ml.IsMoreToFollow() || ml.IsContinuation())
+	{
+		// Part of a stream, which may be feeding us a line at a time.  Whatever's downstream of us shouldn't have to
+		// wait for a block's worth of matches.
+		m_writer->Flush();
+	}
+	else
+	{
+		m_writer->FlushIfFull();
+	}
+	print_trace.End();
+	m_first_matchlist_printed = true;
+	m_last_more_to_follow = ml.IsMoreToFollow();
+	if(m_last_more_to_follow)
+	{
+		m_last_filename = ml.GetFilename();
+	}
+
+	// Count up the total number of matches.
+	m_total_matched_lines += ml.GetNumberOfMatchedLines();
+	m_thread_stats.m_num_matched_lines += ml.GetNumberOfMatchedLines();
+	if(!ml.IsContinuation())
+	{
+		m_thread_stats.m_num_files++;
+	}
+}
+
+void OutputTask::DrainQueue()
+{
+	MatchList ml;
+	while(m_input_queue.try_pull(std::move(ml)) == queue_op_status::success)
+	{
+		Print(ml);
+	}
+}
+
+void OutputTask::End()
+{
+	m_writer->Flush();
+	m_thread_stats.m_num_output_bytes += m_writer->GetNumBytesWritten();
+	m_writer.reset();
+
+	m_thread_stats.m_thread_name = "OutputTask";
+	m_pipeline_stats.AddThreadStats(PipelineStage::OUTPUT, m_thread_stats);
 }
@@ -28,6 +28,9 @@
 
 #include "sync_queue_impl_selector.h"
 #include "OutputContext.h"
+#include "PipelineStats.h"
+
+class OutputWriter;
 
 /**
  * Task which serializes the output from the FileScanner threads.
@@ -35,11 +38,25 @@
 class OutputTask
 {
 public:
-	OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, sync_queue<MatchList> &input_queue);
+	OutputTask(bool flag_color, bool flag_nocolor, bool flag_column, bool flag_context, OutputFormat output_format,
+			sync_queue<MatchList> &input_queue, PipelineStats &pipeline_stats);
 	virtual ~OutputTask();
 
+	/**
+	 * Print everything that comes in on the input queue until it's closed.  Does a Begin(), Print()s, and End().
+	 */
 	void Run();
 
+	/// @name The pieces of Run(), for driving the output from elsewhere, e.g. --task-pool's tasks.
+	/// Print() and DrainQueue() must not be called concurrently.
+	///@{
+	void Begin();
+	void Print(MatchList &ml);
+	/// Print() everything which is in the input queue right now, without waiting for more.
+	void DrainQueue();
+	void End();
+	///@}
+
 	long long GetTotalMatchedLines() const { return m_total_matched_lines; };
 
 private:
@@ -56,10 +73,31 @@ private:
 	/// Whether to print the column number of the first match or not.
 	bool m_print_column;
 
+	/// Whether context lines were requested.
+	bool m_print_context;
+
+	/// Text, JSON, or binary.
+	OutputFormat m_output_format;
+
 	std::unique_ptr<OutputContext> m_output_context;
 
+	/// Where the --stats info goes.
+	PipelineStats &m_pipeline_stats;
+
 	/// The total number of matched lines as reported by the incoming MatchLists.
 	long long m_total_matched_lines { 0 };
+
+	/// Where the output is rendered to, between Begin() and End().
+	std::unique_ptr<OutputWriter> m_writer;
+
+	bool m_first_matchlist_printed { false };
+
+	/// Whether the last MatchList printed was one part of a stream's matches with more to follow, and if so, its file.
+	bool m_last_more_to_follow { false };
+	std::string m_last_filename;
+
+	/// --stats counters.
+	ThreadStats m_thread_stats;
 };
 
 #endif /* OUTPUTTASK_H_ */
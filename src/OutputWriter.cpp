@@ -0,0 +1,66 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "OutputWriter.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "Logger.h"
+
+OutputWriter::OutputWriter(int fd, size_t flush_threshold) : m_fd(fd), m_flush_threshold(flush_threshold)
+{
+	// Leave some headroom so that appending the MatchList which crosses the threshold doesn't usually reallocate.
+	m_buffer.reserve(flush_threshold + flush_threshold/4);
+}
+
+OutputWriter::~OutputWriter()
+{
+	Flush();
+}
+
+void OutputWriter::Flush()
+{
+	const char *p = m_buffer.data();
+	size_t remaining = m_buffer.size();
+
+	while(!m_write_failed && remaining > 0)
+	{
+		ssize_t num_written = write(m_fd, p, remaining);
+		if(num_written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			// Most likely EPIPE, i.e. something like "ucg ... | head".  Nothing more we can do with the output.
+			LOG(INFO) << "write() of output failed: " << std::strerror(errno) << ", discarding further output.";
+			m_write_failed = true;
+			break;
+		}
+		p += num_written;
+		remaining -= num_written;
+		m_num_bytes_written += num_written;
+	}
+
+	m_buffer.clear();
+}
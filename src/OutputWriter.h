@@ -0,0 +1,67 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_OUTPUTWRITER_H_
+#define SRC_OUTPUTWRITER_H_
+
+#include <config.h>
+
+#include <string>
+
+/**
+ * Buffered writer for the search results.  OutputTask renders each MatchList straight onto the end of the buffer,
+ * and the buffer is handed to write(2) in large blocks instead of going through std::cout a MatchList at a time.
+ */
+class OutputWriter
+{
+public:
+	/**
+	 * @param fd               The file descriptor to write to.
+	 * @param flush_threshold  Write the buffer out once it holds at least this many bytes.
+	 */
+	OutputWriter(int fd, size_t flush_threshold);
+	~OutputWriter();
+
+	/// The buffer to append output to.
+	std::string& GetBuffer() noexcept { return m_buffer; };
+
+	/// Write the buffer out if it's reached the flush threshold.
+	void FlushIfFull() { if(m_buffer.size() >= m_flush_threshold) { Flush(); } };
+
+	/// Write out everything that's in the buffer.
+	void Flush();
+
+	/// The total number of bytes handed to write(2) so far.
+	size_t GetNumBytesWritten() const noexcept { return m_num_bytes_written; };
+
+private:
+
+	int m_fd;
+
+	size_t m_flush_threshold;
+
+	std::string m_buffer;
+
+	size_t m_num_bytes_written { 0 };
+
+	/// Set once a write fails (e.g. the reader of the pipe went away).  All further output is discarded.
+	bool m_write_failed { false };
+};
+
+#endif /* SRC_OUTPUTWRITER_H_ */
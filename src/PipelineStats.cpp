@@ -0,0 +1,177 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "PipelineStats.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+
+ThreadStats& ThreadStats::operator+=(const ThreadStats &other)
+{
+	m_num_files += other.m_num_files;
+	m_num_bytes_read += other.m_num_bytes_read;
+	m_num_matched_lines += other.m_num_matched_lines;
+	m_num_regex_invocations += other.m_num_regex_invocations;
+	m_num_output_bytes += other.m_num_output_bytes;
+	m_read_time += other.m_read_time;
+	m_scan_time += other.m_scan_time;
+	m_queue_pull_wait_time += other.m_queue_pull_wait_time;
+	m_queue_push_wait_time += other.m_queue_push_wait_time;
+
+	return *this;
+}
+
+void PipelineStats::AddThreadStats(PipelineStage stage, const ThreadStats &thread_stats)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_thread_stats[static_cast<size_t>(stage)].push_back(thread_stats);
+}
+
+/// Helper to convert a ThreadStats::duration to seconds.
+static inline double to_seconds(ThreadStats::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+/// Description of one column of a stage's table in the report.
+struct StatsColumn
+{
+	const char *m_header;
+	/// Returns the column's value for the given ThreadStats.
+	double (*m_get_value)(const ThreadStats &ts);
+	/// true if the value is a time in seconds, false if it's a count.
+	bool m_is_time;
+};
+
+static const StatsColumn f_globber_columns[] = {
+	{"Files queued", [](const ThreadStats &ts) -> double { return ts.m_num_files; }, false},
+	{"Pull wait (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_queue_pull_wait_time); }, true},
+	{"Push wait (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_queue_push_wait_time); }, true},
+	{ nullptr, nullptr, false }
+};
+
+static const StatsColumn f_scanner_columns[] = {
+	{"Files", [](const ThreadStats &ts) -> double { return ts.m_num_files; }, false},
+	{"Bytes read", [](const ThreadStats &ts) -> double { return ts.m_num_bytes_read; }, false},
+	{"Read (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_read_time); }, true},
+	{"Scan (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_scan_time); }, true},
+	{"Pull wait (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_queue_pull_wait_time); }, true},
+	{"Push wait (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_queue_push_wait_time); }, true},
+	{"Matched lines", [](const ThreadStats &ts) -> double { return ts.m_num_matched_lines; }, false},
+	{"Regex calls", [](const ThreadStats &ts) -> double { return ts.m_num_regex_invocations; }, false},
+	{ nullptr, nullptr, false }
+};
+
+static const StatsColumn f_output_columns[] = {
+	{"Files", [](const ThreadStats &ts) -> double { return ts.m_num_files; }, false},
+	{"Matched lines", [](const ThreadStats &ts) -> double { return ts.m_num_matched_lines; }, false},
+	{"Output bytes", [](const ThreadStats &ts) -> double { return ts.m_num_output_bytes; }, false},
+	{"Pull wait (s)", [](const ThreadStats &ts) -> double { return to_seconds(ts.m_queue_pull_wait_time); }, true},
+	{ nullptr, nullptr, false }
+};
+
+void PipelineStats::PrintStage(std::ostream &os, PipelineStage stage) const
+{
+	static const char * const stage_names[] = { "Directory traversal", "File scanning", "Output" };
+	static const StatsColumn * const stage_columns[] = { f_globber_columns, f_scanner_columns, f_output_columns };
+	constexpr int thread_name_width = 16;
+
+	const auto &thread_stats = m_thread_stats[static_cast<size_t>(stage)];
+	const StatsColumn *columns = stage_columns[static_cast<size_t>(stage)];
+
+	os << stage_names[static_cast<size_t>(stage)] << " (" << thread_stats.size() << " thread"
+			<< (thread_stats.size() == 1 ? "" : "s") << "):\n";
+
+	// Header.
+	os << "  " << std::left << std::setw(thread_name_width) << "Thread" << std::right;
+	for(const StatsColumn *c = columns; c->m_header != nullptr; ++c)
+	{
+		os << std::setw(15) << c->m_header;
+	}
+	os << '\n';
+
+	// One row per thread, then the stage totals.
+	auto print_row = [&](const ThreadStats &ts, const std::string &name){
+		os << "  " << std::left << std::setw(thread_name_width) << name << std::right;
+		for(const StatsColumn *c = columns; c->m_header != nullptr; ++c)
+		{
+			if(c->m_is_time)
+			{
+				os << std::setw(15) << std::fixed << std::setprecision(6) << c->m_get_value(ts);
+			}
+			else
+			{
+				os << std::setw(15) << static_cast<unsigned long long>(c->m_get_value(ts));
+			}
+		}
+		os << '\n';
+	};
+
+	// Sort by thread name so the report is stable from run to run.
+	std::vector<const ThreadStats*> sorted;
+	ThreadStats total;
+	for(const ThreadStats &ts : thread_stats)
+	{
+		sorted.push_back(&ts);
+		total += ts;
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const ThreadStats *a, const ThreadStats *b){
+		// Shorter names first, so that e.g. "FILESCAN_2" sorts before "FILESCAN_10".
+		return (a->m_thread_name.length() != b->m_thread_name.length()) ? (a->m_thread_name.length() < b->m_thread_name.length())
+				: (a->m_thread_name < b->m_thread_name);
+	});
+	for(const ThreadStats *ts : sorted)
+	{
+		print_row(*ts, ts->m_thread_name);
+	}
+	if(sorted.size() > 1)
+	{
+		print_row(total, "Total");
+	}
+
+	if((stage == PipelineStage::SCANNER) && (total.m_read_time.count() > 0))
+	{
+		os << "  Read throughput: " << std::fixed << std::setprecision(2)
+				<< (total.m_num_bytes_read / to_seconds(total.m_read_time)) / (1024.0*1024.0) << " MiB/s per thread-second\n";
+	}
+}
+
+void PipelineStats::Print(std::ostream &os) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Save the stream's formatting state, we're going to change it.
+	std::ios::fmtflags old_flags = os.flags();
+	auto old_precision = os.precision();
+
+	os << "\nPipeline statistics:\n";
+	for(auto stage : {PipelineStage::GLOBBER, PipelineStage::SCANNER, PipelineStage::OUTPUT})
+	{
+		os << '\n';
+		PrintStage(os, stage);
+	}
+
+	os.flags(old_flags);
+	os.precision(old_precision);
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file PipelineStats.h
+ * Per-stage, per-thread statistics for the --stats report.
+ */
+
+#ifndef SRC_PIPELINESTATS_H_
+#define SRC_PIPELINESTATS_H_
+
+#include <config.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iosfwd>
+#include <utility>
+
+#include "Trace.h"
+
+
+/**
+ * Counters and timers collected by a single pipeline thread.
+ * Each thread keeps its own instance on its stack and updates it without any synchronization.  The instance is
+ * handed off to PipelineStats::AddThreadStats() once, when the thread is done, so there's no sharing until then.
+ * Not every stage uses every member; unused ones stay 0.
+ */
+struct ThreadStats
+{
+	using duration = std::chrono::steady_clock::duration;
+
+	/// Name of the thread which collected these stats, e.g. "FILESCAN_0".
+	std::string m_thread_name;
+
+	/// Number of files this thread handled: found and queued (Globber), read (FileScanner), or printed (OutputTask).
+	size_t m_num_files { 0 };
+
+	/// Number of bytes of file data read.
+	size_t m_num_bytes_read { 0 };
+
+	/// Number of matched lines found or printed.
+	size_t m_num_matched_lines { 0 };
+
+	/// Number of calls into the regex engine's match function.
+	size_t m_num_regex_invocations { 0 };
+
+	/// Number of bytes written to stdout.
+	size_t m_num_output_bytes { 0 };
+
+	/// Time spent opening and reading files.
+	duration m_read_time { 0 };
+
+	/// Time spent scanning file data for matches.
+	duration m_scan_time { 0 };
+
+	/// Time spent blocked in wait_pull() on this stage's input queue.
+	duration m_queue_pull_wait_time { 0 };
+
+	/// Time spent in wait_push() to this stage's output queue.
+	duration m_queue_push_wait_time { 0 };
+
+	/// Sum the counters and timers of @a other into *this.  Not thread-safe.
+	ThreadStats& operator+=(const ThreadStats &other);
+};
+
+
+/**
+ * RAII helper which adds the time between its construction and destruction to a ThreadStats duration member.
+ * If constructed with @a enabled == false, it doesn't even read the clock, so the cost when --stats isn't given is
+ * one well-predicted branch at each end.
+ */
+class ScopedStatsTimer
+{
+public:
+	ScopedStatsTimer(bool enabled, ThreadStats::duration &accumulator) noexcept
+		: m_enabled(enabled), m_accumulator(accumulator)
+	{
+		if(m_enabled)
+		{
+			m_start = std::chrono::steady_clock::now();
+		}
+	};
+
+	~ScopedStatsTimer() noexcept
+	{
+		Stop();
+	};
+
+	/// Stop the timer before it goes out of scope.  Subsequent calls, including the one from the destructor, do nothing.
+	void Stop() noexcept
+	{
+		if(m_enabled)
+		{
+			m_accumulator += std::chrono::steady_clock::now() - m_start;
+			m_enabled = false;
+		}
+	};
+
+private:
+	bool m_enabled;
+	ThreadStats::duration &m_accumulator;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+
+/**
+ * Call @a queue.wait_pull(@a x), adding the time spent blocked in it to @a accumulator if @a enabled is true.
+ * The wait is also recorded as a "wait_pull" event when --trace is on.
+ */
+template <typename QueueType, typename ValueType>
+inline auto timed_wait_pull(QueueType &queue, ValueType &&x, bool enabled, ThreadStats::duration &accumulator)
+	-> decltype(queue.wait_pull(std::forward<ValueType>(x)))
+{
+	ScopedTrace trace("wait_pull");
+	ScopedStatsTimer timer(enabled, accumulator);
+	return queue.wait_pull(std::forward<ValueType>(x));
+}
+
+/**
+ * Call @a queue.wait_push(@a x), adding the time spent in it to @a accumulator if @a enabled is true.
+ * The wait is also recorded as a "wait_push" event when --trace is on.
+ */
+template <typename QueueType, typename ValueType>
+inline auto timed_wait_push(QueueType &queue, ValueType &&x, bool enabled, ThreadStats::duration &accumulator)
+	-> decltype(queue.wait_push(std::forward<ValueType>(x)))
+{
+	ScopedTrace trace("wait_push");
+	ScopedStatsTimer timer(enabled, accumulator);
+	return queue.wait_push(std::forward<ValueType>(x));
+}
+
+
+/// The stages of the Globber->FileScanner->OutputTask pipeline.
+enum class PipelineStage
+{
+	GLOBBER,	//!< Directory tree traversal threads.
+	SCANNER,	//!< File reading and scanning threads.
+	OUTPUT,		//!< The output thread.
+	NUM_STAGES
+};
+
+
+/**
+ * Collects the ThreadStats of all the pipeline threads, and prints the --stats report.
+ */
+class PipelineStats
+{
+public:
+	explicit PipelineStats(bool enabled) : m_enabled(enabled) {};
+	~PipelineStats() = default;
+
+	/// Returns true if --stats was given, i.e. if the pipeline threads should be timing themselves.
+	bool IsEnabled() const noexcept { return m_enabled; };
+
+	/**
+	 * Add the stats collected by one thread of pipeline stage @a stage.  Thread-safe.
+	 *
+	 * @param stage
+	 * @param thread_stats
+	 */
+	void AddThreadStats(PipelineStage stage, const ThreadStats &thread_stats);
+
+	/**
+	 * Print the report.  Call only after all pipeline threads have been joined.
+	 *
+	 * @param os
+	 */
+	void Print(std::ostream &os) const;
+
+private:
+
+	void PrintStage(std::ostream &os, PipelineStage stage) const;
+
+	bool m_enabled;
+
+	/// Mutex for serializing AddThreadStats() calls.
+	mutable std::mutex m_mutex;
+
+	/// The per-thread stats, indexed by stage.
+	std::vector<ThreadStats> m_thread_stats[static_cast<size_t>(PipelineStage::NUM_STAGES)];
+};
+
+#endif /* SRC_PIPELINESTATS_H_ */
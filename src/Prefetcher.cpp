@@ -0,0 +1,204 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "Prefetcher.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Logger.h"
+#include "Trace.h"
+
+/// @name The lead limits, in files.
+///@{
+static constexpr size_t f_initial_lead = 16;
+static constexpr size_t f_min_lead = 4;
+static constexpr size_t f_max_lead = 512;
+///@}
+
+/// The most of any one file we prefetch.  Past this, the file is big enough that the kernel's own readahead for the
+/// scanner's sequential read of it takes over.
+static constexpr off_t f_max_prefetch_bytes = 1024*1024;
+
+/// How many reads the scanners report between lead adjustments.
+static constexpr size_t f_adjust_interval = 32;
+
+/// @name A read is a hit if it took no longer than this, which is about what the open() and read() of a file already in
+/// the page cache costs.  Anything which had to wait on the disk or network takes longer.
+///@{
+static constexpr std::chrono::microseconds f_hit_base_time { 50 };
+/// Plus this per byte, i.e. copying out of the cache at about 4 GB/s.
+static constexpr double f_hit_ns_per_byte = 0.25;
+///@}
+
+/// @name Hit rates which trigger an adjustment.
+///@{
+static constexpr double f_grow_below_hit_rate = 0.75;
+static constexpr double f_shrink_above_hit_rate = 0.95;
+///@}
+
+/// How long the prefetcher thread waits for a scanner to take a file before looking again anyway.  FileTaken() doesn't
+/// take m_mutex to notify, so it can't rely on the notification alone.
+static constexpr std::chrono::milliseconds f_max_wait { 10 };
+
+Prefetcher::Prefetcher(sync_queue<FileID> &in_queue)
+	: m_in_queue(in_queue), m_lead(f_initial_lead)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+	Join();
+}
+
+bool Prefetcher::IsSupported() noexcept
+{
+#if defined(HAVE_POSIX_FADVISE)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Prefetcher::Start()
+{
+	m_thread = std::thread(&Prefetcher::Run, this);
+}
+
+void Prefetcher::Join()
+{
+	if(m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void Prefetcher::ReportRead(ThreadStats::duration read_time, size_t num_bytes)
+{
+	auto hit_time = f_hit_base_time + std::chrono::nanoseconds(static_cast<long long>(num_bytes * f_hit_ns_per_byte));
+	bool hit = read_time <= hit_time;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_interval_reads++;
+		m_total_reads++;
+		if(hit)
+		{
+			m_interval_hits++;
+			m_total_hits++;
+		}
+
+		if(m_interval_reads >= f_adjust_interval)
+		{
+			double hit_rate = static_cast<double>(m_interval_hits) / m_interval_reads;
+			size_t lead = m_lead.load();
+			if(hit_rate < f_grow_below_hit_rate)
+			{
+				// The scanners are catching up to the reads we started, or passing them.  Get further ahead.
+				lead = std::min(f_max_lead, lead * 2);
+			}
+			else if(hit_rate > f_shrink_above_hit_rate)
+			{
+				// Far enough ahead, maybe too far.  Back off a little.
+				lead = std::max(f_min_lead, lead - lead/8);
+			}
+			if(lead != m_lead.load())
+			{
+				LOG(INFO) << "Prefetch hit rate " << hit_rate << ", lead now " << lead << " files";
+				m_lead.store(lead);
+			}
+			m_interval_reads = 0;
+			m_interval_hits = 0;
+		}
+	}
+}
+
+double Prefetcher::GetHitRate() const noexcept
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_total_reads == 0 ? 0.0 : static_cast<double>(m_total_hits) / m_total_reads;
+}
+
+void Prefetcher::Run()
+{
+	set_thread_name("PREFETCH");
+
+	FileID file;
+	for(size_t file_number = 0; m_in_queue.wait_pull(std::move(file)) != queue_op_status::closed; ++file_number)
+	{
+		if(file_number >= m_num_taken.load() + m_lead.load())
+		{
+			// Don't get more than the lead ahead of the scanners.
+			ScopedTrace trace("wait_lead");
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while(file_number >= m_num_taken.load() + m_lead.load())
+			{
+				m_file_taken_cv.wait_for(lock, f_max_wait);
+			}
+		}
+
+		// Checked after any wait for the lead, since the scanners may have caught up with us while we were waiting.
+		if(file_number < m_num_taken.load())
+		{
+			// A scanner already has this one, too late to help.
+			LOG(INFO) << "Skipping prefetch of \'" << file.GetPath() << "\', a scanner has it already.";
+			m_num_skipped++;
+			continue;
+		}
+
+		Prefetch(file);
+	}
+}
+
+void Prefetcher::Prefetch(const FileID &file) noexcept
+{
+	if(file.IsStdin())
+	{
+		return;
+	}
+
+	ScopedTrace trace("prefetch");
+
+	int fd = open(file.GetPath().c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		// The scanner will run into the same problem and report it.
+		return;
+	}
+
+	m_num_prefetched++;
+
+#if defined(HAVE_POSIX_FADVISE)
+	// Only prefetch the start of a big file, the kernel's sequential readahead handles the rest of it.
+	off_t len = std::min(file.GetFileSize(), f_max_prefetch_bytes);
+	LOG(INFO) << "Prefetching " << len << " bytes of \'" << file.GetPath() << "\'.";
+	if(len > 0)
+	{
+		// This only starts the read, it doesn't wait for it.  Closing the file doesn't stop it either.
+		(void)posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+	}
+#endif
+
+	close(fd);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_PREFETCHER_H_
+#define SRC_PREFETCHER_H_
+
+#include <config.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "sync_queue_impl_selector.h"
+#include "FileID.h"
+#include "PipelineStats.h"
+
+/**
+ * The --prefetch side stage, which reads ahead of the FileScanners.
+ *
+ * The Globber sends each file it finds to the scanners' queue as usual, and also tells us about it.  Our thread goes
+ * through those files in the same order, asking the OS to start reading each one into the page cache
+ * (posix_fadvise(POSIX_FADV_WILLNEED)), so that the reads are already under way by the time a scanner gets to it.
+ * Nothing waits on us: if we fall behind, we skip the files the scanners have already taken, and catch up.  If we get
+ * more than a "lead" of files ahead of the scanners, we wait for them, so that the prefetched data is still in the
+ * cache when a scanner gets to it.
+ *
+ * The scanners report how long each file took to read.  A read fast enough to have come from the page cache is a hit.
+ * If too many are misses, the prefetching isn't getting far enough ahead, and the lead is doubled.  If nearly all are
+ * hits, the lead is backed off a bit, so we don't hold more of the cache than we need to.
+ *
+ * The files are counted off in the order the Globber reports them, and the scanners' progress by how many they've
+ * taken.  That's only exact with one Globber thread and no reordering in between, which is why --schedule can't be
+ * used with --prefetch.  With several Globber threads it's close enough.
+ */
+class Prefetcher
+{
+public:
+	/**
+	 * @param in_queue  Where the files FileFound() is told about wait for our thread.
+	 */
+	explicit Prefetcher(sync_queue<FileID> &in_queue);
+	~Prefetcher();
+
+	Prefetcher(const Prefetcher&) = delete;
+	Prefetcher& operator=(const Prefetcher&) = delete;
+
+	/// @return true if this platform can prefetch.  If not, don't create a Prefetcher.
+	static bool IsSupported() noexcept;
+
+	/// Start the prefetcher thread.
+	void Start();
+
+	/// Wait for the prefetcher thread to finish.  Call this after @a in_queue has been closed.
+	void Join();
+
+	/**
+	 * Called by the Globber for each file it sends on to the scanners, just before it does.  Never blocks.
+	 */
+	void FileFound(const FileID &file) { m_in_queue.wait_push(FileID(file)); };
+
+	/**
+	 * Called by the scanners as they take each file the Globber found off their queue.
+	 */
+	void FileTaken() noexcept
+	{
+		m_num_taken.fetch_add(1);
+		m_file_taken_cv.notify_one();
+	};
+
+	/**
+	 * Called by the scanners after reading each whole file in, with the time it took to read and its size.
+	 */
+	void ReportRead(ThreadStats::duration read_time, size_t num_bytes);
+
+	/// @return The current lead, in files.
+	size_t GetLead() const noexcept { return m_lead.load(); };
+
+	/// @return The fraction of the reported reads which were hits.
+	double GetHitRate() const noexcept;
+
+	/// @name After Join(), the number of files prefetched, and skipped because the scanners got to them first.
+	///@{
+	size_t GetNumPrefetched() const noexcept { return m_num_prefetched; };
+	size_t GetNumSkipped() const noexcept { return m_num_skipped; };
+	///@}
+
+private:
+
+	void Run();
+
+	/// Start the read of @a file.
+	void Prefetch(const FileID &file) noexcept;
+
+	sync_queue<FileID> &m_in_queue;
+
+	std::thread m_thread;
+
+	/// How many files we get ahead of the scanners.
+	std::atomic<size_t> m_lead;
+
+	/// How many files the scanners have taken.
+	std::atomic<size_t> m_num_taken { 0 };
+
+	/// Only touched by our thread until it's been joined.
+	size_t m_num_prefetched { 0 };
+	size_t m_num_skipped { 0 };
+
+	/// Protects the counts below, and is what the prefetcher thread waits on when it's far enough ahead.
+	mutable std::mutex m_mutex;
+	std::condition_variable m_file_taken_cv;
+
+	/// @name Counts of reads and hits, this adjustment interval and in total.
+	///@{
+	size_t m_interval_reads { 0 };
+	size_t m_interval_hits { 0 };
+	size_t m_total_reads { 0 };
+	size_t m_total_hits { 0 };
+	///@}
+};
+
+#endif /* SRC_PREFETCHER_H_ */
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "SearchPipeline.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "FileScanner.h"
+#include "Globber.h"
+
+namespace
+{
+
+/**
+ * Keeps track of the tasks we've started, so Run() can wait until they've all completely finished with the queues
+ * etc. it was given, and collects the first exception any of them threw.
+ */
+class TaskTracker
+{
+public:
+	/// Wrap @a task so that it's tracked.
+	std::function<void()> Track(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_num_running;
+		}
+		return [this, task](){
+			try
+			{
+				task();
+			}
+			catch(...)
+			{
+				SetException(std::current_exception());
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_num_running;
+			m_cv.notify_all();
+		};
+	}
+
+	void SetException(std::exception_ptr e)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_exception)
+		{
+			m_exception = e;
+		}
+	}
+
+	/// Wait for all the tracked tasks to finish, then rethrow the first exception, if any.
+	void WaitAndRethrow()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this](){ return m_num_running == 0; });
+		if(m_exception)
+		{
+			std::rethrow_exception(m_exception);
+		}
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	int m_num_running { 0 };
+	std::exception_ptr m_exception;
+};
+
+} // namespace
+
+
+SearchPipeline::SearchPipeline(Globber &globber, FileScanner &file_scanner, sync_queue<MatchList> &match_queue)
+	: m_globber(globber), m_file_scanner(file_scanner), m_match_queue(match_queue)
+{
+}
+
+void SearchPipeline::Run(int num_scanners, std::function<void()> on_traversal_done, const std::function<void()> &consume_results,
+		const TaskLauncher &launch_task)
+{
+	// With no TaskLauncher, give each task its own thread.
+	std::vector<std::thread> threads;
+	TaskLauncher launch = launch_task;
+	if(!launch)
+	{
+		launch = [&threads](std::function<void()> task){ threads.emplace_back(std::move(task)); };
+	}
+
+	TaskTracker tracker;
+	std::atomic<int> num_scanners_running { num_scanners };
+
+	// Start the traversal first.  See the class comment.
+	m_globber.Start([&](std::function<void()> worker){ launch(tracker.Track(std::move(worker))); }, std::move(on_traversal_done));
+
+	for(int t = 0; t < num_scanners; ++t)
+	{
+		launch(tracker.Track([&, t](){
+			try
+			{
+				m_file_scanner.Run(t);
+			}
+			catch(...)
+			{
+				if(--num_scanners_running == 0)
+				{
+					m_match_queue.close();
+				}
+				throw;
+			}
+			// The last scanner out closes the queue to the consumer.
+			if(--num_scanners_running == 0)
+			{
+				m_match_queue.close();
+			}
+		}));
+	}
+
+	try
+	{
+		consume_results();
+	}
+	catch(...)
+	{
+		tracker.SetException(std::current_exception());
+
+		// Keep draining the results, so the scanners can finish.
+		MatchList ml;
+		while(m_match_queue.wait_pull(std::move(ml)) != queue_op_status::closed)
+		{
+		}
+	}
+
+	for(auto &thread : threads)
+	{
+		thread.join();
+	}
+	tracker.WaitAndRethrow();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_SEARCHPIPELINE_H_
+#define SRC_SEARCHPIPELINE_H_
+
+#include <config.h>
+
+#include <functional>
+
+#include "sync_queue_impl_selector.h"
+#include "MatchList.h"
+
+class Globber;
+class FileScanner;
+
+/**
+ * The Globber->FileScanner->results pipeline, as run by both ucg and libucg.
+ *
+ * Run() starts the Globber's traversal workers and the FileScanners as tasks, and runs the consumer of the scanners'
+ * results on the calling thread.  Each task is started by a TaskLauncher.  ucg gives each task its own thread, a
+ * libucg caller can have them run on its own thread pool.  The traversal tasks are started first, and never wait on
+ * the scanners, so a pool which runs the tasks in the order they're started, however few threads it has, completes
+ * the traversal before it gets to the scanners, which wait for it.
+ */
+class SearchPipeline
+{
+public:
+	/// Starts one task.
+	using TaskLauncher = std::function<void(std::function<void()> task)>;
+
+	/**
+	 * @param globber       The traversal.  Its output queue has to end up, one way or another, being the
+	 *                      FileScanner's input queue.
+	 * @param file_scanner  The scanner, which sends its results to @a match_queue.
+	 * @param match_queue
+	 */
+	SearchPipeline(Globber &globber, FileScanner &file_scanner, sync_queue<MatchList> &match_queue);
+	~SearchPipeline() = default;
+
+	/**
+	 * Run the search to completion.
+	 *
+	 * @param num_scanners       The number of FileScanner::Run() tasks to start.
+	 * @param on_traversal_done  Called once the traversal is complete, on whichever task completed it.  It has to
+	 *                           close the FileScanner's input queue, after flushing anything still upstream of it.
+	 * @param consume_results    Run on the calling thread.  Pulls the results from the match queue until it's closed,
+	 *                           which happens once the last scanner finishes.
+	 * @param launch_task        Starts the traversal and scanner tasks.  If empty, each task gets its own std::thread.
+	 *
+	 * If any of the tasks or @a consume_results throws, the rest of the search is still run to completion, so that
+	 * nothing is left referring to the queues, and then the first exception thrown is rethrown.
+	 */
+	void Run(int num_scanners, std::function<void()> on_traversal_done, const std::function<void()> &consume_results,
+			const TaskLauncher &launch_task = TaskLauncher());
+
+private:
+	Globber &m_globber;
+	FileScanner &m_file_scanner;
+	sync_queue<MatchList> &m_match_queue;
+};
+
+#endif /* SRC_SEARCHPIPELINE_H_ */
@@ -0,0 +1,653 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "SearchServer.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "DirectoryCache.h"
+#include "Logger.h"
+
+namespace
+{
+
+/**
+ * The fixed-size part of a request.  Sent along with the client's stdin, stdout, and stderr as SCM_RIGHTS
+ * ancillary data, and followed by the working directory and then m_argc strings, each string being sent as a
+ * uint32_t length followed by that many bytes.  The server replies with the int32_t exit status once the search is done.
+ */
+struct RequestHeader
+{
+	char m_magic[4];
+	uint32_t m_version;
+	uint32_t m_cwd_length;
+	uint32_t m_argc;
+};
+
+const char f_request_magic[4] = { 'U', 'C', 'G', 'Q' };
+
+/// Bump this whenever the protocol changes in any way.
+constexpr uint32_t SEARCH_PROTOCOL_VERSION = 1;
+
+/// @name Sanity limits on what we'll accept from a client.
+///@{
+constexpr uint32_t MAX_REQUEST_STRING_LENGTH = 1 << 20;
+constexpr uint32_t MAX_REQUEST_ARGC = 1 << 16;
+///@}
+
+/// The number of file descriptors passed with each request: stdin, stdout, and stderr.
+constexpr int NUM_PASSED_FDS = 3;
+
+/// How long a child waits for any one part of the request before giving up on the client.
+constexpr int REQUEST_READ_TIMEOUT_SECONDS = 10;
+
+/// The self-pipe which the signal handler writes signal numbers to, so that the server's poll() wakes up when a
+/// child exits or we're told to shut down.
+int f_signal_pipe[2] = { -1, -1 };
+
+extern "C" void SignalHandler(int signum)
+{
+	int saved_errno = errno;
+	char c = static_cast<char>(signum);
+	ssize_t retval = write(f_signal_pipe[1], &c, 1);
+	(void)retval;
+	errno = saved_errno;
+}
+
+bool WriteAll(int fd, const void *buffer, size_t length)
+{
+	const char *p = static_cast<const char*>(buffer);
+	while(length > 0)
+	{
+		ssize_t retval = write(fd, p, length);
+		if(retval < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		p += retval;
+		length -= retval;
+	}
+	return true;
+}
+
+bool ReadAll(int fd, void *buffer, size_t length)
+{
+	char *p = static_cast<char*>(buffer);
+	while(length > 0)
+	{
+		ssize_t retval = read(fd, p, length);
+		if(retval < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		if(retval == 0)
+		{
+			// EOF.
+			return false;
+		}
+		p += retval;
+		length -= retval;
+	}
+	return true;
+}
+
+bool ReadString(int fd, uint32_t length, std::string *str)
+{
+	if(length > MAX_REQUEST_STRING_LENGTH)
+	{
+		return false;
+	}
+	str->resize(length);
+	return length == 0 || ReadAll(fd, &(*str)[0], length);
+}
+
+void AppendString(std::string *payload, const std::string &str)
+{
+	uint32_t length = str.size();
+	payload->append(reinterpret_cast<const char*>(&length), sizeof(length));
+	payload->append(str);
+}
+
+/// Fill in @a addr for @a socket_path.  Returns false if the path is too long for a sockaddr_un.
+bool MakeSocketAddress(const std::string &socket_path, struct sockaddr_un *addr)
+{
+	std::memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if(socket_path.empty() || socket_path.size() >= sizeof(addr->sun_path))
+	{
+		return false;
+	}
+	std::memcpy(addr->sun_path, socket_path.c_str(), socket_path.size());
+	return true;
+}
+
+} // namespace
+
+
+SearchServer::SearchServer(std::string socket_path, DirectoryCache *dir_cache, RequestHandler handler)
+	: m_socket_path(std::move(socket_path)), m_dir_cache(dir_cache), m_handler(std::move(handler))
+{
+}
+
+SearchServer::~SearchServer()
+{
+	if(m_listen_fd != -1)
+	{
+		close(m_listen_fd);
+		unlink(m_socket_path.c_str());
+	}
+}
+
+void SearchServer::Run()
+{
+	struct sockaddr_un addr;
+	if(!MakeSocketAddress(m_socket_path, &addr))
+	{
+		throw SearchServerException("invalid socket path \'" + m_socket_path + "\'");
+	}
+
+	// Don't clobber a server which is already running on this socket, but do clean up after one which died.
+	int probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(probe_fd != -1)
+	{
+		bool in_use = (connect(probe_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+		close(probe_fd);
+		if(in_use)
+		{
+			throw SearchServerException("a server is already listening on \'" + m_socket_path + "\'");
+		}
+	}
+	unlink(m_socket_path.c_str());
+
+	m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(m_listen_fd == -1)
+	{
+		throw SearchServerException(std::string("couldn't create socket: ") + std::strerror(errno));
+	}
+
+	// Only the user running the server gets to send it requests.
+	mode_t old_umask = umask(0077);
+	int bind_retval = bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+	int bind_errno = errno;
+	umask(old_umask);
+	if(bind_retval != 0)
+	{
+		close(m_listen_fd);
+		m_listen_fd = -1;
+		throw SearchServerException("couldn't bind to \'" + m_socket_path + "\': " + std::strerror(bind_errno));
+	}
+	if(listen(m_listen_fd, SOMAXCONN) != 0)
+	{
+		throw SearchServerException("couldn't listen on \'" + m_socket_path + "\': " + std::strerror(errno));
+	}
+
+	if(pipe(f_signal_pipe) != 0)
+	{
+		throw SearchServerException(std::string("couldn't create pipe: ") + std::strerror(errno));
+	}
+	fcntl(f_signal_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(f_signal_pipe[1], F_SETFL, O_NONBLOCK);
+
+	struct sigaction sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SignalHandler;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, nullptr);
+	// No SA_RESTART for these, so that they interrupt anything we might be blocked in.
+	sa.sa_flags = 0;
+	sigaction(SIGTERM, &sa, nullptr);
+	sigaction(SIGINT, &sa, nullptr);
+
+	// We don't want to die if a client goes away before we can send its exit status.
+	signal(SIGPIPE, SIG_IGN);
+
+	if(m_dir_cache != nullptr)
+	{
+		// Read in the whole tree before we start taking requests.
+		m_dir_cache->Refresh();
+	}
+
+	LOG(INFO) << "Listening on \'" << m_socket_path << "\'.";
+
+	std::vector<struct pollfd> poll_fds;
+	std::vector<pid_t> poll_fd_pids;
+	bool shutdown = false;
+	while(!shutdown)
+	{
+		// Wait for a new connection, a child to exit, or a client to hang up.
+		poll_fds.clear();
+		poll_fd_pids.clear();
+		poll_fds.push_back({m_listen_fd, POLLIN, 0});
+		poll_fds.push_back({f_signal_pipe[0], POLLIN, 0});
+		// If the cache is disabled, this fd is -1, which poll() ignores.
+		poll_fds.push_back({m_dir_cache != nullptr ? m_dir_cache->GetNotificationFD() : -1, POLLIN, 0});
+		for(const auto &child : m_children)
+		{
+			if(child.second.m_request_read_fd != -1)
+			{
+				// Still reading the request.  This becomes readable (EOF) when the child's done with it.
+				poll_fds.push_back({child.second.m_request_read_fd, POLLIN, 0});
+			}
+			else
+			{
+				// Clients don't send anything after their request, so this only becomes readable if the client goes away.
+				poll_fds.push_back({child.second.m_connection_fd, POLLIN, 0});
+			}
+			poll_fd_pids.push_back(child.first);
+		}
+
+		if(poll(poll_fds.data(), poll_fds.size(), -1) < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			throw SearchServerException(std::string("poll() failed: ") + std::strerror(errno));
+		}
+
+		if(poll_fds[1].revents != 0)
+		{
+			// Drain the self-pipe, checking if we've been asked to shut down.
+			char buf[64];
+			ssize_t num_read;
+			while((num_read = read(f_signal_pipe[0], buf, sizeof(buf))) > 0)
+			{
+				shutdown = shutdown || std::any_of(buf, buf+num_read, [](char c){ return c == SIGTERM || c == SIGINT; });
+			}
+		}
+		ReapChildren();
+
+		if(poll_fds[2].revents != 0)
+		{
+			// Keep up with changes as they happen, so the inotify queue doesn't overflow.
+			m_dir_cache->ProcessEvents();
+		}
+
+		for(size_t i = 0; i < poll_fd_pids.size(); ++i)
+		{
+			auto child = m_children.find(poll_fd_pids[i]);
+			if(poll_fds[i+3].revents == 0 || child == m_children.end())
+			{
+				// Nothing happened, or the child has already been reaped.
+				continue;
+			}
+
+			if(poll_fds[i+3].fd == child->second.m_request_read_fd)
+			{
+				// The child has read the request, start watching for the client to hang up.
+				close(child->second.m_request_read_fd);
+				child->second.m_request_read_fd = -1;
+			}
+			else
+			{
+				// Client went away, e.g. ^C.  Stop the search it was waiting on.
+				LOG(INFO) << "Client of child " << child->first << " hung up, terminating it.";
+				kill(child->first, SIGTERM);
+			}
+		}
+
+		if(!shutdown && (poll_fds[0].revents & POLLIN))
+		{
+			int connection_fd = accept(m_listen_fd, nullptr, nullptr);
+			if(connection_fd != -1)
+			{
+				HandleConnection(connection_fd);
+			}
+		}
+	}
+
+	LOG(INFO) << "Shutting down.";
+
+	// Any searches still running are orphaned at this point.  Let them finish; their clients will see
+	// the connection drop and exit with an error.
+	for(auto &child : m_children)
+	{
+		close(child.second.m_connection_fd);
+		if(child.second.m_request_read_fd != -1)
+		{
+			close(child.second.m_request_read_fd);
+		}
+	}
+	m_children.clear();
+
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	close(f_signal_pipe[0]);
+	close(f_signal_pipe[1]);
+}
+
+void SearchServer::HandleConnection(int connection_fd)
+{
+	if(m_dir_cache != nullptr)
+	{
+		// Bring the cache up to date, so the child gets a current snapshot.
+		m_dir_cache->Refresh();
+	}
+
+	int request_read_pipe[2];
+	if(pipe(request_read_pipe) != 0)
+	{
+		ERROR() << "couldn't create pipe: " << Logger::strerror();
+		close(connection_fd);
+		return;
+	}
+
+	pid_t pid = fork();
+	if(pid == -1)
+	{
+		ERROR() << "fork() failed: " << Logger::strerror();
+		int32_t exit_status = 255;
+		WriteAll(connection_fd, &exit_status, sizeof(exit_status));
+		close(request_read_pipe[0]);
+		close(request_read_pipe[1]);
+		close(connection_fd);
+		return;
+	}
+
+	if(pid == 0)
+	{
+		// We're the child.  Read the request, then become a normal ucg process running the client's command line.
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		close(m_listen_fd);
+		close(f_signal_pipe[0]);
+		close(f_signal_pipe[1]);
+		close(request_read_pipe[0]);
+		for(const auto &child : m_children)
+		{
+			close(child.second.m_connection_fd);
+			if(child.second.m_request_read_fd != -1)
+			{
+				close(child.second.m_request_read_fd);
+			}
+		}
+
+		std::string cwd;
+		std::vector<std::string> args;
+		int client_fds[NUM_PASSED_FDS] = { -1, -1, -1 };
+		int read_status = ReadRequest(connection_fd, client_fds, &cwd, &args);
+
+		// Done with the connection, the parent takes it from here.
+		close(request_read_pipe[1]);
+		close(connection_fd);
+
+		if(read_status != 0)
+		{
+			std::exit(read_status);
+		}
+
+		// What we've logged so far is the server's, so get it out before stderr becomes the client's.
+		Logger::Flush();
+		for(int i = 0; i < NUM_PASSED_FDS; ++i)
+		{
+			dup2(client_fds[i], i);
+		}
+		for(int i = 0; i < NUM_PASSED_FDS; ++i)
+		{
+			if(client_fds[i] >= NUM_PASSED_FDS)
+			{
+				close(client_fds[i]);
+			}
+		}
+
+		if(chdir(cwd.c_str()) != 0)
+		{
+			ERROR() << "couldn't change to directory \'" << cwd << "\': " << Logger::strerror();
+			std::exit(255);
+		}
+
+		std::vector<char*> argv;
+		for(auto &arg : args)
+		{
+			argv.push_back(&arg[0]);
+		}
+		argv.push_back(nullptr);
+
+		int exit_status = m_handler(static_cast<int>(args.size()), argv.data());
+		std::exit(exit_status);
+	}
+
+	// We're the parent.  The child reads the request, we just wait to hear it's done that.
+	close(request_read_pipe[1]);
+	m_children[pid] = { connection_fd, request_read_pipe[0] };
+}
+
+int SearchServer::ReadRequest(int connection_fd, int client_fds[], std::string *cwd, std::vector<std::string> *args)
+{
+	// Don't wait forever on a client which connects and then doesn't send anything.
+	struct timeval timeout = { REQUEST_READ_TIMEOUT_SECONDS, 0 };
+	setsockopt(connection_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	// Receive the header, along with the client's stdin, stdout, and stderr.
+	RequestHeader header;
+	struct iovec iov = { &header, sizeof(header) };
+	union
+	{
+		struct cmsghdr m_align;
+		char m_buf[CMSG_SPACE(sizeof(int) * NUM_PASSED_FDS)];
+	} control;
+	struct msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.m_buf;
+	msg.msg_controllen = sizeof(control.m_buf);
+
+	ssize_t num_received;
+	do
+	{
+		num_received = recvmsg(connection_fd, &msg, MSG_WAITALL);
+	} while(num_received < 0 && errno == EINTR);
+	if(num_received == 0)
+	{
+		// Nothing but a connect() and close(), e.g. another server checking whether we're running.
+		return 255;
+	}
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			std::memcpy(client_fds, CMSG_DATA(cmsg), std::min<size_t>(num_fds, NUM_PASSED_FDS) * sizeof(int));
+		}
+	}
+
+	// Read the rest of the request.
+	bool valid = (num_received == static_cast<ssize_t>(sizeof(header)))
+			&& (std::memcmp(header.m_magic, f_request_magic, sizeof(f_request_magic)) == 0)
+			&& (client_fds[0] != -1) && (client_fds[1] != -1) && (client_fds[2] != -1);
+	if(valid && header.m_version != SEARCH_PROTOCOL_VERSION)
+	{
+		// Let whoever's on the other end know why it's not working.
+		std::string message = "ucg: error: client and server protocol versions differ, restart the server.\n";
+		WriteAll(client_fds[2], message.data(), message.size());
+		valid = false;
+	}
+	valid = valid && (header.m_argc >= 1) && (header.m_argc <= MAX_REQUEST_ARGC) && ReadString(connection_fd, header.m_cwd_length, cwd);
+	for(uint32_t i = 0; valid && i < header.m_argc; ++i)
+	{
+		uint32_t length;
+		std::string arg;
+		valid = ReadAll(connection_fd, &length, sizeof(length)) && ReadString(connection_fd, length, &arg);
+		args->push_back(std::move(arg));
+	}
+	if(!valid)
+	{
+		WARN() << "Ignoring malformed or incomplete request.";
+		return 255;
+	}
+
+	LOG(INFO) << "Request from cwd \'" << *cwd << "\' with " << args->size() << " args.";
+	return 0;
+}
+
+void SearchServer::ReapChildren()
+{
+	int wait_status;
+	pid_t pid;
+
+	while((pid = waitpid(-1, &wait_status, WNOHANG)) > 0)
+	{
+		auto it = m_children.find(pid);
+		if(it == m_children.end())
+		{
+			continue;
+		}
+
+		int32_t exit_status = 255;
+		if(WIFEXITED(wait_status))
+		{
+			exit_status = WEXITSTATUS(wait_status);
+		}
+		else if(WIFSIGNALED(wait_status))
+		{
+			// Same as the shell would report.
+			exit_status = 128 + WTERMSIG(wait_status);
+		}
+		LOG(INFO) << "Child " << pid << " exited with status " << exit_status << ".";
+
+		// The client may have gone away, in which case there's nobody to tell.
+		WriteAll(it->second.m_connection_fd, &exit_status, sizeof(exit_status));
+		close(it->second.m_connection_fd);
+		if(it->second.m_request_read_fd != -1)
+		{
+			close(it->second.m_request_read_fd);
+		}
+		m_children.erase(it);
+	}
+}
+
+
+bool SearchClient::Run(const std::string &socket_path, const std::vector<std::string> &args, int *exit_status)
+{
+	struct sockaddr_un addr;
+	if(!MakeSocketAddress(socket_path, &addr))
+	{
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1)
+	{
+		return false;
+	}
+	if(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		// No server.
+		LOG(INFO) << "Couldn't connect to server on \'" << socket_path << "\': " << Logger::strerror();
+		close(fd);
+		return false;
+	}
+
+	// From here on, we're committed to the server doing the search.
+	signal(SIGPIPE, SIG_IGN);
+	*exit_status = 255;
+
+	std::vector<char> cwd_buf(256);
+	while(getcwd(cwd_buf.data(), cwd_buf.size()) == nullptr)
+	{
+		if(errno != ERANGE)
+		{
+			ERROR() << "couldn't get current directory: " << Logger::strerror();
+			close(fd);
+			return true;
+		}
+		cwd_buf.resize(cwd_buf.size() * 2);
+	}
+	std::string cwd(cwd_buf.data());
+
+	RequestHeader header;
+	std::memcpy(header.m_magic, f_request_magic, sizeof(f_request_magic));
+	header.m_version = SEARCH_PROTOCOL_VERSION;
+	header.m_cwd_length = cwd.size();
+	header.m_argc = args.size();
+
+	// Send the header along with our stdin, stdout, and stderr.
+	int our_fds[NUM_PASSED_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	struct iovec iov = { &header, sizeof(header) };
+	union
+	{
+		struct cmsghdr m_align;
+		char m_buf[CMSG_SPACE(sizeof(our_fds))];
+	} control;
+	std::memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.m_buf;
+	msg.msg_controllen = sizeof(control.m_buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(our_fds));
+	std::memcpy(CMSG_DATA(cmsg), our_fds, sizeof(our_fds));
+
+	std::string payload = cwd;
+	for(const auto &arg : args)
+	{
+		AppendString(&payload, arg);
+	}
+
+	int32_t server_exit_status;
+	if(sendmsg(fd, &msg, 0) != static_cast<ssize_t>(sizeof(header))
+			|| !WriteAll(fd, payload.data(), payload.size())
+			|| !ReadAll(fd, &server_exit_status, sizeof(server_exit_status)))
+	{
+		ERROR() << "lost connection to server on \'" << socket_path << "\'";
+	}
+	else
+	{
+		*exit_status = server_exit_status;
+	}
+
+	close(fd);
+	return true;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file SearchServer.h
+ * The "ucg --server=SOCKET" search daemon, and the "ucg --connect=SOCKET" thin client which talks to it.
+ *
+ * The client sends its argv, working directory, and stdin/stdout/stderr file descriptors over a Unix-domain socket.
+ * The server fork()s a child for each connection as soon as it accepts it, and the child reads the request, so a
+ * client which connects and then sends nothing can't hold up anyone else.  The child chdir()s to the client's
+ * directory, dup2()s the client's descriptors onto its own 0/1/2, and runs the command line as if it were a normal
+ * ucg process.  The output therefore goes straight to the client's terminal or pipe, in exactly the format it would
+ * have had, including color/TTY detection.  When the child exits, the server sends its exit status back, and the
+ * client exits with it.
+ *
+ * Each child gets a copy-on-write copy of the server's already-initialized state, so it skips process startup.
+ * Running it through fork() also isolates requests from each other and from the server, e.g. argp's exit() on bad
+ * options.
+ */
+
+#ifndef SRC_SEARCHSERVER_H_
+#define SRC_SEARCHSERVER_H_
+
+#include <config.h>
+
+#include <sys/types.h>
+
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class DirectoryCache;
+
+/**
+ * SearchServer and SearchClient throw this if they run into trouble setting up the socket.
+ */
+struct SearchServerException : public std::runtime_error
+{
+	SearchServerException(const std::string &message) : std::runtime_error(message) {};
+};
+
+
+/**
+ * The search daemon.
+ */
+class SearchServer
+{
+public:
+	/// The function which runs a request's command line in the fork()ed child, returning the exit status.
+	using RequestHandler = std::function<int(int argc, char **argv)>;
+
+	/**
+	 * @param socket_path  Filesystem path of the Unix-domain socket to listen on.
+	 * @param dir_cache    The directory cache to keep up to date and refresh before each request, or nullptr.
+	 * @param handler      Called in the child process for each request.
+	 */
+	SearchServer(std::string socket_path, DirectoryCache *dir_cache, RequestHandler handler);
+	~SearchServer();
+
+	/**
+	 * Listen for and serve requests until we get a SIGTERM or SIGINT.
+	 * @note Must be called while the process is still single-threaded, since it fork()s.
+	 */
+	void Run();
+
+private:
+
+	/// fork() a child to read and run the request coming in on @a connection_fd.
+	void HandleConnection(int connection_fd);
+
+	/**
+	 * Read a request off of @a connection_fd.  Called in the child, so it's fine for it to block.
+	 *
+	 * @param client_fds  Receives the client's stdin, stdout, and stderr.
+	 * @return  0 on success, otherwise the exit status to send back.
+	 */
+	static int ReadRequest(int connection_fd, int client_fds[], std::string *cwd, std::vector<std::string> *args);
+
+	/// Reap any exited children and send their exit statuses to their clients.
+	void ReapChildren();
+
+	/// What we keep track of for each child still running.
+	struct ChildInfo
+	{
+		/// The connection to the client the child is serving.
+		int m_connection_fd;
+
+		/// The read end of a pipe which the child closes once it has read the request off of m_connection_fd.
+		/// Until then, the connection being readable just means the request hasn't all been read yet, so we can't
+		/// use it to notice the client hanging up.  -1 once the child has closed it.
+		int m_request_read_fd;
+	};
+
+	std::string m_socket_path;
+
+	DirectoryCache *m_dir_cache;
+
+	RequestHandler m_handler;
+
+	int m_listen_fd { -1 };
+
+	/// Map of the child PIDs still running to the connections they're serving.
+	std::map<pid_t, ChildInfo> m_children;
+};
+
+
+/**
+ * The thin client side of --connect.
+ */
+class SearchClient
+{
+public:
+	/**
+	 * Try to send the search to the server listening on @a socket_path.
+	 *
+	 * @param socket_path
+	 * @param args         The command line to send, starting with argv[0].
+	 * @param exit_status  The exit status from the server, if we connected.
+	 * @return  false if there's no server listening on @a socket_path, in which case the caller should just do the
+	 *          search itself.  true if we connected, whether or not the search then succeeded.
+	 */
+	static bool Run(const std::string &socket_path, const std::vector<std::string> &args, int *exit_status);
+};
+
+#endif /* SRC_SEARCHSERVER_H_ */
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "StreamReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "Logger.h"
+
+StreamReader::StreamReader(int file_descriptor, size_t buffer_size)
+	: m_file_descriptor(file_descriptor), m_buffer_size(buffer_size)
+{
+	for(auto &b : m_buffers)
+	{
+		b.m_data.reset(new char[m_buffer_size]);
+	}
+
+#ifdef F_SETPIPE_SZ
+	// If it's a pipe, try to grow its buffer up to ours.  With the default 64KB, a fast producer and we spend most of
+	// our time waking each other up.  This is only a request, the kernel may cap it (see /proc/sys/fs/pipe-max-size).
+	(void)fcntl(m_file_descriptor, F_SETPIPE_SZ, static_cast<int>(m_buffer_size));
+#endif
+
+	// Start reading right away.
+	m_thread = std::thread(&StreamReader::ReadLoop, this);
+}
+
+StreamReader::~StreamReader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+
+	// Note that if the reader thread is blocked in read(), this waits for the next data or EOF.
+	m_thread.join();
+}
+
+size_t StreamReader::Read(char *buffer, size_t len)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Buffer *b = &m_buffers[m_consumer_index];
+
+	if(!b->m_ready)
+	{
+		// Nothing to read yet.  Let the reader thread know we'll take whatever it has, and wait for it.
+		m_consumer_waiting = true;
+		m_cv.wait(lock, [this, b]{ return b->m_ready || m_at_eof; });
+		m_consumer_waiting = false;
+
+		if(!b->m_ready)
+		{
+			// At EOF or an error, and all the data before it has been consumed.
+			if(m_read_errno != 0)
+			{
+				throw StreamReaderException(std::string("read error: ") + std::strerror(m_read_errno));
+			}
+			return 0;
+		}
+	}
+
+	// The reader thread won't touch a ready buffer, so we don't need the lock to copy out of it.
+	lock.unlock();
+
+	size_t num_to_copy = std::min(len, b->m_len - m_consumer_pos);
+	std::memcpy(buffer, b->m_data.get() + m_consumer_pos, num_to_copy);
+	m_consumer_pos += num_to_copy;
+
+	if(m_consumer_pos == b->m_len)
+	{
+		// Used it up, give it back to the reader thread.
+		lock.lock();
+		b->m_ready = false;
+		b->m_len = 0;
+		m_consumer_pos = 0;
+		m_consumer_index ^= 1;
+		lock.unlock();
+		m_cv.notify_all();
+	}
+
+	return num_to_copy;
+}
+
+void StreamReader::ReadLoop()
+{
+	set_thread_name("STREAM_READER");
+
+	int index = 0;
+
+	while(true)
+	{
+		Buffer *b = &m_buffers[index];
+
+		{
+			// Wait for the consumer to be done with this buffer.
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this, b]{ return !b->m_ready || m_stop; });
+			if(m_stop)
+			{
+				return;
+			}
+		}
+
+		// Fill it.
+		bool at_eof = false;
+		int read_errno = 0;
+		size_t len = 0;
+		while(len < m_buffer_size)
+		{
+			ssize_t num_read = read(m_file_descriptor, b->m_data.get() + len, m_buffer_size - len);
+			if(num_read == 0)
+			{
+				at_eof = true;
+				break;
+			}
+			else if(num_read < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+				read_errno = errno;
+				at_eof = true;
+				break;
+			}
+			len += num_read;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if(m_consumer_waiting || m_stop)
+				{
+					// Don't make the consumer wait for a full buffer when it could be working on this.
+					break;
+				}
+			}
+
+			struct pollfd pfd { m_file_descriptor, POLLIN, 0 };
+			if(poll(&pfd, 1, 0) == 0)
+			{
+				// The producer has gone quiet, maybe for a long time (think "tail -f").  Don't sit on what we've got
+				// in another read() until it says something else.
+				break;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(len > 0)
+			{
+				b->m_len = len;
+				b->m_ready = true;
+			}
+			if(at_eof)
+			{
+				m_at_eof = true;
+				m_read_errno = read_errno;
+			}
+		}
+		m_cv.notify_all();
+
+		if(at_eof)
+		{
+			return;
+		}
+
+		index ^= 1;
+	}
+}
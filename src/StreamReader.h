@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_STREAMREADER_H_
+#define SRC_STREAMREADER_H_
+
+#include <config.h>
+
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * StreamReader::Read() will throw this if reading from the stream fails.
+ */
+struct StreamReaderException : public std::runtime_error
+{
+	StreamReaderException(const std::string &message) : std::runtime_error(message) {};
+};
+
+/**
+ * Double-buffered reader for streams we can't seek in or know the size of ahead of time, i.e. stdin and pipes.
+ *
+ * A background thread read()s from the file descriptor into one buffer while the consumer works its way through
+ * the other, so a producer writing into the pipe isn't stalled while we're busy scanning.  A buffer is handed over
+ * when it's full, at EOF, when there's nothing more to read for the moment, or as soon as it has anything in it if the
+ * consumer is sitting idle waiting for data.
+ */
+class StreamReader
+{
+public:
+	/**
+	 * @param file_descriptor  The descriptor to read from.  StreamReader doesn't take ownership of it.
+	 * @param buffer_size      The size of each of the two buffers.
+	 */
+	StreamReader(int file_descriptor, size_t buffer_size);
+	~StreamReader();
+
+	StreamReader(const StreamReader&) = delete;
+	StreamReader& operator=(const StreamReader&) = delete;
+
+	/**
+	 * Copy up to @a len bytes of the stream into @a buffer, blocking until at least one byte is available.
+	 *
+	 * @return  The number of bytes copied.  0 means the end of the stream has been reached.
+	 */
+	size_t Read(char *buffer, size_t len);
+
+private:
+
+	/// The reader thread's main loop.
+	void ReadLoop();
+
+	struct Buffer
+	{
+		std::unique_ptr<char[]> m_data;
+
+		/// Number of valid bytes in m_data.
+		size_t m_len { 0 };
+
+		/// true once the reader thread has handed this buffer over to the consumer, false once the consumer is done with it.
+		bool m_ready { false };
+	};
+
+	int m_file_descriptor;
+
+	size_t m_buffer_size;
+
+	Buffer m_buffers[2];
+
+	/// Index of the buffer the consumer is reading from, and how far into it it's gotten.
+	int m_consumer_index { 0 };
+	size_t m_consumer_pos { 0 };
+
+	std::mutex m_mutex;
+
+	/// Signaled when a buffer is handed over in either direction.
+	std::condition_variable m_cv;
+
+	/// true while the consumer is blocked in Read() waiting for data.
+	bool m_consumer_waiting { false };
+
+	/// true once the reader thread has hit EOF or an error.  It won't hand over any more buffers after that.
+	bool m_at_eof { false };
+
+	/// If the reader thread hit a read() error, its errno.  Reported once the data before it has been consumed.
+	int m_read_errno { 0 };
+
+	/// Set by the destructor to tell the reader thread to stop.
+	bool m_stop { false };
+
+	std::thread m_thread;
+};
+
+#endif /* SRC_STREAMREADER_H_ */
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "TaskPool.h"
+
+#include <exception>
+
+#include "Trace.h"
+
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+/// The index of the TaskPool worker running on this thread, or -1 if this thread isn't one.
+/// @note Only needs to be correct for the one TaskPool we have at a time.
+static thread_local int t_worker_index = -1;
+#endif
+
+TaskPool::TaskPool(int num_workers, const std::function<void(int worker_index)> &on_worker_start)
+{
+	if(num_workers < 1)
+	{
+		num_workers = 1;
+	}
+
+	for(int i = 0; i < num_workers; ++i)
+	{
+		m_workers.emplace_back(new WorkerQueues);
+	}
+	for(int i = 0; i < num_workers; ++i)
+	{
+		m_threads.emplace_back(&TaskPool::WorkerLoop, this, i, on_worker_start);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	try
+	{
+		WaitUntilIdle();
+	}
+	catch(...)
+	{
+		// Nothing we can do with it here.
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_work_available_cv.notify_all();
+
+	for(auto &thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void TaskPool::Submit(Priority priority, Task task)
+{
+	int worker_index = CurrentWorkerIndex();
+	if(worker_index < 0)
+	{
+		worker_index = m_next_worker.fetch_add(1) % m_workers.size();
+	}
+
+	m_num_unfinished++;
+	{
+		WorkerQueues &queues = *m_workers[worker_index];
+		std::lock_guard<std::mutex> lock(queues.m_mutex);
+		queues.m_tasks[static_cast<int>(priority)].push_back(std::move(task));
+	}
+	m_num_queued++;
+
+	// Take the lock before notifying, so that a worker which has just checked m_num_queued and is about to wait
+	// can't miss the notification.
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_work_available_cv.notify_one();
+}
+
+void TaskPool::WaitUntilIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle_cv.wait(lock, [this](){ return m_num_unfinished.load() == 0; });
+
+	if(m_exception)
+	{
+		std::exception_ptr exception = m_exception;
+		m_exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+bool TaskPool::TryGetTask(int worker_index, Task &task)
+{
+	const int num_workers = m_workers.size();
+
+	for(int priority = 0; priority < static_cast<int>(Priority::NUM_PRIORITIES); ++priority)
+	{
+		// Our own tasks first, newest first.
+		{
+			WorkerQueues &queues = *m_workers[worker_index];
+			std::lock_guard<std::mutex> lock(queues.m_mutex);
+			auto &tasks = queues.m_tasks[priority];
+			if(!tasks.empty())
+			{
+				task = std::move(tasks.back());
+				tasks.pop_back();
+				m_num_queued--;
+				return true;
+			}
+		}
+
+		// Then steal the oldest from the other workers.
+		for(int i = 1; i < num_workers; ++i)
+		{
+			WorkerQueues &queues = *m_workers[(worker_index + i) % num_workers];
+			std::lock_guard<std::mutex> lock(queues.m_mutex);
+			auto &tasks = queues.m_tasks[priority];
+			if(!tasks.empty())
+			{
+				task = std::move(tasks.front());
+				tasks.pop_front();
+				m_num_queued--;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+int TaskPool::CurrentWorkerIndex() const
+{
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+	return t_worker_index;
+#else
+	// No thread_local, look ourselves up.
+	auto this_id = std::this_thread::get_id();
+	for(size_t i = 0; i < m_threads.size(); ++i)
+	{
+		if(m_threads[i].get_id() == this_id)
+		{
+			return i;
+		}
+	}
+	return -1;
+#endif
+}
+
+void TaskPool::WorkerLoop(int worker_index, std::function<void(int worker_index)> on_worker_start)
+{
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+	t_worker_index = worker_index;
+#endif
+
+	if(on_worker_start)
+	{
+		on_worker_start(worker_index);
+	}
+
+	Task task;
+	while(true)
+	{
+		if(TryGetTask(worker_index, task))
+		{
+			try
+			{
+				task(worker_index);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if(!m_exception)
+				{
+					m_exception = std::current_exception();
+				}
+			}
+			task = nullptr;
+
+			if(--m_num_unfinished == 0)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_idle_cv.notify_all();
+			}
+			continue;
+		}
+
+		// Nothing to do.  Wait for something to be submitted, or for the pool to be shut down.
+		ScopedTrace idle_trace("idle");
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_work_available_cv.wait(lock, [this](){ return m_stop || m_num_queued.load() > 0; });
+		if(m_stop && m_num_queued.load() == 0)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_TASKPOOL_H_
+#define SRC_TASKPOOL_H_
+
+#include <config.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads with per-worker work-stealing task queues, for --task-pool.
+ *
+ * Each worker has its own deque of tasks for each Priority.  Tasks submitted by a worker go on that worker's own
+ * deques, and are taken back off the same end (LIFO), which keeps e.g. a directory traversal working depth-first
+ * on data that's still in cache.  A worker which runs out of its own work steals from the other end of the other
+ * workers' deques.  Higher-priority tasks are always taken first, from any worker, so that downstream work (output,
+ * then scanning) is drained before more upstream work (directory traversal) is started.
+ */
+class TaskPool
+{
+public:
+	/// The task priorities, highest first.
+	enum class Priority
+	{
+		HIGH,
+		NORMAL,
+		LOW,
+		NUM_PRIORITIES
+	};
+
+	/// The function a task runs.  It's passed the index of the worker running it, [0, GetNumWorkers()).
+	using Task = std::function<void(int worker_index)>;
+
+	/**
+	 * @param num_workers  The number of worker threads.  They're started immediately.
+	 * @param on_worker_start  If not empty, called on each worker thread before it runs any tasks, e.g. to name it.
+	 */
+	TaskPool(int num_workers, const std::function<void(int worker_index)> &on_worker_start = nullptr);
+
+	/// Waits for all tasks to finish, then stops and joins the workers.
+	~TaskPool();
+
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	/**
+	 * Queue up @a task to be run.  If called from a worker, the task goes on that worker's own queue, otherwise
+	 * the workers' queues are filled round-robin.  Tasks may Submit() more tasks.
+	 */
+	void Submit(Priority priority, Task task);
+
+	/**
+	 * Block until every task submitted so far, and every task they submitted in turn, has finished running.
+	 * If a task threw, the first exception thrown is rethrown here.
+	 */
+	void WaitUntilIdle();
+
+	int GetNumWorkers() const noexcept { return static_cast<int>(m_workers.size()); };
+
+private:
+
+	/// The per-worker task queues.
+	struct WorkerQueues
+	{
+		std::mutex m_mutex;
+		std::deque<Task> m_tasks[static_cast<int>(Priority::NUM_PRIORITIES)];
+	};
+
+	void WorkerLoop(int worker_index, std::function<void(int worker_index)> on_worker_start);
+
+	/// @return The index of the worker the calling thread is, or -1 if it isn't one of ours.
+	int CurrentWorkerIndex() const;
+
+	/// Take the highest-priority task we can find, ours or stolen.  @return false if there aren't any.
+	bool TryGetTask(int worker_index, Task &task);
+
+	std::vector<std::unique_ptr<WorkerQueues>> m_workers;
+
+	std::vector<std::thread> m_threads;
+
+	/// Tasks submitted but not yet taken by a worker.
+	std::atomic<long> m_num_queued { 0 };
+
+	/// Tasks submitted but not yet finished, i.e. queued plus running.
+	std::atomic<long> m_num_unfinished { 0 };
+
+	/// Where non-worker threads' Submit()s go next.
+	std::atomic<unsigned int> m_next_worker { 0 };
+
+	/// Protects m_stop and m_exception, and is what idle workers and WaitUntilIdle() wait on.
+	std::mutex m_mutex;
+	std::condition_variable m_work_available_cv;
+	std::condition_variable m_idle_cv;
+	bool m_stop { false };
+	std::exception_ptr m_exception;
+};
+
+#endif /* SRC_TASKPOOL_H_ */
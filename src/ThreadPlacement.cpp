@@ -0,0 +1,507 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "ThreadPlacement.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <future/string.hpp>
+
+#include <dirent.h>
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_SCHED_GETAFFINITY)
+#include <sched.h>
+#endif
+
+#include "Logger.h"
+
+bool ThreadPlacement::m_enabled { false };
+
+/// The CPU affinity mask of each node's CPUs, indexed the same as CpuTopology::m_node_cpus.
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_SCHED_GETAFFINITY)
+static std::vector<cpu_set_t> f_node_cpusets;
+#endif
+
+/// The sweet spot for the number of directory tree traversal threads seems to be 2 on Linux, independent of the
+/// number of scanner threads.  Cygwin does better with 3 or 4 here (and more dirjobs with more scanner threads) since it
+/// spends so much more time in the Windows<->POSIX path resolution logic.
+static constexpr int f_max_default_dirjobs = 2;
+
+/// For each ThreadRole, the number of threads of that role placed so far.
+static std::atomic<unsigned int> f_num_placed[static_cast<int>(ThreadRole::NUM_ROLES)];
+
+/**
+ * Parse a Linux "cpulist" string, e.g. "0-3,8-11", into the list of CPU numbers.
+ */
+static std::vector<int> ParseCpuList(const std::string &cpulist)
+{
+	std::vector<int> retval;
+	std::istringstream iss(cpulist);
+	std::string range;
+
+	while(std::getline(iss, range, ','))
+	{
+		if(range.empty() || !std::isdigit(static_cast<unsigned char>(range[0])))
+		{
+			continue;
+		}
+		char *end;
+		long first = std::strtol(range.c_str(), &end, 10);
+		long last = first;
+		if(*end == '-')
+		{
+			last = std::strtol(end+1, nullptr, 10);
+		}
+		for(long cpu = first; cpu <= last; ++cpu)
+		{
+			retval.push_back(static_cast<int>(cpu));
+		}
+	}
+
+	return retval;
+}
+
+/**
+ * Read a sysfs cpulist file.
+ *
+ * @return The CPUs listed in it, or an empty vector if it couldn't be read.
+ */
+static std::vector<int> ReadCpuListFile(const std::string &path)
+{
+	std::ifstream cpulist_file(path);
+	std::string cpulist;
+
+	if(!std::getline(cpulist_file, cpulist))
+	{
+		return std::vector<int>();
+	}
+	return ParseCpuList(cpulist);
+}
+
+/**
+ * @return The CPUs we're allowed to run on, in ascending order.
+ */
+static std::vector<int> GetAllowedCpus()
+{
+	std::vector<int> retval;
+
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_SCHED_GETAFFINITY)
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if(sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0)
+	{
+		for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if(CPU_ISSET(cpu, &cpuset))
+			{
+				retval.push_back(cpu);
+			}
+		}
+	}
+#endif
+
+	if(retval.empty())
+	{
+		// Couldn't get the affinity mask.  Assume we can use them all.
+		unsigned int num_cpus = std::max(1U, std::thread::hardware_concurrency());
+		for(unsigned int cpu = 0; cpu < num_cpus; ++cpu)
+		{
+			retval.push_back(cpu);
+		}
+	}
+
+	return retval;
+}
+
+/**
+ * @return A cgroup quota of @a quota microseconds of CPU time every @a period microseconds, in CPUs and rounded up,
+ * or 0 if that's no limit at all.
+ */
+static int CpuLimitFromQuota(long long quota, long long period)
+{
+	if(quota <= 0 || period <= 0)
+	{
+		return 0;
+	}
+	return static_cast<int>(std::max(1LL, (quota + period - 1) / period));
+}
+
+int ParseCgroupV2CpuMax(const std::string &cpu_max)
+{
+	// "max 100000" or "<quota> <period>".
+	std::istringstream fields(cpu_max);
+	std::string quota_str;
+	long long period = 0;
+	if(!(fields >> quota_str >> period) || quota_str == "max" || !std::isdigit(static_cast<unsigned char>(quota_str[0])))
+	{
+		return 0;
+	}
+	return CpuLimitFromQuota(std::atoll(quota_str.c_str()), period);
+}
+
+int ParseCgroupV1CfsQuota(const std::string &cfs_quota_us, const std::string &cfs_period_us)
+{
+	// A quota of -1 is no limit.
+	long long quota = -1;
+	long long period = 0;
+	std::istringstream quota_field(cfs_quota_us);
+	std::istringstream period_field(cfs_period_us);
+	if(!(quota_field >> quota) || !(period_field >> period))
+	{
+		return 0;
+	}
+	return CpuLimitFromQuota(quota, period);
+}
+
+/**
+ * @return The first line of the file at @a path, or an empty string if it couldn't be read.
+ */
+static std::string ReadFirstLine(const std::string &path)
+{
+	std::ifstream file(path);
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+
+/**
+ * Read a cgroup's CPU bandwidth limit.
+ *
+ * @param cgroup_dir  The cgroup's directory under the cgroup filesystem mount.
+ * @param v2          true for a cgroup v2 (unified) hierarchy, false for the v1 "cpu" controller.
+ * @return The limit in CPUs, rounded up, or 0 if there's no limit or it couldn't be read.
+ */
+static int ReadCgroupCpuLimit(const std::string &cgroup_dir, bool v2)
+{
+	if(v2)
+	{
+		return ParseCgroupV2CpuMax(ReadFirstLine(cgroup_dir + "/cpu.max"));
+	}
+	else
+	{
+		return ParseCgroupV1CfsQuota(ReadFirstLine(cgroup_dir + "/cpu.cfs_quota_us"),
+				ReadFirstLine(cgroup_dir + "/cpu.cfs_period_us"));
+	}
+}
+
+/**
+ * @return The CPU bandwidth limit of our cgroup, in CPUs and rounded up, or 0 if there's no limit or we couldn't tell.
+ */
+static int GetCgroupCpuLimit()
+{
+	// Find which cgroups we're in.  Lines look like "0::/path" for v2, and "4:cpu,cpuacct:/path" for v1.
+	std::string v2_path, v1_path;
+	bool have_v2 = false, have_v1 = false;
+	std::ifstream proc_cgroup("/proc/self/cgroup");
+	std::string line;
+	while(std::getline(proc_cgroup, line))
+	{
+		auto first_colon = line.find(':');
+		auto second_colon = line.find(':', first_colon+1);
+		if(first_colon == std::string::npos || second_colon == std::string::npos)
+		{
+			continue;
+		}
+		std::string controllers = "," + line.substr(first_colon+1, second_colon-first_colon-1) + ",";
+		std::string path = line.substr(second_colon+1);
+		if(line.compare(0, first_colon, "0") == 0 && controllers == ",,")
+		{
+			v2_path = path;
+			have_v2 = true;
+		}
+		else if(controllers.find(",cpu,") != std::string::npos)
+		{
+			v1_path = path;
+			have_v1 = true;
+		}
+	}
+
+	// Find where those hierarchies are mounted.  The fields of interest are
+	// "<id> <parent> <major:minor> <root> <mount point> <options> [optional fields] - <fstype> <source> <super options>".
+	std::ifstream mountinfo("/proc/self/mountinfo");
+	int limit = 0;
+	while(std::getline(mountinfo, line))
+	{
+		std::istringstream fields(line);
+		std::string field, root, mount_point, fstype, super_options;
+		fields >> field >> field >> field >> root >> mount_point;
+		while(fields >> field && field != "-")
+		{
+		}
+		fields >> fstype >> field >> super_options;
+
+		bool v2;
+		std::string path;
+		if(have_v2 && fstype == "cgroup2")
+		{
+			v2 = true;
+			path = v2_path;
+		}
+		else if(have_v1 && fstype == "cgroup" && ("," + super_options + ",").find(",cpu,") != std::string::npos)
+		{
+			v2 = false;
+			path = v1_path;
+		}
+		else
+		{
+			continue;
+		}
+
+		// Our cgroup's path is relative to the hierarchy's root, but what's mounted may be a subtree of it, e.g. in a
+		// container without its own cgroup namespace.
+		if(root != "/" && path.compare(0, root.length(), root) == 0)
+		{
+			path.erase(0, root.length());
+		}
+
+		// A limit on any ancestor applies to us too, so walk up to the top of the mount and take the smallest.
+		while(true)
+		{
+			int this_limit = ReadCgroupCpuLimit(mount_point + path, v2);
+			if(this_limit > 0 && (limit == 0 || this_limit < limit))
+			{
+				limit = this_limit;
+			}
+			auto last_slash = path.find_last_of('/');
+			if(path.empty() || last_slash == std::string::npos)
+			{
+				break;
+			}
+			path.erase(last_slash);
+		}
+	}
+
+	return limit;
+}
+
+/**
+ * @param skip_smt_siblings  If true, leave out all but the lowest-numbered allowed hardware thread of each core.
+ * @return The CPUs we're allowed to and want to run on, in ascending order.
+ */
+static std::vector<int> GetAllowedCpus(bool skip_smt_siblings)
+{
+	std::vector<int> allowed_cpus = GetAllowedCpus();
+
+	if(!skip_smt_siblings)
+	{
+		return allowed_cpus;
+	}
+
+	std::vector<int> first_threads;
+	for(int cpu : allowed_cpus)
+	{
+		std::vector<int> siblings = ReadCpuListFile("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+		bool is_first = std::none_of(siblings.begin(), siblings.end(), [&](int sibling){
+			return sibling < cpu && std::binary_search(allowed_cpus.begin(), allowed_cpus.end(), sibling);
+		});
+		if(is_first)
+		{
+			first_threads.push_back(cpu);
+		}
+	}
+	return first_threads;
+}
+
+CpuTopology CpuTopology::Detect(bool skip_smt_siblings)
+{
+	CpuTopology retval;
+	std::vector<int> allowed_cpus = GetAllowedCpus(skip_smt_siblings);
+
+	// Find the nodes.
+	std::vector<int> node_ids;
+	DIR *node_dir = opendir("/sys/devices/system/node");
+	if(node_dir != nullptr)
+	{
+		while(struct dirent *entry = readdir(node_dir))
+		{
+			if(std::strncmp(entry->d_name, "node", 4) == 0 && std::isdigit(static_cast<unsigned char>(entry->d_name[4])))
+			{
+				node_ids.push_back(std::atoi(entry->d_name + 4));
+			}
+		}
+		closedir(node_dir);
+	}
+	std::sort(node_ids.begin(), node_ids.end());
+
+	for(int node_id : node_ids)
+	{
+		std::vector<int> node_cpus = ReadCpuListFile("/sys/devices/system/node/node" + std::to_string(node_id) + "/cpulist");
+		std::vector<int> allowed_node_cpus;
+		std::sort(node_cpus.begin(), node_cpus.end());
+		std::set_intersection(node_cpus.begin(), node_cpus.end(), allowed_cpus.begin(), allowed_cpus.end(),
+				std::back_inserter(allowed_node_cpus));
+		if(!allowed_node_cpus.empty())
+		{
+			retval.m_node_cpus.push_back(std::move(allowed_node_cpus));
+			retval.m_node_ids.push_back(node_id);
+		}
+	}
+
+	if(retval.m_node_cpus.empty())
+	{
+		// No NUMA info (e.g. no sysfs, or a kernel without CONFIG_NUMA).  Everything's one node.
+		retval.m_node_cpus.push_back(allowed_cpus);
+		retval.m_node_ids.push_back(0);
+	}
+
+	return retval;
+}
+
+std::string CpuTopology::ToString() const
+{
+	std::string retval;
+
+	for(size_t i = 0; i < m_node_cpus.size(); ++i)
+	{
+		if(i > 0)
+		{
+			retval += "; ";
+		}
+		retval += "node" + std::to_string(m_node_ids[i]) + ":";
+		for(int cpu : m_node_cpus[i])
+		{
+			retval += " " + std::to_string(cpu);
+		}
+	}
+
+	return retval;
+}
+
+int CpuTopology::NumUsableCpus(bool skip_smt_siblings)
+{
+	int num_cpus = GetAllowedCpus(skip_smt_siblings).size();
+	int cgroup_limit = GetCgroupCpuLimit();
+
+	LOG(INFO) << "CPUs in affinity mask: " << num_cpus << (skip_smt_siblings ? " (one per core)" : "")
+			<< ", cgroup CPU limit: " << cgroup_limit;
+
+	if(cgroup_limit > 0 && cgroup_limit < num_cpus)
+	{
+		num_cpus = cgroup_limit;
+	}
+	return std::max(1, num_cpus);
+}
+
+void SetDefaultJobCounts(int &jobs, int &dirjobs, ThreadPlacementMode placement)
+{
+	if(jobs != 0 && dirjobs != 0)
+	{
+		// Nothing to do, and no point looking at /proc and /sys.
+		return;
+	}
+
+	// Threads placed without SMT only ever run on one hardware thread per core, so that's all we have to fill.
+	int num_cpus = CpuTopology::NumUsableCpus(placement == ThreadPlacementMode::NUMA_NO_SMT);
+
+	if(dirjobs == 0)
+	{
+		// One traversal thread until we have enough CPUs that a second won't take much away from the scanners.
+		dirjobs = std::min(f_max_default_dirjobs, std::max(1, num_cpus/4));
+	}
+	if(jobs == 0)
+	{
+		// The traversal threads are mostly blocked in the kernel and are done early, so with only a few CPUs the
+		// scanners get them all.  Past that, leave the traversal threads their own.
+		jobs = (num_cpus < 4) ? num_cpus : num_cpus - dirjobs;
+	}
+
+	LOG(INFO) << "Default jobs: " << jobs << ", dirjobs: " << dirjobs;
+}
+
+bool ThreadPlacement::Enable(ThreadPlacementMode mode)
+{
+	if(mode == ThreadPlacementMode::OS)
+	{
+		m_enabled = false;
+		return true;
+	}
+
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_SCHED_GETAFFINITY)
+	CpuTopology topology = CpuTopology::Detect(mode == ThreadPlacementMode::NUMA_NO_SMT);
+
+	LOG(INFO) << "Thread placement topology: " << topology.ToString();
+
+	f_node_cpusets.clear();
+	for(const auto &node_cpus : topology.m_node_cpus)
+	{
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		for(int cpu : node_cpus)
+		{
+			CPU_SET(cpu, &cpuset);
+		}
+		f_node_cpusets.push_back(cpuset);
+	}
+	for(auto &num_placed : f_num_placed)
+	{
+		num_placed.store(0);
+	}
+
+	m_enabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ThreadPlacement::PlaceThisThread(ThreadRole role) noexcept
+{
+	if(!m_enabled)
+	{
+		return;
+	}
+
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(HAVE_SCHED_GETAFFINITY)
+	unsigned int node_index = f_num_placed[static_cast<int>(role)].fetch_add(1) % f_node_cpusets.size();
+
+	// Pin to the whole node rather than to one CPU, so the scheduler can still balance the threads within it.
+	if(sched_setaffinity(0, sizeof(cpu_set_t), &f_node_cpusets[node_index]) != 0)
+	{
+		LOG(INFO) << "Couldn't set thread affinity: " << LOG_STRERROR();
+	}
+	else if(LOG_ENABLED(INFO))
+	{
+		// Log what the kernel says we're now allowed to run on, not what we asked for.
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		std::string cpus;
+		if(sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0)
+		{
+			for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			{
+				if(CPU_ISSET(cpu, &cpuset))
+				{
+					cpus += " " + std::to_string(cpu);
+				}
+			}
+		}
+		LOG(INFO) << "Placed on node index " << node_index << ", affinity:" << cpus;
+	}
+#else
+	(void)role;
+#endif
+}
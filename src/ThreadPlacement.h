@@ -0,0 +1,128 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#ifndef SRC_THREADPLACEMENT_H_
+#define SRC_THREADPLACEMENT_H_
+
+#include <config.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * How ThreadPlacement puts the scanner and directory traversal threads on CPUs.
+ */
+enum class ThreadPlacementMode
+{
+	OS,          ///< Leave it to the OS scheduler.  The default.
+	NUMA,        ///< Pin each thread to one NUMA node's CPUs, round-robin over the nodes.
+	NUMA_NO_SMT  ///< As NUMA, but only use the first hardware thread of each core.
+};
+
+/**
+ * The kinds of threads which get placed.  Each kind is spread over the nodes separately.
+ */
+enum class ThreadRole
+{
+	SCANNER,
+	GLOBBER,
+	NUM_ROLES
+};
+
+/**
+ * The CPUs this process is allowed to run on, grouped by NUMA node.
+ */
+struct CpuTopology
+{
+	/**
+	 * Read the topology from /sys/devices/system, restricted to the process's CPU affinity mask (which is where
+	 * any cpuset we've been confined to shows up).  Without sysfs NUMA info, all allowed CPUs are in one node.
+	 *
+	 * @param skip_smt_siblings  If true, leave out all but the first allowed hardware thread of each core.
+	 */
+	static CpuTopology Detect(bool skip_smt_siblings);
+
+	/// The allowed CPUs of each node which has any, in node number order.
+	std::vector<std::vector<int>> m_node_cpus;
+
+	/// The node numbers of m_node_cpus[].
+	std::vector<int> m_node_ids;
+
+	/// Human-readable summary for logging, e.g. "node0: 0-3, node1: 4-7".
+	std::string ToString() const;
+
+	/**
+	 * The number of CPUs' worth of time this process can actually use: the number of CPUs in its affinity mask,
+	 * capped by any CPU bandwidth quota (cgroup v2 cpu.max, or v1 cpu.cfs_quota_us) on its cgroup or the cgroup's
+	 * ancestors.  This is what we should size our thread pools to, not the number of CPUs in the host.
+	 *
+	 * @param skip_smt_siblings  If true, count only the first allowed hardware thread of each core, as Detect() does.
+	 */
+	static int NumUsableCpus(bool skip_smt_siblings = false);
+};
+
+/**
+ * Parse the contents of a cgroup v2 cpu.max file, e.g. "max 100000" or "150000 100000".
+ *
+ * @return The CPU bandwidth limit in CPUs, rounded up, or 0 if there's no limit or the contents don't parse.
+ */
+int ParseCgroupV2CpuMax(const std::string &cpu_max);
+
+/**
+ * As ParseCgroupV2CpuMax(), for the contents of a cgroup v1 cpu.cfs_quota_us and cpu.cfs_period_us.
+ */
+int ParseCgroupV1CfsQuota(const std::string &cfs_quota_us, const std::string &cfs_period_us);
+
+/**
+ * Fill in defaults for whichever of @a jobs (scanner threads) and @a dirjobs (directory traversal threads) are 0,
+ * splitting CpuTopology::NumUsableCpus() between them.  With @a placement NUMA_NO_SMT, that's only the CPUs the threads
+ * will be placed on.
+ */
+void SetDefaultJobCounts(int &jobs, int &dirjobs, ThreadPlacementMode placement = ThreadPlacementMode::OS);
+
+/**
+ * Static-only class which pins the pipeline's threads to NUMA nodes, per the --thread-placement mode.
+ *
+ * Placement is done by each thread itself, before it allocates its buffers.  Since Linux by default allocates a
+ * page on the node of the CPU which first touches it, this also keeps each thread's buffers node-local.
+ */
+class ThreadPlacement
+{
+public:
+	ThreadPlacement() = delete;
+
+	/**
+	 * Detect the CPU topology and turn on placement.  Must be called before any of the placed threads are started.
+	 *
+	 * @return false if thread placement isn't supported on this platform, true otherwise.
+	 */
+	static bool Enable(ThreadPlacementMode mode);
+
+	static bool IsEnabled() noexcept { return m_enabled; };
+
+	/**
+	 * Pin the calling thread to the next node in line for threads of @a role.  Does nothing if placement isn't enabled.
+	 */
+	static void PlaceThisThread(ThreadRole role) noexcept;
+
+private:
+	static bool m_enabled;
+};
+
+#endif /* SRC_THREADPLACEMENT_H_ */
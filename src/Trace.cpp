@@ -0,0 +1,206 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>  // For getpid().
+
+#include "Logger.h"
+
+/**
+ * Single-producer ring buffer of trace events for one thread.
+ * Only the owning thread writes to it; it's only read after that thread has been joined.
+ */
+struct TraceBuffer
+{
+	struct Event
+	{
+		const char *m_name;
+		std::int64_t m_ts_ns;
+		char m_phase;
+	};
+
+	/// Number of events each thread can hold before the oldest start getting overwritten.
+	static constexpr size_t m_capacity = 1 << 16;
+
+	explicit TraceBuffer(std::string thread_name) : m_thread_name(std::move(thread_name)), m_events(m_capacity) {};
+
+	void Push(const char *name, char phase, std::int64_t ts_ns) noexcept
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		m_events[head % m_capacity] = Event{name, ts_ns, phase};
+		m_head.store(head+1, std::memory_order_release);
+	};
+
+	std::string m_thread_name;
+
+	std::vector<Event> m_events;
+
+	/// Total number of events ever pushed.
+	std::atomic<size_t> m_head {0};
+};
+
+bool Tracer::m_enabled { false };
+
+/// Start time of the trace.  All timestamps are relative to this.
+static std::chrono::steady_clock::time_point f_trace_start;
+
+/// Mutex protecting f_trace_buffers.  Only taken once per thread, when its buffer is registered.
+static std::mutex f_trace_buffers_mutex;
+
+/// All thread buffers which have been registered.  They live until exit so they can be dumped after the threads are gone.
+static std::vector<std::unique_ptr<TraceBuffer>> f_trace_buffers;
+
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+/// The calling thread's trace buffer, or nullptr if it hasn't recorded anything yet.
+static thread_local TraceBuffer *f_this_threads_buffer { nullptr };
+#endif
+
+bool Tracer::Enable() noexcept
+{
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+	f_trace_start = std::chrono::steady_clock::now();
+	m_enabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Tracer::Record(const char *name, char phase) noexcept
+{
+#if !defined(HAVE_NO_THREAD_LOCAL_SUPPORT)
+	auto ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - f_trace_start).count();
+
+	if(unlikely(f_this_threads_buffer == nullptr))
+	{
+		try
+		{
+			std::unique_ptr<TraceBuffer> buf(new TraceBuffer(get_thread_name()));
+			std::lock_guard<std::mutex> lock(f_trace_buffers_mutex);
+			f_trace_buffers.push_back(std::move(buf));
+			f_this_threads_buffer = f_trace_buffers.back().get();
+		}
+		catch(...)
+		{
+			// Couldn't allocate a buffer.  Drop the event rather than disturb the search.
+			return;
+		}
+	}
+
+	f_this_threads_buffer->Push(name, phase, ts_ns);
+#endif
+}
+
+/// Write #str to #os as a JSON string literal.
+static void WriteJSONString(std::ostream &os, const std::string &str)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+
+	os << '"';
+	for(unsigned char c : str)
+	{
+		switch(c)
+		{
+		case '"': os << "\\\""; break;
+		case '\\': os << "\\\\"; break;
+		case '\n': os << "\\n"; break;
+		case '\t': os << "\\t"; break;
+		default:
+			if(c < 0x20)
+			{
+				os << "\\u00" << hexdigits[c >> 4] << hexdigits[c & 0xF];
+			}
+			else
+			{
+				os << c;
+			}
+			break;
+		}
+	}
+	os << '"';
+}
+
+void Tracer::WriteChromeTraceJSON(std::ostream &os)
+{
+	std::lock_guard<std::mutex> lock(f_trace_buffers_mutex);
+
+	auto pid = getpid();
+	bool first_event = true;
+
+	auto separator = [&]() -> std::ostream& {
+		os << (first_event ? "\n" : ",\n");
+		first_event = false;
+		return os;
+	};
+
+	os << "{\"traceEvents\":[";
+
+	for(size_t tid = 0; tid < f_trace_buffers.size(); ++tid)
+	{
+		const TraceBuffer &buf = *f_trace_buffers[tid];
+
+		// Name the thread.
+		separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"args\":{\"name\":";
+		WriteJSONString(os, buf.m_thread_name);
+		os << "}}";
+
+		size_t head = buf.m_head.load(std::memory_order_acquire);
+		size_t first = (head > TraceBuffer::m_capacity) ? head - TraceBuffer::m_capacity : 0;
+
+		// If the buffer wrapped, the begin events for some of the end events will have been overwritten.
+		// Skip any such orphans so the viewer doesn't get confused.
+		size_t depth = 0;
+		for(size_t i = first; i < head; ++i)
+		{
+			const TraceBuffer::Event &ev = buf.m_events[i % TraceBuffer::m_capacity];
+			if(ev.m_phase == 'E')
+			{
+				if(depth == 0)
+				{
+					continue;
+				}
+				--depth;
+			}
+			else
+			{
+				++depth;
+			}
+
+			separator() << "{\"name\":";
+			WriteJSONString(os, ev.m_name);
+			// Chrome trace timestamps are in microseconds.
+			os << ",\"ph\":\"" << ev.m_phase << "\",\"ts\":" << ev.m_ts_ns / 1000 << '.' << (ev.m_ts_ns % 1000) / 100
+					<< ",\"pid\":" << pid << ",\"tid\":" << tid << "}";
+		}
+	}
+
+	os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
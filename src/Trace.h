@@ -0,0 +1,110 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file Trace.h
+ * Lightweight event tracing for the --trace=FILE option.  Records begin/end events into per-thread ring buffers,
+ * and writes them out as Chrome Trace Event Format JSON, viewable in chrome://tracing or Perfetto.
+ */
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <config.h>
+
+#include <iosfwd>
+
+#include <libext/hints.hpp>
+
+
+/**
+ * Static-only class which owns the global tracing state.
+ */
+class Tracer
+{
+public:
+	Tracer() = delete;
+
+	/**
+	 * Turn tracing on.  Must be called before any of the traced threads are started.
+	 *
+	 * @return false if tracing isn't supported on this platform (no thread_local support), true otherwise.
+	 */
+	static bool Enable() noexcept;
+
+	/// Returns true if tracing is on.  This is the only thing the ScopedTrace fast path checks.
+	static bool IsEnabled() noexcept { return m_enabled; };
+
+	/**
+	 * Record an event for the calling thread.  Only call this if IsEnabled() is true.
+	 * Lock-free except for the first call on any given thread, which registers the thread's ring buffer.
+	 *
+	 * @param name   Name of the event.  Must have static storage duration; only the pointer is stored.
+	 * @param phase  'B' for begin, 'E' for end.
+	 */
+	static void Record(const char *name, char phase) noexcept;
+
+	/**
+	 * Write all recorded events as Chrome trace JSON.  Only call this after all traced threads other than the calling
+	 * thread have been joined.
+	 *
+	 * @param os
+	 */
+	static void WriteChromeTraceJSON(std::ostream &os);
+
+private:
+	static bool m_enabled;
+};
+
+
+/**
+ * RAII helper which records a begin event on construction and the matching end event on destruction.
+ * When tracing is disabled, the cost is one well-predicted branch at each end.
+ */
+class ScopedTrace
+{
+public:
+	explicit ScopedTrace(const char *name) noexcept : m_name(name)
+	{
+		if(unlikely(Tracer::IsEnabled()))
+		{
+			Tracer::Record(m_name, 'B');
+		}
+	};
+
+	~ScopedTrace() noexcept
+	{
+		End();
+	};
+
+	/// End the traced region before the ScopedTrace goes out of scope.  Subsequent calls do nothing.
+	void End() noexcept
+	{
+		if(unlikely(Tracer::IsEnabled() && m_name != nullptr))
+		{
+			Tracer::Record(m_name, 'E');
+		}
+		m_name = nullptr;
+	};
+
+	ScopedTrace(const ScopedTrace&) = delete;
+	ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+	const char *m_name;
+};
+
+#endif /* SRC_TRACE_H_ */
@@ -0,0 +1,570 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "TrigramIndex.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>   // For std::rename().
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <system_error>
+#include <utility>
+
+#include "Logger.h"
+#include "File.h"
+#include "ResizableArray.h"
+
+static const char f_trigram_index_magic[8] = "UCGTRIX";
+
+static constexpr uint32_t TRIGRAM_INDEX_BYTE_ORDER_MARK = 0x01020304;
+
+/// Round @a offset up to the next multiple of 8.
+static inline uint64_t Align8(uint64_t offset) noexcept
+{
+	return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+/// Append @a value to @a out as an unsigned LEB128 varint.
+static void AppendVarint(std::string &out, uint32_t value)
+{
+	while(value >= 0x80)
+	{
+		out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+
+constexpr uint32_t TrigramIndexBuilder::NOT_REUSED;
+
+TrigramIndexBuilder::TrigramIndexBuilder(sync_queue<FileID> &in_queue, const TrigramIndex *previous_index, PipelineStats &pipeline_stats)
+	: m_in_queue(in_queue), m_previous_index(previous_index), m_pipeline_stats(pipeline_stats)
+{
+}
+
+void TrigramIndexBuilder::Run(int thread_index)
+{
+	// Set the name of the thread.
+	set_thread_name("INDEXER_" + std::to_string(thread_index));
+
+	// Create a reusable, resizable buffer for the File() reads.
+	auto file_data_storage = std::make_shared<ResizableArray<char>>();
+
+	// One bit per possible trigram, set if we've seen it in the current file.  We also keep the list of trigrams
+	// we've seen, so that we only have to clear the words we touched instead of the whole 2MB between files.
+	std::vector<uint64_t> trigram_seen(TRIGRAM_SPACE_SIZE / 64, 0);
+	std::vector<trigram_t> trigrams;
+
+	// Results are collected locally and merged in once at the end, so the threads don't contend on the mutex.
+	std::vector<IndexedFile> local_indexed_files;
+
+	// Per-thread --stats counters.
+	ThreadStats thread_stats;
+	const bool collect_stats = m_pipeline_stats.IsEnabled();
+
+	FileID next_file;
+	while(timed_wait_pull(m_in_queue, std::move(next_file), collect_stats, thread_stats.m_queue_pull_wait_time) != queue_op_status::closed)
+	{
+		uint32_t previous_file_index;
+		if(m_previous_index != nullptr && m_previous_index->FindUnchangedFile(next_file, &previous_file_index))
+		{
+			// Unchanged since the previous index was built, so we don't need to read it again.
+			LOG(INFO) << "File \'" << next_file.GetPath() << "\' is unchanged, reusing its previous index entry.";
+			local_indexed_files.push_back({next_file, {}, previous_file_index});
+			continue;
+		}
+
+		try
+		{
+			LOG(INFO) << "Attempting to index file \'" << next_file.GetPath() << "\'";
+			ScopedStatsTimer read_timer(collect_stats, thread_stats.m_read_time);
+			File f(next_file, file_data_storage);
+			read_timer.Stop();
+			thread_stats.m_num_files++;
+			thread_stats.m_num_bytes_read += f.size();
+
+			ScopedStatsTimer scan_timer(collect_stats, thread_stats.m_scan_time);
+			trigrams.clear();
+			if(f.size() >= 3)
+			{
+				const uint8_t *data = reinterpret_cast<const uint8_t*>(f.data());
+				trigram_t t = (static_cast<trigram_t>(TrigramFold(data[0])) << 8) | TrigramFold(data[1]);
+				for(size_t i = 2; i < f.size(); ++i)
+				{
+					t = ((t << 8) | TrigramFold(data[i])) & (TRIGRAM_SPACE_SIZE - 1);
+					uint64_t &word = trigram_seen[t / 64];
+					uint64_t bit = static_cast<uint64_t>(1) << (t % 64);
+					if((word & bit) == 0)
+					{
+						word |= bit;
+						trigrams.push_back(t);
+					}
+				}
+				for(auto seen_trigram : trigrams)
+				{
+					trigram_seen[seen_trigram / 64] = 0;
+				}
+				std::sort(trigrams.begin(), trigrams.end());
+			}
+
+			// Even files with no trigrams get an entry, so that searches know they can skip them.
+			local_indexed_files.push_back({next_file, trigrams, NOT_REUSED});
+		}
+		catch(const FileException &error)
+		{
+			// The File constructor threw an exception.
+			ERROR() << error.what();
+		}
+		catch(const std::system_error& error)
+		{
+			// A system error.  Currently should only be errors from File.
+			ERROR() << error.code() << " - " << error.code().message();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_indexed_files_mutex);
+		std::move(local_indexed_files.begin(), local_indexed_files.end(), std::back_inserter(m_indexed_files));
+	}
+
+	thread_stats.m_thread_name = get_thread_name();
+	m_pipeline_stats.AddThreadStats(PipelineStage::SCANNER, thread_stats);
+}
+
+void TrigramIndexBuilder::Write(const std::string &filename)
+{
+	// Sort the files by (dev, ino), which is how searches will look them up.  Drop any duplicates, which we'll get
+	// from hard links or overlapping start paths.
+	auto by_id = [](const IndexedFile &a, const IndexedFile &b){ return a.m_file_id.GetUniqueFileIdentifier() < b.m_file_id.GetUniqueFileIdentifier(); };
+	auto same_id = [](const IndexedFile &a, const IndexedFile &b){ return a.m_file_id.GetUniqueFileIdentifier() == b.m_file_id.GetUniqueFileIdentifier(); };
+	std::sort(m_indexed_files.begin(), m_indexed_files.end(), by_id);
+	m_indexed_files.erase(std::unique(m_indexed_files.begin(), m_indexed_files.end(), same_id), m_indexed_files.end());
+
+	// Map the previous index's file entries to their new positions.  Entries which aren't reused are for files
+	// which have been deleted, changed, or are no longer part of the indexed tree, and get dropped.
+	size_t num_previous_files = (m_previous_index != nullptr) ? m_previous_index->GetNumFiles() : 0;
+	std::vector<uint32_t> previous_to_new_file_index(num_previous_files, NOT_REUSED);
+	m_num_files_reused = 0;
+
+	// The file entries and their paths.
+	std::vector<TrigramIndexFileEntry> file_entries;
+	std::string paths;
+	file_entries.reserve(m_indexed_files.size());
+	for(const auto &indexed_file : m_indexed_files)
+	{
+		if(indexed_file.m_previous_file_index != NOT_REUSED)
+		{
+			previous_to_new_file_index[indexed_file.m_previous_file_index] = file_entries.size();
+			++m_num_files_reused;
+		}
+
+		const FileID &fid = indexed_file.m_file_id;
+		TrigramIndexFileEntry entry {};
+		entry.m_dev = static_cast<uint64_t>(fid.GetUniqueFileIdentifier().dev());
+		entry.m_ino = static_cast<uint64_t>(fid.GetUniqueFileIdentifier().ino());
+		entry.m_size = fid.GetFileSize();
+		entry.m_mtime_sec = fid.GetModificationTime().tv_sec;
+		entry.m_mtime_nsec = fid.GetModificationTime().tv_nsec;
+		entry.m_path_offset = paths.size();
+		entry.m_path_length = static_cast<uint32_t>(fid.GetPath().size());
+		file_entries.push_back(entry);
+		paths += fid.GetPath();
+	}
+
+	m_num_files_dropped = num_previous_files - m_num_files_reused;
+
+	// Invert the per-file sorted trigram lists into per-trigram posting lists, with a k-way merge.  Popping
+	// (trigram, file index) pairs in ascending order gives us each trigram's postings in ascending file order,
+	// ready for delta encoding, without ever holding more than one copy of the postings in memory.
+	// Reused files' postings come from the previous index's posting list for the same trigram.  Both indexes' file
+	// entries are sorted by (dev, ino), so remapping them keeps them in ascending order too, and we just merge the two.
+	using merge_cursor = std::pair<trigram_t, uint32_t>;
+	std::priority_queue<merge_cursor, std::vector<merge_cursor>, std::greater<merge_cursor>> merge_heap;
+	std::vector<size_t> next_trigram_pos(m_indexed_files.size(), 1);
+	for(uint32_t i = 0; i < m_indexed_files.size(); ++i)
+	{
+		if(!m_indexed_files[i].m_trigrams.empty())
+		{
+			merge_heap.push({m_indexed_files[i].m_trigrams[0], i});
+		}
+	}
+
+	size_t num_previous_trigrams = (m_previous_index != nullptr) ? m_previous_index->GetNumTrigrams() : 0;
+	size_t previous_trigram_pos = 0;
+
+	std::vector<TrigramIndexTrigramEntry> trigram_entries;
+	std::string postings;
+	std::vector<uint32_t> read_file_indices, reused_file_indices, file_indices;
+	while(!merge_heap.empty() || previous_trigram_pos < num_previous_trigrams)
+	{
+		// The next trigram from either source.  TRIGRAM_SPACE_SIZE is one past the largest possible trigram.
+		trigram_t trigram = std::min<trigram_t>(
+				merge_heap.empty() ? TRIGRAM_SPACE_SIZE : merge_heap.top().first,
+				(previous_trigram_pos < num_previous_trigrams) ? m_previous_index->GetTrigramAt(previous_trigram_pos) : TRIGRAM_SPACE_SIZE);
+
+		// Files we read which contain it.
+		read_file_indices.clear();
+		while(!merge_heap.empty() && merge_heap.top().first == trigram)
+		{
+			uint32_t file_index = merge_heap.top().second;
+			merge_heap.pop();
+			read_file_indices.push_back(file_index);
+
+			// Advance this file's cursor.
+			auto &file_trigrams = m_indexed_files[file_index].m_trigrams;
+			size_t &pos = next_trigram_pos[file_index];
+			if(pos < file_trigrams.size())
+			{
+				merge_heap.push({file_trigrams[pos], file_index});
+				++pos;
+			}
+		}
+
+		// Files we reused which contain it.
+		reused_file_indices.clear();
+		if(previous_trigram_pos < num_previous_trigrams && m_previous_index->GetTrigramAt(previous_trigram_pos) == trigram)
+		{
+			for(uint32_t previous_file_index : m_previous_index->GetPostingsAt(previous_trigram_pos))
+			{
+				if(previous_to_new_file_index[previous_file_index] != NOT_REUSED)
+				{
+					reused_file_indices.push_back(previous_to_new_file_index[previous_file_index]);
+				}
+			}
+			++previous_trigram_pos;
+		}
+
+		file_indices.clear();
+		std::merge(read_file_indices.cbegin(), read_file_indices.cend(), reused_file_indices.cbegin(), reused_file_indices.cend(),
+				std::back_inserter(file_indices));
+		if(file_indices.empty())
+		{
+			// Only in files which are gone now.
+			continue;
+		}
+
+		trigram_entries.push_back({trigram, static_cast<uint32_t>(file_indices.size()), postings.size()});
+		uint32_t prev_file_index = 0;
+		for(uint32_t file_index : file_indices)
+		{
+			AppendVarint(postings, file_index - prev_file_index);
+			prev_file_index = file_index;
+		}
+	}
+
+	// Lay out the sections.
+	TrigramIndexHeader header {};
+	std::memcpy(header.m_magic, f_trigram_index_magic, sizeof(header.m_magic));
+	header.m_version = TRIGRAM_INDEX_FORMAT_VERSION;
+	header.m_byte_order_mark = TRIGRAM_INDEX_BYTE_ORDER_MARK;
+	header.m_num_files = file_entries.size();
+	header.m_num_trigrams = trigram_entries.size();
+	header.m_files_offset = Align8(sizeof(header));
+	header.m_trigrams_offset = header.m_files_offset + file_entries.size() * sizeof(TrigramIndexFileEntry);
+	header.m_paths_offset = header.m_trigrams_offset + trigram_entries.size() * sizeof(TrigramIndexTrigramEntry);
+	header.m_postings_offset = Align8(header.m_paths_offset + paths.size());
+	header.m_total_size = header.m_postings_offset + postings.size();
+	paths.resize(header.m_postings_offset - header.m_paths_offset, '\0');
+
+	// Write it all out to a temp file, then move it into place.
+	std::string temp_filename = filename + ".tmp";
+	std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(std::string(header.m_files_offset - sizeof(header), '\0').data(), header.m_files_offset - sizeof(header));
+	out.write(reinterpret_cast<const char*>(file_entries.data()), file_entries.size() * sizeof(TrigramIndexFileEntry));
+	out.write(reinterpret_cast<const char*>(trigram_entries.data()), trigram_entries.size() * sizeof(TrigramIndexTrigramEntry));
+	out.write(paths.data(), paths.size());
+	out.write(postings.data(), postings.size());
+	out.close();
+	if(!out)
+	{
+		std::remove(temp_filename.c_str());
+		throw TrigramIndexException("couldn't write index file \'" + temp_filename + "\'");
+	}
+	if(std::rename(temp_filename.c_str(), filename.c_str()) != 0)
+	{
+		int saved_errno = errno;
+		std::remove(temp_filename.c_str());
+		throw TrigramIndexException("couldn't rename \'" + temp_filename + "\' to \'" + filename + "\': " + std::strerror(saved_errno));
+	}
+
+	LOG(INFO) << "Wrote index \'" << filename << "\': " << header.m_num_files << " files (" << m_num_files_reused
+			<< " reused, " << m_num_files_dropped << " dropped), " << header.m_num_trigrams << " trigrams, " << header.m_total_size << " bytes.";
+}
+
+
+TrigramIndex::TrigramIndex(const std::string &filename) : m_filename(filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		throw TrigramIndexException("couldn't open index file \'" + filename + "\': " + std::strerror(errno));
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		int saved_errno = errno;
+		close(fd);
+		throw TrigramIndexException("couldn't stat index file \'" + filename + "\': " + std::strerror(saved_errno));
+	}
+	m_size = st.st_size;
+	if(m_size < sizeof(TrigramIndexHeader))
+	{
+		close(fd);
+		throw TrigramIndexException("\'" + filename + "\' is too small to be an index file");
+	}
+
+	void *map = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		throw TrigramIndexException("couldn't map index file \'" + filename + "\': " + std::strerror(errno));
+	}
+	m_data = static_cast<const char*>(map);
+	m_header = reinterpret_cast<const TrigramIndexHeader*>(m_data);
+
+	// Validate the header before we trust any of the offsets in it.
+	std::string problem;
+	const auto &h = *m_header;
+	auto section_fits = [this](uint64_t offset, uint64_t count, size_t element_size){
+		return offset <= m_size && (offset % 8) == 0 && count <= (m_size - offset) / element_size;
+	};
+	if(std::memcmp(h.m_magic, f_trigram_index_magic, sizeof(h.m_magic)) != 0)
+	{
+		problem = "isn't an index file";
+	}
+	else if(h.m_version != TRIGRAM_INDEX_FORMAT_VERSION)
+	{
+		problem = "is index format version " + std::to_string(h.m_version) + ", expected version " + std::to_string(TRIGRAM_INDEX_FORMAT_VERSION);
+	}
+	else if(h.m_byte_order_mark != TRIGRAM_INDEX_BYTE_ORDER_MARK)
+	{
+		problem = "was built on a machine with a different byte order";
+	}
+	else if(h.m_total_size != m_size
+			|| !section_fits(h.m_files_offset, h.m_num_files, sizeof(TrigramIndexFileEntry))
+			|| !section_fits(h.m_trigrams_offset, h.m_num_trigrams, sizeof(TrigramIndexTrigramEntry))
+			|| h.m_paths_offset > h.m_postings_offset || h.m_postings_offset > m_size
+			|| h.m_num_files > UINT32_MAX)
+	{
+		problem = "is truncated or corrupt";
+	}
+	if(!problem.empty())
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+		throw TrigramIndexException("index file \'" + filename + "\' " + problem);
+	}
+
+	m_files = reinterpret_cast<const TrigramIndexFileEntry*>(m_data + h.m_files_offset);
+	m_trigrams = reinterpret_cast<const TrigramIndexTrigramEntry*>(m_data + h.m_trigrams_offset);
+}
+
+TrigramIndex::~TrigramIndex()
+{
+	munmap(const_cast<char*>(m_data), m_size);
+}
+
+void TrigramIndex::SetQuery(const TrigramQuery &query)
+{
+	m_candidates = Evaluate(query);
+
+	LOG(INFO) << "Index query: " << query.ToString() << " => "
+			<< (m_candidates.m_all ? GetNumFiles() : m_candidates.m_file_indices.size()) << " of " << GetNumFiles() << " indexed files are candidates.";
+}
+
+bool TrigramIndex::FindUnchangedFile(const FileID &file_id, uint32_t *file_index) const noexcept
+{
+	const TrigramIndexFileEntry *entry = FindFile(file_id);
+	if(entry == nullptr)
+	{
+		// Not in the index, e.g. a file created since the index was built.
+		return false;
+	}
+
+	const struct timespec &mtime = file_id.GetModificationTime();
+	if(entry->m_size != file_id.GetFileSize() || entry->m_mtime_sec != mtime.tv_sec || entry->m_mtime_nsec != mtime.tv_nsec)
+	{
+		// Changed since it was indexed, so what the index says about it is stale.
+		return false;
+	}
+
+	*file_index = static_cast<uint32_t>(entry - m_files);
+	return true;
+}
+
+bool TrigramIndex::FileMightMatch(const FileID &file_id) const noexcept
+{
+	if(m_candidates.m_all)
+	{
+		return true;
+	}
+
+	uint32_t file_index;
+	if(!FindUnchangedFile(file_id, &file_index))
+	{
+		// We don't know anything about this file's current contents.
+		return true;
+	}
+
+	return std::binary_search(m_candidates.m_file_indices.cbegin(), m_candidates.m_file_indices.cend(), file_index);
+}
+
+TrigramIndex::Candidates TrigramIndex::Evaluate(const TrigramQuery &query) const
+{
+	Candidates retval;
+
+	switch(query.GetOp())
+	{
+	case TrigramQuery::Op::ALL:
+		break;
+	case TrigramQuery::Op::TRIGRAM:
+		retval.m_all = false;
+		retval.m_file_indices = GetPostings(query.GetTrigram());
+		break;
+	case TrigramQuery::Op::AND:
+		for(const auto &subquery : query.GetSubqueries())
+		{
+			Candidates sub = Evaluate(subquery);
+			if(sub.m_all)
+			{
+				continue;
+			}
+			if(retval.m_all)
+			{
+				retval = std::move(sub);
+			}
+			else
+			{
+				std::vector<uint32_t> intersection;
+				std::set_intersection(retval.m_file_indices.cbegin(), retval.m_file_indices.cend(),
+						sub.m_file_indices.cbegin(), sub.m_file_indices.cend(), std::back_inserter(intersection));
+				retval.m_file_indices = std::move(intersection);
+			}
+			if(retval.m_file_indices.empty())
+			{
+				// Nothing left to narrow down.
+				break;
+			}
+		}
+		break;
+	case TrigramQuery::Op::OR:
+		retval.m_all = false;
+		for(const auto &subquery : query.GetSubqueries())
+		{
+			Candidates sub = Evaluate(subquery);
+			if(sub.m_all)
+			{
+				return sub;
+			}
+			std::vector<uint32_t> file_union;
+			std::set_union(retval.m_file_indices.cbegin(), retval.m_file_indices.cend(),
+					sub.m_file_indices.cbegin(), sub.m_file_indices.cend(), std::back_inserter(file_union));
+			retval.m_file_indices = std::move(file_union);
+		}
+		break;
+	}
+
+	return retval;
+}
+
+std::vector<uint32_t> TrigramIndex::GetPostings(trigram_t trigram) const
+{
+	std::vector<uint32_t> retval;
+
+	auto trigrams_end = m_trigrams + m_header->m_num_trigrams;
+	auto it = std::lower_bound(m_trigrams, trigrams_end, trigram,
+			[](const TrigramIndexTrigramEntry &entry, trigram_t t){ return entry.m_trigram < t; });
+	if(it == trigrams_end || it->m_trigram != trigram)
+	{
+		// No indexed file contains this trigram.
+		return retval;
+	}
+
+	return DecodePostings(*it);
+}
+
+std::vector<uint32_t> TrigramIndex::DecodePostings(const TrigramIndexTrigramEntry &trigram_entry) const
+{
+	std::vector<uint32_t> retval;
+
+	if(trigram_entry.m_postings_offset > m_size - m_header->m_postings_offset)
+	{
+		// Corrupt.
+		return retval;
+	}
+
+	// Decode the delta-encoded varints, being careful not to run off the end of a corrupt file.
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(m_data + m_header->m_postings_offset) + trigram_entry.m_postings_offset;
+	const uint8_t *end = reinterpret_cast<const uint8_t*>(m_data + m_size);
+	uint32_t file_index = 0;
+	retval.reserve(trigram_entry.m_num_postings);
+	for(uint32_t i = 0; i < trigram_entry.m_num_postings; ++i)
+	{
+		uint32_t delta = 0;
+		int shift = 0;
+		while(p < end && (*p & 0x80) && shift < 28)
+		{
+			delta |= static_cast<uint32_t>(*p & 0x7F) << shift;
+			shift += 7;
+			++p;
+		}
+		if(p >= end)
+		{
+			break;
+		}
+		delta |= static_cast<uint32_t>(*p & 0x7F) << shift;
+		++p;
+		file_index += delta;
+		if(file_index >= GetNumFiles())
+		{
+			break;
+		}
+		retval.push_back(file_index);
+	}
+
+	return retval;
+}
+
+const TrigramIndexFileEntry* TrigramIndex::FindFile(const FileID &file_id) const noexcept
+{
+	dev_ino_pair di = file_id.GetUniqueFileIdentifier();
+	auto key = std::make_pair(static_cast<uint64_t>(di.dev()), static_cast<uint64_t>(di.ino()));
+
+	auto files_end = m_files + GetNumFiles();
+	auto it = std::lower_bound(m_files, files_end, key,
+			[](const TrigramIndexFileEntry &entry, const std::pair<uint64_t, uint64_t> &k){ return std::make_pair(entry.m_dev, entry.m_ino) < k; });
+	if(it == files_end || it->m_dev != key.first || it->m_ino != key.second)
+	{
+		return nullptr;
+	}
+	return it;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file TrigramIndex.h
+ * The persistent trigram index built by "ucg --index" and used by searches to skip files which can't match.
+ *
+ * On-disk format (version 1), all integers in native byte order, all sections 8-byte aligned:
+ *
+ *   TrigramIndexHeader
+ *   TrigramIndexFileEntry[m_num_files]        sorted by (dev, ino)
+ *   TrigramIndexTrigramEntry[m_num_trigrams]  sorted by trigram
+ *   Path string data                          not NUL-terminated
+ *   Posting list data                         per trigram, ascending file entry indices, delta-encoded as LEB128 varints
+ *
+ * The whole file is mmap()ed read-only by searches and used in place; nothing is parsed up front.
+ *
+ * Re-running "ucg --index" over an existing index updates it incrementally: files whose (dev, ino, size, mtime) are
+ * unchanged keep their posting list entries from the old index without being re-read, and only new or changed files
+ * are read.  Since files are identified by (dev, ino) and not path, renames are picked up without re-reading, and
+ * files which have been deleted simply drop out.
+ */
+
+#ifndef SRC_TRIGRAMINDEX_H_
+#define SRC_TRIGRAMINDEX_H_
+
+#include <config.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "sync_queue_impl_selector.h"
+#include "FileID.h"
+#include "PipelineStats.h"
+#include "TrigramQuery.h"
+
+
+/// Bump this whenever the on-disk format changes in any way.  Readers reject any other version.
+constexpr uint32_t TRIGRAM_INDEX_FORMAT_VERSION = 1;
+
+/// Name of the index file used if --index-file isn't given.
+constexpr const char * TRIGRAM_INDEX_DEFAULT_FILENAME = ".ucgindex";
+
+/// The header at the start of every index file.
+struct TrigramIndexHeader
+{
+	/// "UCGTRIX" plus a NUL.
+	char m_magic[8];
+	uint32_t m_version;
+	/// TRIGRAM_INDEX_BYTE_ORDER_MARK as written by the indexing machine.  Lets us reject indexes from other-endian machines.
+	uint32_t m_byte_order_mark;
+	uint64_t m_num_files;
+	uint64_t m_num_trigrams;
+	uint64_t m_files_offset;
+	uint64_t m_trigrams_offset;
+	uint64_t m_paths_offset;
+	uint64_t m_postings_offset;
+	/// Total size of the index file.  Lets us detect truncated files.
+	uint64_t m_total_size;
+};
+
+/// Info on one indexed file.
+struct TrigramIndexFileEntry
+{
+	uint64_t m_dev;
+	uint64_t m_ino;
+	int64_t m_size;
+	int64_t m_mtime_sec;
+	int64_t m_mtime_nsec;
+	uint64_t m_path_offset;
+	uint32_t m_path_length;
+	uint32_t m_reserved;
+};
+
+/// Where the posting list for one trigram is.
+struct TrigramIndexTrigramEntry
+{
+	uint32_t m_trigram;
+	/// Number of file entry indices in the posting list.
+	uint32_t m_num_postings;
+	uint64_t m_postings_offset;
+};
+
+
+/**
+ * Thrown if an index file can't be read or written, or is corrupt or the wrong version.
+ */
+struct TrigramIndexException : public std::runtime_error
+{
+	TrigramIndexException(const std::string &message) : std::runtime_error(message) {};
+};
+
+
+class TrigramIndex;
+
+/**
+ * Builds an index from the files the Globber finds.  Run() is the per-thread worker, one or more of which consume
+ * the Globber's output queue in place of the FileScanners, and Write() serializes the result once they're all done.
+ */
+class TrigramIndexBuilder
+{
+public:
+	/**
+	 * @param in_queue
+	 * @param previous_index  The existing index to update, or nullptr to build from scratch.  Must stay valid until
+	 *                        Write() returns.
+	 * @param pipeline_stats
+	 */
+	TrigramIndexBuilder(sync_queue<FileID> &in_queue, const TrigramIndex *previous_index, PipelineStats &pipeline_stats);
+	~TrigramIndexBuilder() = default;
+
+	void Run(int thread_index);
+
+	/**
+	 * Write the index to @a filename.  Only call this after all Run() threads have returned.
+	 * The index is written to a temporary file and then renamed over @a filename, so concurrent searches always
+	 * see either the old or new index in its entirety.
+	 *
+	 * @param filename
+	 */
+	void Write(const std::string &filename);
+
+	/// @name Stats, valid after Write() returns.
+	///@{
+	size_t GetNumFilesIndexed() const noexcept { return m_indexed_files.size(); };
+	size_t GetNumFilesReused() const noexcept { return m_num_files_reused; };
+	size_t GetNumFilesDropped() const noexcept { return m_num_files_dropped; };
+	///@}
+
+private:
+
+	/// IndexedFile::m_previous_file_index value for files which were read, i.e. weren't reused from the previous index.
+	static constexpr uint32_t NOT_REUSED = UINT32_MAX;
+
+	/// One file's worth of results from Run().
+	struct IndexedFile
+	{
+		FileID m_file_id;
+
+		/// Sorted, unique trigrams found in the file.  Empty if the file was reused from the previous index.
+		std::vector<trigram_t> m_trigrams;
+
+		/// Index of this file's entry in the previous index if it was unchanged and we reused it, else NOT_REUSED.
+		uint32_t m_previous_file_index;
+	};
+
+	sync_queue<FileID>& m_in_queue;
+
+	const TrigramIndex *m_previous_index;
+
+	size_t m_num_files_reused { 0 };
+	size_t m_num_files_dropped { 0 };
+
+	/// Where the per-thread --stats info goes.
+	PipelineStats &m_pipeline_stats;
+
+	std::mutex m_indexed_files_mutex;
+	std::vector<IndexedFile> m_indexed_files;
+};
+
+
+/**
+ * Read-only view of an mmap()ed index file.
+ */
+class TrigramIndex
+{
+public:
+	/**
+	 * Map in the index in @a filename.
+	 * @throws TrigramIndexException if the file can't be opened, or isn't a valid index of the current format version.
+	 */
+	explicit TrigramIndex(const std::string &filename);
+	TrigramIndex(const TrigramIndex&) = delete;
+	TrigramIndex& operator=(const TrigramIndex&) = delete;
+	~TrigramIndex();
+
+	size_t GetNumFiles() const noexcept { return m_header->m_num_files; };
+
+	/// @name Raw access to the trigram table, for updating an index.
+	///@{
+	size_t GetNumTrigrams() const noexcept { return m_header->m_num_trigrams; };
+	trigram_t GetTrigramAt(size_t i) const noexcept { return m_trigrams[i].m_trigram; };
+	std::vector<uint32_t> GetPostingsAt(size_t i) const { return DecodePostings(m_trigrams[i]); };
+	///@}
+
+	/**
+	 * Look up @a file_id, and if it's in the index and hasn't changed since it was indexed, return true and put its
+	 * file entry index in @a file_index.  Thread-safe.
+	 */
+	bool FindUnchangedFile(const FileID &file_id, uint32_t *file_index) const noexcept;
+
+	/**
+	 * Work out which indexed files could match @a query.  Must be called before FileMightMatch().
+	 * @param query
+	 */
+	void SetQuery(const TrigramQuery &query);
+
+	/**
+	 * Returns false only if @a file_id is in the index, is unchanged since it was indexed, and can't match the query
+	 * given to SetQuery().  Thread-safe.
+	 */
+	bool FileMightMatch(const FileID &file_id) const noexcept;
+
+private:
+
+	/// Result of evaluating a (sub)query: a sorted list of file entry indices, or "all files".
+	struct Candidates
+	{
+		bool m_all { true };
+		std::vector<uint32_t> m_file_indices;
+	};
+
+	Candidates Evaluate(const TrigramQuery &query) const;
+
+	/// Decode the posting list for @a trigram.
+	std::vector<uint32_t> GetPostings(trigram_t trigram) const;
+
+	std::vector<uint32_t> DecodePostings(const TrigramIndexTrigramEntry &trigram_entry) const;
+
+	/// Returns the entry for @a file_id, or nullptr if it isn't in the index.
+	const TrigramIndexFileEntry* FindFile(const FileID &file_id) const noexcept;
+
+	std::string m_filename;
+
+	const char *m_data { nullptr };
+	size_t m_size { 0 };
+
+	const TrigramIndexHeader *m_header { nullptr };
+	const TrigramIndexFileEntry *m_files { nullptr };
+	const TrigramIndexTrigramEntry *m_trigrams { nullptr };
+
+	/// The result of SetQuery().
+	Candidates m_candidates;
+};
+
+#endif /* SRC_TRIGRAMINDEX_H_ */
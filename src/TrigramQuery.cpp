@@ -0,0 +1,739 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "TrigramQuery.h"
+
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+
+/// Thrown by RegexTrigramExtractor when it runs into a regex construct it doesn't handle.  Never escapes this file.
+struct UnsupportedRegexConstruct {};
+
+/**
+ * Recursive-descent walker over PCRE pattern syntax which finds the literal strings every match must contain.
+ *
+ * This doesn't have to understand the whole syntax, it only has to never claim a literal is required when it isn't.
+ * Anything which isn't a plain literal byte (classes, ".", anchors, lookarounds, backreferences, etc.) just ends the
+ * current literal run, and anything we don't recognize at all gives up on the whole pattern.
+ */
+class RegexTrigramExtractor
+{
+public:
+	explicit RegexTrigramExtractor(const std::string &regex) : m_re(regex) {};
+
+	TrigramQuery Extract()
+	{
+		try
+		{
+			TrigramQuery retval = ParseAlternation();
+			if(!AtEnd())
+			{
+				// Unbalanced ')'.  The regex engine will complain about this, we'll just not help.
+				return TrigramQuery::All();
+			}
+			return retval;
+		}
+		catch(const UnsupportedRegexConstruct &)
+		{
+			return TrigramQuery::All();
+		}
+		catch(const std::logic_error &)
+		{
+			// std::stoul() choked on an absurdly large repeat count or similar.
+			return TrigramQuery::All();
+		}
+	}
+
+private:
+
+	/// What ParseAtom() found.
+	enum class AtomType
+	{
+		EMPTY,		//!< Nothing which consumes or constrains text, e.g. an inline "(?i)".
+		LITERAL,	//!< One or more literal bytes.
+		GROUP,		//!< A (possibly non-capturing) group.
+		OTHER		//!< Anything else: classes, ".", anchors, lookarounds, backreferences...
+	};
+
+	struct Atom
+	{
+		Atom(AtomType type = AtomType::OTHER) : m_type(type) {};
+		Atom(std::string literal) : m_type(AtomType::LITERAL), m_literal(std::move(literal)) {};
+		Atom(TrigramQuery query) : m_type(AtomType::GROUP), m_query(std::move(query)) {};
+
+		AtomType m_type;
+		std::string m_literal;
+		TrigramQuery m_query;
+	};
+
+	struct Quantifier
+	{
+		bool m_present { false };
+		unsigned long m_min { 1 };
+	};
+
+	bool AtEnd() const noexcept { return m_pos >= m_re.size(); };
+
+	/// Returns the char @a ahead chars from the current position, or '\0' if that's past the end.
+	char Peek(size_t ahead = 0) const noexcept { return (m_pos + ahead < m_re.size()) ? m_re[m_pos + ahead] : '\0'; };
+
+	/// Skip past the next occurrence of @a terminator.
+	void SkipPast(char terminator)
+	{
+		auto end = m_re.find(terminator, m_pos);
+		if(end == std::string::npos)
+		{
+			throw UnsupportedRegexConstruct();
+		}
+		m_pos = end + 1;
+	}
+
+	/// Skip [-+]?[0-9]*.
+	void SkipSignedDigits()
+	{
+		if(Peek() == '-' || Peek() == '+')
+		{
+			++m_pos;
+		}
+		while(std::isdigit(static_cast<unsigned char>(Peek())))
+		{
+			++m_pos;
+		}
+	}
+
+	TrigramQuery ParseAlternation()
+	{
+		std::vector<TrigramQuery> branches;
+
+		branches.push_back(ParseConcatenation());
+		while(Peek() == '|' && !AtEnd())
+		{
+			++m_pos;
+			branches.push_back(ParseConcatenation());
+		}
+
+		return TrigramQuery::Or(std::move(branches));
+	}
+
+	TrigramQuery ParseConcatenation()
+	{
+		std::vector<TrigramQuery> terms;
+		std::string run;
+
+		auto end_run = [&terms, &run](){ terms.push_back(TrigramQuery::FromLiteral(run)); run.clear(); };
+
+		while(!AtEnd() && Peek() != '|' && Peek() != ')')
+		{
+			Atom atom = ParseAtom();
+			Quantifier quantifier = ParseQuantifier();
+
+			switch(atom.m_type)
+			{
+			case AtomType::EMPTY:
+				break;
+			case AtomType::LITERAL:
+			{
+				// A quantifier only applies to the last byte of a multi-byte (\Q...\E) literal.
+				run.append(atom.m_literal, 0, atom.m_literal.size()-1);
+				char last = atom.m_literal.back();
+				if(!quantifier.m_present)
+				{
+					run.push_back(last);
+				}
+				else if(quantifier.m_min == 0)
+				{
+					// Optional, so the run can't extend across it.
+					end_run();
+				}
+				else
+				{
+					// Present at least once, but we don't know what follows it.
+					run.push_back(last);
+					end_run();
+				}
+				break;
+			}
+			case AtomType::GROUP:
+				end_run();
+				if(!quantifier.m_present || quantifier.m_min > 0)
+				{
+					terms.push_back(std::move(atom.m_query));
+				}
+				break;
+			case AtomType::OTHER:
+				end_run();
+				break;
+			}
+		}
+		end_run();
+
+		return TrigramQuery::And(std::move(terms));
+	}
+
+	/**
+	 * Returns true if the '{' at @a pos starts something that looks like it could be a quantifier, e.g. "{ 1, 2 }",
+	 * but isn't one of the strict forms ParseQuantifier() handles.  Newer PCRE2s accept some of these.
+	 */
+	bool LooksLikeLooseQuantifier(size_t pos) const noexcept
+	{
+		auto end = m_re.find('}', pos);
+		if(end == std::string::npos)
+		{
+			return false;
+		}
+		return m_re.find_first_not_of("0123456789, \t", pos+1) == end;
+	}
+
+	Quantifier ParseQuantifier()
+	{
+		Quantifier q;
+
+		switch(Peek())
+		{
+		case '*':
+		case '?':
+			q.m_present = true;
+			q.m_min = 0;
+			++m_pos;
+			break;
+		case '+':
+			q.m_present = true;
+			q.m_min = 1;
+			++m_pos;
+			break;
+		case '{':
+		{
+			// {n}, {n,}, {n,m}, or {,m}.
+			size_t p = m_pos + 1;
+			size_t min_start = p;
+			while(p < m_re.size() && std::isdigit(static_cast<unsigned char>(m_re[p])))
+			{
+				++p;
+			}
+			bool has_min = (p > min_start);
+			bool has_max = false;
+			if(p < m_re.size() && m_re[p] == ',')
+			{
+				++p;
+				size_t max_start = p;
+				while(p < m_re.size() && std::isdigit(static_cast<unsigned char>(m_re[p])))
+				{
+					++p;
+				}
+				has_max = (p > max_start);
+			}
+			if(p < m_re.size() && m_re[p] == '}' && (has_min || has_max))
+			{
+				q.m_present = true;
+				q.m_min = has_min ? std::stoul(m_re.substr(min_start, p - min_start)) : 0;
+				m_pos = p + 1;
+				break;
+			}
+			// Not a quantifier.  ParseAtom() will deal with it.
+			return q;
+		}
+		default:
+			return q;
+		}
+
+		// Skip any lazy or possessive modifier.
+		if(Peek() == '?' || Peek() == '+')
+		{
+			++m_pos;
+		}
+
+		return q;
+	}
+
+	Atom ParseAtom()
+	{
+		char c = m_re[m_pos++];
+
+		switch(c)
+		{
+		case '(':
+			return ParseGroup();
+		case '[':
+			SkipCharacterClass();
+			return Atom(AtomType::OTHER);
+		case '.':
+		case '^':
+		case '$':
+			return Atom(AtomType::OTHER);
+		case '\\':
+			return ParseEscape();
+		case '*':
+		case '+':
+		case '?':
+			// Quantifier with nothing to quantify.
+			throw UnsupportedRegexConstruct();
+		case '{':
+			if(LooksLikeLooseQuantifier(m_pos-1))
+			{
+				throw UnsupportedRegexConstruct();
+			}
+			return Atom(std::string(1, c));
+		default:
+			return Atom(std::string(1, c));
+		}
+	}
+
+	/// Parse the rest of a group, after the "(" and any "?..." prefix, including the closing ")".
+	TrigramQuery ParseGroupBody()
+	{
+		TrigramQuery retval = ParseAlternation();
+		if(Peek() != ')' || AtEnd())
+		{
+			throw UnsupportedRegexConstruct();
+		}
+		++m_pos;
+		return retval;
+	}
+
+	Atom ParseGroup()
+	{
+		if(Peek() == '*')
+		{
+			// Verbs, e.g. (*ACCEPT), which can change what has to match.
+			throw UnsupportedRegexConstruct();
+		}
+
+		if(Peek() != '?')
+		{
+			// Plain capturing group.
+			return Atom(ParseGroupBody());
+		}
+
+		++m_pos;
+		char c = Peek();
+		switch(c)
+		{
+		case ':':
+		case '|':
+		case '>':
+			// Non-capturing, branch reset, and atomic groups.
+			++m_pos;
+			return Atom(ParseGroupBody());
+		case '=':
+		case '!':
+			// Lookaheads.
+			++m_pos;
+			ParseGroupBody();
+			return Atom(AtomType::OTHER);
+		case '<':
+			if(Peek(1) == '=' || Peek(1) == '!')
+			{
+				// Lookbehinds.
+				m_pos += 2;
+				ParseGroupBody();
+				return Atom(AtomType::OTHER);
+			}
+			// Named group, (?<name>...).
+			SkipPast('>');
+			return Atom(ParseGroupBody());
+		case '\'':
+			// Named group, (?'name'...).
+			++m_pos;
+			SkipPast('\'');
+			return Atom(ParseGroupBody());
+		case 'P':
+			if(Peek(1) == '<')
+			{
+				// Named group, (?P<name>...).
+				SkipPast('>');
+				return Atom(ParseGroupBody());
+			}
+			// (?P=name) backreference or (?P>name) subroutine call.
+			SkipPast(')');
+			return Atom(AtomType::OTHER);
+		case '#':
+			// Comment.
+			SkipPast(')');
+			return Atom(AtomType::EMPTY);
+		case 'R':
+		case '&':
+			// Recursion and subroutine calls.
+			SkipPast(')');
+			return Atom(AtomType::OTHER);
+		case '(':
+		case 'C':
+			// Conditionals and callouts.
+			throw UnsupportedRegexConstruct();
+		default:
+			break;
+		}
+
+		if(std::isdigit(static_cast<unsigned char>(c))
+				|| ((c == '+' || c == '-') && std::isdigit(static_cast<unsigned char>(Peek(1)))))
+		{
+			// Numbered subroutine call, e.g. (?1) or (?-1).
+			SkipPast(')');
+			return Atom(AtomType::OTHER);
+		}
+
+		// Must be option settings, (?imsx-imsx) or (?imsx-imsx:...).
+		while(std::isalpha(static_cast<unsigned char>(Peek())) || Peek() == '-' || Peek() == '^')
+		{
+			if(Peek() == 'x')
+			{
+				// Extended mode changes what whitespace and '#' mean.
+				throw UnsupportedRegexConstruct();
+			}
+			++m_pos;
+		}
+		if(Peek() == ')')
+		{
+			// Case is already folded in the index, and none of the other options affect which literals are required.
+			++m_pos;
+			return Atom(AtomType::EMPTY);
+		}
+		if(Peek() == ':')
+		{
+			++m_pos;
+			return Atom(ParseGroupBody());
+		}
+		throw UnsupportedRegexConstruct();
+	}
+
+	/// Skip the rest of a character class, after the opening '['.
+	void SkipCharacterClass()
+	{
+		if(Peek() == '^')
+		{
+			++m_pos;
+		}
+		if(Peek() == ']')
+		{
+			// A ']' right after the '[' or '[^' is a literal.
+			++m_pos;
+		}
+		while(!AtEnd())
+		{
+			char c = m_re[m_pos++];
+			if(c == '\\')
+			{
+				if(AtEnd() || Peek() == 'Q')
+				{
+					throw UnsupportedRegexConstruct();
+				}
+				++m_pos;
+			}
+			else if(c == '[' && (Peek() == ':' || Peek() == '.' || Peek() == '='))
+			{
+				// POSIX class, e.g. "[:alpha:]".
+				auto end = m_re.find(std::string(1, Peek()) + "]", m_pos + 1);
+				if(end == std::string::npos)
+				{
+					throw UnsupportedRegexConstruct();
+				}
+				m_pos = end + 2;
+			}
+			else if(c == ']')
+			{
+				return;
+			}
+		}
+		throw UnsupportedRegexConstruct();
+	}
+
+	/// Parse the rest of an escape sequence, after the '\'.
+	Atom ParseEscape()
+	{
+		if(AtEnd())
+		{
+			throw UnsupportedRegexConstruct();
+		}
+
+		char c = m_re[m_pos++];
+		switch(c)
+		{
+		case 'Q':
+		{
+			// Quoted literal, up to the next \E or the end of the pattern.
+			auto end = m_re.find("\\E", m_pos);
+			std::string literal = m_re.substr(m_pos, end == std::string::npos ? std::string::npos : end - m_pos);
+			m_pos = (end == std::string::npos) ? m_re.size() : end + 2;
+			return literal.empty() ? Atom(AtomType::EMPTY) : Atom(literal);
+		}
+		case 'E':
+			return Atom(AtomType::EMPTY);
+		case 't': return Atom(std::string(1, '\t'));
+		case 'n': return Atom(std::string(1, '\n'));
+		case 'r': return Atom(std::string(1, '\r'));
+		case 'f': return Atom(std::string(1, '\f'));
+		case 'a': return Atom(std::string(1, '\a'));
+		case 'e': return Atom(std::string(1, '\x1B'));
+		case 'x':
+		{
+			// \xhh or \x{hhh...}.  We never run the regex engines in UTF mode, so anything up to 0xFF is a single byte.
+			std::string hex;
+			if(Peek() == '{')
+			{
+				auto end = m_re.find('}', m_pos);
+				if(end == std::string::npos)
+				{
+					throw UnsupportedRegexConstruct();
+				}
+				hex = m_re.substr(m_pos + 1, end - m_pos - 1);
+				m_pos = end + 1;
+			}
+			else
+			{
+				while(hex.size() < 2 && std::isxdigit(static_cast<unsigned char>(Peek())))
+				{
+					hex.push_back(m_re[m_pos++]);
+				}
+			}
+			if(hex.empty() || hex.size() > 2 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+			{
+				return Atom(AtomType::OTHER);
+			}
+			return Atom(std::string(1, static_cast<char>(std::stoul(hex, nullptr, 16))));
+		}
+		case 'o':
+		case 'N':
+			// \o{...} octal, \N{U+...} code point, or \N "not a newline".
+			if(Peek() == '{')
+			{
+				SkipPast('}');
+			}
+			return Atom(AtomType::OTHER);
+		case 'c':
+			// Control char.
+			++m_pos;
+			return Atom(AtomType::OTHER);
+		case 'p':
+		case 'P':
+			// Unicode property.
+			if(Peek() == '{')
+			{
+				SkipPast('}');
+			}
+			else
+			{
+				++m_pos;
+			}
+			return Atom(AtomType::OTHER);
+		case 'g':
+		case 'k':
+			// Backreferences and subroutine calls.
+			switch(Peek())
+			{
+			case '{': SkipPast('}'); break;
+			case '<': SkipPast('>'); break;
+			case '\'': ++m_pos; SkipPast('\''); break;
+			default: SkipSignedDigits(); break;
+			}
+			return Atom(AtomType::OTHER);
+		case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+		case 'h': case 'H': case 'v': case 'V': case 'R': case 'X': case 'C':
+		case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G': case 'K':
+			// Character types, assertions, and match start resets.
+			return Atom(AtomType::OTHER);
+		default:
+			break;
+		}
+
+		if(std::isdigit(static_cast<unsigned char>(c)))
+		{
+			// Backreference or octal escape.
+			SkipSignedDigits();
+			return Atom(AtomType::OTHER);
+		}
+		if(std::isalnum(static_cast<unsigned char>(c)))
+		{
+			// Something we don't know about.
+			throw UnsupportedRegexConstruct();
+		}
+
+		// Escaped punctuation etc. is just that char.
+		return Atom(std::string(1, c));
+	}
+
+	const std::string &m_re;
+
+	size_t m_pos { 0 };
+};
+
+} // namespace
+
+
+TrigramQuery TrigramQuery::FromPattern(const std::string &pattern, bool pattern_is_literal)
+{
+	if(pattern_is_literal)
+	{
+		return FromLiteral(pattern);
+	}
+
+	return RegexTrigramExtractor(pattern).Extract();
+}
+
+TrigramQuery TrigramQuery::Trigram(trigram_t trigram)
+{
+	TrigramQuery retval;
+	retval.m_op = Op::TRIGRAM;
+	retval.m_trigram = trigram;
+	return retval;
+}
+
+TrigramQuery TrigramQuery::And(std::vector<TrigramQuery> subqueries)
+{
+	TrigramQuery retval;
+	std::set<trigram_t> trigrams_seen;
+
+	for(auto &q : subqueries)
+	{
+		switch(q.m_op)
+		{
+		case Op::ALL:
+			// No constraint.
+			break;
+		case Op::AND:
+			// Flatten.
+			for(auto &sq : q.m_subqueries)
+			{
+				if(sq.m_op != Op::TRIGRAM || trigrams_seen.insert(sq.m_trigram).second)
+				{
+					retval.m_subqueries.push_back(std::move(sq));
+				}
+			}
+			break;
+		case Op::TRIGRAM:
+			if(trigrams_seen.insert(q.m_trigram).second)
+			{
+				retval.m_subqueries.push_back(std::move(q));
+			}
+			break;
+		default:
+			retval.m_subqueries.push_back(std::move(q));
+			break;
+		}
+	}
+
+	if(retval.m_subqueries.empty())
+	{
+		return All();
+	}
+	if(retval.m_subqueries.size() == 1)
+	{
+		return std::move(retval.m_subqueries[0]);
+	}
+	retval.m_op = Op::AND;
+	return retval;
+}
+
+TrigramQuery TrigramQuery::Or(std::vector<TrigramQuery> subqueries)
+{
+	TrigramQuery retval;
+
+	for(auto &q : subqueries)
+	{
+		switch(q.m_op)
+		{
+		case Op::ALL:
+			// If any branch can match anything, so can the whole alternation.
+			return All();
+		case Op::OR:
+			// Flatten.
+			for(auto &sq : q.m_subqueries)
+			{
+				retval.m_subqueries.push_back(std::move(sq));
+			}
+			break;
+		default:
+			retval.m_subqueries.push_back(std::move(q));
+			break;
+		}
+	}
+
+	if(retval.m_subqueries.empty())
+	{
+		return All();
+	}
+	if(retval.m_subqueries.size() == 1)
+	{
+		return std::move(retval.m_subqueries[0]);
+	}
+	retval.m_op = Op::OR;
+	return retval;
+}
+
+TrigramQuery TrigramQuery::FromLiteral(const std::string &literal)
+{
+	std::vector<TrigramQuery> trigrams;
+
+	for(size_t i = 0; i + 2 < literal.size(); ++i)
+	{
+		trigrams.push_back(Trigram(MakeTrigram(literal[i], literal[i+1], literal[i+2])));
+	}
+
+	return And(std::move(trigrams));
+}
+
+std::string TrigramQuery::ToString() const
+{
+	std::ostringstream ss;
+
+	switch(m_op)
+	{
+	case Op::ALL:
+		ss << "ALL";
+		break;
+	case Op::TRIGRAM:
+		ss << '"';
+		for(int shift = 16; shift >= 0; shift -= 8)
+		{
+			auto c = static_cast<unsigned char>(m_trigram >> shift);
+			if(std::isprint(c) && c != '"' && c != '\\')
+			{
+				ss << c;
+			}
+			else
+			{
+				ss << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(c) << std::dec;
+			}
+		}
+		ss << '"';
+		break;
+	case Op::AND:
+	case Op::OR:
+		ss << '(';
+		for(size_t i = 0; i < m_subqueries.size(); ++i)
+		{
+			if(i > 0)
+			{
+				ss << (m_op == Op::AND ? " AND " : " OR ");
+			}
+			ss << m_subqueries[i].ToString();
+		}
+		ss << ')';
+		break;
+	}
+
+	return ss.str();
+}
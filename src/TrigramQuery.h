@@ -0,0 +1,109 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file TrigramQuery.h
+ * Conversion of a search PATTERN into a boolean query over the trigrams any matching file must contain.
+ * Used with the --index trigram index to rule out files without reading them.
+ */
+
+#ifndef SRC_TRIGRAMQUERY_H_
+#define SRC_TRIGRAMQUERY_H_
+
+#include <config.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/// A trigram: three consecutive bytes, ASCII case-folded, packed into the low 24 bits of a uint32_t.
+using trigram_t = uint32_t;
+
+/// Number of distinct trigram_t values.
+constexpr size_t TRIGRAM_SPACE_SIZE = 1 << 24;
+
+/**
+ * Fold a byte for trigram purposes.  ASCII letters are lowercased, everything else is left alone.
+ * This matches how the regex engines ignore case (we never enable UTF/UCP), so a single case-folded index can
+ * answer both case-sensitive and case-insensitive queries.
+ */
+inline uint8_t TrigramFold(uint8_t c) noexcept
+{
+	return (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
+}
+
+/// Pack three bytes into a trigram_t.
+inline trigram_t MakeTrigram(uint8_t c0, uint8_t c1, uint8_t c2) noexcept
+{
+	return (static_cast<trigram_t>(TrigramFold(c0)) << 16) | (static_cast<trigram_t>(TrigramFold(c1)) << 8) | TrigramFold(c2);
+}
+
+
+/**
+ * A boolean query over trigrams.  A file which contains a match for the PATTERN the query was generated from
+ * is guaranteed to satisfy the query.  The converse isn't true; the query only narrows down the candidates.
+ */
+class TrigramQuery
+{
+public:
+	enum class Op
+	{
+		ALL,		//!< Every file matches.  I.e. we couldn't extract anything useful from the pattern.
+		TRIGRAM,	//!< Files containing m_trigram.
+		AND,		//!< Files matching all of m_subqueries.
+		OR			//!< Files matching any of m_subqueries.
+	};
+
+	TrigramQuery() = default;
+
+	/**
+	 * Factory function which builds the query for a PATTERN.
+	 *
+	 * @param pattern             The PATTERN, as given to the FileScanner.
+	 * @param pattern_is_literal  true if --literal was given.
+	 * @return  The query.  If the pattern uses a construct we don't understand, this is an ALL query.
+	 */
+	static TrigramQuery FromPattern(const std::string &pattern, bool pattern_is_literal);
+
+	/// @name Simplifying constructors for the composite queries.
+	///@{
+	static TrigramQuery All() { return TrigramQuery(); };
+	static TrigramQuery Trigram(trigram_t trigram);
+	static TrigramQuery And(std::vector<TrigramQuery> subqueries);
+	static TrigramQuery Or(std::vector<TrigramQuery> subqueries);
+	///@}
+
+	/// AND of all the trigrams in @a literal.  ALL if @a literal is shorter than three bytes.
+	static TrigramQuery FromLiteral(const std::string &literal);
+
+	Op GetOp() const noexcept { return m_op; };
+	trigram_t GetTrigram() const noexcept { return m_trigram; };
+	const std::vector<TrigramQuery>& GetSubqueries() const noexcept { return m_subqueries; };
+
+	/// Returns a human-readable version of the query, for logging.
+	std::string ToString() const;
+
+private:
+
+	Op m_op { Op::ALL };
+
+	trigram_t m_trigram { 0 };
+
+	std::vector<TrigramQuery> m_subqueries;
+};
+
+#endif /* SRC_TRIGRAMQUERY_H_ */
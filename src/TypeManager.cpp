@@ -23,6 +23,7 @@
 #include "TypeManager.h"
 
 #include "Logger.h"
+#include "Decompressor.h"
 
 #include <algorithm>
 #include <set>
@@ -135,6 +136,21 @@ TypeManager::TypeManager()
 }
 
 bool TypeManager::FileShouldBeScanned(const std::string& name) const noexcept
+{
+	if(m_search_compressed)
+	{
+		size_t suffix_len = CompressedFileSuffixLength(name);
+		if(suffix_len > 0 && !IsExcludedByAnyGlob(name)
+				&& UncompressedFileShouldBeScanned(name.substr(0, name.length() - suffix_len)))
+		{
+			return true;
+		}
+	}
+
+	return UncompressedFileShouldBeScanned(name);
+}
+
+bool TypeManager::UncompressedFileShouldBeScanned(const std::string& name) const noexcept
 {
 	// Find the name's extension.
 	auto last_period_offset = name.find_last_of('.');
@@ -258,6 +274,7 @@ bool TypeManager::type(const std::string& type_name)
 
 	// Add the type to the active type map.
 	m_active_type_map.insert(*it_type);
+	m_type_tables_are_compiled = false;
 
 	return true;
 }
@@ -280,6 +297,7 @@ bool TypeManager::notype(const std::string& type_name)
 
 	// Remove the type from the active type map.
 	m_active_type_map.erase(type_name);
+	m_type_tables_are_compiled = false;
 
 	return true;
 }
@@ -401,12 +419,14 @@ void TypeManager::TypeAddIs(const std::string& type, const std::string& name)
 {
 	m_builtin_and_user_type_map[type].push_back(name);
 	m_active_type_map[type].push_back(name);
+	m_type_tables_are_compiled = false;
 }
 
 void TypeManager::TypeAddExt(const std::string& type, const std::string& ext)
 {
 	m_builtin_and_user_type_map[type].push_back("."+ext);
 	m_active_type_map[type].push_back("."+ext);
+	m_type_tables_are_compiled = false;
 }
 
 void TypeManager::TypeAddGlobExclude([[maybe_unused]] const std::string& type, const std::string& glob)
@@ -434,6 +454,7 @@ bool TypeManager::TypeDel(const std::string& type)
 {
 	m_active_type_map.erase(type);
 	auto num_erased = m_builtin_and_user_type_map.erase(type);
+	m_type_tables_are_compiled = false;
 
 	return num_erased > 0;
 }
@@ -455,6 +476,19 @@ bool TypeManager::IsExcludedByAnyGlob(const std::string &name) const noexcept
 
 void TypeManager::CompileTypeTables()
 {
+	if(m_type_tables_are_compiled)
+	{
+		// Nothing's changed since the last time, e.g. a --server request with no type options of its own.
+		LOG(INFO) << "Type tables are already compiled.";
+		return;
+	}
+
+	// Start over, in case we're recompiling after a change.
+	m_fast_include_extensions.clear();
+	m_include_extensions.clear();
+	m_included_literal_filenames.clear();
+	m_included_first_line_regexes.clear();
+
 	std::set<microstring> unique_4char_extensions;
 
 	for(auto i : m_active_type_map)
@@ -520,6 +554,8 @@ void TypeManager::CompileTypeTables()
 
 	// Sort the fast_include_extensions list so we can binary search it.
 	std::sort(m_fast_include_extensions.begin(), m_fast_include_extensions.end());
+
+	m_type_tables_are_compiled = true;
 }
 
 void TypeManager::PrintTypesForHelp(std::ostream& s) const
@@ -50,13 +50,19 @@ public:
 
 	/**
 	 * Determine if the file with the given @p name should be scanned based on the
-	 * enabled file types.
+	 * enabled file types.  If SetSearchCompressed() has been turned on, a compressed file is scanned if
+	 * its name without the compression suffix would be, e.g. "foo.cpp.gz" is scanned if "foo.cpp" would be.
 	 *
 	 * @param name
 	 * @return true if file should be scanned, false otherwise.
 	 */
 	bool FileShouldBeScanned(const std::string &name) const noexcept;
 
+	/**
+	 * For -z.  Determines whether FileShouldBeScanned() looks past compressed file suffixes.
+	 */
+	void SetSearchCompressed(bool search_compressed) noexcept { m_search_compressed = search_compressed; };
+
 	/**
 	 * Add the given file type to the types which will be scanned.  For handling the
 	 * --type= command line param.  The first time this function is called, all currently-
@@ -131,6 +137,10 @@ public:
 	 */
 	bool TypeDel(const std::string &type);
 
+	/**
+	 * Compile the type tables used by FileShouldBeScanned().  Does nothing if they've already been compiled and
+	 * nothing's changed since, so a TypeManager which was compiled once can be copied and reused as-is.
+	 */
 	void CompileTypeTables();
 
 	void PrintTypesForHelp(std::ostream &s) const;
@@ -147,6 +157,12 @@ private:
 
 	bool IsExcludedByAnyGlob(const std::string &name) const noexcept;
 
+	/// FileShouldBeScanned(), ignoring any compression suffix.
+	bool UncompressedFileShouldBeScanned(const std::string &name) const noexcept;
+
+	/// true if we're searching compressed files (-z).
+	bool m_search_compressed { false };
+
 	/// Flag to keep track of the first call to type().
 	bool m_first_type_has_been_seen = { false };
 
@@ -194,6 +210,9 @@ private:
 	/// the file type (value).
 	std::unordered_multimap<std::string, std::string> m_included_first_line_regexes;
 
+	/// true if the tables above are up to date with the type maps.
+	bool m_type_tables_are_compiled { false };
+
 	///@}
 };
 
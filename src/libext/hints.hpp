@@ -52,14 +52,14 @@
 #	if defined(HAVE___BUILTIN_EXPECT)
 #		define likely(exp) __builtin_expect(!!(exp), true)
 #	else
-#		define likely(exp) /* empty */
+#		define likely(exp) (exp)
 #	endif
 #endif
 #if !defined(unlikely)
 #	if defined(HAVE___BUILTIN_EXPECT)
 #		define unlikely(exp) __builtin_expect(!!(exp), false)
 #	else
-#		define unlikely(exp) /* empty */
+#		define unlikely(exp) (exp)
 #	endif
 #endif
 /// @}
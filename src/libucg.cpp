@@ -0,0 +1,177 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file */
+
+#include <config.h>
+
+#include "libucg.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+#include "sync_queue_impl_selector.h"
+#include "DirInclusionManager.h"
+#include "FileID.h"
+#include "FileScanner.h"
+#include "Globber.h"
+#include "MatchList.h"
+#include "PipelineStats.h"
+#include "SearchPipeline.h"
+#include "ThreadPlacement.h"
+#include "TypeManager.h"
+
+namespace ucg
+{
+
+/**
+ * The internals of Search, kept out of the public header.
+ */
+class Search::Impl
+{
+public:
+	explicit Impl(const SearchOptions &options) : m_options(options) {};
+
+	SearchOptions m_options;
+
+	TypeManager m_type_manager;
+
+	DirInclusionManager m_dir_inclusion_manager;
+};
+
+
+Search::Search(const SearchOptions &options) : m_impl(new Impl(options))
+{
+	SearchOptions &opts = m_impl->m_options;
+
+	// Same defaults as the command line.
+	opts.m_jobs = std::max(0, opts.m_jobs);
+	opts.m_dirjobs = std::max(0, opts.m_dirjobs);
+	SetDefaultJobCounts(opts.m_jobs, opts.m_dirjobs);
+	if(opts.m_paths.empty())
+	{
+		opts.m_paths.push_back(".");
+	}
+
+	// Set up the file type filtering the same way ArgParse does: globs first, then types.
+	try
+	{
+		for(const auto &glob : opts.m_include_globs)
+		{
+			m_impl->m_type_manager.TypeAddIncludeGlobFromFilterSpecString("glob:" + glob);
+		}
+		for(const auto &glob : opts.m_exclude_globs)
+		{
+			m_impl->m_type_manager.TypeAddIgnoreFileFromFilterSpecString("globx:" + glob);
+		}
+	}
+	catch(const TypeManagerException &e)
+	{
+		throw SearchException(e.what());
+	}
+	for(const auto &type : opts.m_types)
+	{
+		bool known;
+		if(type.compare(0, 2, "no") == 0)
+		{
+			known = m_impl->m_type_manager.notype(type.substr(2));
+		}
+		else
+		{
+			known = m_impl->m_type_manager.type(type);
+		}
+		if(!known)
+		{
+			throw SearchException("Unknown type \'" + type + "\'.");
+		}
+	}
+
+	m_impl->m_type_manager.SetSearchCompressed(opts.m_search_compressed);
+
+	m_impl->m_dir_inclusion_manager.AddExclusions(std::set<std::string>(opts.m_ignore_dirs.begin(), opts.m_ignore_dirs.end()));
+
+	m_impl->m_type_manager.CompileTypeTables();
+	m_impl->m_dir_inclusion_manager.CompileExclusionTables();
+}
+
+Search::~Search() = default;
+
+long long Search::Run(const MatchCallback &callback, const Executor &executor)
+{
+	const SearchOptions &opts = m_impl->m_options;
+
+	sync_queue<FileID> files_to_scan_queue;
+	sync_queue<MatchList> match_queue;
+
+	// The library doesn't do --stats.
+	PipelineStats pipeline_stats(false);
+
+	std::unique_ptr<FileScanner> file_scanner;
+	try
+	{
+		file_scanner = FileScanner::Create(files_to_scan_queue, match_queue, opts.m_pattern, opts.m_ignore_case, opts.m_word_regexp,
+				opts.m_pattern_is_literal, opts.m_lines_before, opts.m_lines_after, opts.m_search_compressed, pipeline_stats);
+	}
+	catch(const FileScannerException &e)
+	{
+		throw SearchException(e.what());
+	}
+
+	Globber globber(opts.m_paths, m_impl->m_type_manager, m_impl->m_dir_inclusion_manager, opts.m_recurse, opts.m_dirjobs,
+			nullptr, nullptr, files_to_scan_queue, pipeline_stats);
+
+	// Deliver the results on this thread.  Everything else is the same pipeline the ucg binary runs.
+	long long total_matched_lines = 0;
+	auto deliver_results = [&](){
+		MatchList match_list;
+		while(match_queue.wait_pull(std::move(match_list)) != queue_op_status::closed)
+		{
+			total_matched_lines += match_list.GetNumberOfMatchedLines();
+
+			// Same as MatchList::Print().
+			std::string filename = match_list.GetFilename();
+			if(filename.compare(0, 2, "./") == 0)
+			{
+				filename.erase(0, 2);
+			}
+
+			for(const Match &match : match_list.GetMatches())
+			{
+				SearchMatch search_match;
+				search_match.m_filename = filename;
+				search_match.m_line_number = match.m_line_number;
+				search_match.m_is_context = match.m_is_context;
+				search_match.m_line = match.m_pre_match + match.m_match + match.m_post_match;
+				if(!match.m_is_context)
+				{
+					search_match.m_match_start = match.m_pre_match.size();
+					search_match.m_match_end = search_match.m_match_start + match.m_match.size();
+				}
+				// If this throws, SearchPipeline drains the rest of the results without us and rethrows it.
+				callback(std::move(search_match));
+			}
+		}
+	};
+
+	SearchPipeline pipeline(globber, *file_scanner, match_queue);
+	pipeline.Run(opts.m_jobs, [&files_to_scan_queue](){ files_to_scan_queue.close(); }, deliver_results, executor);
+
+	return total_matched_lines;
+}
+
+} // namespace ucg
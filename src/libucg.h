@@ -0,0 +1,175 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file libucg.h
+ * The embeddable search API.
+ *
+ * This is the public interface of libucg, for programs which want to run ucg searches in-process and get the
+ * results as structured records, instead of running the ucg binary and parsing its text output.  It's
+ * self-contained: it doesn't depend on config.h or any of ucg's internal headers.
+ *
+ * Usage:
+ * @code
+ * ucg::SearchOptions options;
+ * options.m_pattern = "TODO";
+ * options.m_paths = { "src" };
+ * options.m_types = { "cpp" };
+ * ucg::Search search(options);
+ * search.Run([](ucg::SearchMatch &&match){ std::cout << match.m_filename << ":" << match.m_line_number << "\n"; });
+ * @endcode
+ */
+
+#ifndef SRC_LIBUCG_H_
+#define SRC_LIBUCG_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ucg
+{
+
+/**
+ * Thrown for invalid SearchOptions, e.g. an unknown type or a regex which doesn't compile.
+ */
+struct SearchException : public std::runtime_error
+{
+	SearchException(const std::string &message) : std::runtime_error(message) {};
+};
+
+/**
+ * What to search for and where.  These correspond to the ucg command-line options of the same names.  Note that
+ * .ucgrc files are not read, and there's no smart-case; set m_ignore_case as needed.
+ */
+struct SearchOptions
+{
+	/// The PCRE-compatible regex to search for, or the literal string if m_pattern_is_literal is true.
+	std::string m_pattern;
+
+	/// The files and directories to search.
+	std::vector<std::string> m_paths { "." };
+
+	/// --type: "TYPE" to search only files of that type, "noTYPE" to exclude them.
+	std::vector<std::string> m_types;
+
+	/// --include=GLOB: only search files matching these.
+	std::vector<std::string> m_include_globs;
+
+	/// --exclude=GLOB: don't search files matching these.
+	std::vector<std::string> m_exclude_globs;
+
+	/// --ignore-dir: directory names to skip, in addition to the built-in ones (.git etc.).
+	std::vector<std::string> m_ignore_dirs;
+
+	bool m_ignore_case { false };
+	bool m_word_regexp { false };
+	bool m_pattern_is_literal { false };
+	bool m_recurse { true };
+
+	/// -z: decompress and search gzip/zstd/xz-compressed files.
+	bool m_search_compressed { false };
+
+	/// -B/-A: the number of lines of leading/trailing context to return with each match.
+	int m_lines_before { 0 };
+	int m_lines_after { 0 };
+
+	/// The number of scanner tasks to run.  0 means one per CPU this process can use, per its CPU affinity and cgroup CPU quota.
+	int m_jobs { 0 };
+
+	/// The number of directory traversal tasks to run.  0 means the default.
+	int m_dirjobs { 0 };
+};
+
+/**
+ * One matched line, or one context line.
+ */
+struct SearchMatch
+{
+	/// The path of the file, built from the SearchOptions::m_paths entry it was found under.  As with ucg's output,
+	/// a leading "./" is removed.
+	std::string m_filename;
+
+	/// The 1-based line number.
+	size_t m_line_number { 0 };
+
+	/// true if this is a context line (see SearchOptions::m_lines_before/after), not a match.
+	bool m_is_context { false };
+
+	/// The text of the whole line, without its line terminator.
+	std::string m_line;
+
+	/// The byte offsets in m_line of the first match on the line, [m_match_start, m_match_end).  Both 0 for context lines.
+	size_t m_match_start { 0 };
+	size_t m_match_end { 0 };
+};
+
+/**
+ * A configured search, which can be Run() any number of times.
+ */
+class Search
+{
+public:
+	/// Called once per SearchMatch.
+	using MatchCallback = std::function<void(SearchMatch &&match)>;
+
+	/**
+	 * Runs one task, e.g. by submitting it to the caller's thread pool.  Run() submits SearchOptions::m_dirjobs
+	 * directory traversal tasks, then SearchOptions::m_jobs scanning tasks.  The scanning tasks block until the
+	 * traversal is done, so a pool must either run all of them concurrently, or run them in the order they were
+	 * submitted.  In the latter case it doesn't matter how many threads the pool has.
+	 */
+	using Executor = std::function<void(std::function<void()> task)>;
+
+	/**
+	 * @throws SearchException if @a options are invalid.
+	 */
+	explicit Search(const SearchOptions &options);
+	~Search();
+
+	Search(const Search&) = delete;
+	Search& operator=(const Search&) = delete;
+
+	/**
+	 * Run the search, calling @a callback for each match.
+	 *
+	 * The callback is only ever called on the thread which called Run(), never concurrently.  All the matches for a
+	 * file are delivered together and in line order.  The order in which files are delivered is unspecified.
+	 * If the callback throws, the search is run to completion without calling it again, and the exception is
+	 * then rethrown from Run().
+	 *
+	 * Errors reading individual files are reported on stderr and skipped, the same as the ucg binary does.
+	 *
+	 * @param callback  Receives the results.
+	 * @param executor  Runs the directory traversal and scanning tasks.  If empty, each task gets its own std::thread.
+	 * @return  The number of matched lines, not counting context lines.
+	 * @throws SearchException if the regex doesn't compile.
+	 *
+	 * @note Run() can be called more than once, but not concurrently on the same Search.
+	 */
+	long long Run(const MatchCallback &callback, const Executor &executor = Executor());
+
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace ucg
+
+#endif /* SRC_LIBUCG_H_ */
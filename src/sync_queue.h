@@ -190,6 +190,82 @@ public:
 		return queue_op_status::success;
 	}
 
+	/**
+	 * Pull an item off the queue if there is one, without waiting.
+	 *
+	 * @return queue_op_status::success if @a x was pulled, queue_op_status::empty if the queue is empty, or
+	 *         queue_op_status::closed if it's empty and closed.
+	 */
+	queue_op_status try_pull(ValueType&& x)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if(m_underlying_queue.empty())
+		{
+			return m_closed ? queue_op_status::closed : queue_op_status::empty;
+		}
+
+		x = std::move(m_underlying_queue.front());
+		m_underlying_queue.pop();
+
+		return queue_op_status::success;
+	}
+
+	/**
+	 * wait_pull() for workers which push their own work back onto the queue, but which have no master thread to call
+	 * wait_for_worker_completion() and close() the queue for them.  A worker counts as busy from when this pulls it an
+	 * item until its next call.  If that next call finds the queue empty and no worker busy, no more work can ever
+	 * arrive, so it closes the queue.  Workers which haven't called this yet don't count, so it works even if the
+	 * workers are run one after the other instead of concurrently.
+	 *
+	 * @param is_busy  The calling worker's state, which must start out false.
+	 *
+	 * @note Like wait_for_worker_completion(), not a Boost API.
+	 */
+	queue_op_status wait_pull_until_idle(ValueType&& x, bool &is_busy)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if(is_busy)
+		{
+			m_num_busy_workers--;
+			is_busy = false;
+		}
+
+		if(m_underlying_queue.empty() && m_num_busy_workers == 0 && !m_closed)
+		{
+			// Nobody's left to push anything, we're done.
+			m_closed = true;
+			lock.unlock();
+			m_cv.notify_all();
+			return queue_op_status::closed;
+		}
+
+		m_cv.wait(lock, [this](){ return !m_underlying_queue.empty() || m_closed; });
+
+		if(m_underlying_queue.empty() && m_closed)
+		{
+			return queue_op_status::closed;
+		}
+
+		x = std::move(m_underlying_queue.front());
+		m_underlying_queue.pop();
+
+		m_num_busy_workers++;
+		is_busy = true;
+
+		return queue_op_status::success;
+	}
+
+	/**
+	 * The number of items in the queue at the moment.  Of course, this can be out of date as soon as it's returned.
+	 */
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_underlying_queue.size();
+	}
+
 	/**
 	 *  Blocks the calling thread until:
 	 *	 - The queue is empty, and
@@ -236,6 +312,9 @@ private:
 
 	size_t m_num_waiting_threads { 0 };
 
+	/// The number of workers wait_pull_until_idle() has handed an item to, and which haven't come back for another yet.
+	size_t m_num_busy_workers { 0 };
+
 	bool m_closed { false };
 
 #ifdef TODO
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * Feeds sample cgroup CPU quota file contents to the parsers ucg sizes its default job counts with.
+ *
+ * Usage: cgroup-cpu-limit v2 CPU_MAX
+ *        cgroup-cpu-limit v1 CFS_QUOTA_US CFS_PERIOD_US
+ *
+ * Prints the resulting limit in CPUs, 0 meaning none.
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <string>
+
+#include "ThreadPlacement.h"
+
+int main(int argc, char **argv)
+{
+	const std::string version = (argc > 1) ? argv[1] : "";
+
+	if(version == "v2" && argc == 3)
+	{
+		std::cout << ParseCgroupV2CpuMax(argv[2]) << std::endl;
+	}
+	else if(version == "v1" && argc == 4)
+	{
+		std::cout << ParseCgroupV1CfsQuota(argv[2], argv[3]) << std::endl;
+	}
+	else
+	{
+		std::cerr << "usage: cgroup-cpu-limit v2 CPU_MAX | cgroup-cpu-limit v1 CFS_QUOTA_US CFS_PERIOD_US" << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
@@ -15,26 +15,448 @@
  * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/**
+ * @file
+ * Test data generator.
+ *
+ * In its original mode (-b NUM_BYTES), writes repeated lorem ipsum text to stdout.
+ *
+ * With -o DIR, it instead builds a synthetic, reproducible source tree under DIR, for benchmarks that shouldn't depend
+ * on an external corpus.  The tree's shape (depth, fanout, files per directory), file size distribution, extension mix,
+ * line length, and the density of lines containing a known match string are all controllable, and it can also add
+ * binary files, symlink loops, and directories which ucg ignores by default.  Given the same options and seed, the
+ * same tree is generated on every platform, since all randomness comes from the raw std::mt19937 output.
+ *
+ * Counts of what was generated, including the number of lines containing the match string, are printed to stderr so
+ * that tests can check search results against them.
+ */
+
 #include <config.h>
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <map>
+#include <random>
 #include <cstring>
-#include <unistd.h>
 #include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "lorem_ipsum.hpp"
 
 static const std::size_t f_lorem_ipsum_text_len = std::strlen(f_lorem_ipsum_text);
 
+/**
+ * The tree generation parameters.
+ */
+struct TreeParams
+{
+	std::string m_output_dir;
+	std::uint32_t m_seed { 1 };
+	int m_depth { 3 };
+	int m_fanout { 4 };
+	int m_files_per_dir { 8 };
+	std::string m_size_dist { "lognormal" };
+	std::size_t m_mean_size { 16*1024 };
+	std::size_t m_max_size { 1024*1024 };
+	std::vector<std::pair<std::string, unsigned>> m_ext_mix { {"cpp", 4}, {"h", 4}, {"c", 2}, {"txt", 1}, {"md", 1}, {"o", 1} };
+	std::string m_match_string { "ucgsyntheticmatch" };
+	double m_match_density { 0.001 };
+	std::size_t m_line_length { 80 };
+	unsigned m_binary_percent { 2 };
+	int m_symlink_loops { 1 };
+	std::vector<std::string> m_ignored_dirs { ".git", ".svn", "CVS" };
+};
+
+/**
+ * Running totals of what's been generated.
+ */
+struct TreeStats
+{
+	std::size_t m_num_dirs { 0 };
+	std::size_t m_num_files { 0 };
+	std::size_t m_num_binary_files { 0 };
+	std::size_t m_num_symlink_loops { 0 };
+	std::size_t m_num_bytes { 0 };
+	std::size_t m_num_matching_lines { 0 };
+	std::size_t m_num_matching_lines_in_ignored_dirs { 0 };
+	std::map<std::string, std::size_t> m_matching_lines_per_ext;
+};
+
+/**
+ * Builds the synthetic tree.
+ */
+class TreeGenerator
+{
+public:
+	explicit TreeGenerator(const TreeParams &params) : m_params(params), m_gen(params.m_seed)
+	{
+		// Split the lorem ipsum text into words to build lines from.
+		std::istringstream iss(f_lorem_ipsum_text);
+		std::string word;
+		while(iss >> word)
+		{
+			m_words.push_back(word);
+		}
+
+		for(const auto &e : m_params.m_ext_mix)
+		{
+			m_ext_weight_total += e.second;
+		}
+	};
+
+	bool Generate()
+	{
+		if(!MakeDir(m_params.m_output_dir))
+		{
+			return false;
+		}
+
+		std::vector<std::string> subdirs;
+		if(!GenerateDir(m_params.m_output_dir, 0, false, &subdirs))
+		{
+			return false;
+		}
+
+		// Directories ucg ignores by default, each with a normal complement of files.
+		for(const auto &name : m_params.m_ignored_dirs)
+		{
+			std::string path = m_params.m_output_dir + "/" + name;
+			if(!MakeDir(path) || !GenerateDir(path, m_params.m_depth, true, nullptr))
+			{
+				return false;
+			}
+		}
+
+		// Symlink loops: a link back to the parent directory from a randomly chosen subdirectory.
+		for(int i = 0; i < m_params.m_symlink_loops; ++i)
+		{
+			std::string dir = subdirs.empty() ? m_params.m_output_dir : subdirs[UniformBelow(subdirs.size())];
+			std::string link_path = dir + "/loop_" + std::to_string(i);
+			if(symlink(subdirs.empty() ? "." : "..", link_path.c_str()) != 0)
+			{
+				std::cerr << "ERROR: Couldn't create symlink '" << link_path << "': " << std::strerror(errno) << std::endl;
+				return false;
+			}
+			m_stats.m_num_symlink_loops++;
+		}
+
+		return true;
+	};
+
+	const TreeStats& GetStats() const noexcept { return m_stats; };
+
+private:
+
+	/// @name Platform-independent random number helpers.
+	/// The std:: distributions are implementation-defined, so we roll our own on top of mt19937's raw output,
+	/// which is fully specified by the standard.
+	///@{
+	std::size_t UniformBelow(std::size_t n) { return n == 0 ? 0 : m_gen() % n; };
+	double Uniform01() { return (m_gen() + 0.5) / 4294967296.0; };
+	double Normal()
+	{
+		// Box-Muller.
+		return std::sqrt(-2.0 * std::log(Uniform01())) * std::cos(2.0 * 3.14159265358979323846 * Uniform01());
+	};
+	///@}
+
+	bool MakeDir(const std::string &path)
+	{
+		if(mkdir(path.c_str(), 0777) != 0 && errno != EEXIST)
+		{
+			std::cerr << "ERROR: Couldn't create directory '" << path << "': " << std::strerror(errno) << std::endl;
+			return false;
+		}
+		m_stats.m_num_dirs++;
+		return true;
+	};
+
+	std::size_t PickFileSize()
+	{
+		double size;
+		const double mean = m_params.m_mean_size;
+		if(m_params.m_size_dist == "fixed")
+		{
+			size = mean;
+		}
+		else if(m_params.m_size_dist == "uniform")
+		{
+			size = 2.0 * mean * Uniform01();
+		}
+		else if(m_params.m_size_dist == "exp")
+		{
+			size = -mean * std::log(Uniform01());
+		}
+		else
+		{
+			// Lognormal with sigma=1, scaled to the requested mean.  Source trees look roughly like this: lots of small
+			// files and a long tail of big ones.
+			const double sigma = 1.0;
+			size = std::exp(std::log(mean) - sigma*sigma/2 + sigma*Normal());
+		}
+		return std::min(static_cast<std::size_t>(size) + 1, m_params.m_max_size);
+	};
+
+	const std::string& PickExtension()
+	{
+		std::size_t r = UniformBelow(m_ext_weight_total);
+		for(const auto &e : m_params.m_ext_mix)
+		{
+			if(r < e.second)
+			{
+				return e.first;
+			}
+			r -= e.second;
+		}
+		return m_params.m_ext_mix.back().first;
+	};
+
+	/// Generate text file contents of about @a size bytes, returning the number of lines containing the match string.
+	std::size_t MakeTextContents(std::size_t size, std::string *contents)
+	{
+		std::size_t num_matching_lines = 0;
+		contents->clear();
+		contents->reserve(size + 2*m_params.m_line_length);
+		while(contents->size() < size)
+		{
+			std::size_t target_len = 1 + UniformBelow(2*m_params.m_line_length);
+			bool has_match = Uniform01() < m_params.m_match_density;
+			std::size_t line_start = contents->size();
+			std::size_t match_word_index = has_match ? UniformBelow(target_len/8 + 1) : static_cast<std::size_t>(-1);
+			for(std::size_t word_index = 0; contents->size() - line_start < target_len || (has_match && word_index <= match_word_index); ++word_index)
+			{
+				if(word_index != 0)
+				{
+					contents->push_back(' ');
+				}
+				if(word_index == match_word_index)
+				{
+					*contents += m_params.m_match_string;
+				}
+				else
+				{
+					*contents += m_words[UniformBelow(m_words.size())];
+				}
+			}
+			contents->push_back('\n');
+			num_matching_lines += has_match;
+		}
+		return num_matching_lines;
+	};
+
+	void MakeBinaryContents(std::size_t size, std::string *contents)
+	{
+		contents->resize(size);
+		for(auto &c : *contents)
+		{
+			c = static_cast<char>(m_gen() & 0xFF);
+		}
+		// Make sure there's at least one NUL, as there is in pretty much every real binary.
+		(*contents)[0] = '\0';
+	};
+
+	bool GenerateDir(const std::string &path, int level, bool is_ignored, std::vector<std::string> *subdirs)
+	{
+		std::string contents;
+		for(int i = 0; i < m_params.m_files_per_dir; ++i)
+		{
+			const std::string &ext = PickExtension();
+			std::string filename = path + "/file_" + std::to_string(i) + (ext.empty() ? "" : "." + ext);
+			std::size_t size = PickFileSize();
+
+			if(UniformBelow(100) < m_params.m_binary_percent)
+			{
+				MakeBinaryContents(size, &contents);
+				m_stats.m_num_binary_files++;
+			}
+			else
+			{
+				std::size_t num_matching_lines = MakeTextContents(size, &contents);
+				if(is_ignored)
+				{
+					m_stats.m_num_matching_lines_in_ignored_dirs += num_matching_lines;
+				}
+				else
+				{
+					m_stats.m_num_matching_lines += num_matching_lines;
+					m_stats.m_matching_lines_per_ext[ext] += num_matching_lines;
+				}
+			}
+
+			std::ofstream ofs(filename, std::ios::binary);
+			ofs << contents;
+			if(!ofs)
+			{
+				std::cerr << "ERROR: Couldn't write file '" << filename << "'." << std::endl;
+				return false;
+			}
+			m_stats.m_num_files++;
+			m_stats.m_num_bytes += contents.size();
+		}
+
+		if(level >= m_params.m_depth)
+		{
+			return true;
+		}
+
+		for(int i = 0; i < m_params.m_fanout; ++i)
+		{
+			std::string subdir = path + "/dir_" + std::to_string(i);
+			if(!MakeDir(subdir))
+			{
+				return false;
+			}
+			if(subdirs != nullptr)
+			{
+				subdirs->push_back(subdir);
+			}
+			if(!GenerateDir(subdir, level+1, is_ignored, subdirs))
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	const TreeParams &m_params;
+	std::mt19937 m_gen;
+	std::vector<std::string> m_words;
+	std::size_t m_ext_weight_total { 0 };
+	TreeStats m_stats;
+};
+
+/// Split @a str on commas.
+static std::vector<std::string> SplitList(const std::string &str)
+{
+	std::vector<std::string> retval;
+	std::istringstream iss(str);
+	std::string item;
+	while(std::getline(iss, item, ','))
+	{
+		if(!item.empty())
+		{
+			retval.push_back(item);
+		}
+	}
+	return retval;
+}
+
+/// Parse an extension mix of the form "EXT[:WEIGHT],...".  A WEIGHT of 0 or an empty list is an error.
+static bool ParseExtMix(const std::string &str, std::vector<std::pair<std::string, unsigned>> *ext_mix)
+{
+	ext_mix->clear();
+	for(const auto &item : SplitList(str))
+	{
+		auto colon = item.find(':');
+		std::string ext = item.substr(0, colon);
+		unsigned weight = (colon == std::string::npos) ? 1 : std::atoi(item.c_str() + colon + 1);
+		if(weight == 0)
+		{
+			return false;
+		}
+		// Allow "none" for files with no extension.
+		ext_mix->emplace_back(ext == "none" ? "" : ext, weight);
+	}
+	return !ext_mix->empty();
+}
+
+static void PrintUsage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " -b NUM_BYTES\n"
+		"       " << argv0 << " -o DIR [OPTION...]\n"
+		"\n"
+		"  -b NUM_BYTES              Write NUM_BYTES of lorem ipsum text to stdout.\n"
+		"  -o, --output-dir=DIR      Generate a synthetic source tree in DIR.\n"
+		"\n"
+		"Tree generation options:\n"
+		"  --seed=N                  Random seed (default 1).\n"
+		"  --depth=N                 Levels of subdirectories below DIR (default 3).\n"
+		"  --fanout=N                Subdirectories per directory (default 4).\n"
+		"  --files-per-dir=N         Files per directory (default 8).\n"
+		"  --size-dist=DIST          File size distribution: fixed, uniform, exp, or lognormal (default).\n"
+		"  --mean-size=BYTES         Mean file size (default 16384).\n"
+		"  --max-size=BYTES          Maximum file size (default 1048576).\n"
+		"  --ext-mix=EXT:W,...       Weighted file extension mix, \"none\" for no extension\n"
+		"                            (default cpp:4,h:4,c:2,txt:1,md:1,o:1).\n"
+		"  --match-string=STR        String inserted into matching lines (default ucgsyntheticmatch).\n"
+		"  --match-density=FRACTION  Fraction of text lines containing the match string (default 0.001).\n"
+		"  --line-length=N           Mean line length (default 80).\n"
+		"  --binary-percent=N        Percent of files which are binary (default 2).\n"
+		"  --symlink-loops=N         Number of symlinks pointing back up the tree (default 1).\n"
+		"  --ignored-dirs=NAME,...   Directories ucg ignores by default to create under DIR\n"
+		"                            (default .git,.svn,CVS).  Pass an empty string for none.\n";
+}
+
+static int GenerateLoremIpsum(std::size_t max_chars_out)
+{
+	size_t chars_out = 0;
+	while(chars_out + f_lorem_ipsum_text_len < max_chars_out)
+	{
+		std::cout << f_lorem_ipsum_text << std::endl;
+		chars_out += f_lorem_ipsum_text_len;
+	}
+
+	std::cerr << "Number of bytes written: " << chars_out << std::endl;
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	std::size_t max_chars_out = 0;
+	TreeParams params;
+
+	enum
+	{
+		OPT_SEED = 256,
+		OPT_DEPTH,
+		OPT_FANOUT,
+		OPT_FILES_PER_DIR,
+		OPT_SIZE_DIST,
+		OPT_MEAN_SIZE,
+		OPT_MAX_SIZE,
+		OPT_EXT_MIX,
+		OPT_MATCH_STRING,
+		OPT_MATCH_DENSITY,
+		OPT_LINE_LENGTH,
+		OPT_BINARY_PERCENT,
+		OPT_SYMLINK_LOOPS,
+		OPT_IGNORED_DIRS
+	};
+
+	static const struct option long_options[] =
+	{
+		{"output-dir", required_argument, nullptr, 'o'},
+		{"seed", required_argument, nullptr, OPT_SEED},
+		{"depth", required_argument, nullptr, OPT_DEPTH},
+		{"fanout", required_argument, nullptr, OPT_FANOUT},
+		{"files-per-dir", required_argument, nullptr, OPT_FILES_PER_DIR},
+		{"size-dist", required_argument, nullptr, OPT_SIZE_DIST},
+		{"mean-size", required_argument, nullptr, OPT_MEAN_SIZE},
+		{"max-size", required_argument, nullptr, OPT_MAX_SIZE},
+		{"ext-mix", required_argument, nullptr, OPT_EXT_MIX},
+		{"match-string", required_argument, nullptr, OPT_MATCH_STRING},
+		{"match-density", required_argument, nullptr, OPT_MATCH_DENSITY},
+		{"line-length", required_argument, nullptr, OPT_LINE_LENGTH},
+		{"binary-percent", required_argument, nullptr, OPT_BINARY_PERCENT},
+		{"symlink-loops", required_argument, nullptr, OPT_SYMLINK_LOOPS},
+		{"ignored-dirs", required_argument, nullptr, OPT_IGNORED_DIRS},
+		{nullptr, 0, nullptr, 0}
+	};
 
 	int option;
 	opterr = 0;
-	while((option = getopt(argc, argv, "b:")) != -1)
+	while((option = getopt_long(argc, argv, "b:o:", long_options, nullptr)) != -1)
 	{
 		switch (option)
 		{
@@ -42,8 +464,66 @@ int main(int argc, char **argv)
 			// Number of bytes to output.
 			max_chars_out = std::atol(optarg);
 			break;
+		case 'o':
+			params.m_output_dir = optarg;
+			break;
+		case OPT_SEED:
+			params.m_seed = std::strtoul(optarg, nullptr, 10);
+			break;
+		case OPT_DEPTH:
+			params.m_depth = std::atoi(optarg);
+			break;
+		case OPT_FANOUT:
+			params.m_fanout = std::atoi(optarg);
+			break;
+		case OPT_FILES_PER_DIR:
+			params.m_files_per_dir = std::atoi(optarg);
+			break;
+		case OPT_SIZE_DIST:
+			params.m_size_dist = optarg;
+			if(params.m_size_dist != "fixed" && params.m_size_dist != "uniform" && params.m_size_dist != "exp" && params.m_size_dist != "lognormal")
+			{
+				std::cerr << "ERROR: Unknown size distribution '" << optarg << "'." << std::endl;
+				return 1;
+			}
+			break;
+		case OPT_MEAN_SIZE:
+			params.m_mean_size = std::atol(optarg);
+			break;
+		case OPT_MAX_SIZE:
+			params.m_max_size = std::atol(optarg);
+			break;
+		case OPT_EXT_MIX:
+			if(!ParseExtMix(optarg, &params.m_ext_mix))
+			{
+				std::cerr << "ERROR: Invalid extension mix '" << optarg << "'." << std::endl;
+				return 1;
+			}
+			break;
+		case OPT_MATCH_STRING:
+			params.m_match_string = optarg;
+			break;
+		case OPT_MATCH_DENSITY:
+			params.m_match_density = std::atof(optarg);
+			break;
+		case OPT_LINE_LENGTH:
+			params.m_line_length = std::max(1L, std::atol(optarg));
+			break;
+		case OPT_BINARY_PERCENT:
+			params.m_binary_percent = std::atoi(optarg);
+			break;
+		case OPT_SYMLINK_LOOPS:
+			params.m_symlink_loops = std::atoi(optarg);
+			break;
+		case OPT_IGNORED_DIRS:
+			params.m_ignored_dirs = SplitList(optarg);
+			break;
 		case'?':
-			if(std::isprint(optopt))
+			if(optopt == 0)
+			{
+				std::cerr << "ERROR: Unknown option '" << argv[optind-1] << "'." << std::endl;
+			}
+			else if(std::isprint(optopt))
 			{
 				std::cerr << "ERROR: Unknown option '-" << std::string(1, (char)optopt) << "'." << std::endl;
 			}
@@ -51,22 +531,37 @@ int main(int argc, char **argv)
 			{
 				std::cerr << "ERROR: Unknown option charater '0x" << std::hex << optopt << "'" << std::endl;
 			}
+			PrintUsage(argv[0]);
 			return 1;
 		default:
 			abort();
 		}
 	}
 
-	size_t chars_out = 0;
-	while(chars_out + f_lorem_ipsum_text_len < max_chars_out)
+	if(params.m_output_dir.empty())
 	{
-		std::cout << f_lorem_ipsum_text << std::endl;
-		chars_out += f_lorem_ipsum_text_len;
+		return GenerateLoremIpsum(max_chars_out);
 	}
 
-	std::cerr << "Number of bytes written: " << chars_out << std::endl;
-	return 0;
-}
-
+	TreeGenerator generator(params);
+	if(!generator.Generate())
+	{
+		return 1;
+	}
 
+	const TreeStats &stats = generator.GetStats();
+	std::cerr << "Number of directories created: " << stats.m_num_dirs << "\n"
+		<< "Number of files written: " << stats.m_num_files << "\n"
+		<< "Number of binary files written: " << stats.m_num_binary_files << "\n"
+		<< "Number of symlink loops created: " << stats.m_num_symlink_loops << "\n"
+		<< "Number of bytes written: " << stats.m_num_bytes << "\n"
+		<< "Number of matching lines: " << stats.m_num_matching_lines << "\n"
+		<< "Number of matching lines in ignored directories: " << stats.m_num_matching_lines_in_ignored_dirs << "\n";
+	for(const auto &ext_count : stats.m_matching_lines_per_ext)
+	{
+		std::cerr << "Number of matching lines in '" << (ext_count.first.empty() ? "none" : ext_count.first) << "' files: " << ext_count.second << "\n";
+	}
+	std::cerr.flush();
 
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * A minimal libucg client, used by the testsuite to exercise the embeddable search API.
+ *
+ * Usage: libucg-search [-i] [-w] [-Q] [-j JOBS] [-d DIRJOBS] [-p POOL_THREADS] [-t TYPE]... PATTERN [PATH...]
+ *
+ * Prints one "FILE:LINE:START-END:TEXT" record per matched line.  If -p is given, the search's tasks are run on a
+ * simple FIFO pool of that many threads instead of one std::thread each.
+ */
+
+#include <config.h>
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "libucg.h"
+
+/**
+ * Just enough of a thread pool to stand in for a caller's.
+ */
+class FifoThreadPool
+{
+public:
+	explicit FifoThreadPool(int num_threads)
+	{
+		for(int i = 0; i < num_threads; ++i)
+		{
+			m_threads.emplace_back([this](){
+				while(true)
+				{
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_cv.wait(lock, [this](){ return m_stopping || !m_tasks.empty(); });
+						if(m_tasks.empty())
+						{
+							return;
+						}
+						task = std::move(m_tasks.front());
+						m_tasks.pop_front();
+					}
+					task();
+				}
+			});
+		}
+	}
+
+	~FifoThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_cv.notify_all();
+		for(auto &thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	void Submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.push_back(std::move(task));
+		}
+		m_cv.notify_one();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::function<void()>> m_tasks;
+	bool m_stopping { false };
+	std::vector<std::thread> m_threads;
+};
+
+int main(int argc, char **argv)
+{
+	ucg::SearchOptions options;
+	int pool_threads = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "iwQj:d:p:t:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'i': options.m_ignore_case = true; break;
+		case 'w': options.m_word_regexp = true; break;
+		case 'Q': options.m_pattern_is_literal = true; break;
+		case 'j': options.m_jobs = std::atoi(optarg); break;
+		case 'd': options.m_dirjobs = std::atoi(optarg); break;
+		case 'p': pool_threads = std::atoi(optarg); break;
+		case 't': options.m_types.push_back(optarg); break;
+		default:
+			std::cerr << "usage: libucg-search [-i] [-w] [-Q] [-j JOBS] [-d DIRJOBS] [-p POOL_THREADS] [-t TYPE]... PATTERN [PATH...]" << std::endl;
+			return 2;
+		}
+	}
+	if(optind >= argc)
+	{
+		std::cerr << "libucg-search: no PATTERN given" << std::endl;
+		return 2;
+	}
+	options.m_pattern = argv[optind++];
+	if(optind < argc)
+	{
+		options.m_paths.assign(argv + optind, argv + argc);
+	}
+
+	try
+	{
+		ucg::Search search(options);
+
+		auto print_match = [](ucg::SearchMatch &&match){
+			std::cout << match.m_filename << ":" << match.m_line_number << ":" << match.m_match_start << "-" << match.m_match_end
+					<< ":" << match.m_line << "\n";
+		};
+
+		long long num_matched_lines;
+		if(pool_threads > 0)
+		{
+			FifoThreadPool pool(pool_threads);
+			num_matched_lines = search.Run(print_match, [&pool](std::function<void()> task){ pool.Submit(std::move(task)); });
+		}
+		else
+		{
+			num_matched_lines = search.Run(print_match);
+		}
+
+		return num_matched_lines > 0 ? 0 : 1;
+	}
+	catch(const ucg::SearchException &e)
+	{
+		std::cerr << "libucg-search: " << e.what() << std::endl;
+		return 255;
+	}
+}
@@ -0,0 +1,580 @@
+/*
+ * Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+ *
+ * This file is part of UniversalCodeGrep.
+ *
+ * UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+ * terms of version 3 of the GNU General Public License as published by the Free
+ * Software Foundation.
+ *
+ * UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * Microbenchmarks for ucg's hot kernels.  Built and run by "make bench".
+ *
+ * The end-to-end benchmarks in performance_tests.at tell us when the whole program got slower, but not which kernel
+ * did it.  These time the individual pieces in isolation, each across a range of input sizes and hit densities.
+ *
+ * This is a self-contained harness rather than Google Benchmark, so that "make bench" works anywhere ucg builds.
+ * Each benchmark's iteration count is scaled up until one run takes at least the minimum time (-t), and the
+ * per-iteration time and any throughput are reported.
+ */
+
+#include <config.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <unistd.h>
+
+#include <libext/cpuidex.hpp>
+
+#include "sync_queue_impl_selector.h"
+#include "FileScanner.h"
+#include "TypeManager.h"
+#include "Match.h"
+#include "MatchList.h"
+#include "OutputContext.h"
+#include "ResizableArray.h"
+
+
+/// Prevent the compiler from optimizing away the computation of @a value.
+template <typename T>
+inline void DoNotOptimize(const T &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Passed to each benchmark function.  The function must perform its operation m_iterations times, and may report
+ * how many bytes or items it processed so that throughput can be printed.
+ */
+struct BenchState
+{
+	std::size_t m_iterations;
+	std::size_t m_bytes_processed { 0 };
+	std::size_t m_items_processed { 0 };
+};
+
+struct Benchmark
+{
+	std::string m_name;
+	std::function<void(BenchState&)> m_fn;
+};
+
+static std::vector<Benchmark> f_benchmarks;
+
+static void Register(std::string name, std::function<void(BenchState&)> fn)
+{
+	f_benchmarks.push_back(Benchmark{std::move(name), std::move(fn)});
+}
+
+/// Print a count/sec rate with an SI prefix.
+static std::string HumanRate(double per_sec, const char *unit)
+{
+	static const char *prefixes[] = { "", "k", "M", "G", "T" };
+	int i = 0;
+	while(per_sec >= 1000.0 && i < 4)
+	{
+		per_sec /= 1000.0;
+		++i;
+	}
+	std::ostringstream ss;
+	ss << std::fixed << std::setprecision(2) << per_sec << ' ' << prefixes[i] << unit << "/s";
+	return ss.str();
+}
+
+static void RunBenchmark(const Benchmark &b, double min_time)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::size_t iterations = 1;
+	while(true)
+	{
+		BenchState state;
+		state.m_iterations = iterations;
+
+		auto start = clock::now();
+		b.m_fn(state);
+		double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+		if(elapsed >= min_time || iterations >= 1000000000)
+		{
+			std::cout << std::left << std::setw(60) << b.m_name << std::right
+					<< std::setw(14) << std::fixed << std::setprecision(1) << (elapsed * 1e9 / iterations) << " ns"
+					<< std::setw(12) << iterations;
+			if(state.m_bytes_processed != 0)
+			{
+				std::cout << "  " << HumanRate(state.m_bytes_processed / elapsed, "B");
+			}
+			if(state.m_items_processed != 0)
+			{
+				std::cout << "  " << HumanRate(state.m_items_processed / elapsed, "items");
+			}
+			std::cout << std::endl;
+			return;
+		}
+
+		// Scale up the iteration count, aiming a bit past min_time so we usually only need one more run.
+		double scale = (elapsed > 0) ? (1.4 * min_time / elapsed) : 10.0;
+		scale = std::min(std::max(scale, 2.0), 100.0);
+		iterations = static_cast<std::size_t>(iterations * scale);
+	}
+}
+
+/// Deterministic random text: lines of lowercase letters with lengths uniformly distributed around @a avg_line_len.
+static std::string MakeText(std::size_t size, std::size_t avg_line_len, unsigned seed = 1)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<std::size_t> line_len(1, 2*avg_line_len - 1);
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	std::string retval;
+	retval.reserve(size);
+	while(retval.size() < size)
+	{
+		std::size_t len = line_len(gen);
+		for(std::size_t i = 0; i < len-1 && retval.size() < size; ++i)
+		{
+			retval.push_back(letter(gen));
+		}
+		if(retval.size() < size)
+		{
+			retval.push_back('\n');
+		}
+	}
+	return retval;
+}
+
+
+///
+/// CountLinesSinceLastMatch_*() variants.
+///
+
+/// Gives us access to FileScanner's protected multiversioned functions.
+struct FileScannerBenchAccess : public FileScanner
+{
+	using FileScanner::CountLinesSinceLastMatch_default;
+	using FileScanner::CountLinesSinceLastMatch_sse2;
+	using FileScanner::CountLinesSinceLastMatch_sse4_2_no_popcnt;
+	using FileScanner::CountLinesSinceLastMatch_sse4_2_popcnt;
+};
+
+static void RegisterCountLinesBenchmarks()
+{
+	using fn_type = size_t (*)(const char * __restrict__, const char * __restrict__) noexcept;
+	struct Variant { const char *m_name; fn_type m_fn; bool m_supported; };
+	const Variant variants[] = {
+		{ "default", &FileScannerBenchAccess::CountLinesSinceLastMatch_default, true },
+		{ "sse2", &FileScannerBenchAccess::CountLinesSinceLastMatch_sse2, sys_has_sse2() },
+		{ "sse4_2_no_popcnt", &FileScannerBenchAccess::CountLinesSinceLastMatch_sse4_2_no_popcnt, sys_has_sse4_2() },
+		{ "sse4_2_popcnt", &FileScannerBenchAccess::CountLinesSinceLastMatch_sse4_2_popcnt, sys_has_sse4_2() && sys_has_popcnt() },
+	};
+
+	for(const auto &v : variants)
+	{
+		if(!v.m_supported)
+		{
+			continue;
+		}
+		for(std::size_t size : { 64, 4096, 1024*1024 })
+		{
+			// Average line length; shorter lines == more '\n's to count.
+			for(std::size_t line_len : { 8, 80, 1024 })
+			{
+				// Pad the text so the SIMD versions' aligned loads past the end stay inside the allocation,
+				// and start at an unaligned offset, as the real callers usually do.
+				constexpr std::size_t offset = 5;
+				auto text = std::make_shared<std::string>(std::string(offset, 'x') + MakeText(size, line_len) + std::string(64, 'x'));
+				fn_type fn = v.m_fn;
+				Register(std::string("CountLinesSinceLastMatch_") + v.m_name + "/size:" + std::to_string(size) + "/linelen:" + std::to_string(line_len),
+					[text, fn, size](BenchState &state){
+						const char *begin = text->data() + offset;
+						for(std::size_t i = 0; i < state.m_iterations; ++i)
+						{
+							DoNotOptimize(fn(begin, begin + size));
+						}
+						state.m_bytes_processed = state.m_iterations * size;
+					});
+			}
+		}
+	}
+}
+
+
+///
+/// TypeManager::FileShouldBeScanned().
+///
+
+static std::vector<std::string> MakeFilenames(std::size_t count)
+{
+	// A rough mix of what's found in a typical source tree.
+	struct Ext { const char *m_suffix; int m_weight; };
+	const Ext exts[] = {
+		{ ".cpp", 20 }, { ".h", 20 }, { ".c", 10 }, { ".hpp", 5 }, { ".py", 5 }, { ".js", 5 }, { ".java", 3 },
+		{ ".o", 10 }, { ".lo", 3 }, { ".a", 1 }, { ".so", 1 }, { ".png", 3 }, { ".txt", 3 }, { ".md", 2 },
+		{ ".html", 2 }, { ".json", 2 }, { ".orig", 1 }, { "~", 1 }, { ".tar.gz", 1 }, { ".properties", 1 },
+		{ "", 2 }, // No extension.
+	};
+	const char *literal_names[] = { "Makefile", "Makefile.am", "CMakeLists.txt", "configure.ac", "README", ".gitignore" };
+
+	std::vector<int> weights;
+	for(const auto &e : exts)
+	{
+		weights.push_back(e.m_weight);
+	}
+
+	std::mt19937 gen(2);
+	std::discrete_distribution<std::size_t> pick_ext(weights.begin(), weights.end());
+	std::uniform_int_distribution<std::size_t> stem_len(3, 20);
+	std::uniform_int_distribution<int> letter('a', 'z');
+	std::uniform_int_distribution<int> percent(0, 99);
+
+	std::vector<std::string> retval;
+	while(retval.size() < count)
+	{
+		if(percent(gen) < 3)
+		{
+			retval.push_back(literal_names[retval.size() % (sizeof(literal_names)/sizeof(literal_names[0]))]);
+			continue;
+		}
+		std::string name;
+		for(std::size_t i = stem_len(gen); i > 0; --i)
+		{
+			name.push_back(letter(gen));
+		}
+		name += exts[pick_ext(gen)].m_suffix;
+		retval.push_back(std::move(name));
+	}
+	return retval;
+}
+
+static void RegisterFileShouldBeScannedBenchmarks()
+{
+	auto names = std::make_shared<std::vector<std::string>>(MakeFilenames(4096));
+
+	// "all" is the default type set, where most source files hit.  "cpp" is --type=cpp, where most miss.
+	for(const char *types : { "all", "cpp" })
+	{
+		auto tm = std::make_shared<TypeManager>();
+		if(std::strcmp(types, "cpp") == 0)
+		{
+			tm->type("cpp");
+		}
+		tm->CompileTypeTables();
+
+		Register(std::string("FileShouldBeScanned/types:") + types, [names, tm](BenchState &state){
+			std::size_t num_names = names->size();
+			for(std::size_t i = 0; i < state.m_iterations; ++i)
+			{
+				DoNotOptimize(tm->FileShouldBeScanned((*names)[i % num_names]));
+			}
+			state.m_items_processed = state.m_iterations;
+		});
+	}
+}
+
+
+///
+/// Match construction.
+///
+
+static void RegisterMatchBenchmarks()
+{
+	for(std::size_t line_len : { 40, 400, 4000 })
+	{
+		auto text = std::make_shared<std::string>(MakeText(64*1024, line_len));
+
+		// Put the "match" in the middle of a line near the middle of the buffer.
+		std::size_t line_start = text->find('\n', text->size()/2) + 1;
+		std::size_t line_end = text->find('\n', line_start);
+		std::size_t match_start = line_start + (line_end - line_start)/2;
+		std::size_t match_end = std::min(match_start + 4, line_end);
+
+		Register("Match/matched_line/linelen:" + std::to_string(line_len), [=](BenchState &state){
+			for(std::size_t i = 0; i < state.m_iterations; ++i)
+			{
+				Match m(text->data(), text->size(), match_start, match_end, 1234);
+				DoNotOptimize(m);
+			}
+			state.m_items_processed = state.m_iterations;
+		});
+		Register("Match/context_line/linelen:" + std::to_string(line_len), [=](BenchState &state){
+			for(std::size_t i = 0; i < state.m_iterations; ++i)
+			{
+				Match m(text->data() + line_start, text->data() + line_end, 1234, line_start);
+				DoNotOptimize(m);
+			}
+			state.m_items_processed = state.m_iterations;
+		});
+	}
+}
+
+
+///
+/// MatchList::Print().
+///
+
+static void RegisterMatchListPrintBenchmarks()
+{
+	for(std::size_t num_matches : { 1, 16, 256 })
+	{
+		// Every fourth line is a context line when context is on.
+		for(bool context : { false, true })
+		{
+			auto text = std::make_shared<std::string>(MakeText(num_matches * 200, 80));
+			auto ml = std::make_shared<MatchList>("some/directory/file.cpp");
+			std::size_t line_no = 1;
+			std::size_t line_start = 0;
+			std::size_t num_added = 0;
+			while(num_added < num_matches && line_start < text->size())
+			{
+				std::size_t line_end = text->find('\n', line_start);
+				if(line_end == std::string::npos)
+				{
+					break;
+				}
+				if(context && (line_no % 4 == 0))
+				{
+					ml->AddMatch(Match(text->data() + line_start, text->data() + line_end, line_no, line_start));
+				}
+				else
+				{
+					std::size_t match_start = line_start + (line_end - line_start)/3;
+					ml->AddMatch(Match(text->data(), text->size(), match_start, std::min(match_start + 3, line_end), line_no));
+				}
+				++num_added;
+				++line_no;
+				line_start = line_end + 1;
+			}
+
+			for(bool color : { false, true })
+			{
+				auto oc = std::make_shared<OutputContext>(color, color, false, context, OutputFormat::TEXT);
+				Register("MatchList::Print/matches:" + std::to_string(num_matches) + (context ? "/context" : "") + (color ? "/color" : ""),
+					[ml, oc](BenchState &state){
+						std::string out;
+						for(std::size_t i = 0; i < state.m_iterations; ++i)
+						{
+							ml->Print(out, *oc);
+							state.m_bytes_processed += out.size();
+							out.clear();
+						}
+					});
+			}
+
+			for(OutputFormat format : { OutputFormat::JSON, OutputFormat::BINARY })
+			{
+				auto oc = std::make_shared<OutputContext>(false, false, false, context, format);
+				Register("MatchList::Print/matches:" + std::to_string(num_matches) + (context ? "/context" : "") + (format == OutputFormat::JSON ? "/json" : "/binary"),
+					[ml, oc](BenchState &state){
+						std::string out;
+						for(std::size_t i = 0; i < state.m_iterations; ++i)
+						{
+							ml->Print(out, *oc);
+							state.m_bytes_processed += out.size();
+							out.clear();
+						}
+					});
+			}
+		}
+	}
+}
+
+
+///
+/// sync_queue<> push/pull under contention.
+///
+
+static void RegisterSyncQueueBenchmarks()
+{
+	struct Config { int m_producers; int m_consumers; };
+	for(const Config &c : { Config{1, 1}, Config{1, 4}, Config{4, 1}, Config{4, 4} })
+	{
+		Register("sync_queue/producers:" + std::to_string(c.m_producers) + "/consumers:" + std::to_string(c.m_consumers),
+			[c](BenchState &state){
+				// Each iteration is one item making it through the queue.  Items are strings, roughly the size of the
+				// FileIDs the Globber sends to the FileScanners.
+				sync_queue<std::string> q;
+				std::vector<std::thread> consumers;
+				for(int i = 0; i < c.m_consumers; ++i)
+				{
+					consumers.emplace_back([&q](){
+						std::string s;
+						while(q.wait_pull(std::move(s)) != queue_op_status::closed)
+						{
+							DoNotOptimize(s);
+						}
+					});
+				}
+				std::vector<std::thread> producers;
+				for(int i = 0; i < c.m_producers; ++i)
+				{
+					std::size_t num_to_push = state.m_iterations / c.m_producers + (static_cast<std::size_t>(i) < state.m_iterations % c.m_producers ? 1 : 0);
+					producers.emplace_back([&q, num_to_push](){
+						for(std::size_t n = 0; n < num_to_push; ++n)
+						{
+							q.wait_push(std::string("some/directory/path/to/a/file.cpp"));
+						}
+					});
+				}
+				for(auto &t : producers)
+				{
+					t.join();
+				}
+				q.close();
+				for(auto &t : consumers)
+				{
+					t.join();
+				}
+				state.m_items_processed = state.m_iterations;
+			});
+	}
+}
+
+
+///
+/// ResizableArray::reserve_no_copy().
+///
+
+static void RegisterReserveNoCopyBenchmarks()
+{
+	// Same size every call: the fast path File() hits when a run of files all fit in the existing buffer.
+	for(std::size_t size : { 4096, 1024*1024 })
+	{
+		Register("ResizableArray::reserve_no_copy/steady/size:" + std::to_string(size), [size](BenchState &state){
+			ResizableArray<char> ra;
+			for(std::size_t i = 0; i < state.m_iterations; ++i)
+			{
+				ra.reserve_no_copy(size, 64);
+				DoNotOptimize(ra.data());
+			}
+			state.m_items_processed = state.m_iterations;
+		});
+	}
+
+	// Sizes growing by 1.5x from 4KB to ~16MB, starting over with a fresh array each cycle: every call reallocates.
+	Register("ResizableArray::reserve_no_copy/growing", [](BenchState &state){
+		std::size_t i = 0;
+		while(i < state.m_iterations)
+		{
+			ResizableArray<char> ra;
+			for(std::size_t size = 4096; size < 16*1024*1024 && i < state.m_iterations; size += size/2, ++i)
+			{
+				ra.reserve_no_copy(size, 64);
+				DoNotOptimize(ra.data());
+			}
+		}
+		state.m_items_processed = state.m_iterations;
+	});
+
+	// Log-uniform file sizes from 100B to 1MB, the way a scanner thread sees them in a source tree.
+	auto sizes = std::make_shared<std::vector<std::size_t>>();
+	std::mt19937 gen(3);
+	std::uniform_real_distribution<double> log_size(std::log(100.0), std::log(1024.0*1024.0));
+	for(int i = 0; i < 4096; ++i)
+	{
+		sizes->push_back(static_cast<std::size_t>(std::exp(log_size(gen))));
+	}
+	Register("ResizableArray::reserve_no_copy/mixed", [sizes](BenchState &state){
+		ResizableArray<char> ra;
+		for(std::size_t i = 0; i < state.m_iterations; ++i)
+		{
+			ra.reserve_no_copy((*sizes)[i % sizes->size()], 64);
+			DoNotOptimize(ra.data());
+		}
+		state.m_items_processed = state.m_iterations;
+	});
+}
+
+
+int main(int argc, char **argv)
+{
+	double min_time = 0.1;
+	std::string filter;
+	bool list_only = false;
+
+	int option;
+	opterr = 0;
+	while((option = getopt(argc, argv, "f:lt:")) != -1)
+	{
+		switch (option)
+		{
+		case 'f':
+			// Only run benchmarks whose names contain this substring.
+			filter = optarg;
+			break;
+		case 'l':
+			// Just list the benchmark names.
+			list_only = true;
+			break;
+		case 't':
+			// Minimum time in seconds to run each benchmark.
+			min_time = std::atof(optarg);
+			break;
+		case'?':
+			if(std::isprint(optopt))
+			{
+				std::cerr << "ERROR: Unknown option '-" << std::string(1, (char)optopt) << "'." << std::endl;
+			}
+			else
+			{
+				std::cerr << "ERROR: Unknown option charater '0x" << std::hex << optopt << "'" << std::endl;
+			}
+			return 1;
+		default:
+			abort();
+		}
+	}
+
+	RegisterCountLinesBenchmarks();
+	RegisterFileShouldBeScannedBenchmarks();
+	RegisterMatchBenchmarks();
+	RegisterMatchListPrintBenchmarks();
+	RegisterSyncQueueBenchmarks();
+	RegisterReserveNoCopyBenchmarks();
+
+	if(!list_only)
+	{
+		std::cout << std::left << std::setw(60) << "Benchmark" << std::right << std::setw(17) << "Time" << std::setw(12) << "Iterations"
+				<< "  Throughput" << std::endl;
+		std::cout << std::string(101, '-') << std::endl;
+	}
+
+	for(const auto &b : f_benchmarks)
+	{
+		if(!filter.empty() && b.m_name.find(filter) == std::string::npos)
+		{
+			continue;
+		}
+		if(list_only)
+		{
+			std::cout << b.m_name << std::endl;
+		}
+		else
+		{
+			RunBenchmark(b, min_time);
+		}
+	}
+
+	return 0;
+}
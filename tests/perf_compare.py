@@ -0,0 +1,234 @@
+#! /usr/bin/env python
+# encoding: utf-8
+
+from __future__ import print_function
+from __future__ import division
+
+copyright_notice=\
+'''
+# Copyright 2016 Gary R. Van Sickle (grvs@users.sourceforge.net).
+#
+# This file is part of UniversalCodeGrep.
+#
+# UniversalCodeGrep is free software: you can redistribute it and/or modify it under the
+# terms of version 3 of the GNU General Public License as published by the Free
+# Software Foundation.
+#
+# UniversalCodeGrep is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+# PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
+'''
+
+description = '''
+Compare two sets of benchmark results (the perf_test_results.csv or perf_test_results.json files written by
+performance_tests.at) and flag statistically significant regressions.
+
+A benchmark/program pair is a regression if its mean wall-clock time got slower by more than the threshold,
+and a one-sided Welch's t-test on the individual run times says the slowdown is significant at the given alpha.
+
+Exit status is 0 if there are no regressions, 1 if there are, and 2 on errors.
+'''
+
+import sys
+import os
+import csv
+import json
+import math
+from argparse import ArgumentParser
+from argparse import RawDescriptionHelpFormatter
+
+
+class BenchmarkResult(object):
+    '''
+    The results for one program on one benchmark.
+    '''
+    def __init__(self, test_desc, prog_id, samples):
+        self.test_desc = test_desc
+        self.prog_id = prog_id
+        self.samples = samples
+        self.n = len(samples)
+        self.mean = sum(samples) / self.n
+        if self.n > 1:
+            self.variance = sum((x - self.mean) ** 2 for x in samples) / (self.n - 1)
+        else:
+            self.variance = 0.0
+
+    def key(self):
+        return (self.test_desc, self.prog_id)
+
+
+def load_results(filename):
+    '''
+    Load a results file, either CSV with a header line or JSON Lines.  Returns a dict of BenchmarkResults keyed
+    on (test_desc, prog_id).
+    '''
+    results = {}
+    with open(filename) as fh:
+        first_char = fh.read(1)
+        fh.seek(0)
+        if first_char == '{':
+            rows = [json.loads(line) for line in fh if line.strip()]
+            for row in rows:
+                samples = [float(x) for x in row['wall']['samples']]
+                if samples:
+                    r = BenchmarkResult(row['test_desc'], row['prog_id'], samples)
+                    results[r.key()] = r
+        else:
+            for row in csv.DictReader(fh):
+                samples = [float(x) for x in row['wall_samples'].split(';') if x]
+                if samples:
+                    r = BenchmarkResult(row['test_desc'], row['prog_id'], samples)
+                    results[r.key()] = r
+    return results
+
+
+def betacf(a, b, x):
+    '''
+    Continued fraction for the incomplete beta function, by the modified Lentz method.
+    '''
+    max_iterations = 200
+    epsilon = 3.0e-14
+    tiny = 1.0e-300
+    qab = a + b
+    qap = a + 1.0
+    qam = a - 1.0
+    c = 1.0
+    d = 1.0 - qab * x / qap
+    if abs(d) < tiny:
+        d = tiny
+    d = 1.0 / d
+    h = d
+    for m in range(1, max_iterations + 1):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        if abs(d) < tiny:
+            d = tiny
+        c = 1.0 + aa / c
+        if abs(c) < tiny:
+            c = tiny
+        d = 1.0 / d
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        if abs(d) < tiny:
+            d = tiny
+        c = 1.0 + aa / c
+        if abs(c) < tiny:
+            c = tiny
+        d = 1.0 / d
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < epsilon:
+            break
+    return h
+
+
+def regularized_incomplete_beta(a, b, x):
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    log_front = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) + a * math.log(x) + b * math.log(1.0 - x)
+    if x < (a + 1.0) / (a + b + 2.0):
+        return math.exp(log_front) * betacf(a, b, x) / a
+    else:
+        return 1.0 - math.exp(log_front) * betacf(b, a, 1.0 - x) / b
+
+
+def welch_one_sided_p(baseline, current):
+    '''
+    One-sided Welch's t-test p-value for the hypothesis that current's mean is greater (slower) than baseline's.
+    '''
+    var_term_b = baseline.variance / baseline.n
+    var_term_c = current.variance / current.n
+    se2 = var_term_b + var_term_c
+    diff = current.mean - baseline.mean
+    if se2 == 0.0:
+        # No variance at all (e.g. single runs).  All we can go by is the means.
+        return 0.0 if diff > 0 else 1.0
+    t = diff / math.sqrt(se2)
+    # Welch-Satterthwaite degrees of freedom.
+    denom = 0.0
+    if baseline.n > 1:
+        denom += var_term_b ** 2 / (baseline.n - 1)
+    if current.n > 1:
+        denom += var_term_c ** 2 / (current.n - 1)
+    df = se2 ** 2 / denom if denom > 0 else 1.0
+    # P(T > t) for Student's t with df degrees of freedom.
+    tail = 0.5 * regularized_incomplete_beta(df / 2.0, 0.5, df / (df + t * t))
+    return tail if t > 0 else 1.0 - tail
+
+
+def compare(baseline, current, alpha, threshold, prog_ids, fh=sys.stdout):
+    '''
+    Print the comparison table and return the number of regressions.
+    '''
+    num_regressions = 0
+    keys = sorted(set(baseline.keys()) | set(current.keys()))
+    if prog_ids:
+        keys = [k for k in keys if k[1] in prog_ids]
+
+    print("| Benchmark | Program | Baseline mean (s) | Current mean (s) | Change | p-value | Verdict |", file=fh)
+    print("|-----------|---------|-------------------|------------------|--------|---------|---------|", file=fh)
+    for key in keys:
+        b = baseline.get(key)
+        c = current.get(key)
+        if b is None:
+            print("| {} | {} | - | {:.6f} | - | - | new |".format(key[0], key[1], c.mean), file=fh)
+            continue
+        if c is None:
+            print("| {} | {} | {:.6f} | - | - | - | missing |".format(key[0], key[1], b.mean), file=fh)
+            continue
+        change = (c.mean - b.mean) / b.mean if b.mean > 0 else 0.0
+        p = welch_one_sided_p(b, c)
+        if change > threshold and p < alpha:
+            verdict = "REGRESSION"
+            num_regressions += 1
+        elif change < -threshold and welch_one_sided_p(c, b) < alpha:
+            verdict = "improved"
+        else:
+            verdict = "ok"
+        print("| {} | {} | {:.6f} | {:.6f} | {:+.1%} | {:.4f} | {} |".format(key[0], key[1], b.mean, c.mean, change, p, verdict),
+              file=fh)
+
+    return num_regressions
+
+
+def main(argv=None):
+    '''Command line options.'''
+
+    if argv is None:
+        argv = sys.argv[1:]
+
+    parser = ArgumentParser(description=description, epilog=copyright_notice, formatter_class=RawDescriptionHelpFormatter)
+    parser.add_argument("-a", "--alpha", dest="alpha", type=float, default=0.05,
+                        help="Significance level for the one-sided t-test. [default: %(default)s]")
+    parser.add_argument("-t", "--threshold", dest="threshold", type=float, default=0.05,
+                        help="Minimum relative slowdown to count as a regression, e.g. 0.05 == 5%%. [default: %(default)s]")
+    parser.add_argument("-p", "--prog", dest="prog_ids", action='append',
+                        help="Only compare results for this prog_id (e.g. built_ucg).  Can be specified multiple times.")
+    parser.add_argument(dest="baseline", help="Baseline results file (.csv or .json).", metavar="BASELINE")
+    parser.add_argument(dest="current", help="Current results file (.csv or .json).", metavar="CURRENT")
+    args = parser.parse_args(argv)
+
+    try:
+        baseline = load_results(args.baseline)
+        current = load_results(args.current)
+    except (IOError, OSError, ValueError, KeyError) as e:
+        print("{}: error: couldn't load results: {}".format(os.path.basename(sys.argv[0]), e), file=sys.stderr)
+        return 2
+
+    num_regressions = compare(baseline, current, args.alpha, args.threshold, args.prog_ids)
+    if num_regressions > 0:
+        print("{} regression(s) found.".format(num_regressions))
+        return 1
+    print("No regressions found.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
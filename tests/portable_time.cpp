@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <spawn.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <stdio.h>
 
@@ -113,10 +114,18 @@ int main(int argc, char *argv[])
 	end = std::chrono::steady_clock::now();
 	std::chrono::duration<double> elapsed_seconds = end-start;
 
+	// Get the CPU times of the (now reaped) child.
+	double user_seconds = 0.0, sys_seconds = 0.0;
+	struct rusage child_usage;
+	if(getrusage(RUSAGE_CHILDREN, &child_usage) == 0)
+	{
+		user_seconds = child_usage.ru_utime.tv_sec + child_usage.ru_utime.tv_usec / 1e6;
+		sys_seconds = child_usage.ru_stime.tv_sec + child_usage.ru_stime.tv_usec / 1e6;
+	}
+
 	// Send the time to stderr.
 	std::cerr << "real " << elapsed_seconds.count() << "\n";
-	/// @todo System and User times not yet implemented.
-	std::cerr << "user 0.00\nsys 0.00\n";
+	std::cerr << "user " << user_seconds << "\nsys " << sys_seconds << "\n";
 
 	return retval;
 }
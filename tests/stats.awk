@@ -15,7 +15,52 @@
 # You should have received a copy of the GNU General Public License along with
 # UniversalCodeGrep.  If not, see <http://www.gnu.org/licenses/>.
 
+# Summarizes one time_results_*.txt file.
+#
+# Set FORMAT with -v (e.g. "TEST_DESC='...' stats.awk -v FORMAT=csv file") to select the output format.  The benchmark's
+# description is taken from the TEST_DESC environment variable, since -v would mangle any backslashes in it.
+#   markdown  (default) One row of the human-readable results table.
+#   csv       One CSV record; see CSV_HEADER below for the columns.
+#   json      One JSON object on a single line (i.e. JSON Lines).
+#   csvheader Just the CSV header line.  No input file is read.
+# The csv and json formats include the individual wall-clock samples, so that runs can be compared
+# statistically later (see perf_compare.py).
+
+function mean(arr, n,    i, sum)
+{
+	sum=0;
+	for(i=0; i<n; ++i) { sum+=arr[i]; }
+	return n > 0 ? sum/n : 0;
+}
+
+# Sample standard deviation, sqrt((sum of squared deviations from mean)/(N-1)).
+function sample_stddev(arr, n, avg,    i, sum)
+{
+	if(n < 2) { return 0; }
+	sum=0;
+	for(i=0; i<n; ++i) { sum+=(avg - arr[i])^2; }
+	return sqrt(sum/(n-1));
+}
+
+function csv_quote(str)
+{
+	gsub(/"/, "\"\"", str);
+	return "\"" str "\"";
+}
+
+function json_quote(str)
+{
+	# "&&" doubles the backslash; the "\\\\" equivalent is treated differently by different awks.
+	gsub(/\\/, "&&", str);
+	gsub(/"/, "\\\"", str);
+	gsub(/\t/, "\\t", str);
+	return "\"" str "\"";
+}
+
 BEGIN {
+	CSV_HEADER="test_desc,prog_id,prog_path,command_line,num_runs,wall_mean,wall_stddev,wall_sem,user_mean,user_stddev,sys_mean,sys_stddev,num_matched_lines,num_diff_chars,wall_samples";
+	if(FORMAT == "csvheader") { print(CSV_HEADER); exit 0; }
+	TEST_DESC=ENVIRON["TEST_DESC"];
 	TEST_PROG_ID="unknown";
 	TEST_PROG_PATH="unknown";
 	NUM_TIME_ENTRIES=0;
@@ -24,6 +69,16 @@ BEGIN {
 	SEM=0;
 	NUM_MATCHED_LINES=0;
 	NUM_DIFF_CHARS=0;
+	NUM_USER_ENTRIES=0;
+	NUM_SYS_ENTRIES=0;
+	COMMAND_LINE="";
+}
+
+# The header line of the file has the full wrapped command line.  Strip it down to the program and its arguments.
+FNR==1 && /^Timing run for wrapped command line:/ {
+	COMMAND_LINE=$0;
+	sub(/^.*portable_time -p /, "", COMMAND_LINE);
+	sub(/; 1>&3.*$/, "", COMMAND_LINE);
 }
 
 #FNR==1 { print("FN=" FILENAME); };
@@ -34,25 +89,50 @@ $1 ~ /^NUM_CHARS_DIFF:/ { NUM_DIFF_CHARS=$2; }
 $1 ~ /^real/ {
 	REAL_TIME[NUM_TIME_ENTRIES]=$2;
 	NUM_TIME_ENTRIES++;
-	AVG_TIME+=$2;
 	}
+$1 ~ /^user/ { USER_TIME[NUM_USER_ENTRIES++]=$2; }
+$1 ~ /^sys/ { SYS_TIME[NUM_SYS_ENTRIES++]=$2; }
 
 END {
+	if(FORMAT == "csvheader") { exit 0; }
+
 	# Protect from divide by zero.
 	if(NUM_TIME_ENTRIES==0) { print("ERROR: No time entries in file " FILENAME "."); exit 1; };
 	
-	AVG_TIME /= NUM_TIME_ENTRIES;
 	# Calculate the sample std deviation and the standard error of the mean (SEM).
 	# https://en.wikipedia.org/wiki/Standard_error#Standard_error_of_the_mean
+	AVG_TIME=mean(REAL_TIME, NUM_TIME_ENTRIES);
+	SAMPLE_STD_DEV=sample_stddev(REAL_TIME, NUM_TIME_ENTRIES, AVG_TIME);
+	SEM=SAMPLE_STD_DEV/sqrt(NUM_TIME_ENTRIES);
+	AVG_USER=mean(USER_TIME, NUM_USER_ENTRIES);
+	USER_STD_DEV=sample_stddev(USER_TIME, NUM_USER_ENTRIES, AVG_USER);
+	AVG_SYS=mean(SYS_TIME, NUM_SYS_ENTRIES);
+	SYS_STD_DEV=sample_stddev(SYS_TIME, NUM_SYS_ENTRIES, AVG_SYS);
+
+	SAMPLES="";
 	for(j=0; j < NUM_TIME_ENTRIES; ++j)
 	{
-		# sample std dev is sqrt((sum of squared deviations from mean)/(N-1))
-		SAMPLE_STD_DEV+=(AVG_TIME - REAL_TIME[j])^2;
+		SAMPLES = SAMPLES (j > 0 ? ";" : "") REAL_TIME[j];
+	}
+
+	if(FORMAT == "csv")
+	{
+		OFS=",";
+		print(csv_quote(TEST_DESC), csv_quote(TEST_PROG_ID), csv_quote(TEST_PROG_PATH), csv_quote(COMMAND_LINE), NUM_TIME_ENTRIES,
+			AVG_TIME, SAMPLE_STD_DEV, SEM, AVG_USER, USER_STD_DEV, AVG_SYS, SYS_STD_DEV, NUM_MATCHED_LINES, NUM_DIFF_CHARS, csv_quote(SAMPLES));
+	}
+	else if(FORMAT == "json")
+	{
+		gsub(/;/, ",", SAMPLES);
+		printf("{\"test_desc\":%s,\"prog_id\":%s,\"prog_path\":%s,\"command_line\":%s,\"num_runs\":%d,", json_quote(TEST_DESC),
+			json_quote(TEST_PROG_ID), json_quote(TEST_PROG_PATH), json_quote(COMMAND_LINE), NUM_TIME_ENTRIES);
+		printf("\"wall\":{\"mean\":%s,\"stddev\":%s,\"sem\":%s,\"samples\":[%s]},", AVG_TIME, SAMPLE_STD_DEV, SEM, SAMPLES);
+		printf("\"user\":{\"mean\":%s,\"stddev\":%s},\"sys\":{\"mean\":%s,\"stddev\":%s},", AVG_USER, USER_STD_DEV, AVG_SYS, SYS_STD_DEV);
+		printf("\"num_matched_lines\":%d,\"num_diff_chars\":%d}\n", NUM_MATCHED_LINES, NUM_DIFF_CHARS);
+	}
+	else
+	{
+		OFS=" | ";
+		print("| " TEST_PROG_ID, AVG_TIME, SAMPLE_STD_DEV, SEM, NUM_MATCHED_LINES, NUM_DIFF_CHARS " |");
 	}
-	SAMPLE_STD_DEV=sqrt(SAMPLE_STD_DEV/(NUM_TIME_ENTRIES-1));
-	SEM=SAMPLE_STD_DEV/sqrt(NUM_TIME_ENTRIES);
-	
-	OFS=" | ";
-	
-	print("| " TEST_PROG_ID, AVG_TIME, SAMPLE_STD_DEV, SEM, NUM_MATCHED_LINES, NUM_DIFF_CHARS " |");
 }